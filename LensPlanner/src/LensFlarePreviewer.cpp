@@ -19,6 +19,14 @@ LensFlarePreviewer::LensFlarePreviewer(OLEF::OpticalSystem* system, QWidget* par
     m_starburstMaxWavelength(780.0f),
     m_starburstWavelengthStep(5.0f),
     m_rayTraceGhostAlgorithm(nullptr),
+    m_programCache(nullptr),
+    m_cpuGhostTracer(new OLEF::CpuGhostTracer(&m_precomputeSystem)),
+    m_taskPool(new OLEF::TaskPool),
+    m_ghostAttributeCache(nullptr),
+    m_cancelPrecompute(false),
+    m_precomputeFinished(false),
+    m_precomputeCacheKey(0),
+    m_precomputeMaxAngles(0),
     m_precompute(false),
     m_generateStarburst(false)
 {
@@ -36,6 +44,13 @@ LensFlarePreviewer::LensFlarePreviewer(OLEF::OpticalSystem* system, QWidget* par
 
     setFormat(fmt);
 
+    // Create the ghost attribute cache in the user's cache directory
+    QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/GhostAttributes";
+    if (QDir().mkpath(cacheDir))
+    {
+        m_ghostAttributeCache = new OLEF::GhostAttributeCache(cacheDir.toStdString());
+    }
+
     // Set a minimum size.
     setMinimumSize(QSize(400, 400));
 }
@@ -43,6 +58,9 @@ LensFlarePreviewer::LensFlarePreviewer(OLEF::OpticalSystem* system, QWidget* par
 ////////////////////////////////////////////////////////////////////////////////
 LensFlarePreviewer::~LensFlarePreviewer()
 {
+    // Stop the background computations
+    cancelGhostPrecomputation();
+
     // Access the context.
     makeCurrent();
 
@@ -61,6 +79,14 @@ LensFlarePreviewer::~LensFlarePreviewer()
         delete m_rayTraceGhostAlgorithm;
     }
 
+    // Release the shared programs, after their users.
+    delete m_programCache;
+
+    // Release the precomputation objects.
+    delete m_cpuGhostTracer;
+    delete m_taskPool;
+    delete m_ghostAttributeCache;
+
     // Release the created textures
     m_imageLibrary->releaseTextures();
 
@@ -94,38 +120,122 @@ void LensFlarePreviewer::generateStarburst()
 ////////////////////////////////////////////////////////////////////////////////
 void LensFlarePreviewer::computeGhostParameters()
 {
+    // Stop the previous computations
+    cancelGhostPrecomputation();
+
     // Generate the starting ghost list
     OLEF::GhostList originalGhosts = m_opticalSystem->generateGhosts(2, false);
 
-    // Process each possible angle
-    //
-    // TODO: don't use pre-baked angles!
-    QMap<float, OLEF::GhostList> rawValues;
+    // The computations run in the background, on a snapshot of the system
+    m_precomputeSystem = *m_opticalSystem;
+
+    // Make sure the tracer sees the current aperture
+    updateApertureMask();
+
+    // Sample the incoming angles adaptively, refining them where the ghosts
+    // change quickly
+    OLEF::CpuGhostTracer::AngleSamplingParams samplingParams;
+
+    samplingParams.m_minAngle = 0.0f;
+    samplingParams.m_maxAngle = glm::radians(90.0f);
+    samplingParams.m_initialSamples = 25;
+    samplingParams.m_maxSamples = 181;
+
+    // Construct the parameter object
+    OLEF::RayTraceGhostAlgorithm::GhostAttribComputeParams computeParams;
+
+    computeParams.m_boundingRays = { 32, 32, 32 };
+    computeParams.m_rayPresets = { 5, 16, 32, 64, 128 };
+    computeParams.m_targetVariance = 0.025f;
+    computeParams.m_warmStart = true;
+    computeParams.m_seedDilation = 0.1f;
+    computeParams.m_boundsEpsilon = 0.01f;
+
+    // Look for the results in the cache; the aperture mask is hashed in as
+    // well, since it affects the iris distance clipping
+    const auto& mask = m_cpuGhostTracer->getApertureMask();
+    OLEF::GhostAttributeCache::Key cacheSeed = OLEF::GhostAttributeCache::hashBytes(
+        mask.m_values.data(), mask.m_values.size() * sizeof(float));
+
+    // The angles are only known after the computations, so the sampling
+    // parameters are hashed instead
+    std::vector<float> samplingKey =
+    {
+        samplingParams.m_minAngle, samplingParams.m_maxAngle,
+        (float) samplingParams.m_initialSamples, (float) samplingParams.m_maxSamples,
+        samplingParams.m_minStep, samplingParams.m_boundsTolerance, samplingParams.m_intensityTolerance,
+    };
+    OLEF::GhostAttributeCache::Key cacheKey = OLEF::GhostAttributeCache::computeKey(
+        *m_opticalSystem, originalGhosts, samplingKey, computeParams, cacheSeed);
+
+    OLEF::GhostAttributeCache::AngleGhostMap cachedGhosts;
+    if (m_ghostAttributeCache && m_ghostAttributeCache->load(cacheKey, cachedGhosts))
+    {
+        m_precomputedGhosts = QMap<float, OLEF::GhostList>(cachedGhosts);
+        updateGhostAttributeTable();
+
+        // Update the view
+        emit ghostPrecomputationProgressSignal((int) cachedGhosts.size(), (int) cachedGhosts.size(), true);
+        update();
+        return;
+    }
+
+    // Start over with an empty set, which fills up as the angles finish
+    m_precomputedGhosts.clear();
+    updateGhostAttributeTable();
+
+    m_precomputeCacheKey = cacheKey;
+    m_precomputeMaxAngles = samplingParams.m_maxSamples;
+    m_precomputeThread = std::thread([=]()
+    {
+        precomputeGhostParameters(originalGhosts, samplingParams, computeParams);
+    });
+
+    emit ghostPrecomputationProgressSignal(0, m_precomputeMaxAngles, false);
+}
 
-    for (int i = 0; i < 181; ++i)
+////////////////////////////////////////////////////////////////////////////////
+void LensFlarePreviewer::precomputeGhostParameters(OLEF::GhostList originalGhosts,
+    OLEF::CpuGhostTracer::AngleSamplingParams samplingParams,
+    OLEF::RayTraceGhostAlgorithm::GhostAttribComputeParams computeParams)
+{
+    // Hand over each finished angle to the GUI thread
+    auto angleFinished = [this](float angle, const OLEF::GhostList& ghosts)
     {
-        // Current angle
-        float angle = i * 0.5f;
+        {
+            std::lock_guard<std::mutex> lock(m_precomputeMutex);
+            m_pendingGhosts[glm::degrees(angle)] = ghosts;
+        }
+        QMetaObject::invokeMethod(this, "publishPrecomputedGhosts", Qt::QueuedConnection);
+    };
+
+    // Compute the ghost attributes for every angle, on multiple threads
+    OLEF::RayTraceGhostAlgorithm::GhostAttribComputeStats computeStats;
+    std::map<float, OLEF::GhostList> angleGhosts = m_cpuGhostTracer->computeGhostAttributesAdaptive(
+        originalGhosts, samplingParams, computeParams, *m_taskPool, &computeStats,
+        angleFinished, &m_cancelPrecompute);
 
-        // Construct the parameter object
-        OLEF::RayTraceGhostAlgorithm::GhostAttribComputeParams computeParams;
+    if (m_cancelPrecompute)
+    {
+        return;
+    }
 
-        computeParams.m_angle = glm::radians(angle);
-        computeParams.m_boundingRays = { 32, 32, 32 };
-        computeParams.m_rayPresets = { 5, 16, 32, 64, 128 };
-        computeParams.m_targetVariance = 0.025f;
+    qDebug() << "Ghost precomputation sampled" << angleGhosts.size() << "angles, traced"
+        << computeStats.m_raysTraced << "rays, instead of"
+        << computeStats.m_raysTracedWithoutReuse << "without vertex reuse, skipped"
+        << computeStats.m_skippedBoundingPasses << "bounding passes with"
+        << computeStats.m_warmStartRestarts << "warm start restarts";
 
-        // Compute the ghost attributes
-        OLEF::GhostList currentGhosts = 
-            m_rayTraceGhostAlgorithm->computeGhostAttributes(
-                originalGhosts, computeParams);
+    // Store them in the map, keyed by their angles in degrees
+    QMap<float, OLEF::GhostList> rawValues;
 
-        // Store it in the map
-        rawValues[angle] = currentGhosts;
+    for (const auto& angle: angleGhosts)
+    {
+        rawValues[glm::degrees(angle.first)] = angle.second;
     }
 
     // Use neighbouring values to find looser bounds, to avoid clipping
-    m_precomputedGhosts = rawValues;
+    QMap<float, OLEF::GhostList> result = rawValues;
 
     for (auto it = rawValues.begin() + 1; it != rawValues.end() - 1; ++it)
     {
@@ -186,13 +296,124 @@ void LensFlarePreviewer::computeGhostParameters()
         }
 
         // Store the merged ghost list
-        m_precomputedGhosts[it.key()] = mergedGhosts;
+        result[it.key()] = mergedGhosts;
+    }
+
+    // Hand over the final results
+    {
+        std::lock_guard<std::mutex> lock(m_precomputeMutex);
+        m_finishedGhosts = result.toStdMap();
+        m_precomputeFinished = true;
     }
+    QMetaObject::invokeMethod(this, "publishPrecomputedGhosts", Qt::QueuedConnection);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LensFlarePreviewer::publishPrecomputedGhosts()
+{
+    std::map<float, OLEF::GhostList> pendingGhosts;
+    std::map<float, OLEF::GhostList> finishedGhosts;
+    bool finished = false;
+    {
+        std::lock_guard<std::mutex> lock(m_precomputeMutex);
+        pendingGhosts.swap(m_pendingGhosts);
+        finishedGhosts.swap(m_finishedGhosts);
+        std::swap(finished, m_precomputeFinished);
+    }
+
+    // Nothing to do if an earlier call already published everything
+    if (pendingGhosts.empty() && !finished)
+    {
+        return;
+    }
+
+    if (finished)
+    {
+        // Replace the partial results with the final ones
+        m_precomputeThread.join();
+        m_precomputedGhosts = QMap<float, OLEF::GhostList>(finishedGhosts);
+
+        // Store the results in the cache
+        if (m_ghostAttributeCache)
+        {
+            m_ghostAttributeCache->store(m_precomputeCacheKey, finishedGhosts);
+        }
+    }
+    else
+    {
+        // Add the newly finished angles
+        for (const auto& angle: pendingGhosts)
+        {
+            m_precomputedGhosts[angle.first] = angle.second;
+        }
+    }
+    updateGhostAttributeTable();
 
     // Update the view
+    emit ghostPrecomputationProgressSignal(m_precomputedGhosts.size(), 
+        finished ? m_precomputedGhosts.size() : m_precomputeMaxAngles, finished);
     update();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void LensFlarePreviewer::cancelGhostPrecomputation()
+{
+    if (!m_precomputeThread.joinable())
+    {
+        return;
+    }
+
+    // Stop the worker, and wait for the running tasks to finish
+    m_cancelPrecompute = true;
+    m_precomputeThread.join();
+    m_cancelPrecompute = false;
+
+    // Drop the results that haven't been published yet
+    std::lock_guard<std::mutex> lock(m_precomputeMutex);
+    m_pendingGhosts.clear();
+    m_finishedGhosts.clear();
+    m_precomputeFinished = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LensFlarePreviewer::updateApertureMask()
+{
+    // Find the aperture texture
+    GLuint apertureTexture = 0;
+    for (const auto& lens: m_opticalSystem->getElements())
+    {
+        if (lens.getType() == OLEF::OpticalSystemElement::ElementType::APERTURE_STOP)
+        {
+            apertureTexture = lens.getTexture();
+            break;
+        }
+    }
+
+    // Copy its red channel, in the same row order as the uploaded texture
+    const QImage& image = m_imageLibrary->getImage(apertureTexture);
+
+    OLEF::CpuGhostTracer::ApertureMask mask;
+    mask.m_width = image.width();
+    mask.m_height = image.height();
+    mask.m_values.resize(mask.m_width * mask.m_height);
+
+    for (int y = 0; y < mask.m_height; ++y)
+    {
+        for (int x = 0; x < mask.m_width; ++x)
+        {
+            mask.m_values[y * mask.m_width + x] = qRed(image.pixel(x, y)) / 255.0f;
+        }
+    }
+
+    m_cpuGhostTracer->setApertureMask(std::move(mask));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void LensFlarePreviewer::updateGhostAttributeTable()
+{
+    m_ghostAttributeTable.build(m_precomputedGhosts.toStdMap());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void LensFlarePreviewer::update()
 {
@@ -202,8 +423,12 @@ void LensFlarePreviewer::update()
 ////////////////////////////////////////////////////////////////////////////////
 void LensFlarePreviewer::opticalSystemChanged()
 {
+    // Stop computing attributes for the old system
+    cancelGhostPrecomputation();
+
     // Clear the precomputed attribute set
     m_precomputedGhosts.clear();
+    m_ghostAttributeTable.clear();
 
     // Regenerate the image
     update();
@@ -297,12 +522,17 @@ void LensFlarePreviewer::initializeGL()
     //      are created within the proper context. Find a way to safely extract
     //      these objects into the MainWindow instance, and manage them from there
 
+    // Create the program cache, persisting the program binaries next to the
+    // ghost attributes, so later runs skip compiling the shaders.
+    QString programDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/Programs";
+    m_programCache = new OLEF::ProgramCache(QDir().mkpath(programDir) ? programDir.toStdString() : "");
+
     // Create the starburst renderer.
     m_diffractionStarburstAlgorithm = new OLEF::DiffractionStarburstAlgorithm(
-        m_opticalSystem);
+        m_opticalSystem, m_programCache);
 
     /// Create the ray trace ghost algorithm
-    m_rayTraceGhostAlgorithm = new OLEF::RayTraceGhostAlgorithm(m_opticalSystem);
+    m_rayTraceGhostAlgorithm = new OLEF::RayTraceGhostAlgorithm(m_opticalSystem, m_programCache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -366,7 +596,8 @@ void LensFlarePreviewer::paintGL()
         m_diffractionStarburstAlgorithm->renderStarburst(lightSource);
 
         // Generate the list of ghosts to render
-        OLEF::GhostList allGhosts;
+        OLEF::GhostListView allGhosts;
+        OLEF::GhostList freshGhosts;
 
         // Re-use the precomputed values if we can
         if (layer.m_useGhostAttributes)
@@ -375,22 +606,18 @@ void LensFlarePreviewer::paintGL()
                 -lightSource.getIncidenceDirection(), 
                 glm::vec3(0.0f, 0.0f, -1.0f))));
 
-            auto it = m_precomputedGhosts.lowerBound(angle - 0.1f);
-            if (it != m_precomputedGhosts.end() && glm::abs(angle - it.key()) < 1.0f)
-                allGhosts = it.value();
+            allGhosts = m_ghostAttributeTable.lookup(angle);
         }
 
         // Generate a fresh list if we couldn't re-use anything
         if (!layer.m_useGhostAttributes || allGhosts.empty())
         {
-            allGhosts = m_opticalSystem->generateGhosts(2, false);
+            freshGhosts = m_opticalSystem->generateGhosts(2, false);
+            allGhosts = freshGhosts;
         }
         
-        int firstGhost = std::min(layer.m_firstGhost - 1, (int) allGhosts.size());
-        int lastGhost = std::min(layer.m_firstGhost + layer.m_numGhosts - 1, (int) allGhosts.size());
-
-        OLEF::GhostList ghosts(allGhosts.begin() + firstGhost, 
-            allGhosts.begin() + lastGhost);
+        int firstGhost = std::max(layer.m_firstGhost - 1, 0);
+        OLEF::GhostListView ghosts = allGhosts.slice(firstGhost, std::max(layer.m_numGhosts, 0));
 
         // Set the per-light ghost parameters        
         m_rayTraceGhostAlgorithm->setIntensityScale(layer.m_ghostIntensityScale);
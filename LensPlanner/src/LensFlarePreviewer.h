@@ -87,8 +87,12 @@ public:
     void setStarburstMaxWavelength(float value) { m_starburstMaxWavelength = value; }
     void setStarburstWavelengthStep(float value) { m_starburstWavelengthStep = value; }
     void setLayers(const QVector<Layer>& value) { m_layers = value; }
-    void setPrecomputedGhosts(const QMap<float, OLEF::GhostList>& value) {m_precomputedGhosts = value; };
+    void setPrecomputedGhosts(const QMap<float, OLEF::GhostList>& value) {cancelGhostPrecomputation(); m_precomputedGhosts = value; updateGhostAttributeTable(); };
     void requestPrecomputation() { m_precompute = true; }
+
+    /// Stops the background ghost precomputation, if one is running. The
+    /// angles finished so far are kept.
+    void cancelGhostPrecomputation();
     void requestStarburstGeneration() { m_generateStarburst = true; }
 
     /// TextureAccessor interface
@@ -104,16 +108,38 @@ public:
     void paintGL();
     void resizeGL(int w, int h);
 
+signals:
+    /// Signal, used to report the progress of the background ghost
+    /// precomputation.
+    void ghostPrecomputationProgressSignal(int finishedAngles, int maxAngles, bool finished);
+
 public slots:
     /// Slot, used to indicate that the underlying optical system changed.
     void opticalSystemChanged();
 
+private slots:
+    /// Moves the angles finished by the background precomputation to the
+    /// precomputed ghosts. Invoked by the worker, through the event loop.
+    void publishPrecomputedGhosts();
+
 private:
     /// Generates the diffraction starbust texture.
     void generateStarburst();
 
-    /// Computes parameters for the rendered ghosts.
+    /// Starts computing the parameters for the rendered ghosts, in the
+    /// background.
     void computeGhostParameters();
+
+    /// Body of the background precomputation thread.
+    void precomputeGhostParameters(OLEF::GhostList originalGhosts,
+        OLEF::CpuGhostTracer::AngleSamplingParams samplingParams,
+        OLEF::RayTraceGhostAlgorithm::GhostAttribComputeParams computeParams);
+
+    /// Copies the aperture texture of the optical system to the CPU tracer.
+    void updateApertureMask();
+
+    /// Rebuilds the angle lookup table out of the precomputed ghosts.
+    void updateGhostAttributeTable();
     
     /// The optical system to use with the algorithms.
     OLEF::OpticalSystem* m_opticalSystem;
@@ -148,9 +174,51 @@ private:
     /// The ray traced ghost rendering algorithm.
     OLEF::RayTraceGhostAlgorithm* m_rayTraceGhostAlgorithm;
 
+    /// Cache of the shader programs, shared by the rendering algorithms.
+    OLEF::ProgramCache* m_programCache;
+
+    /// Snapshot of the optical system, used by the background precomputation.
+    OLEF::OpticalSystem m_precomputeSystem;
+
+    /// CPU ghost tracer, used for precomputing the ghost attributes.
+    OLEF::CpuGhostTracer* m_cpuGhostTracer;
+
+    /// Thread pool used for the precomputations.
+    OLEF::TaskPool* m_taskPool;
+
+    /// On-disk cache of the precomputed ghost attributes.
+    OLEF::GhostAttributeCache* m_ghostAttributeCache;
+
     /// Precomputed ghosts with their attributes.
     QMap<float, OLEF::GhostList> m_precomputedGhosts;
 
+    /// Angle lookup table of the precomputed ghosts, used during rendering.
+    OLEF::GhostAttributeTable m_ghostAttributeTable;
+
+    /// The background precomputation thread.
+    std::thread m_precomputeThread;
+
+    /// Used to stop the background precomputation.
+    std::atomic<bool> m_cancelPrecompute;
+
+    /// Guards the results handed over by the background precomputation.
+    std::mutex m_precomputeMutex;
+
+    /// Finished angles (in degrees) that are not published yet.
+    std::map<float, OLEF::GhostList> m_pendingGhosts;
+
+    /// The final results of the precomputation, once it is finished.
+    std::map<float, OLEF::GhostList> m_finishedGhosts;
+
+    /// Whether the background precomputation finished or not.
+    bool m_precomputeFinished;
+
+    /// Cache key of the running precomputation.
+    OLEF::GhostAttributeCache::Key m_precomputeCacheKey;
+
+    /// Maximum number of angles sampled by the running precomputation.
+    int m_precomputeMaxAngles;
+
     /// The list of light source objects used for previewing.
     QVector<Layer> m_layers;
 };
\ No newline at end of file
@@ -53,6 +53,18 @@ void MainWindow::createLensFlareObjects()
         &OpticalSystemEditor::opticalSystemChangedSignal, 
         m_opticalSystemPreviewProperties, 
         &OpticalSystemPreviewProperties::opticalSystemChanged);
+
+    // Show the progress of the ghost precomputations in the status bar
+    connect(m_lensFlarePreviewer,
+        &LensFlarePreviewer::ghostPrecomputationProgressSignal,
+        this,
+        [this](int finishedAngles, int maxAngles, bool finished)
+        {
+            if (finished)
+                statusBar()->showMessage(QString("Ghost bounds ready, %1 angles").arg(finishedAngles), 5000);
+            else
+                statusBar()->showMessage(QString("Generating ghost bounds: %1 / %2 angles").arg(finishedAngles).arg(maxAngles));
+        });
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -150,6 +162,15 @@ void MainWindow::createMenu()
 
     fileMenu->addSeparator();
 
+    // File->convert ghost bounds
+    QAction* convertBoundsAction = new QAction;
+    fileMenu->addAction(convertBoundsAction);
+    convertBoundsAction->setText("Convert Ghost Bounds To Binary...");
+    connect(convertBoundsAction, &QAction::triggered, 
+        this, &MainWindow::convertGhostBounds);
+
+    fileMenu->addSeparator();
+
     // File->quit
     QAction* quitAction = new QAction;
     fileMenu->addAction(quitAction);
@@ -252,22 +273,37 @@ void MainWindow::loadGhostBounds()
         nullptr,
         QStringLiteral("Open Optical System"),
         m_browseFolder,
-        QStringLiteral("Optical System Files (*.xml)"));
+        QStringLiteral("Ghost Bounds Files (*.xml *.olefgb)"));
 
     // Make sure the dialog wasn't cancelled.
     if (fileName.isNull())
         return;
 
-    // Open the file
-    QFile fin(fileName);
-    if (!fin.open(QIODevice::ReadOnly))
-        return;
-
-    // Deserialize the object.
     QMap<float, OLEF::GhostList> ghosts;
-    GhostSerializer serializer(&fin, &ghosts);
-    if (!serializer.deserialize())
-        return;
+
+    // Map the binary files
+    if (fileName.endsWith(".olefgb", Qt::CaseInsensitive))
+    {
+        OLEF::GhostBoundsFile file;
+        if (!file.open(fileName.toStdString()))
+            return;
+
+        ghosts = QMap<float, OLEF::GhostList>(file.getGhostLists());
+    }
+
+    // Deserialize the xml files
+    else
+    {
+        // Open the file
+        QFile fin(fileName);
+        if (!fin.open(QIODevice::ReadOnly))
+            return;
+
+        // Deserialize the object.
+        GhostSerializer serializer(&fin, &ghosts);
+        if (!serializer.deserialize())
+            return;
+    }
 
     // Store the deserialized ghosts
     m_lensFlarePreviewer->setPrecomputedGhosts(ghosts);
@@ -323,23 +359,71 @@ void MainWindow::saveGhostBounds()
         QStringLiteral("Save Ghost Bounds"),
         //QDir::currentPath(),
         "D:/Program/Programming/Projects/Cpp/OpenLensFlare/OpenLensFlare/examples/systems",
-        QStringLiteral("Ghost Bounds Files (*.xml)"));
+        QStringLiteral("Ghost Bounds Files (*.xml *.olefgb)"));
 
     // Make sure the dialog wasn't cancelled.
     if (fileName.isNull())
         return;
 
+    auto ghosts = m_lensFlarePreviewer->getPrecomputedGhosts();
+
+    // Write the binary files directly
+    if (fileName.endsWith(".olefgb", Qt::CaseInsensitive))
+    {
+        OLEF::GhostBoundsFile::write(fileName.toStdString(), ghosts.toStdMap());
+        return;
+    }
+
     // Open the file
     QFile fin(fileName);
     if (!fin.open(QIODevice::WriteOnly))
         return;
 
     // Serialize the object.
-    auto ghosts = m_lensFlarePreviewer->getPrecomputedGhosts();
     GhostSerializer serializer(&fin, &ghosts);
     serializer.serialize();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void MainWindow::convertGhostBounds()
+{
+    // Browse the files.
+    QStringList fileNames = QFileDialog::getOpenFileNames(
+        nullptr,
+        QStringLiteral("Convert Ghost Bounds"),
+        m_browseFolder,
+        QStringLiteral("Ghost Bounds Files (*.xml)"));
+
+    // Convert each file, writing the result next to the source file
+    for (const QString& fileName: fileNames)
+    {
+        // Open the file
+        QFile fin(fileName);
+        if (!fin.open(QIODevice::ReadOnly))
+        {
+            qDebug() << "Unable to open" << fileName;
+            continue;
+        }
+
+        // Deserialize the object.
+        QMap<float, OLEF::GhostList> ghosts;
+        GhostSerializer serializer(&fin, &ghosts);
+        if (!serializer.deserialize())
+        {
+            qDebug() << "Not a valid ghost bounds file:" << fileName;
+            continue;
+        }
+
+        // Write the binary version
+        QFileInfo info(fileName);
+        QString outputName = info.path() + "/" + info.completeBaseName() + ".olefgb";
+        if (OLEF::GhostBoundsFile::write(outputName.toStdString(), ghosts.toStdMap()) == 0)
+        {
+            qDebug() << "Unable to write" << outputName;
+        }
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void MainWindow::saveStarburst()
 {
@@ -36,6 +36,7 @@ private:
     void loadStarburst();
     void saveSystem();
     void saveGhostBounds();
+    void convertGhostBounds();
     void saveStarburst();
     void quit();
 
@@ -0,0 +1,1076 @@
+#include "CpuGhostTracer.h"
+#include "GhostAttribHelpers.h"
+
+/// Inlines the helpers called from the packet lane loops, which can't be
+/// vectorized while they contain function calls.
+#if defined(_MSC_VER)
+    #define OLEF_LANE_INLINE __forceinline
+#else
+    #define OLEF_LANE_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace OLEF
+{
+
+////////////////////////////////////////////////////////////////////////////////
+/// Fresnel reflectance of an interface with a single layer anti-reflection
+/// coating. Mirrors fresnelAR in the ray tracing vertex shader.
+static float fresnelAR(float theta0, float lambda, float d, float n0, float n1, float n2)
+{
+    // Apply Snell's law to get the other angles
+    float theta1 = glm::asin(glm::sin(theta0) * n0 / n1);
+    float theta2 = glm::asin(glm::sin(theta0) * n0 / n2);
+
+    float rs01 = -glm::sin(theta0 - theta1) / glm::sin(theta0 + theta1);
+    float rp01 = glm::tan(theta0 - theta1) / glm::tan(theta0 + theta1);
+    float ts01 = 2.0f * glm::sin(theta1) * glm::cos(theta0) / glm::sin(theta0 + theta1);
+    float tp01 = ts01 * glm::cos(theta0 - theta1);
+
+    float rs12 = -glm::sin(theta1 - theta2) / glm::sin(theta1 + theta2);
+    float rp12 = glm::tan(theta1 - theta2) / glm::tan(theta1 + theta2);
+
+    float ris = ts01 * ts01 * rs12;
+    float rip = tp01 * tp01 * rp12;
+
+    float dy = d * n1;
+    float dx = glm::tan(theta1) * dy;
+    float delay = glm::sqrt(dx * dx + dy * dy);
+    float relPhase = 4.0f * glm::pi<float>() / lambda * (delay - dx * glm::sin(theta0));
+
+    float out_s2 = rs01 * rs01 + ris * ris + 2.0f * rs01 * ris * glm::cos(relPhase);
+    float out_p2 = rp01 * rp01 + rip * rip + 2.0f * rp01 * rip * glm::cos(relPhase);
+
+    return (out_s2 + out_p2) * 0.5f;
+}
+
+/// Computes the incident angle between a ray direction and a surface normal.
+static float incidentAngle(glm::vec3 dir, glm::vec3 normal)
+{
+    return glm::acos(glm::clamp(glm::dot(-dir, normal), -1.0f, 1.0f));
+}
+
+/// Number of rays traced together in a packet, based on the vector width of
+/// the targeted instruction set. Without a vector unit, the rays are traced
+/// one by one with the scalar tracer.
+#if defined(__AVX512F__)
+static const int PACKET_SIZE = 16;
+#elif defined(__AVX__)
+static const int PACKET_SIZE = 8;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__ARM_NEON)
+static const int PACKET_SIZE = 4;
+#else
+static const int PACKET_SIZE = 0;
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// Branch-free cosine, accurate to a few float ULPs for the phase values
+/// encountered by the tracer. Unlike the standard library version, it can be
+/// vectorized by the compiler when used inside the packet lane loops.
+static OLEF_LANE_INLINE float packetCos(float x)
+{
+    // Reduce the argument to [-pi/4, pi/4] around the closest multiple of pi/2
+    float fq = x * 0.636619772f;
+    int q = (int) (fq + (fq >= 0.0f ? 0.5f : -0.5f));
+    float r = x - float(q) * 1.57079637f;
+    r = r + float(q) * 4.37113900e-8f;
+
+    // Minimax polynomials for the reduced range
+    float r2 = r * r;
+    float c = 1.0f + r2 * (-0.5f + r2 * (4.166664568e-2f + r2 * (-1.388731625e-3f + r2 * 2.443315711e-5f)));
+    float s = r + r * r2 * (-1.666665461e-1f + r2 * (8.332160873e-3f + r2 * -1.951529589e-4f));
+
+    // Select the result based on the quadrant
+    int quadrant = q & 3;
+    float v = (quadrant & 1) ? s : c;
+    return ((quadrant + 1) & 2) ? -v : v;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Trigonometry-free version of fresnelAR, taking the cosine of the incident
+/// angle instead of the angle itself. The angle sums and differences are
+/// expanded using the sines and cosines obtained from Snell's law, so that
+/// only square roots and divisions remain, which vectorize well.
+static OLEF_LANE_INLINE float packetFresnelAR(float cos0, float lambda, float d, float n0, float n1, float n2)
+{
+    // Sines and cosines of the incident and refracted angles
+    float sin0 = glm::sqrt(1.0f - cos0 * cos0);
+    float sin1 = sin0 * n0 / n1;
+    float sin2 = sin0 * n0 / n2;
+    float cos1 = glm::sqrt(1.0f - sin1 * sin1);
+    float cos2 = glm::sqrt(1.0f - sin2 * sin2);
+
+    // sin(a -+ b) and cos(a -+ b) for the first interface
+    float sinDiff01 = sin0 * cos1 - cos0 * sin1;
+    float sinSum01 = sin0 * cos1 + cos0 * sin1;
+    float cosDiff01 = cos0 * cos1 + sin0 * sin1;
+    float cosSum01 = cos0 * cos1 - sin0 * sin1;
+
+    // ... and for the second one
+    float sinDiff12 = sin1 * cos2 - cos1 * sin2;
+    float sinSum12 = sin1 * cos2 + cos1 * sin2;
+    float cosDiff12 = cos1 * cos2 + sin1 * sin2;
+    float cosSum12 = cos1 * cos2 - sin1 * sin2;
+
+    float rs01 = -sinDiff01 / sinSum01;
+    float rp01 = (sinDiff01 * cosSum01) / (cosDiff01 * sinSum01);
+    float ts01 = 2.0f * sin1 * cos0 / sinSum01;
+    float tp01 = ts01 * cosDiff01;
+
+    float rs12 = -sinDiff12 / sinSum12;
+    float rp12 = (sinDiff12 * cosSum12) / (cosDiff12 * sinSum12);
+
+    float ris = ts01 * ts01 * rs12;
+    float rip = tp01 * tp01 * rp12;
+
+    float dy = d * n1;
+    float dx = sin1 / cos1 * dy;
+    float delay = glm::sqrt(dx * dx + dy * dy);
+    float relPhase = 4.0f * glm::pi<float>() / lambda * (delay - dx * sin0);
+    float cosPhase = packetCos(relPhase);
+
+    float out_s2 = rs01 * rs01 + ris * ris + 2.0f * rs01 * ris * cosPhase;
+    float out_p2 = rp01 * rp01 + rip * rip + 2.0f * rp01 * rip * cosPhase;
+
+    return (out_s2 + out_p2) * 0.5f;
+}
+
+/// Creates the light source corresponding to the parameter incoming angle.
+static LightSource createPrecomputeLight(float angle)
+{
+    LightSource light;
+
+    light.setIncidenceDirection(glm::vec3(-glm::sin(angle), 0.0f, glm::cos(angle)));
+    light.setDiffuseColor(glm::vec3(1.0f));
+    light.setDiffuseIntensity(1.0f);
+
+    return light;
+}
+
+/// Creates warm start seeds for an angle between two already computed ones:
+/// the union of the pupil bounds of the ghosts visible at both angles. The
+/// other ghosts keep their original bounds.
+static GhostList mergeSeedBounds(const GhostList& ghosts, const GhostList& lower, const GhostList& upper)
+{
+    GhostList result = ghosts;
+    for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+    {
+        Ghost::BoundingRect lowerBounds = lower[ghostId].getPupilBounds();
+        Ghost::BoundingRect upperBounds = upper[ghostId].getPupilBounds();
+        if (lowerBounds[1][0] < 0.0f || upperBounds[1][0] < 0.0f)
+        {
+            continue;
+        }
+
+        glm::vec2 minCorner = glm::min(lowerBounds[0], upperBounds[0]);
+        glm::vec2 maxCorner = glm::max(lowerBounds[0] + lowerBounds[1], upperBounds[0] + upperBounds[1]);
+        result[ghostId].setPupilBounds({ minCorner, maxCorner - minCorner });
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+CpuGhostTracer::CpuGhostTracer(OpticalSystem* system):
+    m_opticalSystem(system),
+    m_packetSize(PACKET_SIZE)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+int CpuGhostTracer::getNativePacketSize()
+{
+    return PACKET_SIZE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void CpuGhostTracer::setPacketSize(int value)
+{
+    m_packetSize = (value == 1 || value == 4 || value == 8 || value == 16) ? value : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<CpuGhostTracer::Lens> CpuGhostTracer::createLenses(float lambda) const
+{
+    // Calculate the entrance plane's distance from the sensor plane
+    float sensorDistance = m_opticalSystem->getSensorDistance();
+
+    // Compute the effective aperture length
+    float apertureHeight = m_opticalSystem->getEffectiveApertureHeight();
+
+    // The resulting lens list, with the air before the front element
+    std::vector<Lens> result(m_opticalSystem->getElementCount() + 1);
+    result[0] = { glm::vec3(0.0f), glm::vec3(1.0f), 0.0f, 0.0f, 0.0f, 0.0f };
+
+    // Fill the lens parameters
+    float lensDistance = sensorDistance;
+    for (size_t lensId = 1; lensId < result.size(); ++lensId)
+    {
+        // Reference to the current lens
+        const auto& lens = (*m_opticalSystem)[lensId - 1];
+        auto& out = result[lensId];
+
+        // Set its attributes
+        out.m_radius = lens.getRadiusOfCurvature();
+        out.m_height = lens.getHeight();
+        out.m_aperture = 0.0f;
+        out.m_center = glm::vec3(0.0f, 0.0f, lensDistance - lens.getRadiusOfCurvature());
+        out.m_n.x = result[lensId - 1].m_n.z;
+        out.m_n.y = lens.getCoatingLambda();
+        out.m_n.z = lens.computeIndexOfRefraction(lambda);
+        out.m_d1 = lens.getCoatingLambda() / 4.0f / glm::max(
+            glm::sqrt(out.m_n.x * out.m_n.z), out.m_n.y);
+
+        // Special treatment for the special elements
+        if (lens.getType() == OpticalSystemElement::ElementType::APERTURE_STOP)
+        {
+            out.m_radius = 0.0f;
+            out.m_height = apertureHeight;
+            out.m_aperture = apertureHeight;
+        }
+        else if (lens.getType() == OpticalSystemElement::ElementType::SENSOR)
+        {
+            out.m_radius = 0.0f;
+            out.m_height = glm::min(m_opticalSystem->getFilmWidth(),
+                m_opticalSystem->getFilmHeight());
+            out.m_aperture = 0.0f;
+        }
+
+        // The next element is closer
+        lensDistance -= lens.getThickness();
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+CpuGhostTracer::Ray CpuGhostTracer::traceRay(Ray ray, const std::vector<Lens>& lenses,
+    const Ghost& ghost, float lambda) const
+{
+    // Current phase of testing (0: forward #1, 1: backward, 2: forward #2)
+    int phase = 0;
+
+    // Tracing direction
+    int delta = 1;
+
+    // Number of reflections
+    int numIndices = (int) ghost.getLength();
+
+    for (int t = 1; t < (int) lenses.size(); t += delta)
+    {
+        // Extract the current lens
+        const Lens& lens = lenses[t];
+
+        // Change direction upon reaching the designated interfaces (the ghost
+        // indices are offset by one because of the empty space before the
+        // front element)
+        bool reflectRay = phase < numIndices && t == ghost[phase] + 1;
+        if (reflectRay)
+        {
+            delta = -delta;
+            ++phase;
+        }
+
+        // Determine the intersection
+        glm::vec3 hitPos;
+        glm::vec3 hitNormal;
+        float theta;
+
+        if (lens.m_radius == 0.0f)
+        {
+            // Ray-plane intersection, which is always a hit
+            hitPos = ray.m_pos + ray.m_dir * ((lens.m_center.z - ray.m_pos.z) / ray.m_dir.z);
+            hitNormal = glm::vec3(0.0f, 0.0f, ray.m_dir.z > 0.0f ? -1.0f : 1.0f);
+            theta = incidentAngle(ray.m_dir, hitNormal);
+        }
+        else
+        {
+            // Vector pointing from the ray to the sphere center
+            glm::vec3 D = ray.m_pos - lens.m_center;
+            float B = glm::dot(D, ray.m_dir);
+            float C = glm::dot(D, D) - lens.m_radius * lens.m_radius;
+
+            // Stop tracing if we couldn't hit anything
+            float B2_C = B * B - C;
+            if (B2_C < 0.0f)
+            {
+                ray.m_intensity = 0.0f;
+                break;
+            }
+
+            // The ray is inside the virtual sphere if multiplying its Z
+            // coordinate by the lens radius yields a positive value
+            float inside = glm::sign(lens.m_radius * ray.m_dir.z);
+            float dist = -B + glm::sqrt(B2_C) * inside;
+
+            hitPos = ray.m_pos + dist * ray.m_dir;
+            hitNormal = glm::normalize(hitPos - lens.m_center) * -inside;
+            theta = incidentAngle(ray.m_dir, hitNormal);
+        }
+
+        // Update the ray
+        ray.m_pos = hitPos;
+
+        // Update the relative radius
+        ray.m_radius = glm::max(ray.m_radius,
+            glm::length(glm::vec2(ray.m_pos.x, ray.m_pos.y)) / lens.m_height);
+
+        // Save the UV upon reaching the aperture
+        if (lens.m_aperture != 0.0f)
+        {
+            ray.m_uv = glm::vec2(ray.m_pos.x, ray.m_pos.y) / lens.m_aperture;
+        }
+
+        // Don't reflect/refract on flat surfaces
+        if (lens.m_radius == 0.0f)
+            continue;
+
+        // Get the refractive indices
+        float n0 = ray.m_dir.z < 0.0f ? lens.m_n.x : lens.m_n.z;
+        float n1 = lens.m_n.y;
+        float n2 = ray.m_dir.z < 0.0f ? lens.m_n.z : lens.m_n.x;
+
+        // Are we refracting?
+        if (!reflectRay)
+        {
+            // Refract the ray
+            ray.m_dir = glm::refract(ray.m_dir, hitNormal, n0 / n2);
+
+            // Stop if we experience total internal reflection
+            if (ray.m_dir == glm::vec3(0.0f))
+            {
+                ray.m_intensity = 0.0f;
+                break;
+            }
+        }
+
+        // Or are we reflecting?
+        else
+        {
+            // Reflect the ray
+            ray.m_dir = glm::reflect(ray.m_dir, hitNormal);
+
+            // Update the intensity with the Fresnel reflectivity (R) term
+            ray.m_intensity *= fresnelAR(theta, lambda, lens.m_d1, n0, n1, n2);
+        }
+    }
+
+    // Return the modified ray
+    return ray;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<int N>
+struct CpuGhostTracer::RayPacket
+{
+    /// Ray positions.
+    alignas(64) float m_posX[N];
+    alignas(64) float m_posY[N];
+    alignas(64) float m_posZ[N];
+
+    /// Ray directions.
+    alignas(64) float m_dirX[N];
+    alignas(64) float m_dirY[N];
+    alignas(64) float m_dirZ[N];
+
+    /// UV coordinates on the aperture.
+    alignas(64) float m_uvX[N];
+    alignas(64) float m_uvY[N];
+
+    /// Relative radii.
+    alignas(64) float m_radius[N];
+
+    /// Accumulated intensities.
+    alignas(64) float m_intensity[N];
+
+    /// Whether the lane is still being traced (1) or not (0).
+    alignas(64) float m_alive[N];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+template<int N>
+void CpuGhostTracer::tracePlane(RayPacket<N>& p, const Lens& lens)
+{
+    const float invHeight = 1.0f / lens.m_height;
+    const float invAperture = lens.m_aperture != 0.0f ? 1.0f / lens.m_aperture : 0.0f;
+    const bool atAperture = lens.m_aperture != 0.0f;
+    const float centerZ = lens.m_center.z;
+
+    // Flat surfaces only move the ray and update the radius and UV
+    for (int i = 0; i < N; ++i)
+    {
+        bool live = p.m_alive[i] != 0.0f;
+
+        float dist = (centerZ - p.m_posZ[i]) / p.m_dirZ[i];
+        float hx = p.m_posX[i] + p.m_dirX[i] * dist;
+        float hy = p.m_posY[i] + p.m_dirY[i] * dist;
+        float hz = p.m_posZ[i] + p.m_dirZ[i] * dist;
+        float r = glm::max(p.m_radius[i], glm::sqrt(hx * hx + hy * hy) * invHeight);
+
+        p.m_posX[i] = live ? hx : p.m_posX[i];
+        p.m_posY[i] = live ? hy : p.m_posY[i];
+        p.m_posZ[i] = live ? hz : p.m_posZ[i];
+        p.m_radius[i] = live ? r : p.m_radius[i];
+
+        // A select instead of a branch, which would keep the loop scalar
+        bool updateUv = live && atAperture;
+        p.m_uvX[i] = updateUv ? hx * invAperture : p.m_uvX[i];
+        p.m_uvY[i] = updateUv ? hy * invAperture : p.m_uvY[i];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<int N, bool REFLECT>
+void CpuGhostTracer::traceSphere(RayPacket<N>& p, const Lens& lens, float lambda)
+{
+    const float invHeight = 1.0f / lens.m_height;
+    const float invAperture = lens.m_aperture != 0.0f ? 1.0f / lens.m_aperture : 0.0f;
+    const bool atAperture = lens.m_aperture != 0.0f;
+    const float radiusSq = lens.m_radius * lens.m_radius;
+    const float centerZ = lens.m_center.z;
+    const float lensRadius = lens.m_radius;
+    const float nBefore = lens.m_n.x;
+    const float nCoating = lens.m_n.y;
+    const float nAfter = lens.m_n.z;
+    const float d1 = lens.m_d1;
+
+    for (int i = 0; i < N; ++i)
+    {
+        // Ray-sphere intersection
+        float Dx = p.m_posX[i];
+        float Dy = p.m_posY[i];
+        float Dz = p.m_posZ[i] - centerZ;
+        float B = Dx * p.m_dirX[i] + Dy * p.m_dirY[i] + Dz * p.m_dirZ[i];
+        float C = Dx * Dx + Dy * Dy + Dz * Dz - radiusSq;
+        float B2_C = B * B - C;
+
+        // Lanes that miss the sphere are terminated
+        bool hit = B2_C >= 0.0f;
+        bool live = p.m_alive[i] != 0.0f && hit;
+
+        // The ray is inside the virtual sphere if multiplying its Z
+        // coordinate by the lens radius yields a positive value
+        float inside = lensRadius * p.m_dirZ[i] > 0.0f ? 1.0f : -1.0f;
+        float dist = -B + glm::sqrt(glm::max(B2_C, 0.0f)) * inside;
+
+        float hx = p.m_posX[i] + dist * p.m_dirX[i];
+        float hy = p.m_posY[i] + dist * p.m_dirY[i];
+        float hz = p.m_posZ[i] + dist * p.m_dirZ[i];
+
+        // Surface normal, facing the incoming ray
+        float nx = hx;
+        float ny = hy;
+        float nz = hz - centerZ;
+        float nScale = -inside / glm::sqrt(nx * nx + ny * ny + nz * nz);
+        nx *= nScale;
+        ny *= nScale;
+        nz *= nScale;
+
+        // Cosine of the incident angle
+        float cos0 = glm::clamp(-(p.m_dirX[i] * nx + p.m_dirY[i] * ny + p.m_dirZ[i] * nz), -1.0f, 1.0f);
+
+        // Update the position, radius and UV
+        float r = glm::max(p.m_radius[i], glm::sqrt(hx * hx + hy * hy) * invHeight);
+        p.m_posX[i] = live ? hx : p.m_posX[i];
+        p.m_posY[i] = live ? hy : p.m_posY[i];
+        p.m_posZ[i] = live ? hz : p.m_posZ[i];
+        p.m_radius[i] = live ? r : p.m_radius[i];
+
+        bool updateUv = live && atAperture;
+        p.m_uvX[i] = updateUv ? hx * invAperture : p.m_uvX[i];
+        p.m_uvY[i] = updateUv ? hy * invAperture : p.m_uvY[i];
+
+        // Get the refractive indices
+        bool forward = p.m_dirZ[i] < 0.0f;
+        float n0 = forward ? nBefore : nAfter;
+        float n2 = forward ? nAfter : nBefore;
+
+        float newX, newY, newZ;
+        float newIntensity = p.m_intensity[i];
+        bool survives = true;
+
+        if (!REFLECT)
+        {
+            // Refraction, with total internal reflection terminating the ray
+            float eta = n0 / n2;
+            float k = 1.0f - eta * eta * (1.0f - cos0 * cos0);
+            float scale = eta * cos0 - glm::sqrt(glm::max(k, 0.0f));
+            newX = eta * p.m_dirX[i] + scale * nx;
+            newY = eta * p.m_dirY[i] + scale * ny;
+            newZ = eta * p.m_dirZ[i] + scale * nz;
+            survives = k >= 0.0f;
+        }
+        else
+        {
+            // Reflection, attenuated by the Fresnel reflectivity
+            newX = p.m_dirX[i] + 2.0f * cos0 * nx;
+            newY = p.m_dirY[i] + 2.0f * cos0 * ny;
+            newZ = p.m_dirZ[i] + 2.0f * cos0 * nz;
+            newIntensity *= packetFresnelAR(cos0, lambda, d1, n0, nCoating, n2);
+        }
+
+        p.m_dirX[i] = live ? (survives ? newX : 0.0f) : p.m_dirX[i];
+        p.m_dirY[i] = live ? (survives ? newY : 0.0f) : p.m_dirY[i];
+        p.m_dirZ[i] = live ? (survives ? newZ : 0.0f) : p.m_dirZ[i];
+        p.m_intensity[i] = live ? (survives ? newIntensity : 0.0f) : (hit ? p.m_intensity[i] : 0.0f);
+        p.m_alive[i] = live && survives ? 1.0f : 0.0f;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<int N>
+void CpuGhostTracer::tracePacket(const Ray* rays, int numRays, const std::vector<Lens>& lenses,
+    const Ghost& ghost, float lambda, Ray* results) const
+{
+    // Ray attributes, in structure-of-arrays layout
+    RayPacket<N> p;
+
+    // Load the rays; unused lanes start out terminated
+    for (int i = 0; i < N; ++i)
+    {
+        const Ray& ray = rays[i < numRays ? i : 0];
+        p.m_posX[i] = ray.m_pos.x;
+        p.m_posY[i] = ray.m_pos.y;
+        p.m_posZ[i] = ray.m_pos.z;
+        p.m_dirX[i] = ray.m_dir.x;
+        p.m_dirY[i] = ray.m_dir.y;
+        p.m_dirZ[i] = ray.m_dir.z;
+        p.m_uvX[i] = ray.m_uv.x;
+        p.m_uvY[i] = ray.m_uv.y;
+        p.m_radius[i] = ray.m_radius;
+        p.m_intensity[i] = ray.m_intensity;
+        p.m_alive[i] = i < numRays ? 1.0f : 0.0f;
+    }
+
+    // Current phase of testing (0: forward #1, 1: backward, 2: forward #2)
+    int phase = 0;
+
+    // Tracing direction
+    int delta = 1;
+
+    // Number of reflections
+    int numIndices = (int) ghost.getLength();
+
+    // Every lane walks the same interfaces, so the loop itself is uniform,
+    // and the interface kind is resolved once per interface instead of per
+    // lane
+    for (int t = 1; t < (int) lenses.size(); t += delta)
+    {
+        // Extract the current lens
+        const Lens& lens = lenses[t];
+
+        // Change direction upon reaching the designated interfaces
+        bool reflectRay = phase < numIndices && t == ghost[phase] + 1;
+        if (reflectRay)
+        {
+            delta = -delta;
+            ++phase;
+        }
+
+        if (lens.m_radius == 0.0f)
+        {
+            tracePlane<N>(p, lens);
+            continue;
+        }
+        else if (reflectRay)
+        {
+            traceSphere<N, true>(p, lens, lambda);
+        }
+        else
+        {
+            traceSphere<N, false>(p, lens, lambda);
+        }
+
+        // Stop once every lane has been terminated
+        float anyAlive = 0.0f;
+        for (int i = 0; i < N; ++i)
+        {
+            anyAlive += p.m_alive[i];
+        }
+
+        if (anyAlive == 0.0f)
+        {
+            break;
+        }
+    }
+
+    // Store the results of the active lanes
+    for (int i = 0; i < numRays; ++i)
+    {
+        Ray& result = results[i];
+        result.m_pos = glm::vec3(p.m_posX[i], p.m_posY[i], p.m_posZ[i]);
+        result.m_dir = glm::vec3(p.m_dirX[i], p.m_dirY[i], p.m_dirZ[i]);
+        result.m_uv = glm::vec2(p.m_uvX[i], p.m_uvY[i]);
+        result.m_radius = p.m_radius[i];
+        result.m_intensity = p.m_intensity[i];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<int N>
+void CpuGhostTracer::tracePackets(const std::vector<Ray>& rays, const std::vector<Lens>& lenses,
+    const Ghost& ghost, float lambda, std::vector<Ray>& results) const
+{
+    int numRays = (int) rays.size();
+    for (int first = 0; first < numRays; first += N)
+    {
+        tracePacket<N>(rays.data() + first, glm::min(N, numRays - first),
+            lenses, ghost, lambda, results.data() + first);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+float CpuGhostTracer::sampleApertureMask(glm::vec2 uv) const
+{
+    // An unbound texture samples as zero
+    if (m_apertureMask.m_values.empty())
+        return 0.0f;
+
+    // Bilinear filtering with edge clamping, mimicking the texture sampler
+    int w = m_apertureMask.m_width;
+    int h = m_apertureMask.m_height;
+
+    float x = uv.x * w - 0.5f;
+    float y = uv.y * h - 0.5f;
+    float x0f = glm::floor(x);
+    float y0f = glm::floor(y);
+    float fx = x - x0f;
+    float fy = y - y0f;
+
+    int x0 = glm::clamp((int) x0f, 0, w - 1);
+    int y0 = glm::clamp((int) y0f, 0, h - 1);
+    int x1 = glm::clamp((int) x0f + 1, 0, w - 1);
+    int y1 = glm::clamp((int) y0f + 1, 0, h - 1);
+
+    const auto& v = m_apertureMask.m_values;
+    float top = glm::mix(v[y0 * w + x0], v[y0 * w + x1], fx);
+    float bottom = glm::mix(v[y1 * w + x0], v[y1 * w + x1], fx);
+
+    return glm::mix(top, bottom, fy);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void CpuGhostTracer::traceGhostChannel(const LightSource& light, const Ghost& ghost,
+    float lambda, int rayCount, PerVertexData* vertices) const
+{
+    // Build the lens list for the wavelength
+    auto lenses = createLenses(lambda);
+
+    // Convert the light direction to spherical angles
+    glm::vec3 toLight = -light.getIncidenceDirection();
+    float rotation = glm::atan(toLight.y, toLight.x);
+    float angle = glm::acos(glm::dot(toLight, glm::vec3(0.0f, 0.0f, -1.0f)));
+
+    // Compute the ray direction and grid parameters, like the GL path does
+    glm::mat4 rotMat = glm::rotate(rotation, glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::vec3 baseDir = glm::vec3(glm::sin(angle), 0.0f, -glm::cos(angle));
+    glm::vec3 rayDir = glm::vec3(rotMat * glm::vec4(baseDir, 1.0f));
+    glm::vec2 gridCenter = glm::mat2(rotMat) * (
+        ghost.getPupilBounds()[0] + ghost.getPupilBounds()[1] / 2.0f);
+    glm::vec2 gridSize = ghost.getPupilBounds()[1] / 2.0f;
+    float rayDist = m_opticalSystem->getSensorDistance() + 0.1f;
+    float pupilHeight = lenses.size() > 1 ? lenses[1].m_height : 0.0f;
+    glm::vec2 halfFilmSize = m_opticalSystem->getFilmSize() * 0.5f;
+
+    // Step size between neighbouring rays
+    glm::vec2 step = glm::vec2(2.0f) / float(rayCount - 1);
+    int numVertices = GhostAttribHelpers::gridVertexCount(rayCount);
+
+    // Generate the rays for each grid point
+    std::vector<Ray> rays(numVertices);
+    for (int vertexId = 0; vertexId < numVertices; ++vertexId)
+    {
+        // Grid position of the vertex
+        int col = vertexId % rayCount;
+        int row = vertexId / rayCount;
+
+        // Calculate the ray position on the pupil
+        glm::vec2 vertexPos = glm::vec2(-1.0f) + glm::vec2(col, row) * step;
+        glm::vec2 rayPos = gridSize * vertexPos + gridCenter;
+
+        // Generate the ray
+        Ray& ray = rays[vertexId];
+        ray.m_pos = glm::vec3(rayPos * pupilHeight, rayDist);
+        ray.m_dir = rayDir;
+        ray.m_uv = glm::vec2(0.0f);
+        ray.m_radius = 0.0f;
+        ray.m_intensity = 1.0f;
+
+        vertices[vertexId].m_parameter = rayPos;
+    }
+
+    // Trace them, either in packets or one by one
+    std::vector<Ray> results(numVertices);
+    switch (m_packetSize)
+    {
+        case 1:
+            tracePackets<1>(rays, lenses, ghost, lambda, results);
+            break;
+
+        case 4:
+            tracePackets<4>(rays, lenses, ghost, lambda, results);
+            break;
+
+        case 8:
+            tracePackets<8>(rays, lenses, ghost, lambda, results);
+            break;
+
+        case 16:
+            tracePackets<16>(rays, lenses, ghost, lambda, results);
+            break;
+
+        default:
+            for (int vertexId = 0; vertexId < numVertices; ++vertexId)
+            {
+                results[vertexId] = traceRay(rays[vertexId], lenses, ghost, lambda);
+            }
+            break;
+    }
+
+    // Write out the output values
+    for (int vertexId = 0; vertexId < numVertices; ++vertexId)
+    {
+        const Ray& result = results[vertexId];
+        auto& out = vertices[vertexId];
+        out.m_position = glm::vec2(result.m_pos.x, result.m_pos.y) / halfFilmSize;
+        out.m_uv = result.m_uv;
+        out.m_radius = result.m_radius;
+        out.m_intensity = glm::clamp(result.m_intensity, 0.0f, 1.0f);
+        out.m_irisDistance = sampleApertureMask(
+            glm::clamp(result.m_uv, glm::vec2(-1.0f), glm::vec2(1.0f)) * 0.5f + 0.5f);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GhostList CpuGhostTracer::computeGhostAttributes(const GhostList& ghosts,
+    const GhostAttribComputeParams& computeParams, GhostAttribComputeStats* stats) const
+{
+    // The light source corresponding to the incoming angle
+    LightSource light = createPrecomputeLight(computeParams.m_angle);
+
+    // Allocate the vertex buffer
+    auto layout = GhostAttribHelpers::computeVertexLayout(
+        *m_opticalSystem, ghosts, computeParams);
+    std::vector<PerVertexData> vertices(layout.m_totalVertices);
+
+    // Run the attribute computations
+    return GhostAttribHelpers::computeGhostAttributes(
+        *m_opticalSystem, ghosts, computeParams,
+        [&](const GhostList& current, const std::vector<bool>& active, int numRays, auto analyse)
+    {
+        for (size_t ghostId = 0; ghostId < current.size(); ++ghostId)
+        {
+            // Skip the ghosts that do not take part in this pass
+            if (!active[ghostId])
+            {
+                continue;
+            }
+
+            // Trace each channel into its slot
+            PerVertexData* ghostVertices = vertices.data() + layout.m_vertexOffsets[ghostId][0];
+            for (int chId = 0; chId < computeParams.m_lambdas.size(); ++chId)
+            {
+                traceGhostChannel(light, current[ghostId], computeParams.m_lambdas[chId],
+                    numRays, ghostVertices + chId * layout.m_vertexOffsets[ghostId][1]);
+            }
+
+            // Process the generated ray data
+            analyse(ghostId, ghostVertices, layout.m_vertexOffsets[ghostId][1]);
+        }
+    }, stats);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Ghost CpuGhostTracer::computeGhostAttributes(const LightSource& light, const Ghost& ghost,
+    const GhostAttribComputeParams& computeParams, TaskPool& pool, GhostAttribComputeStats* stats) const
+{
+    // Run the regular computations on a single element list, which gives the
+    // same result as processing the ghost along with the others
+    GhostList ghosts = { ghost };
+
+    // Allocate the vertex buffer
+    auto layout = GhostAttribHelpers::computeVertexLayout(
+        *m_opticalSystem, ghosts, computeParams);
+    std::vector<PerVertexData> vertices(layout.m_totalVertices);
+
+    // Run the attribute computations
+    return GhostAttribHelpers::computeGhostAttributes(
+        *m_opticalSystem, ghosts, computeParams,
+        [&](const GhostList& current, const std::vector<bool>& active, int numRays, auto analyse)
+    {
+        if (active[0])
+        {
+            // Trace each channel as a separate task
+            TaskPool::TaskGroup channels;
+            for (int chId = 0; chId < computeParams.m_lambdas.size(); ++chId)
+            {
+                pool.run(channels, [&, chId]()
+                {
+                    int vertexOffset = layout.m_vertexOffsets[0][0] +
+                        chId * layout.m_vertexOffsets[0][1];
+
+                    traceGhostChannel(light, current[0],
+                        computeParams.m_lambdas[chId], numRays, vertices.data() + vertexOffset);
+                });
+            }
+            pool.wait(channels);
+
+            // Process the generated ray data
+            analyse(0, vertices.data() + layout.m_vertexOffsets[0][0], layout.m_vertexOffsets[0][1]);
+        }
+    }, stats)[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GhostList CpuGhostTracer::computeGhostAttributes(const GhostList& ghosts,
+    const GhostAttribComputeParams& computeParams, TaskPool& pool,
+    GhostAttribComputeStats* stats) const
+{
+    return computeGhostAttributes(ghosts, { computeParams.m_angle }, computeParams, pool, stats)[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<GhostList> CpuGhostTracer::computeGhostAttributes(const GhostList& ghosts,
+    const std::vector<float>& angles, const GhostAttribComputeParams& computeParams,
+    TaskPool& pool, GhostAttribComputeStats* stats) const
+{
+    return computeGhostAttributes(std::vector<GhostList>(angles.size(), ghosts),
+        angles, computeParams, pool, stats);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<GhostList> CpuGhostTracer::computeGhostAttributes(const std::vector<GhostList>& angleGhosts,
+    const std::vector<float>& angles, const GhostAttribComputeParams& computeParams,
+    TaskPool& pool, GhostAttribComputeStats* stats, const AngleCallback& angleFinished,
+    const std::atomic<bool>* cancel) const
+{
+    // Each task writes its own slot, so the result is deterministic
+    std::vector<GhostList> result = angleGhosts;
+    std::vector<size_t> taskOffsets(angles.size() + 1, 0);
+    for (size_t angleId = 0; angleId < angles.size(); ++angleId)
+    {
+        taskOffsets[angleId + 1] = taskOffsets[angleId] + angleGhosts[angleId].size();
+    }
+    std::vector<GhostAttribComputeStats> taskStats(taskOffsets.back());
+
+    // Number of unfinished ghosts for each angle
+    std::vector<std::atomic<int>> remainingGhosts(angles.size());
+    for (size_t angleId = 0; angleId < angles.size(); ++angleId)
+    {
+        remainingGhosts[angleId] = (int) angleGhosts[angleId].size();
+    }
+
+    // Light sources for each angle
+    std::vector<LightSource> lights;
+    lights.reserve(angles.size());
+    for (float angle: angles)
+    {
+        lights.push_back(createPrecomputeLight(angle));
+    }
+
+    // Process each (angle, ghost) pair as a separate task
+    TaskPool::TaskGroup tasks;
+    for (size_t angleId = 0; angleId < angles.size(); ++angleId)
+    {
+        for (size_t ghostId = 0; ghostId < angleGhosts[angleId].size(); ++ghostId)
+        {
+            pool.run(tasks, [&, angleId, ghostId]()
+            {
+                if (cancel != nullptr && cancel->load())
+                {
+                    return;
+                }
+
+                GhostAttribComputeParams params = computeParams;
+                params.m_angle = angles[angleId];
+
+                result[angleId][ghostId] = computeGhostAttributes(
+                    lights[angleId], angleGhosts[angleId][ghostId], params, pool,
+                    &taskStats[taskOffsets[angleId] + ghostId]);
+
+                // Report the angle once its last ghost is done
+                if (--remainingGhosts[angleId] == 0 && angleFinished)
+                {
+                    angleFinished(angles[angleId], result[angleId]);
+                }
+            });
+        }
+    }
+    pool.wait(tasks);
+
+    // Gather the statistics
+    if (stats != nullptr)
+    {
+        for (const auto& current: taskStats)
+        {
+            stats->m_raysTraced += current.m_raysTraced;
+            stats->m_raysTracedWithoutReuse += current.m_raysTracedWithoutReuse;
+            stats->m_skippedBoundingPasses += current.m_skippedBoundingPasses;
+            stats->m_warmStartRestarts += current.m_warmStartRestarts;
+        }
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::map<float, GhostList> CpuGhostTracer::computeGhostAttributesAdaptive(const GhostList& ghosts,
+    const AngleSamplingParams& sampling, const GhostAttribComputeParams& params,
+    TaskPool& pool, GhostAttribComputeStats* stats, const AngleCallback& angleFinished,
+    const std::atomic<bool>* cancel) const
+{
+    std::map<float, GhostList> result;
+
+    int initialSamples = glm::max(sampling.m_initialSamples, 2);
+    size_t maxSamples = (size_t) glm::max(sampling.m_maxSamples, initialSamples);
+
+    // Start with a uniform set of angles
+    std::vector<float> angles;
+    for (int i = 0; i < initialSamples; ++i)
+    {
+        angles.push_back(glm::mix(sampling.m_minAngle, sampling.m_maxAngle,
+            float(i) / float(initialSamples - 1)));
+    }
+
+    std::vector<GhostList> angleGhosts = computeGhostAttributes(
+        std::vector<GhostList>(angles.size(), ghosts), angles, params, pool, stats,
+        angleFinished, cancel);
+    if (cancel != nullptr && cancel->load())
+    {
+        return result;
+    }
+
+    for (size_t i = 0; i < angles.size(); ++i)
+    {
+        result[angles[i]] = std::move(angleGhosts[i]);
+    }
+
+    // Every initial interval is a refinement candidate
+    std::vector<std::pair<float, float>> intervals;
+    for (size_t i = 1; i < angles.size(); ++i)
+    {
+        intervals.emplace_back(angles[i - 1], angles[i]);
+    }
+
+    while (!intervals.empty() && result.size() < maxSamples)
+    {
+        // Trace the midpoints of the candidate intervals, as far as the
+        // sample limit allows
+        intervals.resize(std::min(intervals.size(), maxSamples - result.size()));
+
+        angles.clear();
+        std::vector<GhostList> seeds;
+        for (const auto& interval: intervals)
+        {
+            angles.push_back((interval.first + interval.second) * 0.5f);
+
+            // Seed the bounds with the results of the interval's endpoints
+            if (params.m_warmStart)
+            {
+                seeds.push_back(mergeSeedBounds(ghosts, result[interval.first], result[interval.second]));
+            }
+            else
+            {
+                seeds.push_back(ghosts);
+            }
+        }
+
+        angleGhosts = computeGhostAttributes(seeds, angles, params, pool, stats,
+            angleFinished, cancel);
+        if (cancel != nullptr && cancel->load())
+        {
+            break;
+        }
+
+        for (size_t i = 0; i < angles.size(); ++i)
+        {
+            result[angles[i]] = std::move(angleGhosts[i]);
+        }
+
+        // Bisect the intervals whose midpoints are not predicted well enough
+        // by their endpoints
+        std::vector<std::pair<float, std::pair<float, float>>> refine;
+        for (size_t i = 0; i < intervals.size(); ++i)
+        {
+            float lower = intervals[i].first, middle = angles[i], upper = intervals[i].second;
+            if (middle - lower < 2.0f * sampling.m_minStep)
+            {
+                continue;
+            }
+
+            float error = computeInterpolationError(result[lower], result[middle], result[upper], sampling);
+            if (error > 1.0f)
+            {
+                refine.emplace_back(error, std::make_pair(lower, middle));
+                refine.emplace_back(error, std::make_pair(middle, upper));
+            }
+        }
+
+        // The ones with the largest errors are refined first
+        std::stable_sort(refine.begin(), refine.end(), [](const auto& a, const auto& b)
+        {
+            return a.first > b.first;
+        });
+
+        intervals.clear();
+        for (const auto& interval: refine)
+        {
+            intervals.push_back(interval.second);
+        }
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+float CpuGhostTracer::computeInterpolationError(const GhostList& lower, const GhostList& middle,
+    const GhostList& upper, const AngleSamplingParams& sampling)
+{
+    // Ghosts without any valid rays keep their initial, inverted bounds
+    auto isVisible = [](const Ghost& ghost)
+    {
+        return ghost.getSensorBounds()[1].x >= 0.0f && ghost.getSensorBounds()[1].y >= 0.0f;
+    };
+
+    float result = 0.0f;
+    for (size_t ghostId = 0; ghostId < middle.size(); ++ghostId)
+    {
+        const Ghost& a = lower[ghostId];
+        const Ghost& m = middle[ghostId];
+        const Ghost& b = upper[ghostId];
+
+        // Ghosts that appear or disappear inside the interval always need
+        // refining, while the invisible ones never do
+        int visible = int(isVisible(a)) + int(isVisible(m)) + int(isVisible(b));
+        if (visible == 0)
+        {
+            continue;
+        }
+        if (visible != 3)
+        {
+            return std::numeric_limits<float>::max();
+        }
+
+        // Relative intensity error
+        float intensity = glm::mix(a.getAverageIntensity(), b.getAverageIntensity(), 0.5f);
+        float maxIntensity = glm::max(intensity, m.getAverageIntensity());
+        if (maxIntensity > 0.0f)
+        {
+            result = glm::max(result, glm::abs(intensity - m.getAverageIntensity()) /
+                (maxIntensity * sampling.m_intensityTolerance));
+        }
+
+        // Bounds error
+        Ghost::BoundingRect boundsA[2] = { a.getPupilBounds(), a.getSensorBounds() };
+        Ghost::BoundingRect boundsM[2] = { m.getPupilBounds(), m.getSensorBounds() };
+        Ghost::BoundingRect boundsB[2] = { b.getPupilBounds(), b.getSensorBounds() };
+        for (int i = 0; i < 2; ++i)
+        {
+            for (int j = 0; j < 2; ++j)
+            {
+                glm::vec2 delta = glm::abs(glm::mix(boundsA[i][j], boundsB[i][j], 0.5f) - boundsM[i][j]);
+                result = glm::max(result, glm::max(delta.x, delta.y) / sampling.m_boundsTolerance);
+            }
+        }
+    }
+    return result;
+}
+
+}
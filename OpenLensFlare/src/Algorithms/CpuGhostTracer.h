@@ -0,0 +1,282 @@
+#pragma once
+
+#include "../OpticalSystem.h"
+#include "../Ghost.h"
+#include "../LightSource.h"
+#include "../TaskPool.h"
+#include "RayTraceGhostAlgorithm.h"
+
+namespace OLEF
+{
+
+/// A CPU implementation of the ray tracer found in the ray traced ghost
+/// algorithm's shaders. It produces the same per-vertex data as the transform
+/// feedback path, without requiring a GL context, so ghost attributes can be
+/// precomputed on machines without a GPU.
+///
+/// Rays are traced in structure-of-arrays packets, whose default width is
+/// picked based on the instruction set the library is compiled for (16 lanes
+/// with AVX-512, 8 with AVX, 4 with SSE2/NEON), with a scalar fallback. Since
+/// every ray of a ghost walks the same interface sequence, only misses and
+/// total internal reflection diverge, which are handled by masking the
+/// affected lanes. The lane loops rely on the compiler's auto-vectorizer,
+/// which needs math functions that don't set errno (see CMakeLists.txt).
+///
+/// The tracing functions do not modify the object, so a single tracer can be
+/// shared between multiple threads.
+class CpuGhostTracer
+{
+public:
+    /// Per-vertex data generated by the tracer.
+    using PerVertexData = RayTraceGhostAlgorithm::PerVertexData;
+
+    /// Parameters for the attribute computations.
+    using GhostAttribComputeParams = RayTraceGhostAlgorithm::GhostAttribComputeParams;
+
+    /// Statistics gathered during the attribute computations.
+    using GhostAttribComputeStats = RayTraceGhostAlgorithm::GhostAttribComputeStats;
+
+    /// A CPU-side copy of the aperture mask texture, used to compute the iris
+    /// distance attribute of the traced rays.
+    struct ApertureMask
+    {
+        /// Width of the mask.
+        int m_width = 0;
+
+        /// Height of the mask.
+        int m_height = 0;
+
+        /// Row-major mask values (the red channel of the texture), in [0, 1],
+        /// stored in the same row order as the texture data.
+        std::vector<float> m_values;
+    };
+
+    /// Parameters of the adaptive incoming angle sampling.
+    struct AngleSamplingParams
+    {
+        /// Start of the sampled angle range, in radians.
+        float m_minAngle = 0.0f;
+
+        /// End of the sampled angle range, in radians.
+        float m_maxAngle = glm::radians(90.0f);
+
+        /// Number of uniformly spaced samples to start with, including both
+        /// ends of the range.
+        int m_initialSamples = 25;
+
+        /// Maximum number of samples taken, including the initial ones.
+        int m_maxSamples = 181;
+
+        /// Intervals are not bisected into halves narrower than this.
+        float m_minStep = glm::radians(0.25f);
+
+        /// Maximum error of the linearly interpolated (normalized) pupil and
+        /// sensor bounds of any ghost.
+        float m_boundsTolerance = 0.05f;
+
+        /// Maximum relative error of the linearly interpolated intensity of
+        /// any ghost.
+        float m_intensityTolerance = 0.1f;
+    };
+
+    /// Callback invoked once the attributes of an incoming angle (in radians)
+    /// are computed. It can be called from any thread of the task pool, and
+    /// from multiple threads at the same time.
+    using AngleCallback = std::function<void(float angle, const GhostList& ghosts)>;
+
+    /// Constructs a tracer for the parameter optical system.
+    CpuGhostTracer(OpticalSystem* system);
+
+    /// Traces a single channel of a ghost, with a grid of rayCount x rayCount
+    /// rays, at the parameter wavelength. The output array must have room for
+    /// rayCount * rayCount vertices, which are laid out in row-major order,
+    /// the same way as the vertices generated by the transform feedback path.
+    void traceGhostChannel(const LightSource& light, const Ghost& ghost,
+        float lambda, int rayCount, PerVertexData* vertices) const;
+
+    /// Computes the ghost rendering attributes corresponding to the provided
+    /// parameters, and returns a new ghost list with the ghosts containing
+    /// the computed attributes. This is the CPU counterpart of
+    /// RayTraceGhostAlgorithm::computeGhostAttributes.
+    GhostList computeGhostAttributes(const GhostList& ghosts,
+        const GhostAttribComputeParams& params = {}, GhostAttribComputeStats* stats = nullptr) const;
+
+    /// Multi-threaded version of the attribute computations, which spreads
+    /// the work across the threads of the parameter pool. The result does not
+    /// depend on the number of threads or the order of execution.
+    GhostList computeGhostAttributes(const GhostList& ghosts,
+        const GhostAttribComputeParams& params, TaskPool& pool,
+        GhostAttribComputeStats* stats = nullptr) const;
+
+    /// Computes the ghost attributes for each of the parameter incoming
+    /// angles (in radians, overriding the angle in params) in parallel. Every
+    /// (angle, ghost, channel) combination is traced as a separate task, and
+    /// the results are merged into one ghost list per angle, in the order of
+    /// the angles.
+    std::vector<GhostList> computeGhostAttributes(const GhostList& ghosts,
+        const std::vector<float>& angles, const GhostAttribComputeParams& params,
+        TaskPool& pool, GhostAttribComputeStats* stats = nullptr) const;
+
+    /// Computes the ghost attributes for each of the parameter incoming
+    /// angles, starting from a separate ghost list for each angle. Combined
+    /// with warm starting, this allows seeding the bounds of each angle with
+    /// the results of its neighbours. The optional callback is invoked for
+    /// every finished angle, as soon as it is done. Once the optional cancel
+    /// flag is set, the ghosts that haven't started yet are skipped, and the
+    /// corresponding angles are left unfinished.
+    std::vector<GhostList> computeGhostAttributes(const std::vector<GhostList>& angleGhosts,
+        const std::vector<float>& angles, const GhostAttribComputeParams& params,
+        TaskPool& pool, GhostAttribComputeStats* stats = nullptr,
+        const AngleCallback& angleFinished = nullptr,
+        const std::atomic<bool>* cancel = nullptr) const;
+
+    /// Computes the ghost attributes for adaptively chosen incoming angles.
+    /// Starting from a uniform set of angles, intervals are recursively
+    /// bisected while the bounds or the intensity of any ghost at their
+    /// midpoint differ from the linear interpolation of their endpoints by
+    /// more than the tolerances, or a ghost appears or disappears inside
+    /// them. Refinement stops at the minimum step or the sample limit, with
+    /// the largest errors refined first. With warm starting, the bounds of
+    /// the refined angles are seeded with the results of their interval's
+    /// endpoints. The results are keyed by the sampled angles, in radians.
+    ///
+    /// The optional callback is invoked for every finished angle, which
+    /// allows using the results while the computations are still running.
+    /// Setting the optional cancel flag stops the computations as soon as
+    /// possible, and only the results of the refinement rounds finished so
+    /// far are returned.
+    std::map<float, GhostList> computeGhostAttributesAdaptive(const GhostList& ghosts,
+        const AngleSamplingParams& sampling, const GhostAttribComputeParams& params,
+        TaskPool& pool, GhostAttribComputeStats* stats = nullptr,
+        const AngleCallback& angleFinished = nullptr,
+        const std::atomic<bool>* cancel = nullptr) const;
+
+    /// Returns the largest difference between the ghost attributes at the
+    /// middle of an interval and the linear interpolation of its endpoints,
+    /// relative to the sampling tolerances. Values above one mean that the
+    /// interval needs to be refined.
+    static float computeInterpolationError(const GhostList& lower, const GhostList& middle,
+        const GhostList& upper, const AngleSamplingParams& sampling);
+
+    /// Samples the aperture mask at the parameter texture coordinates, with
+    /// bilinear filtering and edge clamping, like the GL texture sampler.
+    float sampleApertureMask(glm::vec2 uv) const;
+
+    /// Returns the packet width matching the vector width of the instruction
+    /// set the library is compiled for, or 0 if it targets no vector unit.
+    static int getNativePacketSize();
+
+    /// Returns the optical system that generates the ghosts.
+    OpticalSystem* getOpticalSystem() const { return m_opticalSystem; }
+
+    /// Returns the number of rays traced together in a packet.
+    int getPacketSize() const { return m_packetSize; }
+
+    /// Returns the aperture mask.
+    const ApertureMask& getApertureMask() const { return m_apertureMask; }
+
+    /// Sets the aperture mask. Without a mask, every ray passes the iris.
+    void setApertureMask(const ApertureMask& value) { m_apertureMask = value; }
+
+    /// Sets the aperture mask. This version moves the parameter.
+    void setApertureMask(ApertureMask&& value) { m_apertureMask = std::move(value); }
+
+    /// Sets the number of rays traced together in a packet: 1, 4, 8 or 16,
+    /// or 0 to trace the rays one by one with the scalar tracer, which
+    /// mirrors the GLSL one. Packets wider than the native width are traced
+    /// as multiple vectors, and single-lane packets use the same code as the
+    /// wider ones, which is mainly useful for benchmarking.
+    void setPacketSize(int value);
+
+private:
+    /// Describes a lens interface, as seen by the tracer.
+    struct Lens
+    {
+        /// Center of the lens interface.
+        glm::vec3 m_center;
+
+        /// Refraction indices (before, coating, after).
+        glm::vec3 m_n;
+
+        /// Radius of curvature.
+        float m_radius;
+
+        /// Height of the lens element.
+        float m_height;
+
+        /// Aperture height.
+        float m_aperture;
+
+        /// Coating thickness.
+        float m_d1;
+    };
+
+    /// Describes a ray being traced.
+    struct Ray
+    {
+        /// Ray position.
+        glm::vec3 m_pos;
+
+        /// Ray direction.
+        glm::vec3 m_dir;
+
+        /// UV coordinates on the aperture.
+        glm::vec2 m_uv;
+
+        /// Relative radius.
+        float m_radius;
+
+        /// Accumulated intensity.
+        float m_intensity;
+    };
+
+    /// Builds the lens interface list for the parameter wavelength. The first
+    /// entry corresponds to the empty space before the front element.
+    std::vector<Lens> createLenses(float lambda) const;
+
+    /// Traces a ray from the entrance plane up until the sensor.
+    Ray traceRay(Ray ray, const std::vector<Lens>& lenses, const Ghost& ghost, float lambda) const;
+
+    /// A packet of N rays, in structure-of-arrays layout.
+    template<int N>
+    struct RayPacket;
+
+    /// Moves the live rays of a packet to a flat interface.
+    template<int N>
+    static void tracePlane(RayPacket<N>& packet, const Lens& lens);
+
+    /// Intersects the live rays of a packet with a spherical interface, and
+    /// reflects or refracts them. The interface kind is a template parameter,
+    /// so the lane loop has no branches left, and refracting interfaces don't
+    /// evaluate the Fresnel term in the masked out branch.
+    template<int N, bool REFLECT>
+    static void traceSphere(RayPacket<N>& packet, const Lens& lens, float lambda);
+
+    /// Traces a packet of up to N rays, starting on the entrance plane at the
+    /// parameter pupil positions and sharing the same direction.
+    template<int N>
+    void tracePacket(const Ray* rays, int numRays, const std::vector<Lens>& lenses,
+        const Ghost& ghost, float lambda, Ray* results) const;
+
+    /// Traces every parameter ray in packets of N rays.
+    template<int N>
+    void tracePackets(const std::vector<Ray>& rays, const std::vector<Lens>& lenses,
+        const Ghost& ghost, float lambda, std::vector<Ray>& results) const;
+
+    /// Computes the attributes of a single ghost, tracing its channels as
+    /// separate tasks of the parameter pool.
+    Ghost computeGhostAttributes(const LightSource& light, const Ghost& ghost,
+        const GhostAttribComputeParams& params, TaskPool& pool,
+        GhostAttribComputeStats* stats) const;
+
+    /// The optical system that generates the ghosts.
+    OpticalSystem* m_opticalSystem;
+
+    /// The aperture mask.
+    ApertureMask m_apertureMask;
+
+    /// Number of rays traced together in a packet.
+    int m_packetSize;
+};
+
+}
@@ -12,8 +12,9 @@ namespace OLEF
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-DiffractionStarburstAlgorithm::DiffractionStarburstAlgorithm(OpticalSystem* opticalSystem):
+DiffractionStarburstAlgorithm::DiffractionStarburstAlgorithm(OpticalSystem* opticalSystem, ProgramCache* programCache):
     m_opticalSystem(opticalSystem),
+    m_programCache(programCache),
     m_size(0.0f),
     m_intensity(0.0f),
     m_texture(0),
@@ -44,7 +45,7 @@ DiffractionStarburstAlgorithm::DiffractionStarburstAlgorithm(OpticalSystem* opti
             }
         },
     };
-    m_generateShader = GLHelpers::createShader(generateSource);
+    m_generateShader = ProgramCache::createProgram(m_programCache, generateSource);
     
     // Create the render shader
     GLHelpers::ShaderSource renderSource;
@@ -68,7 +69,7 @@ DiffractionStarburstAlgorithm::DiffractionStarburstAlgorithm(OpticalSystem* opti
             }
         },
     };
-    m_renderShader = GLHelpers::createShader(renderSource);
+    m_renderShader = ProgramCache::createProgram(m_programCache, renderSource);
 
     // Generate a dummy vertex array.
     glGenVertexArrays(1, &m_vao);
@@ -80,8 +81,8 @@ DiffractionStarburstAlgorithm::~DiffractionStarburstAlgorithm()
     glDeleteVertexArrays(1, &m_vao);
 
     // Release the shaders
-    glDeleteProgram(m_generateShader);
-    glDeleteProgram(m_renderShader);
+    ProgramCache::releaseProgram(m_programCache, m_generateShader);
+    ProgramCache::releaseProgram(m_programCache, m_renderShader);
 
     // Release the generated texture, if any.
     if (m_texture != 0 && m_external == false)
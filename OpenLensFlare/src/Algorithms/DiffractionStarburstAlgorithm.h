@@ -3,6 +3,7 @@
 #include "../OpticalSystem.h"
 #include "../LightSource.h"
 #include "../StarburstAlgorithm.h"
+#include "ProgramCache.h"
 
 namespace OLEF
 {
@@ -13,7 +14,9 @@ class DiffractionStarburstAlgorithm: public StarburstAlgorithm
 {
 public:
     /// Constructs an algorithms by using the parameter texture as the sprite.
-    DiffractionStarburstAlgorithm(OpticalSystem* system);
+    /// If a program cache is provided, the shader programs are taken from it;
+    /// the cache must outlive this object.
+    DiffractionStarburstAlgorithm(OpticalSystem* system, ProgramCache* programCache = nullptr);
     
     /// These objects are not copyable.
     DiffractionStarburstAlgorithm(const DiffractionStarburstAlgorithm& other) = delete;
@@ -52,6 +55,9 @@ public:
     /// Returns a pointer to the optical system.
     OpticalSystem* getOpticalSystem() const { return m_opticalSystem; }
 
+    /// Returns the program cache the shaders are taken from, if any.
+    ProgramCache* getProgramCache() const { return m_programCache; }
+
     /// Returns a handle to the generated texture, that is used for rendering.
     GLuint getTexture() const { return m_texture; }
     
@@ -78,6 +84,9 @@ private:
     /// Pointer to the optical system.
     OpticalSystem* m_opticalSystem;
 
+    /// The program cache the shaders are taken from, or nullptr.
+    ProgramCache* m_programCache;
+
     /// Size of the starburst. Note that this is scaled by the F-number of the
     /// optical system.
     float m_size;
@@ -6,180 +6,266 @@ namespace OLEF
 {
 namespace GLHelpers
 {
-    /// Helper functions to overload a named uniform.
-    inline void uploadUniform(GLuint program, const char* name, GLfloat val)
+    /// Helper functions to upload a uniform to the parameter location of the
+    /// currently bound program.
+    inline void uploadUniform(GLint loc, GLfloat val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform1f(loc, val);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::vec2& val)
+    inline void uploadUniform(GLint loc, const glm::vec2& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform2f(loc, val.x, val.y);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::vec3& val)
+    inline void uploadUniform(GLint loc, const glm::vec3& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform3f(loc, val.x, val.y, val.z);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::vec4& val)
+    inline void uploadUniform(GLint loc, const glm::vec4& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform4f(loc, val.x, val.y, val.z, val.w);
     }
     
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<GLfloat>& val)
+    inline void uploadUniform(GLint loc, const std::vector<GLfloat>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform1fv(loc, (GLsizei) val.size(), val.data());
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<glm::vec2>& val)
+    inline void uploadUniform(GLint loc, const std::vector<glm::vec2>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform2fv(loc, (GLsizei) val.size(), (GLfloat*) val.data());
+        glUniform2fv(loc, (GLsizei) val.size(), (const GLfloat*) val.data());
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<glm::vec3>& val)
+    inline void uploadUniform(GLint loc, const std::vector<glm::vec3>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform3fv(loc, (GLsizei) val.size(), (GLfloat*) val.data());
+        glUniform3fv(loc, (GLsizei) val.size(), (const GLfloat*) val.data());
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<glm::vec4>& val)
+    inline void uploadUniform(GLint loc, const std::vector<glm::vec4>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform4fv(loc, (GLsizei) val.size(), (GLfloat*) val.data());
+        glUniform4fv(loc, (GLsizei) val.size(), (const GLfloat*) val.data());
     }
     
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, GLfloat (&val)[N])
+    inline void uploadUniform(GLint loc, const GLfloat (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform1fv(loc, N, (GLfloat*) val);
+        glUniform1fv(loc, N, (const GLfloat*) val);
     }
 
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, glm::vec2 (&val)[N])
+    inline void uploadUniform(GLint loc, const glm::vec2 (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform2fv(loc, N, (GLfloat*) val);
+        glUniform2fv(loc, N, (const GLfloat*) val);
     }
 
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, glm::vec3 (&val)[N])
+    inline void uploadUniform(GLint loc, const glm::vec3 (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform3fv(loc, N, (GLfloat*) val);
+        glUniform3fv(loc, N, (const GLfloat*) val);
     }
 
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, glm::vec4 (&val)[N])
+    inline void uploadUniform(GLint loc, const glm::vec4 (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform4fv(loc, N, (GLfloat*) val);
+        glUniform4fv(loc, N, (const GLfloat*) val);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, GLint val)
+    inline void uploadUniform(GLint loc, GLint val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform1i(loc, val);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::ivec2& val)
+    inline void uploadUniform(GLint loc, const glm::ivec2& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform2i(loc, val.x, val.y);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::ivec3& val)
+    inline void uploadUniform(GLint loc, const glm::ivec3& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform3i(loc, val.x, val.y, val.z);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::ivec4& val)
+    inline void uploadUniform(GLint loc, const glm::ivec4& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform4i(loc, val.x, val.y, val.z, val.w);
     }
     
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<GLint>& val)
+    inline void uploadUniform(GLint loc, const std::vector<GLint>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniform1iv(loc, (GLsizei) val.size(), val.data());
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<glm::ivec2>& val)
+    inline void uploadUniform(GLint loc, const std::vector<glm::ivec2>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform2iv(loc, (GLsizei) val.size(), (GLint*) val.data());
+        glUniform2iv(loc, (GLsizei) val.size(), (const GLint*) val.data());
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<glm::ivec3>& val)
+    inline void uploadUniform(GLint loc, const std::vector<glm::ivec3>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform3iv(loc, (GLsizei) val.size(), (GLint*) val.data());
+        glUniform3iv(loc, (GLsizei) val.size(), (const GLint*) val.data());
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const std::vector<glm::ivec4>& val)
+    inline void uploadUniform(GLint loc, const std::vector<glm::ivec4>& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform4iv(loc, (GLsizei) val.size(), (GLint*) val.data());
+        glUniform4iv(loc, (GLsizei) val.size(), (const GLint*) val.data());
     }
     
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, GLint (&val)[N])
+    inline void uploadUniform(GLint loc, const GLint (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform1iv(loc, N, (GLint*) val);
+        glUniform1iv(loc, N, (const GLint*) val);
     }
 
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, glm::ivec2 (&val)[N])
+    inline void uploadUniform(GLint loc, const glm::ivec2 (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform2iv(loc, N, (GLint*) val);
+        glUniform2iv(loc, N, (const GLint*) val);
     }
 
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, glm::ivec3 (&val)[N])
+    inline void uploadUniform(GLint loc, const glm::ivec3 (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform3iv(loc, N, (GLint*) val);
+        glUniform3iv(loc, N, (const GLint*) val);
     }
 
     template<size_t N>
-    inline void uploadUniform(GLuint program, const char* name, glm::ivec4 (&val)[N])
+    inline void uploadUniform(GLint loc, const glm::ivec4 (&val)[N])
     {
-        GLuint loc = glGetUniformLocation(program, name);
-        glUniform4iv(loc, N, (GLint*) val);
+        glUniform4iv(loc, N, (const GLint*) val);
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::mat2& val)
+    inline void uploadUniform(GLint loc, const glm::mat2& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniformMatrix2fv(loc, 1, GL_FALSE, glm::value_ptr(val));
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::mat3& val)
+    inline void uploadUniform(GLint loc, const glm::mat3& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(val));
     }
 
-    inline void uploadUniform(GLuint program, const char* name, const glm::mat4& val)
+    inline void uploadUniform(GLint loc, const glm::mat4& val)
     {
-        GLuint loc = glGetUniformLocation(program, name);
         glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(val));
     }
 
+    /// Helper function to upload a named uniform of the currently bound
+    /// program, looking up its location first.
+    template<typename T>
+    inline void uploadUniform(GLuint program, const char* name, const T& val)
+    {
+        uploadUniform(glGetUniformLocation(program, name), val);
+    }
+
+    /// Resolves the uniform locations and uniform block indices of a linked
+    /// program once, so that they don't have to be looked up by name on
+    /// every upload.
+    class ProgramReflection
+    {
+    public:
+        /// Constructs an empty reflection object.
+        ProgramReflection():
+            m_program(0)
+        {}
+
+        /// Enumerates the active uniforms and uniform blocks of the parameter
+        /// program.
+        explicit ProgramReflection(GLuint program):
+            m_program(program)
+        {
+            static GLchar s_nameBuffer[256];
+
+            // Default block uniforms; array uniforms are also registered
+            // without their '[0]' suffix
+            GLint numUniforms = 0;
+            glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+            for (GLint i = 0; i < numUniforms; ++i)
+            {
+                GLint size;
+                GLenum type;
+                glGetActiveUniform(program, (GLuint) i, sizeof(s_nameBuffer), 
+                    nullptr, &size, &type, s_nameBuffer);
+
+                GLint location = glGetUniformLocation(program, s_nameBuffer);
+                if (location == -1)
+                    continue;
+
+                std::string name = s_nameBuffer;
+                m_uniforms[name] = location;
+                if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+                {
+                    m_uniforms[name.substr(0, name.size() - 3)] = location;
+                }
+            }
+
+            // Uniform blocks
+            GLint numBlocks = 0;
+            glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+            for (GLint i = 0; i < numBlocks; ++i)
+            {
+                glGetActiveUniformBlockName(program, (GLuint) i, sizeof(s_nameBuffer), 
+                    nullptr, s_nameBuffer);
+                m_uniformBlocks[s_nameBuffer] = (GLuint) i;
+            }
+        }
+
+        /// Returns the reflected program.
+        GLuint getProgram() const { return m_program; }
+
+        /// Returns the location of the parameter uniform, or -1 if the program
+        /// has no such active uniform.
+        GLint getUniformLocation(const std::string& name) const
+        {
+            auto it = m_uniforms.find(name);
+            return it != m_uniforms.end() ? it->second : -1;
+        }
+
+        /// Returns the index of the parameter uniform block, or
+        /// GL_INVALID_INDEX if the program has no such active block.
+        GLuint getUniformBlockIndex(const std::string& name) const
+        {
+            auto it = m_uniformBlocks.find(name);
+            return it != m_uniformBlocks.end() ? it->second : GL_INVALID_INDEX;
+        }
+
+        /// Assigns the parameter binding point to the parameter uniform block,
+        /// if the program uses it.
+        void bindUniformBlock(const std::string& name, GLuint binding) const
+        {
+            GLuint blockIndex = getUniformBlockIndex(name);
+            if (blockIndex != GL_INVALID_INDEX)
+            {
+                glUniformBlockBinding(m_program, blockIndex, binding);
+            }
+        }
+
+    private:
+        /// The reflected program.
+        GLuint m_program;
+
+        /// Locations of the active uniforms.
+        std::map<std::string, GLint> m_uniforms;
+
+        /// Indices of the active uniform blocks.
+        std::map<std::string, GLuint> m_uniformBlocks;
+    };
+
+    /// Helper function to upload a named uniform of the currently bound
+    /// program, using the pre-resolved location of the uniform.
+    template<typename T>
+    inline void uploadUniform(const ProgramReflection& program, const char* name, const T& val)
+    {
+        uploadUniform(program.getUniformLocation(name), val);
+    }
+
     /// Structure holding the shader parameters
     struct ShaderSource
     {
+        /// The version directive to prepend to each stage.
+        const char* m_version = "#version 330\n";
+
         /// The source code for the shader stages.
         std::map<GLenum, std::vector<const char*>> m_source;
         
@@ -190,8 +276,9 @@ namespace GLHelpers
         std::vector<const char*> m_varyings;
     };
 
-    /// Creates a shader from the provided shader source.
-    inline GLuint createShader(const ShaderSource& source)
+    /// Creates a shader from the provided shader source. If retrievable is
+    /// set, the binary of the linked program can be queried afterwards.
+    inline GLuint createShader(const ShaderSource& source, bool retrievable = false)
     {
         // Buffer for getting the error text.
         static GLchar s_errorBuffer[4098];
@@ -205,7 +292,7 @@ namespace GLHelpers
             std::vector<const char*> src;
             src.reserve(1 + shaderSource.second.size() + source.m_defines.size() * 2);
 
-            src.push_back("#version 330\n");
+            src.push_back(source.m_version);
             for (auto define: source.m_defines)
             {
                 src.push_back(define);
@@ -251,6 +338,12 @@ namespace GLHelpers
                 source.m_varyings.data(), GL_INTERLEAVED_ATTRIBS);
         }
 
+        // Ask the driver to keep the program binary around
+        if (retrievable)
+        {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+
         // Link the program.
         glLinkProgram(program);
 
@@ -0,0 +1,619 @@
+#pragma once
+
+#include "../Dependencies.h"
+#include "../OpticalSystem.h"
+#include "../Ghost.h"
+#include "RayTraceGhostAlgorithm.h"
+
+namespace OLEF
+{
+namespace GhostAttribHelpers
+{
+    /// Per-vertex data produced by the ghost tracers.
+    using PerVertexData = RayTraceGhostAlgorithm::PerVertexData;
+
+    /// Parameters controlling the attribute computations.
+    using GhostAttribComputeParams = RayTraceGhostAlgorithm::GhostAttribComputeParams;
+
+    /// Statistics gathered during the attribute computations.
+    using GhostAttribComputeStats = RayTraceGhostAlgorithm::GhostAttribComputeStats;
+
+    /// Describes how the traced vertices of the individual ghosts are laid out
+    /// in a single, shared vertex buffer.
+    struct VertexLayout
+    {
+        /// Per-ghost vertex offset and per-channel vertex count.
+        std::vector<std::array<int, 2>> m_vertexOffsets;
+
+        /// Total number of vertices in the buffer.
+        int m_totalVertices = 0;
+    };
+
+    /// Returns the number of vertices (unique rays) generated for a ray grid
+    /// of the parameter size. The vertices are stored in row-major order.
+    inline int gridVertexCount(int numRays)
+    {
+        return numRays * numRays;
+    }
+
+    /// Returns the number of indices needed to triangulate a ray grid of the
+    /// parameter size.
+    inline int gridIndexCount(int numRays)
+    {
+        return (numRays - 1) * (numRays - 1) * 6;
+    }
+
+    /// Generates the triangle indices of a ray grid of the parameter size.
+    /// Each grid cell is split into two triangles.
+    inline std::vector<GLuint> computeGridIndices(int numRays)
+    {
+        // Quad corner offsets of the two triangles making up a grid cell
+        static const glm::ivec2 QUAD_IDS[6] =
+        {
+            glm::ivec2(0, 0),
+            glm::ivec2(1, 0),
+            glm::ivec2(1, 1),
+
+            glm::ivec2(1, 1),
+            glm::ivec2(0, 1),
+            glm::ivec2(0, 0)
+        };
+
+        std::vector<GLuint> result;
+        result.reserve(gridIndexCount(numRays));
+
+        for (int row = 0; row < numRays - 1; ++row)
+        {
+            for (int col = 0; col < numRays - 1; ++col)
+            {
+                for (int vert = 0; vert < 6; ++vert)
+                {
+                    glm::ivec2 corner = glm::ivec2(col, row) + QUAD_IDS[vert];
+                    result.push_back((GLuint) (corner.y * numRays + corner.x));
+                }
+            }
+        }
+
+        return result;
+    }
+
+    /// Returns the largest ray grid size used during the computations.
+    inline int maxRayCount(const GhostAttribComputeParams& params)
+    {
+        int maxRaysBounds = *std::max_element(
+            params.m_boundingRays.begin(), params.m_boundingRays.end());
+        int maxRaysPresets = *std::max_element(
+            params.m_rayPresets.begin(), params.m_rayPresets.end());
+
+        return std::max(maxRaysBounds, maxRaysPresets);
+    }
+
+    /// Computes the per-ghost vertex offsets into the shared vertex buffer.
+    inline VertexLayout computeVertexLayout(const OpticalSystem& system,
+        const GhostList& ghosts, const GhostAttribComputeParams& params)
+    {
+        VertexLayout result;
+        result.m_vertexOffsets.resize(ghosts.size(), { 0, 0 });
+
+        // Per-channel vertices needed
+        int vertices = gridVertexCount(maxRayCount(params));
+
+        for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+        {
+            // Skip invalid ghosts
+            if (!system.isValidGhost(ghosts[ghostId]))
+            {
+                continue;
+            }
+
+            // Per-channel offsets and sizes
+            result.m_vertexOffsets[ghostId] = { result.m_totalVertices, vertices };
+
+            // Total number of vertices needed
+            result.m_totalVertices += vertices * (int) params.m_lambdas.size();
+        }
+
+        return result;
+    }
+
+    /// Tests whether a traced vertex passes the clipping criteria.
+    inline bool isValidVertex(const PerVertexData& vertex, const GhostAttribComputeParams& params)
+    {
+        return
+            vertex.m_radius <= params.m_radiusClip &&
+            vertex.m_intensity >= params.m_intensityClip &&
+            vertex.m_irisDistance <= params.m_distanceClip;
+    }
+
+    /// Adds the rays traced by a single pass to the parameter statistics.
+    inline void updateComputeStats(GhostAttribComputeStats* stats,
+        const std::vector<bool>& active, int numRays, const GhostAttribComputeParams& params)
+    {
+        if (stats == nullptr)
+            return;
+
+        long long numChannels = (long long) std::count(active.begin(), active.end(), true) *
+            (long long) params.m_lambdas.size();
+
+        stats->m_raysTraced += numChannels * gridVertexCount(numRays);
+        stats->m_raysTracedWithoutReuse += numChannels * gridIndexCount(numRays);
+    }
+
+    /// The kinds of reductions performed on the traced ray grid of a channel.
+    enum class ReductionType
+    {
+        /// Bounding rectangles of the triangles with at least one valid vertex.
+        BOUNDS,
+
+        /// Area and intensity statistics of the valid triangles.
+        AREAS,
+    };
+
+    /// The reduced values of a single ghost channel. The same layout is used
+    /// by the GPU reduction shader, so it must only contain floats.
+    struct ChannelReduction
+    {
+        /// Pupil bounds, in min-max corner format.
+        glm::vec2 m_pupilMin;
+        glm::vec2 m_pupilMax;
+
+        /// Sensor bounds, in min-max corner format.
+        glm::vec2 m_sensorMin;
+        glm::vec2 m_sensorMax;
+
+        /// Total area of the fully valid projected triangles.
+        float m_areaSum;
+
+        /// Number of fully valid triangles.
+        float m_areaCount;
+
+        /// Sum of the squared differences between the triangle areas and
+        /// their average.
+        float m_areaVarianceSum;
+
+        /// Total intensity of the valid triangle vertices.
+        float m_intensitySum;
+
+        /// Number of valid triangle vertices.
+        float m_intensityCount;
+
+        /// Padding, to keep the size at a multiple of 16 bytes.
+        float m_padding[3];
+    };
+
+    static_assert(sizeof(ChannelReduction) == 16 * sizeof(float),
+        "The channel reduction layout must match the reduction shader.");
+
+    /// Returns a reduction object with its initial values.
+    inline ChannelReduction emptyReduction()
+    {
+        ChannelReduction result;
+
+        result.m_pupilMin = result.m_sensorMin = glm::vec2(1.0f);
+        result.m_pupilMax = result.m_sensorMax = glm::vec2(-1.0f);
+        result.m_areaSum = result.m_areaCount = result.m_areaVarianceSum = 0.0f;
+        result.m_intensitySum = result.m_intensityCount = 0.0f;
+        result.m_padding[0] = result.m_padding[1] = result.m_padding[2] = 0.0f;
+
+        return result;
+    }
+
+    /// Computes the bounds of a single channel's ray grid.
+    inline void reduceBounds(const PerVertexData* vertices, const std::vector<GLuint>& indices,
+        const GhostAttribComputeParams& params, ChannelReduction& out)
+    {
+        // Process each triangle
+        for (size_t baseIndex = 0; baseIndex < indices.size(); baseIndex += 3)
+        {
+            // Keep the full triangle if any of its vertices are 'valid'
+            bool keep = false;
+            for (int vertexId = 0; vertexId < 3; ++vertexId)
+            {
+                keep = keep || isValidVertex(vertices[indices[baseIndex + vertexId]], params);
+            }
+
+            // Skip the full triangle if all of its vertices are invalid
+            if (!keep)
+                continue;
+
+            // Update the bounds using all 3 vertices
+            for (int vertexId = 0; vertexId < 3; ++vertexId)
+            {
+                const auto& vertex = vertices[indices[baseIndex + vertexId]];
+
+                out.m_pupilMin = glm::min(out.m_pupilMin, vertex.m_parameter);
+                out.m_pupilMax = glm::max(out.m_pupilMax, vertex.m_parameter);
+
+                out.m_sensorMin = glm::min(out.m_sensorMin, vertex.m_position);
+                out.m_sensorMax = glm::max(out.m_sensorMax, vertex.m_position);
+            }
+        }
+    }
+
+    /// Returns the area of a projected triangle.
+    inline float triangleArea(glm::vec2 a, glm::vec2 b, glm::vec2 c)
+    {
+        return 0.5f * glm::abs(a.x * (b.y - c.y) + b.x * (c.y - a.y) + c.x * (a.y - b.y));
+    }
+
+    /// Computes the area and intensity statistics of a single channel's ray grid.
+    inline void reduceAreas(const PerVertexData* vertices, const std::vector<GLuint>& indices,
+        const GhostAttribComputeParams& params, std::vector<float>& triangleAreas,
+        ChannelReduction& out)
+    {
+        // Clear the temporary buffer holding triangle information
+        triangleAreas.clear();
+
+        // Process each vertex of each triangle; shared vertices are counted
+        // once per triangle
+        for (GLuint index: indices)
+        {
+            const auto& vertex = vertices[index];
+
+            if (isValidVertex(vertex, params))
+            {
+                out.m_intensitySum += vertex.m_intensity;
+                out.m_intensityCount += 1.0f;
+            }
+        }
+
+        // Process each triangle
+        for (size_t baseIndex = 0; baseIndex < indices.size(); baseIndex += 3)
+        {
+            // Only keep those triangles that are fully valid (a.k.a. all of its
+            // vertices are valid) - this should minimize the effect of
+            // degenerate values on the output
+            bool keep = true;
+            for (int vertexId = 0; vertexId < 3; ++vertexId)
+            {
+                keep = keep && isValidVertex(vertices[indices[baseIndex + vertexId]], params);
+            }
+
+            // Skip a degenerate triangle
+            if (!keep)
+            {
+                continue;
+            }
+
+            // Compute and store the area of the projected triangle
+            triangleAreas.push_back(triangleArea(
+                vertices[indices[baseIndex + 0]].m_position,
+                vertices[indices[baseIndex + 1]].m_position,
+                vertices[indices[baseIndex + 2]].m_position));
+        }
+
+        // Compute the avg area
+        float totalArea = std::accumulate(triangleAreas.begin(), triangleAreas.end(), 0.0f);
+        float avgArea = totalArea / triangleAreas.size();
+
+        // Compute the sum of the squared differences
+        float totalVariance = 0.0f;
+        for (float area: triangleAreas)
+        {
+            totalVariance += glm::pow(area - avgArea, 2.0f);
+        }
+
+        out.m_areaSum = totalArea;
+        out.m_areaCount = (float) triangleAreas.size();
+        out.m_areaVarianceSum = totalVariance;
+    }
+
+    /// Replaces the pupil bounds of the parameter ghost with a seed for the
+    /// bounding passes: its current bounds, dilated by the parameter amount
+    /// and clamped to the pupil. Ghosts without visible bounds are seeded
+    /// with the full pupil instead. Returns whether the ghost was seeded with
+    /// a region smaller than the full pupil.
+    inline bool seedPupilBounds(Ghost& ghost, float dilation)
+    {
+        Ghost::BoundingRect bounds = ghost.getPupilBounds();
+        if (bounds[1][0] < 0.0f || bounds[1][1] < 0.0f)
+        {
+            ghost.setPupilBounds({ glm::vec2(-1.0f), glm::vec2(2.0f) });
+            return false;
+        }
+
+        glm::vec2 minCorner = glm::max(bounds[0] - dilation, glm::vec2(-1.0f));
+        glm::vec2 maxCorner = glm::min(bounds[0] + bounds[1] + dilation, glm::vec2(1.0f));
+        ghost.setPupilBounds({ minCorner, maxCorner - minCorner });
+
+        return minCorner.x > -1.0f || minCorner.y > -1.0f ||
+            maxCorner.x < 1.0f || maxCorner.y < 1.0f;
+    }
+
+    /// Determines whether the bounds computed from a seed (in min-max corner
+    /// format) reach any of the seed's edges that lie inside the pupil, within
+    /// half a ray grid cell.
+    inline bool reachesSeedEdge(const Ghost::BoundingRect& seed,
+        const Ghost::BoundingRect& bounds, int numRays)
+    {
+        glm::vec2 seedMin = seed[0];
+        glm::vec2 seedMax = seed[0] + seed[1];
+        glm::vec2 halfCell = seed[1] / float(glm::max(numRays - 1, 1)) * 0.5f;
+
+        for (int i = 0; i < 2; ++i)
+        {
+            if (seedMin[i] > -1.0f && bounds[0][i] <= seedMin[i] + halfCell[i])
+                return true;
+            if (seedMax[i] < 1.0f && bounds[1][i] >= seedMax[i] - halfCell[i])
+                return true;
+        }
+        return false;
+    }
+
+    /// Computes the ghost attributes using the parameter reduction function.
+    ///
+    /// With warm starting enabled, the pupil bounds of the input ghosts are
+    /// used as dilated seeds for the bounding passes, falling back to the
+    /// full pupil if a ghost turns out to reach the edge of its seed. With a
+    /// positive bounds epsilon, ghosts whose pupil bounds change less than
+    /// that between two passes skip the remaining bounding passes.
+    ///
+    /// The reduce function is invoked once per pass, with the signature of
+    /// reduce(ghosts, active, numRays, type, reductions). It must trace each
+    /// channel of each active ghost with a grid of numRays x numRays rays,
+    /// and store the reduction of the requested type for channel c of ghost
+    /// g in reductions[g * numChannels + c], which are initialized to
+    /// emptyReduction().
+    template<typename FnReduce>
+    GhostList computeGhostAttributesReduced(const OpticalSystem& system,
+        const GhostList& ghosts, const GhostAttribComputeParams& params,
+        FnReduce reduce, GhostAttribComputeStats* stats = nullptr)
+    {
+        // Make a local copy of the original ghost list that we are going to modify
+        auto result = ghosts;
+
+        // Which ghosts take part in the current pass
+        std::vector<bool> active(ghosts.size());
+
+        // Number of channels per ghost
+        size_t numChannels = params.m_lambdas.size();
+
+        // Per-channel reduction results
+        std::vector<ChannelReduction> reductions(ghosts.size() * numChannels);
+
+        // Whether the bounds of a ghost are seeded, whether they had to be
+        // reset to the full pupil, and whether they stopped changing between
+        // the bounding passes
+        std::vector<bool> seeded(ghosts.size(), false);
+        std::vector<bool> restarted(ghosts.size(), false);
+        std::vector<bool> converged(ghosts.size(), false);
+
+        // Seed the pupil bounds with the dilated input bounds
+        if (params.m_warmStart)
+        {
+            for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+            {
+                seeded[ghostId] = seedPupilBounds(result[ghostId], params.m_seedDilation);
+            }
+        }
+
+        // Compute ghost bounding information; an extra pass is appended for
+        // the ghosts reset in the last pass
+        size_t numPasses = params.m_boundingRays.size();
+        for (size_t passId = 0; passId < numPasses; ++passId)
+        {
+            // Extract the current grid size
+            bool extraPass = passId >= params.m_boundingRays.size();
+            int numRays = params.m_boundingRays[extraPass ? params.m_boundingRays.size() - 1 : passId];
+
+            // Skip invalid, previously detected invisible, and converged ghosts
+            for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+            {
+                active[ghostId] = system.isValidGhost(result[ghostId]) &&
+                    result[ghostId].getPupilBounds()[1][0] >= 0.0f &&
+                    (!extraPass || restarted[ghostId]);
+
+                if (active[ghostId] && converged[ghostId])
+                {
+                    active[ghostId] = false;
+                    if (stats != nullptr)
+                        ++stats->m_skippedBoundingPasses;
+                }
+            }
+            updateComputeStats(stats, active, numRays, params);
+
+            // Trace the ghosts and reduce the generated ray data to the bounds
+            std::fill(reductions.begin(), reductions.end(), emptyReduction());
+            reduce(result, active, numRays, ReductionType::BOUNDS, reductions);
+
+            for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+            {
+                if (!active[ghostId])
+                {
+                    continue;
+                }
+
+                // Output bounding information - note that this is temporarily
+                // stored in a min-max corner format, instead of corner-size,
+                // to help with the computations
+                Ghost::BoundingRect pupilBounds = { glm::vec2(1.0f), glm::vec2(-1.0f) };
+                Ghost::BoundingRect sensorBounds = { glm::vec2(1.0f), glm::vec2(-1.0f) };
+
+                // Merge the bounds of each channel
+                for (size_t channelId = 0; channelId < numChannels; ++channelId)
+                {
+                    const auto& reduction = reductions[ghostId * numChannels + channelId];
+
+                    pupilBounds[0] = glm::min(pupilBounds[0], reduction.m_pupilMin);
+                    pupilBounds[1] = glm::max(pupilBounds[1], reduction.m_pupilMax);
+
+                    sensorBounds[0] = glm::min(sensorBounds[0], reduction.m_sensorMin);
+                    sensorBounds[1] = glm::max(sensorBounds[1], reduction.m_sensorMax);
+                }
+
+                // Fall back to the full pupil if the ghost reaches the edge
+                // of its seed, since it might extend beyond it
+                if (seeded[ghostId])
+                {
+                    seeded[ghostId] = false;
+                    if (reachesSeedEdge(result[ghostId].getPupilBounds(), pupilBounds, numRays))
+                    {
+                        result[ghostId].setPupilBounds({ glm::vec2(-1.0f), glm::vec2(2.0f) });
+                        restarted[ghostId] = true;
+                        if (passId + 1 == numPasses)
+                            ++numPasses;
+                        if (stats != nullptr)
+                            ++stats->m_warmStartRestarts;
+                        continue;
+                    }
+                }
+
+                // Make sure the ghost is visible
+                if (pupilBounds[1][0] < pupilBounds[0][0] ||
+                    (pupilBounds[0][0] > 1.0f && pupilBounds[0][1] > 1.0f) ||
+                    (pupilBounds[1][0] < -1.0f && pupilBounds[1][1] < -1.0f))
+                {
+                    pupilBounds[0] = pupilBounds[1] = glm::vec2(-1.0f);
+                    sensorBounds[0] = sensorBounds[1] = glm::vec2(-1.0f);
+                }
+
+                // Convert the bounds to the corner-size format
+                else
+                {
+                    pupilBounds[1] = pupilBounds[1] - pupilBounds[0];
+                    sensorBounds[1] = sensorBounds[1] - sensorBounds[0];
+                }
+
+                // Stop refining the ghost once its bounds settle
+                if (params.m_boundsEpsilon > 0.0f)
+                {
+                    Ghost::BoundingRect previous = result[ghostId].getPupilBounds();
+                    glm::vec2 change = glm::max(
+                        glm::abs(pupilBounds[0] - previous[0]),
+                        glm::abs(pupilBounds[1] - previous[1]));
+
+                    converged[ghostId] = glm::max(change.x, change.y) < params.m_boundsEpsilon;
+                }
+
+                // Store the computed bounds
+                result[ghostId].setPupilBounds(pupilBounds);
+                result[ghostId].setSensorBounds(sensorBounds);
+            }
+        }
+
+        // Set the ray grid sizes to 0 for each ghost, to indicate that it needs
+        // to be processed
+        for (auto& ghost: result)
+        {
+            ghost.setMinimumRays(0);
+            ghost.setOptimalRays(0);
+        }
+
+        // Compute bounding geometry
+        for (int passId = 0; passId < params.m_rayPresets.size(); ++passId)
+        {
+            // Extract the current grid size
+            int numRays = params.m_rayPresets[passId];
+
+            // Skip invalid, invisible, and already finished ghosts
+            for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+            {
+                active[ghostId] = system.isValidGhost(result[ghostId]) &&
+                    result[ghostId].getPupilBounds()[1][0] >= 0.0f &&
+                    result[ghostId].getMinimumRays() == 0;
+            }
+            updateComputeStats(stats, active, numRays, params);
+
+            // Trace the ghosts and reduce the generated ray data to the
+            // triangle area statistics
+            std::fill(reductions.begin(), reductions.end(), emptyReduction());
+            reduce(result, active, numRays, ReductionType::AREAS, reductions);
+
+            for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+            {
+                if (!active[ghostId])
+                {
+                    continue;
+                }
+
+                // Accumulate the per-channel values
+                float totalVariance = 0.0f;
+                int numVariances = 0;
+                float totalIntensity = 0.0f;
+                float validVertices = 0.0f;
+
+                for (size_t channelId = 0; channelId < numChannels; ++channelId)
+                {
+                    const auto& reduction = reductions[ghostId * numChannels + channelId];
+
+                    totalIntensity += reduction.m_intensitySum;
+                    validVertices += reduction.m_intensityCount;
+
+                    // Skip the variance if the channel is fully invisible
+                    if (reduction.m_areaCount == 0.0f)
+                        continue;
+
+                    totalVariance += glm::sqrt(reduction.m_areaVarianceSum / reduction.m_areaCount);
+                    ++numVariances;
+                }
+
+                // Compute the average variance
+                float avgVariance = totalVariance / numVariances;
+
+                // Store the grid size as the result if the variance is small enough
+                if (avgVariance <= params.m_targetVariance ||
+                    numRays == params.m_rayPresets.back())
+                {
+                    result[ghostId].setMinimumRays(numRays);
+                    result[ghostId].setOptimalRays(numRays);
+                    result[ghostId].setAverageIntensity(totalIntensity / validVertices);
+                }
+            }
+        }
+
+        // Return the refreshed ghost list
+        return result;
+    }
+
+    /// Computes the ghost attributes using the parameter tracing function,
+    /// performing the reductions on the CPU.
+    ///
+    /// The trace function is invoked once per pass, with the signature of
+    /// trace(ghosts, active, numRays, analyse). It must trace each channel of
+    /// each active ghost with a grid of numRays x numRays rays, and invoke
+    /// analyse(ghostId, vertices, channelStride) once the rays of a ghost are
+    /// available, where vertices points to the first vertex of the ghost's
+    /// first channel, and channelStride is the distance between the first
+    /// vertices of neighbouring channels. Ghosts can be analysed in any order,
+    /// which allows tracing the remaining ghosts in the meantime. The traced
+    /// rays are shared by the neighbouring grid triangles, as described by
+    /// computeGridIndices.
+    template<typename FnTrace>
+    GhostList computeGhostAttributes(const OpticalSystem& system,
+        const GhostList& ghosts, const GhostAttribComputeParams& params,
+        FnTrace trace, GhostAttribComputeStats* stats = nullptr)
+    {
+        // Temporary storage for the triangle areas
+        std::vector<float> triangleAreas;
+
+        // Number of channels per ghost
+        size_t numChannels = params.m_lambdas.size();
+
+        return computeGhostAttributesReduced(system, ghosts, params,
+            [&](const GhostList& current, const std::vector<bool>& active, int numRays,
+                ReductionType type, std::vector<ChannelReduction>& reductions)
+        {
+            // Triangle indices of the current ray grid
+            std::vector<GLuint> indices = computeGridIndices(numRays);
+
+            // Trace the ghosts and reduce the generated ray data
+            trace(current, active, numRays,
+                [&](size_t ghostId, const PerVertexData* vertices, int channelStride)
+            {
+                for (size_t channelId = 0; channelId < numChannels; ++channelId)
+                {
+                    // Vertices of the channel
+                    const PerVertexData* channelVertices = vertices + channelId * channelStride;
+
+                    auto& reduction = reductions[ghostId * numChannels + channelId];
+
+                    if (type == ReductionType::BOUNDS)
+                        reduceBounds(channelVertices, indices, params, reduction);
+                    else
+                        reduceAreas(channelVertices, indices, params, triangleAreas, reduction);
+                }
+            });
+        }, stats);
+    }
+}
+}
@@ -0,0 +1,195 @@
+#include "GhostScheduler.h"
+
+namespace OLEF
+{
+
+/// Possible quality upgrades of a scheduled ghost.
+enum class GhostUpgrade
+{
+    /// Render it with its optimal channel count.
+    CHANNELS,
+
+    /// Render it with its optimal ray grid.
+    RAYS,
+};
+
+/// A quality upgrade of a scheduled ghost, waiting to be applied.
+struct PendingUpgrade
+{
+    /// Index of the ghost in the schedule.
+    int m_ghost;
+
+    /// The upgrade to apply.
+    GhostUpgrade m_upgrade;
+
+    /// Value gained per unit of extra cost.
+    float m_priority;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+GhostScheduler::GhostScheduler():
+    m_budget(0.0f),
+    m_rayCost(DEFAULT_RAY_COST),
+    m_smoothing(0.25f)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+float GhostScheduler::estimateCost(int rayCount, int channels) const
+{
+    return float(rayCount * rayCount) * float(channels) * m_rayCost;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+float GhostScheduler::estimateValue(const Ghost& ghost)
+{
+    // Fraction of the screen covered by the sensor bounds
+    glm::vec2 size = ghost.getSensorBounds()[1];
+    float area = glm::max(size.x, 0.0f) * glm::max(size.y, 0.0f) / 4.0f;
+
+    return ghost.getAverageIntensity() * area;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<GhostScheduler::ScheduledGhost> GhostScheduler::schedule(
+    const std::vector<const Ghost*>& candidates, int maxChannels)
+{
+    m_stats = Stats();
+    m_stats.m_candidates = (int) candidates.size();
+
+    // Start with the minimum settings of every candidate
+    std::vector<ScheduledGhost> scheduled(candidates.size());
+    std::vector<float> values(candidates.size());
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        scheduled[i].m_ghost = candidates[i];
+        scheduled[i].m_rayCount = candidates[i]->getMinimumRays();
+        scheduled[i].m_channels = glm::min(candidates[i]->getMinimumChannels(), maxChannels);
+        values[i] = estimateValue(*candidates[i]);
+    }
+
+    // Without a budget, everything is rendered as before
+    if (m_budget <= 0.0f)
+    {
+        for (const auto& ghost: scheduled)
+        {
+            m_stats.m_estimatedTime += estimateCost(ghost.m_rayCount, ghost.m_channels);
+        }
+        return scheduled;
+    }
+
+    // Admit the ghosts in decreasing order of value per cost, skipping the
+    // ones that don't fit anymore, since cheaper ones still might
+    std::vector<int> order(candidates.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<float> ratios(candidates.size());
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        float cost = estimateCost(scheduled[i].m_rayCount, scheduled[i].m_channels);
+        ratios[i] = cost > 0.0f ? values[i] / cost : std::numeric_limits<float>::max();
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return ratios[a] > ratios[b]; });
+
+    float spent = 0.0f;
+    std::vector<bool> admitted(candidates.size(), false);
+    for (int i: order)
+    {
+        float cost = estimateCost(scheduled[i].m_rayCount, scheduled[i].m_channels);
+        if (values[i] > 0.0f && spent + cost <= m_budget)
+        {
+            admitted[i] = true;
+            spent += cost;
+        }
+        else
+        {
+            ++m_stats.m_dropped;
+        }
+    }
+
+    // Spend the remaining budget on upgrading the admitted ghosts, again in
+    // decreasing order of value per extra cost
+    std::vector<PendingUpgrade> upgrades;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (!admitted[i])
+            continue;
+
+        const Ghost& ghost = *scheduled[i].m_ghost;
+        int rayCount = scheduled[i].m_rayCount;
+        int channels = scheduled[i].m_channels;
+        float cost = estimateCost(rayCount, channels);
+
+        int optimalChannels = glm::min(ghost.getOptimalChannels(), maxChannels);
+        if (optimalChannels > channels)
+        {
+            float extra = estimateCost(rayCount, optimalChannels) - cost;
+            upgrades.push_back({ (int) i, GhostUpgrade::CHANNELS, values[i] / glm::max(extra, 1e-12f) });
+        }
+
+        if (ghost.getOptimalRays() > rayCount)
+        {
+            float extra = estimateCost(ghost.getOptimalRays(), channels) - cost;
+            upgrades.push_back({ (int) i, GhostUpgrade::RAYS, values[i] / glm::max(extra, 1e-12f) });
+        }
+    }
+    std::stable_sort(upgrades.begin(), upgrades.end(),
+        [](const PendingUpgrade& a, const PendingUpgrade& b) { return a.m_priority > b.m_priority; });
+
+    for (const auto& upgrade: upgrades)
+    {
+        // The extra cost depends on whether the other upgrade of the ghost
+        // was already applied
+        ScheduledGhost& ghost = scheduled[upgrade.m_ghost];
+        ScheduledGhost upgraded = ghost;
+        switch (upgrade.m_upgrade)
+        {
+            case GhostUpgrade::CHANNELS:
+                upgraded.m_channels = glm::min(ghost.m_ghost->getOptimalChannels(), maxChannels);
+                break;
+
+            case GhostUpgrade::RAYS:
+                upgraded.m_rayCount = ghost.m_ghost->getOptimalRays();
+                break;
+        }
+
+        float extra = estimateCost(upgraded.m_rayCount, upgraded.m_channels) -
+            estimateCost(ghost.m_rayCount, ghost.m_channels);
+        if (spent + extra <= m_budget)
+        {
+            ghost = upgraded;
+            spent += extra;
+        }
+    }
+
+    // Collect the admitted ghosts, in their original order
+    std::vector<ScheduledGhost> result;
+    result.reserve(candidates.size() - m_stats.m_dropped);
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (!admitted[i])
+            continue;
+
+        const ScheduledGhost& ghost = scheduled[i];
+        if (ghost.m_rayCount > ghost.m_ghost->getMinimumRays())
+            ++m_stats.m_optimalRays;
+        if (ghost.m_channels > glm::min(ghost.m_ghost->getMinimumChannels(), maxChannels))
+            ++m_stats.m_optimalChannels;
+
+        result.push_back(ghost);
+    }
+    m_stats.m_estimatedTime = spent;
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void GhostScheduler::reportTiming(double rays, double milliseconds)
+{
+    // Nothing was rendered, so there is nothing to learn from
+    if (rays <= 0.0 || milliseconds <= 0.0)
+        return;
+
+    float measured = float(milliseconds / rays);
+    m_rayCost = glm::mix(m_rayCost, measured, m_smoothing);
+}
+
+}
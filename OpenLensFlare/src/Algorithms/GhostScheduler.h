@@ -0,0 +1,117 @@
+#pragma once
+
+#include "../Ghost.h"
+
+namespace OLEF
+{
+
+/// Chooses which ghosts to render, and at what quality, to fit a frame time
+/// budget.
+///
+/// The cost of a ghost is estimated as the number of traced rays times the
+/// number of rendered channels, multiplied by the time a single ray costs.
+/// Its value is its average intensity times its screen area, so bright and
+/// large ghosts are kept over dim and small ones. Each ghost is rendered
+/// either with its minimum or its optimal ray grid and channel count.
+///
+/// The per-ray time starts from an initial guess, and is refined with the
+/// measured render times (see reportTiming), so the schedules adapt to the
+/// actual hardware.
+class GhostScheduler
+{
+public:
+    /// A ghost selected for rendering, with its chosen quality.
+    struct ScheduledGhost
+    {
+        /// The ghost to render.
+        const Ghost* m_ghost;
+
+        /// Size of the ray grid to render with.
+        int m_rayCount;
+
+        /// Number of channels to render.
+        int m_channels;
+    };
+
+    /// Statistics of the last schedule.
+    struct Stats
+    {
+        /// Number of ghosts considered.
+        int m_candidates = 0;
+
+        /// Number of ghosts dropped, because they didn't fit the budget.
+        int m_dropped = 0;
+
+        /// Number of ghosts rendered with their optimal ray grid.
+        int m_optimalRays = 0;
+
+        /// Number of ghosts rendered with their optimal channel count.
+        int m_optimalChannels = 0;
+
+        /// Estimated render time of the scheduled ghosts, in milliseconds.
+        float m_estimatedTime = 0.0f;
+    };
+
+    /// The initial estimate of the time a single ray costs, in milliseconds.
+    static constexpr float DEFAULT_RAY_COST = 1e-6f;
+
+    /// Constructs a scheduler without a budget.
+    GhostScheduler();
+
+    /// Selects the ghosts to render from the parameter candidates, and the
+    /// ray grid and channel count of each, rendering at most maxChannels
+    /// channels. The scheduled ghosts keep the order of the candidates.
+    /// Without a budget, every candidate is scheduled with its minimum ray
+    /// grid and channel count.
+    std::vector<ScheduledGhost> schedule(const std::vector<const Ghost*>& candidates, int maxChannels);
+
+    /// Feeds a measured render time back into the cost model. The rays
+    /// parameter is the total number of rays traced in all the rendered
+    /// channels (the sum of the ray grid vertices times channels).
+    void reportTiming(double rays, double milliseconds);
+
+    /// Returns the estimated cost of rendering a ghost with the parameter
+    /// settings, in milliseconds.
+    float estimateCost(int rayCount, int channels) const;
+
+    /// Returns the value of rendering the parameter ghost.
+    static float estimateValue(const Ghost& ghost);
+
+    /// Returns the frame time budget, in milliseconds.
+    float getBudget() const { return m_budget; }
+
+    /// Returns the estimated time of a single ray, in milliseconds.
+    float getRayCost() const { return m_rayCost; }
+
+    /// Returns the weight of new measurements in the cost model.
+    float getSmoothing() const { return m_smoothing; }
+
+    /// Returns the statistics of the last schedule.
+    const Stats& getStats() const { return m_stats; }
+
+    /// Sets the frame time budget, in milliseconds. Zero disables it.
+    void setBudget(float value) { m_budget = value; }
+
+    /// Sets the estimated time of a single ray, in milliseconds, e.g. to
+    /// restore a cost model measured in an earlier run.
+    void setRayCost(float value) { m_rayCost = value; }
+
+    /// Sets the weight of new measurements in the cost model, between 0
+    /// (ignore the measurements) and 1 (only keep the last one).
+    void setSmoothing(float value) { m_smoothing = value; }
+
+private:
+    /// The frame time budget, in milliseconds.
+    float m_budget;
+
+    /// The estimated time of a single ray, in milliseconds.
+    float m_rayCost;
+
+    /// Weight of new measurements in the cost model.
+    float m_smoothing;
+
+    /// Statistics of the last schedule.
+    Stats m_stats;
+};
+
+}
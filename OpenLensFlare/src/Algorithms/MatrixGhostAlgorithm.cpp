@@ -1,308 +1,355 @@
 #include "MatrixGhostAlgorithm.h"
-#include "GLHelpers.h"
-
-#include "Common_Functions.glsl.h"
-#include "Common_ColorSpace.glsl.h"
-#include "MatrixGhostAlgorithm_RenderGhost_VertexShader.glsl.h"
-#include "MatrixGhostAlgorithm_RenderGhost_FragmentShader.glsl.h"
 
 namespace OLEF
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-MatrixGhostAlgorithm::MatrixGhostAlgorithm(OpticalSystem* system, const GhostList& ghosts):
-    m_opticalSystem(system),
-    m_ghosts(ghosts),
-    m_vao(0)
+/// Transfer matrix of a translation along the optical axis, by dz.
+static glm::mat2 translationMatrix(float dz)
 {
-    // Create the render shader
-    GLHelpers::ShaderSource renderSource;
-    
-    renderSource.m_source =
-    {
-        {
-            GL_VERTEX_SHADER, 
-            {
-                Shaders::Common_Functions,
-                Shaders::Common_ColorSpace,
-                Shaders::MatrixGhostAlgorithm_RenderGhost_VertexShader,
-            }
-        },
-        {
-            GL_FRAGMENT_SHADER, 
-            {
-                Shaders::Common_Functions,
-                Shaders::Common_ColorSpace,
-                Shaders::MatrixGhostAlgorithm_RenderGhost_FragmentShader,
-            }
-        },
-    };
-    m_renderShader = GLHelpers::createShader(renderSource);
+    glm::mat2 result(1.0f);
 
-    // Generate a dummy vertex array.
-    glGenVertexArrays(1, &m_vao);
-}
+    result[1][0] = dz;
 
-MatrixGhostAlgorithm::~MatrixGhostAlgorithm()
-{
-    // Generate a dummy vertex array.
-    glDeleteVertexArrays(1, &m_vao);
-    
-    // Release the shader
-    glDeleteProgram(m_renderShader);
+    return result;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-/*
-glm::mat2 translationMatrix(float dist)
+/// Transfer matrix of a reflection off of an interface.
+static glm::mat2 reflectionMatrix(float radius)
 {
-	glm::mat2 result;
+    glm::mat2 result(1.0f);
 
-	result[1][0] = dist;
+    result[1][1] = -1.0f;
+    if (radius != 0.0f)
+    {
+        result[0][1] = 2.0f / radius;
+    }
 
-	return result;
+    return result;
 }
 
-glm::mat2 reflectionMatrix(float radius)
+/// Transfer matrix of a refraction from a medium with an index of n1 into
+/// one with an index of n2.
+static glm::mat2 refractionMatrix(float n1, float n2, float radius)
 {
-	glm::mat2 result;
+    glm::mat2 result(1.0f);
 
-	if (radius != 0.0f)
-	{
-		result[0][1] = 2.0f / radius;
-	}
+    result[1][1] = n1 / n2;
+    if (radius != 0.0f)
+    {
+        result[0][1] = (n2 - n1) / (n2 * radius);
+    }
 
-	return result;
+    return result;
 }
 
-glm::mat2 refractionMatrix(float n1, float n2, float radius)
-{
-	glm::mat2 result;
-
-	result[1][1] = n1 / n2;
-	if (radius != 0.0f)
-	{
-		result[0][1] = (n1 - n2) / (n2 * radius);
-	}
-
-	return result;
-}
+////////////////////////////////////////////////////////////////////////////////
+MatrixGhostAlgorithm::MatrixGhostAlgorithm(OpticalSystem* system):
+    m_opticalSystem(system)
+{}
 
-float coatingFresnel(float lambda, float coatingLambda, float theta0, float n0, float n1, float n2)
+////////////////////////////////////////////////////////////////////////////////
+bool MatrixGhostAlgorithm::tracePath(const Ghost& ghost, float lambda,
+    std::vector<PathVertex>& path) const
 {
-	// Compute the optimial coating refractive index
-	n1 = glm::max(glm::sqrt(n0 * n2), n1);
+    path.clear();
 
-	// Compute the optimal coating thickness
-	float d = coatingLambda / 4.0f / n1;
-
-	// Apply Snell's law to get the other angles
-	float theta1 = glm::asin(glm::sin(theta0) * n0 / n1);
-	float theta2 = glm::asin(glm::sin(theta0) * n0 / n2);
+    const auto& elements = m_opticalSystem->getElements();
+    int numElements = (int) elements.size();
+    int numIndices = (int) ghost.getLength();
 
-	float cos0 = glm::cos(theta0);
-	float cos1 = glm::cos(theta1);
-	float cos2 = glm::cos(theta2);
+    // Rays start slightly in front of the front element, like in the tracers
+    float dz = -0.1f;
 
-	float beta = (glm::two_pi<float>()) / lambda * n1 * d * cos1;
+    // Current phase of the path and tracing direction
+    int phase = 0;
+    int delta = 1;
 
-	// Compute the Fresnel terms for the first and second interfaces for both
-	// s and p polarized light
-	float r12p = (n1 * cos0 - n0 * cos1) / (n1 * cos0 + n0 * cos1);
-	float r12p2 = r12p * r12p;
+    // Accumulated transfer matrix
+    glm::mat2 matrix(1.0f);
 
-	float r23p = (n2 * cos1 - n1 * cos2) / (n2 * cos1 + n1 * cos2);
-	float r23p2 = r23p * r23p;
+    for (int elementId = 0; elementId >= 0 && elementId < numElements; elementId += delta)
+    {
+        const auto& element = elements[elementId];
+        auto type = element.getType();
+
+        // Transfer the ray to the interface
+        matrix = translationMatrix(dz) * matrix;
+
+        // Refractive indices on the two sides of the interface, in the order
+        // the ray crosses them
+        float nBefore = elementId == 0 ? 1.0f : elements[elementId - 1].computeIndexOfRefraction(lambda);
+        float nAfter = element.computeIndexOfRefraction(lambda);
+
+        PathVertex vertex;
+        vertex.m_matrix = matrix;
+        vertex.m_height = element.getHeight();
+        vertex.m_radius = element.getRadiusOfCurvature();
+        vertex.m_n0 = delta > 0 ? nBefore : nAfter;
+        vertex.m_n2 = delta > 0 ? nAfter : nBefore;
+        vertex.m_elementId = elementId;
+        vertex.m_aperture = type == OpticalSystemElement::ElementType::APERTURE_STOP;
+        vertex.m_reflect = phase < numIndices && elementId == ghost[phase];
+
+        // The aperture and the sensor are flat, and do not bend the rays
+        if (type == OpticalSystemElement::ElementType::APERTURE_STOP)
+        {
+            vertex.m_height = m_opticalSystem->getEffectiveApertureHeight();
+            vertex.m_radius = 0.0f;
+        }
+        else if (type == OpticalSystemElement::ElementType::SENSOR)
+        {
+            vertex.m_height = glm::min(m_opticalSystem->getFilmWidth(), m_opticalSystem->getFilmHeight());
+            vertex.m_radius = 0.0f;
+        }
 
-	float rp = (r12p2 + r23p2 + 2.0f * r12p * r23p * glm::cos(2.0f * beta)) /
-		(1.0f + r12p2 * r23p2 + 2.0f * r12p * r23p * glm::cos(2.0f * beta));
+        path.push_back(vertex);
 
-	float r12s = (n0 * cos0 - n1 * cos1) / (n0 * cos0 + n1 * cos1);
-	float r12s2 = r12s * r12s;
+        // Reflect or refract the ray
+        if (vertex.m_reflect)
+        {
+            matrix = reflectionMatrix(vertex.m_radius) * matrix;
+            delta = -delta;
+            ++phase;
+        }
+        else if (type != OpticalSystemElement::ElementType::APERTURE_STOP &&
+            type != OpticalSystemElement::ElementType::SENSOR)
+        {
+            matrix = refractionMatrix(vertex.m_n0, vertex.m_n2, vertex.m_radius) * matrix;
+        }
 
-	float r23s = (n1 * cos1 - n2 * cos2) / (n1 * cos1 + n2 * cos2);
-	float r23s2 = r23s * r23s;
+        // Stop at the sensor
+        if (type == OpticalSystemElement::ElementType::SENSOR)
+        {
+            return phase == numIndices;
+        }
 
-	float rs = (r12s2 + r23s2 + 2.0f * r12s * r23s * glm::cos(2.0f * beta)) /
-		(1.0f + r12s2 * r23s2 + 2.0f * r12s * r23s * glm::cos(2.0f * beta));
+        // Distance to the next interface along the optical axis, which
+        // points from the sensor towards the front element
+        dz = delta > 0 ? -element.getThickness() :
+            (elementId > 0 ? elements[elementId - 1].getThickness() : 0.0f);
+    }
 
-	return (rs + rp) * 0.5f;
+    return false;
 }
 
-GhostAttributes MatrixGhostAlgorithm::computeGhostAttributes(const GhostList::Ghost& ghost)
+////////////////////////////////////////////////////////////////////////////////
+MatrixGhostAlgorithm::GhostChannel MatrixGhostAlgorithm::computeGhostChannel(
+    const Ghost& ghost, float lambda) const
 {
-	// Resulting matrices
-	GhostAttributes result;
-
-    result.m_intensity = 1.0f;
-    result.m_matrices.resize(m_opticalSystem->getApertureCount())
-
-    // Extract the optical system elements
-    const auto& elements = m_opticalSystem->getElements();
-
-	// Do the computations for each channel
-	for (int ch = 0; ch < m_lambda.size(); ++ch)
-	{
-        // Index of the matrix we are appending to currently.
-        int matrixId = 0;
+    GhostChannel result;
+    result.m_apertureMatrix = glm::mat2(1.0f);
+    result.m_systemMatrix = glm::mat2(1.0f);
+    result.m_reflectance = 1.0f;
 
-        // The direction in which the ray is travelling.
-        int direction = 1;
+    std::vector<PathVertex> path;
+    if (!tracePath(ghost, lambda, path))
+    {
+        result.m_reflectance = 0.0f;
+        return result;
+    }
 
-        // Process each interface
-        for (int id = 0; i < ghost.size(); ++id)
+    // Extract the matrices and the reflectances
+    bool apertureFound = false;
+    for (const auto& vertex: path)
+    {
+        if (vertex.m_aperture && !apertureFound)
         {
-            // Keep on transferring until we reach the interface
-            for (int i = 0; i < ghost[i]; ++i)
-            {
-                glm::mat2 Ri = refractionMatrix(
-                    elements[i - direction].computeIndexOfRefraction(m_lambdas[ch]), 
-                    elements[i].computeIndexOfRefraction(m_lambdasch]), 
-                    elements[i].getRadiusOfCurvature());
-                glm::mat2 Ti = translationMatrix(elements[i].getThickness());
-                result[ch].m_matrices[id] = Ti * Ri * result[ch].m_matrices[id];
-
-                // Increment the matrix id upon reaching an aperture.
-                if (elements[i].getType() == OpticalSystemElement::ElementType::APERTURE_STOP)
-                {
-                    matrixId += direction;
-                }
-            }
+            result.m_apertureMatrix = vertex.m_matrix;
+            apertureFound = true;
+        }
 
-            // Reflect off of the component and transfer back
-            glm::mat2 L = reflectionMatrix(elements[ghost[i]].getRadiusOfCurvature());
-            glm::mat2 T = translationMatrix(elements[ghost[i] - 1].getThickness());
-            result[ch].m_matrices[id] = T * L * result[ch].m_matrices[id];
-
-            float I = coatingFresnel(
-                m_lambdas[ch], 
-                elements[ghost[i]].getCoatingLambda(), 
-                0.0f, 
-                elements[ghost[i] - 1].computeIndexOfRefraction(m_lambdas[ch]),
-                elements[ghost[i]].getCoatingIor(), 
-                elements[ghost[i]].computeIndexOfRefraction(m_lambdas[ch]);
-            result[ch].m_intensity *= I;
+        if (vertex.m_reflect)
+        {
+            result.m_reflectance *= (*m_opticalSystem)[vertex.m_elementId].computeReflectance(
+                lambda, 0.0f, vertex.m_n0, vertex.m_n2);
         }
-	}
+    }
+    result.m_systemMatrix = path.back().m_matrix;
 
-	// Return the result
-	return result;
+    return result;
 }
-*/
-void MatrixGhostAlgorithm::renderGhosts(const LightSource& light, int first, int last)
-{
-    /*
-    // Angle of light that we are tracing
-    float theta = glm::acos(glm::dot(glm::vec3(0, 0, -1), light.getIncidenceDirection()));
-    
-    // Compute the system matrices
-    auto systemMatrices = getMatrixLensFlareSystemMatrices(object);
 
-    // Effective aperture height
-    float H_ea = (m_opticalSystem->getEffectiveFocalLength() / 
-        m_opticalSystem->getFnumber()) / 2.0f;
+////////////////////////////////////////////////////////////////////////////////
+Ghost MatrixGhostAlgorithm::computeGhostAttributes(const Ghost& ghost,
+    const GhostAttribComputeParams& params, Workspace& workspace) const
+{
+    Ghost result = ghost;
 
-    // Compute the physical aperture height
-    float H_ep = H_ea / systemMatrices.first[0][0];
+    // Leave the invalid ghosts untouched, like the tracers do
+    if (!m_opticalSystem->isValidGhost(ghost))
+    {
+        return result;
+    }
 
-    // Film size
-    float H_f = m_opticalSystem->getFilmSize().y * 0.5f;
+    // Pupil coordinates are relative to the height of the front element
+    float pupilHeight = m_opticalSystem->getPupilHeight();
 
-    // Aspect correction vector
-    glm::vec2 aspectCorrection = glm::vec2(1.0f, 1.0f);
+    // Slope of the incoming rays, in the meridional plane
+    float slope = -glm::tan(params.m_angle);
 
-    // Bind the render shader
-    glUseProgram(m_renderShader);
+    glm::vec2 halfFilmSize = m_opticalSystem->getFilmSize() * 0.5f;
 
-    // Bind the aperture texture
-    glActiveTexture(GL_TEXTURE0 + TEXTURE_POST_PROCESS_1);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    GLuint textureLoc = glGetUniformLocation(m_renderShader, "sAperture");
-    glUniform1i(textureLoc, 0);
+    // Merged bounds of the channels, in min-max corner format
+    Ghost::BoundingRect pupilBounds = { glm::vec2(1.0f), glm::vec2(-1.0f) };
+    Ghost::BoundingRect sensorBounds = { glm::vec2(std::numeric_limits<float>::max()),
+        glm::vec2(-std::numeric_limits<float>::max()) };
+    float intensitySum = 0.0f;
+    float areaSum = 0.0f;
 
-    // Go through the ghost list and render them
-    for (int i = first; i <= last; ++i)
+    for (float lambda: params.m_lambdas)
     {
-        // Compute the ghost matrices
-        auto ghostData = getMatrixLensFlareGhostData(object, ghostIndices[i][0], ghostIndices[i][1], theta);
+        auto& path = workspace.m_path;
+        auto& discs = workspace.m_discs;
+        if (!tracePath(ghost, lambda, path))
+        {
+            continue;
+        }
 
-        // Compute the ghost projections per-channel
-        std::vectors<float> centers(m_lambdas.size());
-        std::vector<float> radi(m_lambdas.size());
-        std::vector<float> intensities(m_lambdas.size());
-        glm::vec2 loosePupilsizes, looseProjections;
+        // The height of a ray at each interface is an affine function of its
+        // pupil position, so each interface clips the pupil to a disc; the
+        // meridional extent is the intersection of their diameters
+        float pupilMin = -1.0f;
+        float pupilMax = 1.0f;
+        bool blocked = false;
 
-        for (size_t ch = 0; ch < m_lambdas.size(); ++ch)
+        discs.clear();
+        for (const auto& vertex: path)
         {
-            // Compute the height of the ghost's effective pupil
-            glm::vec2 pupilSizes =
+            float a = vertex.m_matrix[0][0] * pupilHeight;
+            float c = vertex.m_matrix[1][0] * slope;
+            float clip = vertex.m_height * (vertex.m_aperture ?
+                glm::min(params.m_radiusClip, params.m_distanceClip) : params.m_radiusClip);
+
+            if (glm::abs(a) < 1e-6f)
             {
-                ( H_ea - ghostData[ch].m_matrices[0][1][0] * theta) / ghostData[ch].m_matrices[0][0][0],
-                (-H_ea - ghostData[ch].m_matrices[0][1][0] * theta) / ghostData[ch].m_matrices[0][0][0], 
-            };
-            if (pupilSizes[1] < pupilSizes[0])
-                std::swap(pupilSizes[0], pupilSizes[1]);
-
-            // Project it onto the sensor plane
-            glm::vec2 projections =
+                blocked = blocked || glm::abs(c) > clip;
+                continue;
+            }
+
+            glm::vec2 disc = glm::vec2(-c / a, clip / glm::abs(a));
+            pupilMin = glm::max(pupilMin, disc[0] - disc[1]);
+            pupilMax = glm::min(pupilMax, disc[0] + disc[1]);
+            discs.push_back(disc);
+        }
+
+        if (blocked || pupilMin >= pupilMax)
+        {
+            continue;
+        }
+
+        // The sagittal extent is the largest half-chord of the intersection,
+        // which is a concave function of the meridional position
+        auto halfChord2 = [&](float p)
+        {
+            float result = 1.0f;
+            for (const auto& disc: discs)
             {
-                ((ghostData[ch].m_matrices[1] * ghostData[ch].m_matrices[0] * glm::vec2(pupilSizes[0], theta)).x) / H_f,
-                ((ghostData[ch].m_matrices[1] * ghostData[ch].m_matrices[0] * glm::vec2(pupilSizes[1], theta)).x) / H_f,
-            };
-            if (projections[1] < projections[0])
-                std::swap(projections[0], projections[1]);
-
-            // Compute the center and radius
-            centers[ch] = (projections[0] + projections[1]) / 2.0f;
-            radi[ch] = (projections[1] - projections[0]) / 2.0f;
-            intensities[ch] = ghostData.m_channels[ch].m_intensity * 
-                ((glm::pow(pupilSizes[0] - pupilSizes[1], 2.0f) / glm::pow(H_ep * 2.0f, 2.0f)) / 
-                glm::pow(projections[0] - projections[1], 2.0f));
-
-            // Initialize the loose coordinates with these if this is the first channel
-            if (ch == 0)
+                result = glm::min(result, disc[1] * disc[1] - (p - disc[0]) * (p - disc[0]));
+            }
+            return result;
+        };
+
+        float lo = pupilMin, hi = pupilMax;
+        for (int iteration = 0; iteration < 32; ++iteration)
+        {
+            float p0 = lo + (hi - lo) / 3.0f;
+            float p1 = hi - (hi - lo) / 3.0f;
+            if (halfChord2(p0) < halfChord2(p1))
+                lo = p0;
+            else
+                hi = p1;
+        }
+        float pupilSagittal = glm::sqrt(glm::max(halfChord2((lo + hi) * 0.5f), 0.0f));
+        if (pupilSagittal <= 0.0f)
+        {
+            continue;
+        }
+
+        // Compute the transmitted intensity along the central ray
+        float pupilCenter = (pupilMin + pupilMax) * 0.5f;
+        glm::vec2 centerRay = glm::vec2(pupilCenter * pupilHeight, slope);
+        float intensity = 1.0f;
+        for (const auto& vertex: path)
+        {
+            if (!vertex.m_reflect)
             {
-                loosePupilsizes[0] = pupilSizes[0];
-                loosePupilsizes[1] = pupilSizes[1];
-                looseProjections[0] = projections[0];
-                looseProjections[1] = projections[1];
+                continue;
             }
-            
-            // Compute the loose projections
-            loosePupilsizes[0] = glm::min(pupilSizes[0], loosePupilsizes[0]);
-            loosePupilsizes[1] = glm::max(pupilSizes[1], loosePupilsizes[1]);
-            looseProjections[0] = glm::min(projections[0], looseProjections[0]);
-            looseProjections[1] = glm::max(projections[1], looseProjections[1]);
+
+            glm::vec2 ray = vertex.m_matrix * centerRay;
+            float normalAngle = vertex.m_radius == 0.0f ? 0.0f :
+                glm::asin(glm::clamp(ray.x / vertex.m_radius, -1.0f, 1.0f));
+            float theta = glm::abs(glm::atan(ray.y) - normalAngle);
+
+            intensity *= (*m_opticalSystem)[vertex.m_elementId].computeReflectance(
+                lambda, theta, vertex.m_n0, vertex.m_n2);
         }
 
-        // Compute the loose flare quad
-        float center = (looseProjections[0] + looseProjections[1]) / 2.0f;
-        float radius = (looseProjections[1] - looseProjections[0]) / 2.0f;
-
-        // Upload the loose parameters
-        glm::vec2 position = center * toLightScreenSpace;
-        glm::vec2 scale = radius * aspectCorrection;
-        glm::vec3 color = glm::vec3(intensities[0], intensities[1], intensities[2]) * 
-            light.getDiffuseColor() * light.getDiffuseIntensity();
-
-        // Upload the channel parameters
-        std::vector<glm::vec2> channelPositions(m_lambdas.size());
-        std::vector<glm::vec2> channelScales(m_lambdas.size());
-        std::vector<glm::vec3> channelColors(m_lambdas.size());
-        for (size_t i = 0; i < m_lambdas; ++i)
+        if (intensity < params.m_intensityClip)
         {
-            channelPositions = (((center * toLightScreenSpace) - glm::vec2(radius)) -
-                ((centers[i] * toLightScreenSpace) - glm::vec2(radi[i]))) / (radius * 2.0f);
-            channelScales[i] = glm::vec2(radius / radi[i]);
-            channelColors[i] = glm::vec3(1.0f);
+            continue;
         }
 
-        // Render the plane mesh
-        glBindVertexArray(m_vao);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
+        // Project the pupil extents onto the sensor
+        const glm::mat2& systemMatrix = path.back().m_matrix;
+        float a = systemMatrix[0][0] * pupilHeight;
+        float c = systemMatrix[1][0] * slope;
+        glm::vec2 sensorMin = glm::vec2(glm::min(a * pupilMin, a * pupilMax) + c,
+            -glm::abs(a) * pupilSagittal) / halfFilmSize;
+        glm::vec2 sensorMax = glm::vec2(glm::max(a * pupilMin, a * pupilMax) + c,
+            glm::abs(a) * pupilSagittal) / halfFilmSize;
+
+        // Merge the channel into the ghost
+        pupilBounds[0] = glm::min(pupilBounds[0], glm::vec2(pupilMin, -pupilSagittal));
+        pupilBounds[1] = glm::max(pupilBounds[1], glm::vec2(pupilMax, pupilSagittal));
+        sensorBounds[0] = glm::min(sensorBounds[0], sensorMin);
+        sensorBounds[1] = glm::max(sensorBounds[1], sensorMax);
+
+        // Weigh the intensity by the unblocked pupil area
+        float area = (pupilMax - pupilMin) * pupilSagittal;
+        intensitySum += intensity * area;
+        areaSum += area;
+    }
+
+    // Mark the ghost invisible if no channel made it through
+    if (areaSum <= 0.0f)
+    {
+        result.setPupilBounds({ glm::vec2(-1.0f), glm::vec2(-1.0f) });
+        result.setSensorBounds({ glm::vec2(-1.0f), glm::vec2(-1.0f) });
+        return result;
     }
-    */
+
+    // Store the bounds in the corner-size format
+    result.setPupilBounds({ pupilBounds[0], pupilBounds[1] - pupilBounds[0] });
+    result.setSensorBounds({ sensorBounds[0], sensorBounds[1] - sensorBounds[0] });
+    result.setAverageIntensity(intensitySum / areaSum);
+
+    return result;
 }
 
-}
\ No newline at end of file
+////////////////////////////////////////////////////////////////////////////////
+Ghost MatrixGhostAlgorithm::computeGhostAttributes(const Ghost& ghost,
+    const GhostAttribComputeParams& params) const
+{
+    Workspace workspace;
+    return computeGhostAttributes(ghost, params, workspace);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GhostList MatrixGhostAlgorithm::computeGhostAttributes(const GhostList& ghosts,
+    const GhostAttribComputeParams& params) const
+{
+    Workspace workspace;
+
+    GhostList result;
+    result.reserve(ghosts.size());
+    for (const auto& ghost: ghosts)
+    {
+        result.push_back(computeGhostAttributes(ghost, params, workspace));
+    }
+
+    return result;
+}
+
+}
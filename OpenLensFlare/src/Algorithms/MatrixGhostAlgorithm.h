@@ -2,71 +2,121 @@
 
 #include "../OpticalSystem.h"
 #include "../Ghost.h"
-#include "../LightSource.h"
-#include "../GhostAlgorithm.h"
+#include "RayTraceGhostAlgorithm.h"
 
 namespace OLEF
 {
 
-/// Implements the matrix optics based ghost rendering algorithm, as described 
-/// in the 2013 paper.
-class MatrixGhostAlgorithm: public GhostAlgorithm
+/// Implements the matrix optics based ghost estimation, as described in the
+/// 2013 paper.
+///
+/// Each ghost is described by paraxial 2x2 system matrices per wavelength,
+/// which are built by walking the ghost's interface sequence once, so the
+/// cost of a ghost is linear in the number of elements it passes through.
+/// The pupil and sensor extents and the transmitted intensity derived from
+/// them are a cheap estimate of what the ray tracers compute, which is
+/// enough to sort, cull, or pre-size thousands of ghosts before any rays are
+/// traced. No GL context is required.
+///
+/// Rays are described by their height and their slope (dx/dz) in the
+/// meridional plane, in the same coordinate system as the ray tracers use;
+/// since the slope does not depend on the direction of travel, the same
+/// refraction matrix works for both forward and backward passes.
+class MatrixGhostAlgorithm
 {
 public:
-    /// Construct a matrix optics based flare rendering object that can render
-    /// the ghosts provided in the parameter ghost list.
-    MatrixGhostAlgorithm(OpticalSystem* system, const GhostList& ghosts);
-    
-    /// Releases all the allocated GL objects.
-    ~MatrixGhostAlgorithm();
-
-    /// These objects are not copyable.
-    MatrixGhostAlgorithm(const MatrixGhostAlgorithm& other) = delete;
-
-    /// These objects are not copyable.
-    MatrixGhostAlgorithm& operator=(const MatrixGhostAlgorithm& other) = delete;
-    
-    /// Renders the ghosts corresponding to the parameter light source.
-    void renderGhosts(const LightSource& light, int first, int last);
+    /// Parameters for the attribute computations.
+    using GhostAttribComputeParams = RayTraceGhostAlgorithm::GhostAttribComputeParams;
+
+    /// The paraxial description of a ghost at a single wavelength.
+    struct GhostChannel
+    {
+        /// Transfer matrix from the entrance plane to the first crossing of
+        /// the aperture stop.
+        glm::mat2 m_apertureMatrix;
+
+        /// Transfer matrix from the entrance plane to the sensor.
+        glm::mat2 m_systemMatrix;
+
+        /// Product of the normal incidence reflectances of the reflecting
+        /// interfaces.
+        float m_reflectance;
+    };
+
+    /// Construct a matrix optics based estimator for the parameter optical
+    /// system.
+    MatrixGhostAlgorithm(OpticalSystem* system);
 
     /// Returns the optical system that generates the ghosts.
     OpticalSystem* getOpticalSystem() const { return m_opticalSystem; }
 
-    /// Returns the list of ghosts this object can render.
-    const GhostList& getGhostList() const { return m_ghosts; }
+    /// Computes the system matrices of the parameter ghost at the parameter
+    /// wavelength.
+    GhostChannel computeGhostChannel(const Ghost& ghost, float lambda) const;
+
+    /// Estimates the attributes of a single ghost for the incoming angle and
+    /// wavelengths of the parameter compute params. The pupil and sensor
+    /// bounds and the average intensity are filled in, using the same
+    /// conventions as the ray tracers; the ray grid sizes are left untouched.
+    /// Ghosts with no unblocked rays, or with an intensity below the clip
+    /// value, are marked invisible.
+    Ghost computeGhostAttributes(const Ghost& ghost, const GhostAttribComputeParams& params) const;
+
+    /// Estimates the attributes of every ghost in the parameter list, and
+    /// returns a new ghost list with the ghosts containing the estimates.
+    GhostList computeGhostAttributes(const GhostList& ghosts, const GhostAttribComputeParams& params) const;
 
 private:
-    /// Instances of this class describe a particular ghost channel is rendered.
-    struct GhostAttributesChannel
+    /// A single interface crossing along the path of a ghost.
+    struct PathVertex
     {
-        /// Transferred intensity.
-        float m_intensity;
-        
-        /// Transfer matrices that describe how a ray is transferred to the next
-        /// relevant surface (aperture or sensor).
-        std::vector<glm::mat2> m_matrices;
-    };
+        /// Transfer matrix from the entrance plane to the interface.
+        glm::mat2 m_matrix;
 
-    /// An object holding all the channel data for a partical ghost.
-    using GhostAttributes = std::vector<GhostAttributesChannel>;
+        /// Height of the interface.
+        float m_height;
 
-    /// Computes the attributes for the parameter ghost.
-    GhostAttributes computeGhostAttributes(const Ghost& ghost);
+        /// Radius of curvature of the interface.
+        float m_radius;
 
-    /// The optical system that generates the ghosts.
-    OpticalSystem* m_opticalSystem;
+        /// Refractive index of the medium the ray arrives from.
+        float m_n0;
 
-    // The full list of all the ghosts this object should render.
-    GhostList m_ghosts;
+        /// Refractive index of the medium on the other side.
+        float m_n2;
 
-    /// Wavelengths at which to render the ghosts.
-    std::vector<float> m_lambdas;
+        /// Index of the element.
+        int m_elementId;
 
-    /// A dummy vao to use.
-    GLuint m_vao;
+        /// Whether the interface is an aperture stop.
+        bool m_aperture;
 
-    /// Shader used for rendering.
-    GLuint m_renderShader;
+        /// Whether the ray is reflected here.
+        bool m_reflect;
+    };
+
+    /// Scratch buffers reused between the ghosts.
+    struct Workspace
+    {
+        /// Interface crossings of the current path.
+        std::vector<PathVertex> m_path;
+
+        /// Pupil space clipping discs (center, radius) of the crossings.
+        std::vector<glm::vec2> m_discs;
+    };
+
+    /// Walks the interface sequence of the parameter ghost at the parameter
+    /// wavelength, recording every interface crossing into the output list.
+    /// Returns false if the path leaves the system before reaching the sensor.
+    bool tracePath(const Ghost& ghost, float lambda, std::vector<PathVertex>& path) const;
+
+    /// Estimates the attributes of a single ghost, using the parameter
+    /// scratch buffers.
+    Ghost computeGhostAttributes(const Ghost& ghost, const GhostAttribComputeParams& params,
+        Workspace& workspace) const;
+
+    /// The optical system that generates the ghosts.
+    OpticalSystem* m_opticalSystem;
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,246 @@
+#include "ProgramCache.h"
+#include "../HashHelpers.h"
+
+namespace OLEF
+{
+
+/// Identifies the program binary files.
+static const char BINARY_MAGIC[8] = { 'O', 'L', 'E', 'F', 'P', 'B', 'I', 'N' };
+
+/// Hashes a null-terminated string, including the terminator, so that
+/// consecutive strings can't run into each other.
+static ProgramCache::Key hashString(const char* str, ProgramCache::Key seed)
+{
+    return HashHelpers::hashBytes(str, std::strlen(str) + 1, seed);
+}
+
+/// Returns a string identifying the current driver.
+static std::string getDriverString()
+{
+    std::string result;
+    for (GLenum name: { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION })
+    {
+        const GLubyte* value = glGetString(name);
+        result += value ? (const char*) value : "";
+        result += '\n';
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ProgramCache::ProgramCache(const std::string& directory):
+    m_directory(directory),
+    m_driver(getDriverString()),
+    m_binarySupported(false)
+{
+    // Make sure the path ends with a separator
+    if (!m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\')
+    {
+        m_directory += '/';
+    }
+
+    // Binaries need driver support, and at least one binary format
+    if (!m_directory.empty() && (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+    {
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        m_binarySupported = numFormats > 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ProgramCache::~ProgramCache()
+{
+    clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ProgramCache::Key ProgramCache::computeKey(const GLHelpers::ShaderSource& source)
+{
+    Key result = HashHelpers::HASH_SEED;
+
+    result = hashString(source.m_version, result);
+
+    for (auto define: source.m_defines)
+    {
+        result = hashString(define, result);
+    }
+
+    for (const auto& stage: source.m_source)
+    {
+        std::uint32_t type = stage.first;
+        std::uint32_t numParts = (std::uint32_t) stage.second.size();
+        result = HashHelpers::hashBytes(&type, sizeof(type), result);
+        result = HashHelpers::hashBytes(&numParts, sizeof(numParts), result);
+        for (auto part: stage.second)
+        {
+            result = hashString(part, result);
+        }
+    }
+
+    for (auto varying: source.m_varyings)
+    {
+        result = hashString(varying, result);
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GLuint ProgramCache::getProgram(const GLHelpers::ShaderSource& source)
+{
+    Key key = computeKey(source);
+
+    // Share the already built programs
+    auto it = m_programs.find(key);
+    if (it != m_programs.end())
+    {
+        ++m_stats.m_hits;
+        return it->second;
+    }
+
+    // Try the binary from an earlier run
+    GLuint program = m_binarySupported ? loadBinary(key) : 0;
+    if (program != 0)
+    {
+        ++m_stats.m_binaryLoads;
+    }
+
+    // Compile it from source, and store the binary for the next run
+    else
+    {
+        program = GLHelpers::createShader(source, m_binarySupported);
+        ++m_stats.m_compiles;
+
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (m_binarySupported && status == GL_TRUE)
+        {
+            storeBinary(key, program);
+        }
+    }
+
+    m_programs[key] = program;
+    return program;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GLuint ProgramCache::createProgram(ProgramCache* cache, const GLHelpers::ShaderSource& source)
+{
+    return cache ? cache->getProgram(source) : GLHelpers::createShader(source);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ProgramCache::releaseProgram(ProgramCache* cache, GLuint program)
+{
+    if (cache == nullptr)
+    {
+        glDeleteProgram(program);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ProgramCache::clear()
+{
+    for (const auto& program: m_programs)
+    {
+        glDeleteProgram(program.second);
+    }
+    m_programs.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string ProgramCache::getBinaryPath(Key key) const
+{
+    // The driver is part of the file name, so binaries of different drivers
+    // can live side by side
+    Key fileKey = HashHelpers::hashBytes(m_driver.data(), m_driver.size(), key);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.olefpb", (unsigned long long) fileKey);
+    return m_directory + name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GLuint ProgramCache::loadBinary(Key key) const
+{
+    std::ifstream file(getBinaryPath(key), std::ios::binary);
+    if (!file)
+    {
+        return 0;
+    }
+
+    // Validate the header; the driver string guards against hash collisions
+    char magic[sizeof(BINARY_MAGIC)];
+    std::uint64_t storedKey = 0;
+    std::uint32_t driverLength = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char*) &storedKey, sizeof(storedKey));
+    file.read((char*) &driverLength, sizeof(driverLength));
+    if (!file || std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0 ||
+        storedKey != key || driverLength != m_driver.size())
+    {
+        return 0;
+    }
+
+    std::string driver(driverLength, '\0');
+    std::uint32_t format = 0, length = 0;
+    file.read(&driver[0], driverLength);
+    file.read((char*) &format, sizeof(format));
+    file.read((char*) &length, sizeof(length));
+    if (!file || driver != m_driver)
+    {
+        return 0;
+    }
+
+    std::vector<char> binary(length);
+    file.read(binary.data(), length);
+    if (!file)
+    {
+        return 0;
+    }
+
+    // Hand it to the driver, which may still reject it
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), (GLsizei) length);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ProgramCache::storeBinary(Key key, GLuint program) const
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    std::ofstream file(getBinaryPath(key), std::ios::binary | std::ios::trunc);
+    std::uint64_t storedKey = key;
+    std::uint32_t driverLength = (std::uint32_t) m_driver.size();
+    std::uint32_t storedFormat = format;
+    std::uint32_t storedLength = (std::uint32_t) length;
+    file.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    file.write((const char*) &storedKey, sizeof(storedKey));
+    file.write((const char*) &driverLength, sizeof(driverLength));
+    file.write(m_driver.data(), driverLength);
+    file.write((const char*) &storedFormat, sizeof(storedFormat));
+    file.write((const char*) &storedLength, sizeof(storedLength));
+    file.write(binary.data(), storedLength);
+}
+
+}
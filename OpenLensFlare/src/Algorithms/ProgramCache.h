@@ -0,0 +1,116 @@
+#pragma once
+
+#include "../Dependencies.h"
+#include "GLHelpers.h"
+
+namespace OLEF
+{
+
+/// A cache of linked shader programs, shared by the algorithms of a single
+/// GL context.
+///
+/// Programs are identified by a hash of their full source (version, defines,
+/// stage sources and captured varyings), so algorithm instances built from
+/// the same sources share a single program object, which is compiled only
+/// once. The cached programs are owned by the cache, and stay alive until it
+/// is cleared or destroyed, which must happen while the context is current.
+///
+/// If a directory is set and the driver supports program binaries, the
+/// linked programs are also written to disk, keyed by the source hash and
+/// the driver identification string, so later runs can load them without
+/// compiling anything. Binaries that are rejected by the driver (e.g. after
+/// a driver update) are recompiled and overwritten. The cache directory must
+/// already exist.
+class ProgramCache
+{
+public:
+    /// Type of the cache keys.
+    using Key = std::uint64_t;
+
+    /// Statistics of the program requests.
+    struct Stats
+    {
+        /// Number of requests served by an already cached program.
+        int m_hits = 0;
+
+        /// Number of programs loaded from a binary on disk.
+        int m_binaryLoads = 0;
+
+        /// Number of programs compiled from source.
+        int m_compiles = 0;
+    };
+
+    /// Constructs a cache object, which persists the program binaries in the
+    /// parameter directory. With an empty directory, programs are only
+    /// shared in memory.
+    ProgramCache(const std::string& directory = "");
+
+    /// These objects are not copyable.
+    ProgramCache(const ProgramCache& other) = delete;
+
+    /// Releases the cached programs.
+    ~ProgramCache();
+
+    /// These objects are not copyable.
+    ProgramCache& operator=(const ProgramCache& other) = delete;
+
+    /// Computes the key of the parameter shader source.
+    static Key computeKey(const GLHelpers::ShaderSource& source);
+
+    /// Returns the program built from the parameter source, loading or
+    /// compiling it if it is not cached yet. The returned program is owned
+    /// by the cache.
+    GLuint getProgram(const GLHelpers::ShaderSource& source);
+
+    /// Returns the program built from the parameter source, taken from the
+    /// parameter cache, or compiled separately if there is no cache.
+    static GLuint createProgram(ProgramCache* cache, const GLHelpers::ShaderSource& source);
+
+    /// Releases a program returned by createProgram. Cached programs are
+    /// left alive, since they are owned by the cache.
+    static void releaseProgram(ProgramCache* cache, GLuint program);
+
+    /// Releases every cached program. The programs returned earlier become
+    /// invalid. The binaries on disk are kept.
+    void clear();
+
+    /// Returns the directory of the cache.
+    const std::string& getDirectory() const { return m_directory; }
+
+    /// Returns whether the program binaries are persisted on disk.
+    bool isBinarySupported() const { return m_binarySupported; }
+
+    /// Returns the number of cached programs.
+    size_t getProgramCount() const { return m_programs.size(); }
+
+    /// Returns the request statistics.
+    const Stats& getStats() const { return m_stats; }
+
+private:
+    /// Returns the path of the binary file belonging to the parameter key.
+    std::string getBinaryPath(Key key) const;
+
+    /// Tries to load the program binary of the parameter key. Returns 0 if
+    /// there is no usable binary.
+    GLuint loadBinary(Key key) const;
+
+    /// Writes out the binary of the parameter program.
+    void storeBinary(Key key, GLuint program) const;
+
+    /// The cache directory, with a trailing separator.
+    std::string m_directory;
+
+    /// Identification string of the driver the binaries belong to.
+    std::string m_driver;
+
+    /// Whether the program binaries are persisted on disk.
+    bool m_binarySupported;
+
+    /// The cached programs.
+    std::map<Key, GLuint> m_programs;
+
+    /// Request statistics.
+    Stats m_stats;
+};
+
+}
@@ -1,43 +1,389 @@
 #include "RayTraceGhostAlgorithm.h"
 #include "GLHelpers.h"
+#include "ColorSpaceHelpers.h"
+#include "GhostAttribHelpers.h"
 
 #include "Common_Functions.glsl.h"
 #include "Common_ColorSpace.glsl.h"
 #include "RayTraceGhostAlgorithm_RenderGhost_Uniforms.glsl.h"
+#include "RayTraceGhostAlgorithm_TraceRay.glsl.h"
+#include "RayTraceGhostAlgorithm_TraceGhost_VertexShader.glsl.h"
+#include "RayTraceGhostAlgorithm_TraceGhost_ComputeShader.glsl.h"
+#include "RayTraceGhostAlgorithm_TraceGhostBatch_ComputeShader.glsl.h"
+#include "RayTraceGhostAlgorithm_ReduceGhost_ComputeShader.glsl.h"
 #include "RayTraceGhostAlgorithm_RenderGhost_VertexShader.glsl.h"
-#include "RayTraceGhostAlgorithm_RenderGhost_GeometryShader.glsl.h"
+#include "RayTraceGhostAlgorithm_RenderGhostBatch_VertexShader.glsl.h"
 #include "RayTraceGhostAlgorithm_RenderGhost_FragmentShader.glsl.h"
 
-//TODO: implement two precomputation methods: transform feedback and compute
-//      shader versions, and expose a switch or something to allow the user
-//      choose from the desired version
-//TODO: extract the ray tracing code into a separate file and assemble the 
-//      required shaders (rendering, xfb precomputation, compute shader
-//      precomputation) using the multiple source file feature of the shader 
-//      compiler function
-
 namespace OLEF
 {
 
 /// Standard 3-color wavelengths
 static const std::vector<float> STANDARD_WAVELENGTHS = { 650.0f, 510.0f, 475.0f };
 
+/// Minimum number of vertices in a buffer of the readback ring.
+static const int READBACK_SLOT_VERTICES = 1 << 17;
+
+/// Timeout of a single wait for a readback buffer, in nanoseconds.
+static const GLuint64 READBACK_WAIT_TIMEOUT = 1000000000;
+
+/// Work group sizes of the compute shaders; these must match the shaders.
+static const int TRACE_GROUP_SIZE = 64;
+static const int REDUCE_GROUP_SIZE = 256;
+
+/// Reduction types understood by the reduction compute shader.
+static const GLint REDUCTION_BOUNDS = 0;
+static const GLint REDUCTION_AREAS = 1;
+static const GLint REDUCTION_VARIANCE = 2;
+
+/// Maximum number of lens table entries; this must match the shaders.
+static const int MAX_ELEMENTS = 64;
+
+/// Uniform buffer binding points of the lens table and the ghost parameters.
+static const GLuint LENS_TABLE_BINDING = 0;
+static const GLuint GHOST_PARAMS_BINDING = 1;
+
+/// Number of slots in the ghost parameter buffer.
+static const int GHOST_PARAMS_SLOTS = 1024;
+
+/// Storage buffer binding points of the batched path; these must match the
+/// shaders.
+static const GLuint BATCH_VERTEX_BINDING = 0;
+static const GLuint BATCH_PARAMS_BINDING = 1;
+
+/// Maximum number of draws traced by a single dispatch of the batched path
+/// (the minimum work group count limit).
+static const int MAX_DISPATCH_DRAWS = 65535;
+
+/// Defines selecting the render mode of a render shader variant, indexed by
+/// the render mode.
+static const char* RENDER_MODE_DEFINES[] =
+{
+    "#define RENDER_MODE RENDER_MODE_PROJECTED_GHOST",
+    "#define RENDER_MODE RENDER_MODE_PUPIL_GRID",
+};
+
+/// Defines selecting the shading mode of a render shader variant, indexed by
+/// the shading mode.
+static const char* SHADING_MODE_DEFINES[] =
+{
+    "#define SHADING_MODE SHADING_MODE_SHADED",
+    "#define SHADING_MODE SHADING_MODE_UNCOLORED",
+    "#define SHADING_MODE SHADING_MODE_UNSHADED",
+    "#define SHADING_MODE SHADING_MODE_RAY_COORDINATES",
+    "#define SHADING_MODE SHADING_MODE_UV_COORDINATES",
+    "#define SHADING_MODE SHADING_MODE_RELATIVE_RADIUS",
+};
+
+/// Contents of the LensTable uniform block, laid out according to std140.
+struct LensTableData
+{
+    /// Center (xyz) and radius of curvature (w) of each element.
+    glm::vec4 m_centerRadius[MAX_ELEMENTS];
+
+    /// Previous, coating and element IORs (xyz) and coating thickness (w).
+    glm::vec4 m_iorCoating[MAX_ELEMENTS];
+
+    /// Height (x) and aperture height (y) of each element.
+    glm::vec4 m_heightAperture[MAX_ELEMENTS];
+
+    /// Size of the film.
+    glm::vec2 m_filmSize;
+
+    /// Distance of the ray from the sensor, along the optical axis.
+    GLfloat m_rayDistance;
+
+    /// Number of interfaces (including air before).
+    GLint m_length;
+
+    /// Wavelength of the table.
+    GLfloat m_lambda;
+
+    /// Padding to the size of the std140 block.
+    GLfloat m_padding[3];
+};
+
+/// Contents of the GhostParams uniform block, laid out according to std140;
+/// the batched path stores an array of these in a storage buffer.
+struct RayTraceGhostAlgorithm::GhostParamsData
+{
+    /// Reflecting interfaces of the ghost, four per entry.
+    glm::ivec4 m_ghostIndices[4];
+
+    /// Color of the channel, scaled by every intensity factor that is
+    /// constant for the draw.
+    glm::vec4 m_color;
+
+    /// Direction of the rays.
+    glm::vec3 m_rayDir;
+
+    /// Number of reflecting interfaces.
+    GLint m_numIndices;
+
+    /// Center of the ray grid.
+    glm::vec2 m_gridCenter;
+
+    /// Size of the ray grid.
+    glm::vec2 m_gridSize;
+
+    /// Center of the ghost image.
+    glm::vec2 m_imageCenter;
+
+    /// Size of the ghost image.
+    glm::vec2 m_imageSize;
+
+    /// Ray grid dimensions.
+    GLint m_rayCount;
+
+    /// Radius clipping.
+    GLfloat m_radiusClip;
+
+    /// Iris clipping.
+    GLfloat m_irisClip;
+
+    /// First traced vertex of the draw; only used by the batched path.
+    GLint m_vertexOffset;
+};
+
+/// Layout of an indirect draw command of glMultiDrawArraysIndirect.
+struct DrawArraysIndirectCommand
+{
+    /// Number of vertices to draw.
+    GLuint m_count;
+
+    /// Number of instances to draw.
+    GLuint m_instanceCount;
+
+    /// First vertex to draw.
+    GLuint m_first;
+
+    /// First instance to draw.
+    GLuint m_baseInstance;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static GLHelpers::ProgramReflection reflectProgram(GLuint program)
+{
+    GLHelpers::ProgramReflection reflection(program);
+
+    // Assign the shared uniform block binding points
+    reflection.bindUniformBlock("LensTable", LENS_TABLE_BINDING);
+    reflection.bindUniformBlock("GhostParams", GHOST_PARAMS_BINDING);
+
+    // The aperture texture is always bound to the first texture unit
+    glUseProgram(program);
+    GLHelpers::uploadUniform(reflection, "sAperture", 0);
+    glUseProgram(0);
+
+    return reflection;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Computes the lens table of the parameter system at the parameter
+/// wavelength.
+static LensTableData buildLensTable(const OpticalSystem& system, float lambda)
+{
+    // Calculate the entrance plane's distance from the sensor plane 
+    float sensorDistance = system.getSensorDistance();
+
+    // Compute the effective aperture length
+    float apertureHeight = system.getEffectiveApertureHeight();
+
+    // Number of interfaces (including air before)
+    auto elementCount = glm::min(system.getElementCount() + 1, (size_t) MAX_ELEMENTS);
+
+    LensTableData table = {};
+    table.m_iorCoating[0] = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+
+    // Fill the lens parameter arrays
+    float lensDistance = sensorDistance;
+    for (int lensId = 1; lensId < (int) elementCount; ++lensId)
+    {
+        // Reference to the current lens
+        const auto& lens = system[lensId - 1];
+
+        // Compute its attributes
+        float curvature = lens.getRadiusOfCurvature();
+        float height = lens.getHeight();
+        float aperture = 0.0f;
+        glm::vec3 center = glm::vec3(0.0f, 0.0f, lensDistance - lens.getRadiusOfCurvature());
+        glm::vec3 refraction = glm::vec3(
+            table.m_iorCoating[lensId - 1].z,
+            lens.getCoatingLambda(),
+            lens.computeIndexOfRefraction(lambda));
+        float thickness = lens.getCoatingLambda() / 4.0f / glm::max(
+            glm::sqrt(refraction[0] * refraction[2]), 
+            refraction[1]);
+
+        // Special treatment for the special elements
+        if (lens.getType() == OpticalSystemElement::ElementType::APERTURE_STOP)
+        {
+            curvature = 0.0f;
+            height = apertureHeight;
+            aperture = apertureHeight;
+        }
+        else if (lens.getType() == OpticalSystemElement::ElementType::SENSOR)
+        {
+            curvature = 0.0f;
+            height = glm::min(system.getFilmWidth(), 
+                system.getFilmHeight());
+            aperture = 0.0f;
+        }
+
+        table.m_centerRadius[lensId] = glm::vec4(center, curvature);
+        table.m_iorCoating[lensId] = glm::vec4(refraction, thickness);
+        table.m_heightAperture[lensId] = glm::vec4(height, aperture, 0.0f, 0.0f);
+
+        // The next element is closer
+        lensDistance -= lens.getThickness();
+    }
+
+    // Fill the remaining attributes
+    table.m_filmSize = system.getFilmSize();
+    table.m_rayDistance = sensorDistance + 0.1f;
+    table.m_length = (GLint) elementCount;
+    table.m_lambda = lambda;
+
+    return table;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Formats a float as a GLSL floating point literal, exactly. Uses the
+/// classic locale, so the decimal separator is always a point.
+static std::string formatFloat(float value)
+{
+    std::ostringstream stream;
+    stream.imbue(std::locale::classic());
+    stream << std::setprecision(9) << value;
+
+    std::string result = stream.str();
+    if (result.find_first_of(".e") == std::string::npos)
+    {
+        result += ".0";
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Formats the first length entries of a vec4 array as a constant GLSL array.
+static std::string formatConstArray(const char* name, const glm::vec4* values, int length)
+{
+    std::string result = "const vec4 " + std::string(name) + "[" + std::to_string(length) + "] = vec4[](\n";
+    for (int i = 0; i < length; ++i)
+    {
+        result += "    vec4(" + formatFloat(values[i].x) + ", " + formatFloat(values[i].y) + ", " + 
+            formatFloat(values[i].z) + ", " + formatFloat(values[i].w) + ")";
+        result += i + 1 < length ? ",\n" : ");\n";
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Returns the number of interfaces the parameter ghost visits in a system
+/// with the parameter lens table length, walking them the same way as
+/// traceRay does.
+static int computeGhostPathLength(int length, const Ghost& ghost)
+{
+    int result = 0;
+    int phase = 0;
+    int delta = 1;
+    for (int t = 1; t >= 0 && t < length; t += delta)
+    {
+        if (phase < (int) ghost.getLength() && t == ghost[phase] + 1)
+        {
+            delta = -delta;
+            ++phase;
+        }
+        ++result;
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Generates the GLSL source that bakes the parameter lens table and ghost
+/// path length into a tracing program. The lens table entries are declared
+/// as constants, under the names of the LensTable block. The reflecting
+/// interfaces are still read from the ghost parameters, so every ghost with
+/// the same path length shares the program.
+static std::string generateBakedSource(const LensTableData& table, int pathLength)
+{
+    // Lens table
+    std::string result = "#define BAKED_LENS_TABLE\n";
+    result += "const int iLength = " + std::to_string(table.m_length) + ";\n";
+    result += "const float fLambda = " + formatFloat(table.m_lambda) + ";\n";
+    result += "const float fRayDistance = " + formatFloat(table.m_rayDistance) + ";\n";
+    result += "const vec2 vFilmSize = vec2(" + formatFloat(table.m_filmSize.x) + ", " + 
+        formatFloat(table.m_filmSize.y) + ");\n";
+    result += formatConstArray("vLensCenterRadius", table.m_centerRadius, table.m_length);
+    result += formatConstArray("vLensIorCoating", table.m_iorCoating, table.m_length);
+    result += formatConstArray("vLensHeightAperture", table.m_heightAperture, table.m_length);
+
+    // Ghost path length
+    result += "#define BAKED_PATH_LENGTH " + std::to_string(pathLength) + "\n";
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Issues a GL call (or a helper issuing a single GL call), and counts it in
+/// the parameter render statistics, if any.
+template<typename Function, typename... Args>
+static void countedCall(RayTraceGhostAlgorithm::GhostRenderStats* stats, Function function, Args... args)
+{
+    function(args...);
+    if (stats)
+        ++stats->m_glCalls;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
-RayTraceGhostAlgorithm::RayTraceGhostAlgorithm(OpticalSystem* system):
+/// Returns the screen-space bounding box of the ghost image, i.e. its sensor
+/// bounds rotated by the parameter light azimuth, as its center and half
+/// extents.
+static void rotatedSensorBounds(const Ghost& ghost, const glm::mat2& rotation,
+    glm::vec2& center, glm::vec2& extents)
+{
+    glm::vec2 halfSize = ghost.getSensorBounds()[1] / 2.0f;
+    center = rotation * (ghost.getSensorBounds()[0] + halfSize);
+
+    // Extents of the rotated rectangle along the screen axes
+    extents = glm::vec2(
+        glm::abs(rotation[0][0]) * halfSize.x + glm::abs(rotation[1][0]) * halfSize.y,
+        glm::abs(rotation[0][1]) * halfSize.x + glm::abs(rotation[1][1]) * halfSize.y);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+RayTraceGhostAlgorithm::RayTraceGhostAlgorithm(OpticalSystem* system, ProgramCache* programCache):
     m_opticalSystem(system),
-	m_lambdas(STANDARD_WAVELENGTHS),
+    m_programCache(programCache),
     m_intensityScale(100.0f),
     m_renderMode(RenderMode::PROJECTED_GHOST),
     m_shadingMode(ShadingMode::SHADED),
     m_radiusClip(1.0f),
     m_distanceClip(0.95f),
 	m_intensityClip(1.0f),
-    m_vao(0)
+    m_minPixelArea(1.0f),
+	m_lambdas(STANDARD_WAVELENGTHS),
+    m_precomputeBackend(PrecomputeBackend::TRANSFORM_FEEDBACK),
+    m_vao(0),
+    m_renderVao(0),
+    m_vertexBuffer(0),
+    m_vertexBufferSize(0),
+    m_ghostParamsBuffer(0),
+    m_ghostParamsSlotSize(0),
+    m_ghostParamsSlot(0),
+    m_batchedRendering(false),
+    m_bakedTracing(false),
+    m_batchParamsBuffer(0),
+    m_indirectBuffer(0),
+    m_readbackRing(),
+    m_readbackSlotSize(0),
+    m_renderTimers(),
+    m_renderTimerSlot(0),
+    m_measuredRenderTime(0.0)
 {
-    // Create the precomputation shader
-    GLHelpers::ShaderSource precomputeSource;
-	
-	precomputeSource.m_source =
+    // Create the ray tracing shader, which writes the traced rays out through
+    // transform feedback
+	m_traceSource.m_source =
     {
         {
             GL_VERTEX_SHADER, 
@@ -45,16 +391,34 @@ RayTraceGhostAlgorithm::RayTraceGhostAlgorithm(OpticalSystem* system):
                 Shaders::Common_Functions,
                 Shaders::Common_ColorSpace,
 				Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
-                Shaders::RayTraceGhostAlgorithm_RenderGhost_VertexShader,
+                Shaders::RayTraceGhostAlgorithm_TraceRay,
+                Shaders::RayTraceGhostAlgorithm_TraceGhost_VertexShader,
             }
         },
+    };
+	m_traceSource.m_varyings =
+	{
+		"vParamOut",
+		"vPositionOut",
+		"vUvOut",
+		"fRadiusOut",
+		"fIntensityOut",
+		"fIrisDistanceOut"
+	};
+    m_traceShader = ProgramCache::createProgram(m_programCache, m_traceSource);
+    reflectProgram(m_traceShader);
+
+    // Set up the render shader source; the variants for the different modes
+    // are compiled on demand
+	m_renderSource.m_source =
+    {
         {
-            GL_GEOMETRY_SHADER, 
+            GL_VERTEX_SHADER, 
             {
                 Shaders::Common_Functions,
                 Shaders::Common_ColorSpace,
 				Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
-                Shaders::RayTraceGhostAlgorithm_RenderGhost_GeometryShader,
+                Shaders::RayTraceGhostAlgorithm_RenderGhost_VertexShader,
             }
         },
         {
@@ -67,76 +431,449 @@ RayTraceGhostAlgorithm::RayTraceGhostAlgorithm(OpticalSystem* system):
             }
         },
     };
-	precomputeSource.m_defines =
-	{
-		"#define PRECOMPUTATION 1",
-	};
-	precomputeSource.m_varyings =
-	{
-		"vParamGS",
-		"vPositionGS",
-		"vUvGS",
-		"fRadiusGS",
-		"fIntensityGS",
-		"fIrisDistanceGS"
-	};
-    m_precomputeShader = GLHelpers::createShader(precomputeSource);
+    getRenderShader(m_renderMode, m_shadingMode, false);
 
-    // Create the render shader
-    GLHelpers::ShaderSource renderSource;
-	
-	renderSource.m_source =
+    // Create the compute shaders, if they are supported
+    m_computeTraceShader = 0;
+    m_computeReduceShader = 0;
+    if (GLEW_VERSION_4_3)
     {
+        GLHelpers::ShaderSource computeTraceSource;
+
+        computeTraceSource.m_version = "#version 430\n";
+        computeTraceSource.m_source =
         {
-            GL_VERTEX_SHADER, 
             {
-                Shaders::Common_Functions,
-                Shaders::Common_ColorSpace,
-				Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
-                Shaders::RayTraceGhostAlgorithm_RenderGhost_VertexShader,
-            }
-        },
+                GL_COMPUTE_SHADER,
+                {
+                    Shaders::Common_Functions,
+                    Shaders::Common_ColorSpace,
+                    Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
+                    Shaders::RayTraceGhostAlgorithm_TraceRay,
+                    Shaders::RayTraceGhostAlgorithm_TraceGhost_ComputeShader,
+                }
+            },
+        };
+        m_computeTraceShader = ProgramCache::createProgram(m_programCache, computeTraceSource);
+        m_computeTraceUniforms = reflectProgram(m_computeTraceShader);
+
+        GLHelpers::ShaderSource computeReduceSource;
+
+        computeReduceSource.m_version = "#version 430\n";
+        computeReduceSource.m_source =
         {
-            GL_GEOMETRY_SHADER, 
             {
-                Shaders::Common_Functions,
-                Shaders::Common_ColorSpace,
-				Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
-                Shaders::RayTraceGhostAlgorithm_RenderGhost_GeometryShader,
-            }
-        },
+                GL_COMPUTE_SHADER,
+                {
+                    Shaders::RayTraceGhostAlgorithm_ReduceGhost_ComputeShader,
+                }
+            },
+        };
+        m_computeReduceShader = ProgramCache::createProgram(m_programCache, computeReduceSource);
+        m_computeReduceUniforms = reflectProgram(m_computeReduceShader);
+    }
+
+    // Create the batched shaders, if they are supported; the draw index is
+    // either core (4.6) or comes from the draw parameters extension
+    m_batchTraceShader = 0;
+    if (GLEW_VERSION_4_3 && (GLEW_VERSION_4_6 || GLEW_ARB_shader_draw_parameters))
+    {
+        GLHelpers::ShaderSource batchTraceSource;
+
+        batchTraceSource.m_version = "#version 430\n";
+        batchTraceSource.m_defines = { "#define BATCHED" };
+        batchTraceSource.m_source =
         {
-            GL_FRAGMENT_SHADER, 
             {
-                Shaders::Common_Functions,
-                Shaders::Common_ColorSpace,
-				Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
-                Shaders::RayTraceGhostAlgorithm_RenderGhost_FragmentShader,
-            }
-        },
-    };
-    m_renderShader = GLHelpers::createShader(renderSource);
+                GL_COMPUTE_SHADER,
+                {
+                    Shaders::Common_Functions,
+                    Shaders::Common_ColorSpace,
+                    Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
+                    Shaders::RayTraceGhostAlgorithm_TraceRay,
+                    Shaders::RayTraceGhostAlgorithm_TraceGhostBatch_ComputeShader,
+                }
+            },
+        };
+        m_batchTraceShader = ProgramCache::createProgram(m_programCache, batchTraceSource);
+        m_batchTraceUniforms = reflectProgram(m_batchTraceShader);
+
+        if (GLEW_VERSION_4_6)
+        {
+            m_batchRenderSource.m_version = "#version 460\n";
+            m_batchRenderSource.m_defines = { "#define BATCHED", "#define DRAW_ID gl_DrawID" };
+        }
+        else
+        {
+            m_batchRenderSource.m_version = "#version 430\n#extension GL_ARB_shader_draw_parameters : require\n";
+            m_batchRenderSource.m_defines = { "#define BATCHED", "#define DRAW_ID gl_DrawIDARB" };
+        }
+        m_batchRenderSource.m_source =
+        {
+            {
+                GL_VERTEX_SHADER, 
+                {
+                    Shaders::Common_Functions,
+                    Shaders::Common_ColorSpace,
+                    Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
+                    Shaders::RayTraceGhostAlgorithm_RenderGhostBatch_VertexShader,
+                }
+            },
+            {
+                GL_FRAGMENT_SHADER, 
+                {
+                    Shaders::Common_Functions,
+                    Shaders::Common_ColorSpace,
+                    Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms,
+                    Shaders::RayTraceGhostAlgorithm_RenderGhost_FragmentShader,
+                }
+            },
+        };
+        // Generate the per-draw parameter and indirect command buffers
+        glGenBuffers(1, &m_batchParamsBuffer);
+        glGenBuffers(1, &m_indirectBuffer);
+    }
 
     // Generate a dummy vertex array.
     glGenVertexArrays(1, &m_vao);
+
+    // Generate the ghost parameter buffer, with each slot aligned to the
+    // required uniform buffer offset alignment
+    GLint offsetAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+    offsetAlignment = glm::max(offsetAlignment, 1);
+    m_ghostParamsSlotSize = (sizeof(GhostParamsData) + offsetAlignment - 1) / 
+        offsetAlignment * offsetAlignment;
+
+    glGenBuffers(1, &m_ghostParamsBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_ghostParamsBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, GHOST_PARAMS_SLOTS * m_ghostParamsSlotSize, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Generate the traced vertex buffer and the vertex array that reads it
+    glGenBuffers(1, &m_vertexBuffer);
+    glGenVertexArrays(1, &m_renderVao);
+
+    glBindVertexArray(m_renderVao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(PerVertexData),
+        (const void*) offsetof(PerVertexData, m_parameter));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(PerVertexData),
+        (const void*) offsetof(PerVertexData, m_position));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(PerVertexData),
+        (const void*) offsetof(PerVertexData, m_uv));
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(PerVertexData),
+        (const void*) offsetof(PerVertexData, m_radius));
+    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(PerVertexData),
+        (const void*) offsetof(PerVertexData, m_intensity));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Generate the render timer queries
+    for (auto& timer: m_renderTimers)
+    {
+        glGenQueries(1, &timer.m_query);
+    }
 }
 
 RayTraceGhostAlgorithm::~RayTraceGhostAlgorithm()
 {
-    // Generate a dummy vertex array.
+    // Release the vertex arrays.
     glDeleteVertexArrays(1, &m_vao);
+    glDeleteVertexArrays(1, &m_renderVao);
+
+    // Release the buffers
+    glDeleteBuffers(1, &m_vertexBuffer);
+    glDeleteBuffers(1, &m_ghostParamsBuffer);
+    releaseReadbackRing();
+    for (const auto& indexBuffer: m_indexBuffers)
+    {
+        glDeleteBuffers(1, &indexBuffer.second);
+    }
+    releaseLensTables();
+
+    // Release the timer queries
+    for (const auto& timer: m_renderTimers)
+    {
+        glDeleteQueries(1, &timer.m_query);
+    }
 	
     // Release the shaders
-    glDeleteProgram(m_precomputeShader);
-    glDeleteProgram(m_renderShader);
+    ProgramCache::releaseProgram(m_programCache, m_traceShader);
+    for (const auto& renderShader: m_renderShaders)
+    {
+        ProgramCache::releaseProgram(m_programCache, renderShader.second);
+    }
+    if (m_computeTraceShader != 0)
+    {
+        ProgramCache::releaseProgram(m_programCache, m_computeTraceShader);
+        ProgramCache::releaseProgram(m_programCache, m_computeReduceShader);
+    }
+    if (m_batchTraceShader != 0)
+    {
+        ProgramCache::releaseProgram(m_programCache, m_batchTraceShader);
+        glDeleteBuffers(1, &m_batchParamsBuffer);
+        glDeleteBuffers(1, &m_indirectBuffer);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::reserveVertexBuffer(int numVertices)
+{
+    if (numVertices <= m_vertexBufferSize)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(PerVertexData), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    m_vertexBufferSize = numVertices;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::reserveReadbackRing(int numVertices)
+{
+    if (numVertices <= m_readbackSlotSize)
+        return;
+
+    releaseReadbackRing();
+
+    // Persistently map the buffers, if possible
+    bool persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    GLsizeiptr bufferSize = numVertices * sizeof(PerVertexData);
+
+    for (auto& slot: m_readbackRing)
+    {
+        glGenBuffers(1, &slot.m_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, slot.m_buffer);
+
+        if (persistent)
+        {
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, bufferSize, nullptr, flags);
+            slot.m_vertices = (const PerVertexData*) glMapBufferRange(
+                GL_COPY_WRITE_BUFFER, 0, bufferSize, flags);
+        }
+        else
+        {
+            glBufferData(GL_COPY_WRITE_BUFFER, bufferSize, nullptr, GL_STREAM_READ);
+            slot.m_vertices = nullptr;
+        }
+
+        slot.m_fence = 0;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    m_readbackSlotSize = numVertices;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::releaseReadbackRing()
+{
+    for (auto& slot: m_readbackRing)
+    {
+        if (slot.m_buffer == 0)
+            continue;
+
+        if (slot.m_fence != 0)
+        {
+            glDeleteSync(slot.m_fence);
+        }
+
+        if (slot.m_vertices != nullptr)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, slot.m_buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        glDeleteBuffers(1, &slot.m_buffer);
+        slot = ReadbackSlot();
+    }
+
+    m_readbackSlotSize = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GLuint RayTraceGhostAlgorithm::getIndexBuffer(int rayCount)
+{
+    // Look for an existing one
+    auto it = m_indexBuffers.find(rayCount);
+    if (it != m_indexBuffers.end())
+        return it->second;
+
+    // Generate the indices
+    std::vector<GLuint> indices = GhostAttribHelpers::computeGridIndices(rayCount);
+
+    // Upload them into a new buffer; the render vertex array must not be
+    // bound, so that its element buffer binding isn't modified
+    GLuint indexBuffer;
+    glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    m_indexBuffers[rayCount] = indexBuffer;
+    return indexBuffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GLuint RayTraceGhostAlgorithm::getRenderShader(RenderMode renderMode, ShadingMode shadingMode, bool batched)
+{
+    // Look for an existing one
+    int key = ((batched ? 1 : 0) * 16 + (int) renderMode) * 16 + (int) shadingMode;
+    auto it = m_renderShaders.find(key);
+    if (it != m_renderShaders.end())
+        return it->second;
+
+    // Specialize the source for the modes
+    GLHelpers::ShaderSource source = batched ? m_batchRenderSource : m_renderSource;
+    source.m_defines.push_back(RENDER_MODE_DEFINES[(int) renderMode]);
+    source.m_defines.push_back(SHADING_MODE_DEFINES[(int) shadingMode]);
+
+    GLuint program = ProgramCache::createProgram(m_programCache, source);
+    reflectProgram(program);
+
+    m_renderShaders[key] = program;
+    return program;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::updateLensTables()
+{
+    // Collect every system parameter the tables depend on; the elements can
+    // be edited in place, so a plain comparison is the only reliable check
+    std::vector<float> source =
+    {
+        m_opticalSystem->getFilmWidth(),
+        m_opticalSystem->getFilmHeight(),
+        m_opticalSystem->getFnumber(),
+        m_opticalSystem->getEffectiveFocalLength(),
+    };
+    for (const auto& lens: m_opticalSystem->getElements())
+    {
+        source.push_back((float) lens.getType());
+        source.push_back(lens.getHeight());
+        source.push_back(lens.getThickness());
+        source.push_back(lens.getRadiusOfCurvature());
+        source.push_back(lens.getIndexOfRefraction());
+        source.push_back(lens.getAbbeNumber());
+        source.push_back(lens.getCoatingLambda());
+    }
+
+    // Throw away the outdated tables
+    if (source != m_lensTableSource)
+    {
+        releaseLensTables();
+        m_lensTableSource = std::move(source);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GLuint RayTraceGhostAlgorithm::getLensTable(float lambda)
+{
+    // Look for an existing one
+    auto it = m_lensTables.find(lambda);
+    if (it != m_lensTables.end())
+        return it->second;
+
+    // Build the table
+    LensTableData table = buildLensTable(*m_opticalSystem, lambda);
+
+    // Upload it into a new buffer
+    GLuint lensTable;
+    glGenBuffers(1, &lensTable);
+    glBindBuffer(GL_UNIFORM_BUFFER, lensTable);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LensTableData), &table, GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    m_lensTables[lambda] = lensTable;
+    return lensTable;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::releaseLensTables()
+{
+    for (const auto& lensTable: m_lensTables)
+    {
+        glDeleteBuffers(1, &lensTable.second);
+    }
+    m_lensTables.clear();
+    m_lensTableSource.clear();
+
+    for (const auto& bakedShader: m_bakedTraceShaders)
+    {
+        ProgramCache::releaseProgram(m_programCache, bakedShader.second);
+    }
+    m_bakedTraceShaders.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GLuint RayTraceGhostAlgorithm::getBakedTraceShader(float lambda, const Ghost& ghost)
+{
+    // Fall back to the generic program if there is nothing to bake
+    int length = (int) glm::min(m_opticalSystem->getElementCount() + 1, (size_t) MAX_ELEMENTS);
+    int pathLength = computeGhostPathLength(length, ghost);
+    if (pathLength == 0)
+        return m_traceShader;
+
+    // Look for an existing one
+    auto key = std::make_pair(lambda, pathLength);
+    auto it = m_bakedTraceShaders.find(key);
+    if (it != m_bakedTraceShaders.end())
+        return it->second;
+
+    // Bake the lens table and the path length
+    std::string bakedSource = generateBakedSource(buildLensTable(*m_opticalSystem, lambda), pathLength);
+
+    // Insert it in front of the uniform declarations, which it replaces
+    GLHelpers::ShaderSource source = m_traceSource;
+    for (auto& stage: source.m_source)
+    {
+        auto uniforms = std::find(stage.second.begin(), stage.second.end(), 
+            Shaders::RayTraceGhostAlgorithm_RenderGhost_Uniforms);
+        stage.second.insert(uniforms, bakedSource.c_str());
+    }
+
+    GLuint program = ProgramCache::createProgram(m_programCache, source);
+    reflectProgram(program);
+
+    m_bakedTraceShaders[key] = program;
+    return program;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::bakeGhosts(GhostListView ghosts)
+{
+    // Make sure the lens tables match the optical system
+    updateLensTables();
+
+    for (const auto& ghost: ghosts)
+    {
+        if (!m_opticalSystem->isValidGhost(ghost))
+            continue;
+
+        for (int ch = 0; ch < ghost.getMinimumChannels() && ch < (int) m_lambdas.size(); ++ch)
+        {
+            getBakedTraceShader(m_lambdas[ch], ghost);
+        }
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-GhostList RayTraceGhostAlgorithm::computeGhostAttributes(
-	const GhostList& ghosts, const GhostAttribComputeParams& computeParams)
+GhostList RayTraceGhostAlgorithm::computeGhostAttributes(const GhostList& ghosts,
+	const GhostAttribComputeParams& computeParams, GhostAttribComputeStats* stats)
 {
-	// Make a local copy of the original ghost list that we are going to modify
-	auto result = ghosts;
+    // Make sure the lens tables match the optical system
+    updateLensTables();
 
     // Find the aperture mask texture
     GLuint apertureTexture = 0;
@@ -159,440 +896,374 @@ GhostList RayTraceGhostAlgorithm::computeGhostAttributes(
 	parameters.m_lightSource.setDiffuseIntensity(1.0f);
 
 	parameters.m_mask = apertureTexture;
-	parameters.m_shader = m_precomputeShader;
 	parameters.m_intensityScale = 1.0f;
 	parameters.m_renderMode = RenderMode::PROJECTED_GHOST;
 	parameters.m_shadingMode = ShadingMode::SHADED;
 	parameters.m_radiusClip = 100000.0f;
 	parameters.m_distanceClip = 100000.0f;
-	
-	// Highest ray grid size that is used while bounding
-	int maxRaysBounds = *std::max_element(
-		computeParams.m_boundingRays.begin(), computeParams.m_boundingRays.end());
-	int maxRaysPresets = *std::max_element(
-		computeParams.m_rayPresets.begin(), computeParams.m_rayPresets.end());
-	int maxRays = std::max(maxRaysBounds, maxRaysPresets);
-
-	// Compute the maximum buffer size needed, and per-ghost byte offsets into
-	// the buffer
-	std::vector<std::array<int, 2>> byteOffsets(ghosts.size());
-	std::vector<std::array<int, 2>> vertexOffsets(ghosts.size());
-	GLint vertexSize = 0;
-	GLint bufferSize = 0;
-	
-	for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
-	{
-		// Skip invalid ghosts
-		if (!m_opticalSystem->isValidGhost(ghosts[ghostId]))
-		{
-			continue;
-		}
-
-		// Per-channel vertices and bytes needed
-		int vertices = (maxRays - 1) * (maxRays - 1) * 6;
-		int bytes = vertices * sizeof(PerVertexData);
 
-		// Total vertices and bytes per ghost
-		int totalVerts = vertices * (int) computeParams.m_lambdas.size();
-		int totalBytes = bytes * (int) computeParams.m_lambdas.size();
-
-		// Per-channel offsets and sizes
-		vertexOffsets[ghostId] = { vertexSize, vertices };
-		byteOffsets[ghostId] = { bufferSize, bytes };
-
-		// Total number of vertices and bytes needed
-		vertexSize += totalVerts;
-		bufferSize += totalBytes;
+	// Run the computations with the selected backend
+	if (m_precomputeBackend == PrecomputeBackend::COMPUTE_SHADER && isComputeBackendSupported())
+	{
+		return computeGhostAttributesCompute(ghosts, computeParams, parameters, stats);
 	}
+	return computeGhostAttributesTransformFeedback(ghosts, computeParams, parameters, stats);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GhostList RayTraceGhostAlgorithm::computeGhostAttributesTransformFeedback(const GhostList& ghosts,
+	const GhostAttribComputeParams& computeParams, RenderParameters& parameters,
+	GhostAttribComputeStats* stats)
+{
+	// Number of channels per ghost
+	int numChannels = (int) computeParams.m_lambdas.size();
 
-	// Create and initialize the read-back buffer
-	GLuint readBackBuffer;
-	glGenBuffers(1, &readBackBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, readBackBuffer);
-	glBufferData(GL_ARRAY_BUFFER, bufferSize, nullptr, GL_STATIC_READ);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// Make sure the readback buffers can hold at least one ghost with the
+	// largest ray grid
+	reserveReadbackRing(glm::max(READBACK_SLOT_VERTICES, numChannels *
+		GhostAttribHelpers::gridVertexCount(GhostAttribHelpers::maxRayCount(computeParams))));
 	
-	// Bind the precomputation shader
-	glUseProgram(m_precomputeShader);
+	// Bind the ray tracing shader
+	glUseProgram(m_traceShader);
     glBindVertexArray(m_vao);
 
 	// Disable rasterization
 	glEnable(GL_RASTERIZER_DISCARD);
 
-	// Compute ghost bounding information
-	for (int passId = 0; passId < computeParams.m_boundingRays.size(); ++passId)
+	// Run the attribute computations, using transform feedback to trace the rays
+	auto result = GhostAttribHelpers::computeGhostAttributes(
+		*m_opticalSystem, ghosts, computeParams,
+		[&](const GhostList& current, const std::vector<bool>& active, int numRays, auto analyse)
 	{
-		// Extract the current grid size
-		int numRays = computeParams.m_boundingRays[passId];
-		int numVertices = (numRays - 1) * (numRays - 1) * 6;
-
 		// Set it as the fixed ray grid size
 		parameters.m_fixedRayCount = numRays;
 
-		// Process each ghost
-		for (int ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+		// Number of vertices per channel and per ghost
+		int channelVertices = GhostAttribHelpers::gridVertexCount(numRays);
+		int ghostVertices = channelVertices * numChannels;
+
+		// Number of ghosts that fit into a single readback buffer
+		int chunkSize = m_readbackSlotSize / ghostVertices;
+
+		// The ghosts traced into each readback buffer, in the order of their submission
+		std::deque<std::pair<int, std::vector<size_t>>> inFlight;
+		int nextSlot = 0;
+
+		// Waits for the oldest buffer in flight and processes its contents
+		auto retireChunk = [&]()
 		{
-			// Skip invalid or previously detected invisible ghosts
-			if (!m_opticalSystem->isValidGhost(result[ghostId]) || 
-				result[ghostId].getPupilBounds()[1][0] < 0.0f)
+			int slotId = inFlight.front().first;
+			std::vector<size_t> chunk = std::move(inFlight.front().second);
+			inFlight.pop_front();
+
+			ReadbackSlot& slot = m_readbackRing[slotId];
+
+			// Wait for the GPU to finish writing the buffer
+			auto waitStart = std::chrono::steady_clock::now();
+			GLenum waitResult;
+			do
 			{
-				continue;
+				waitResult = glClientWaitSync(slot.m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, READBACK_WAIT_TIMEOUT);
+			} while (waitResult == GL_TIMEOUT_EXPIRED);
+
+			// The wait fails on GL errors; fall back to waiting for every command,
+			// so the buffer is never read while it is still being written
+			if (waitResult == GL_WAIT_FAILED)
+			{
+				glFinish();
 			}
+			auto waitEnd = std::chrono::steady_clock::now();
 
-			// Set the ghost we are rendering
-			parameters.m_ghost = result[ghostId];
+			glDeleteSync(slot.m_fence);
+			slot.m_fence = 0;
 
-			// Process each channel
-			for (int chId = 0; chId < computeParams.m_lambdas.size(); ++chId)
+			// The GPU is still busy if the next buffer isn't finished yet
+			bool overlapped = false;
+			if (!inFlight.empty())
 			{
-				// Set the current wavelength
-				parameters.m_lambda = computeParams.m_lambdas[chId];
+				GLint status = GL_SIGNALED;
+				glGetSynciv(m_readbackRing[inFlight.front().first].m_fence, GL_SYNC_STATUS, 1, nullptr, &status);
+				overlapped = status == GL_UNSIGNALED;
+			}
 
-				// Extract the corresponding byte offset and byte size
-				auto byteOffset = byteOffsets[ghostId][0];
-				auto byteSize = byteOffsets[ghostId][1];
+			// Access the traced vertices
+			const PerVertexData* vertices = slot.m_vertices;
+			if (vertices == nullptr)
+			{
+				glBindBuffer(GL_COPY_READ_BUFFER, slot.m_buffer);
+				vertices = (const PerVertexData*) glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+					chunk.size() * ghostVertices * sizeof(PerVertexData), GL_MAP_READ_BIT);
+			}
 
-				// Bind the transform feedback buffer
-				glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 
-					readBackBuffer, byteOffset + chId * byteSize, byteSize);
+			// Process the generated ray data
+			for (size_t i = 0; i < chunk.size(); ++i)
+			{
+				analyse(chunk[i], vertices + i * ghostVertices, channelVertices);
+			}
+			auto analysisEnd = std::chrono::steady_clock::now();
 
-				// Start the transform feedback
-				glBeginTransformFeedback(GL_TRIANGLES);
+			// Unmap the buffer
+			if (slot.m_vertices == nullptr)
+			{
+				glUnmapBuffer(GL_COPY_READ_BUFFER);
+				glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			}
 
-				// Render the ghost
-				renderGhostChannel(parameters);
+			// Update the timing statistics
+			if (stats != nullptr)
+			{
+				double analysisTime = std::chrono::duration<double>(analysisEnd - waitEnd).count();
 
-				// End the transform feedback
-				glEndTransformFeedback();
+				stats->m_gpuWaitTime += std::chrono::duration<double>(waitEnd - waitStart).count();
+				stats->m_cpuAnalysisTime += analysisTime;
+				if (overlapped)
+					stats->m_intraPassOverlapTime += analysisTime;
 			}
-		}
-		
-		// Read back the values
-		glMemoryBarrier(GL_TRANSFORM_FEEDBACK_BARRIER_BIT);
-		glBindBuffer(GL_ARRAY_BUFFER, readBackBuffer);
-		PerVertexData* vertices = 
-			(PerVertexData*) glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
-
-		// Process the generated ray data to find the bounds
-		for (int ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+		};
+
+		// Traces a set of ghosts into the next readback buffer
+		auto submitChunk = [&](std::vector<size_t>& chunk)
 		{
-			// Output bounding information - note that this is temporarily stored
-			// in a min-max corner format, instead of corner-size, to help
-			// with the computations
-			Ghost::BoundingRect pupilBounds = { glm::vec2(1.0f), glm::vec2(-1.0f) };
-			Ghost::BoundingRect sensorBounds = { glm::vec2(1.0f), glm::vec2(-1.0f) };
-
-			// Go through each channel
-			for (int channelId = 0; channelId < computeParams.m_lambdas.size(); ++channelId)
+			// Free up a buffer, if all of them are in use
+			if (inFlight.size() == READBACK_RING_SIZE)
 			{
-				// Process each triangle
-				for (int triangleId = 0; triangleId < numVertices / 3; ++triangleId)
-				{
-					// Index of the first vertex
-					int baseVertexId = vertexOffsets[ghostId][0] + 
-						channelId * vertexOffsets[ghostId][1] + triangleId * 3;
-
-					// Keep the full triangle if any of its vertices are 'valid'
-					bool keep = false;
-					for (int vertexId = 0; vertexId < 3; ++vertexId)
-					{
-						// Extract the current vertex
-						int actualVertexId = baseVertexId + vertexId;
-						const auto& vertex = vertices[actualVertexId];
-
-						keep = keep || (
-							vertex.m_radius <= computeParams.m_radiusClip && 
-							vertex.m_intensity >= computeParams.m_intensityClip && 
-							vertex.m_irisDistance <= computeParams.m_distanceClip);
-					}
-
-					// Skip the full triangle if all of its vertices are invalid
-					if (!keep)
-						continue;
-
-					// Update the bounds using all 3 vertices
-					for (int vertexId = 0; vertexId < 3; ++vertexId)
-					{
-						// Extract the current vertex
-						int actualVertexId = baseVertexId + vertexId;
-						const auto& vertex = vertices[actualVertexId];
-
-						pupilBounds[0] = glm::min(pupilBounds[0], vertex.m_parameter);
-						pupilBounds[1] = glm::max(pupilBounds[1], vertex.m_parameter);
-
-						sensorBounds[0] = glm::min(sensorBounds[0], vertex.m_position);
-						sensorBounds[1] = glm::max(sensorBounds[1], vertex.m_position);
-					}
-				}
+				retireChunk();
 			}
 
-			// Make sure the ghost is visible
-			if (pupilBounds[1][0] < pupilBounds[0][0] ||
-				(pupilBounds[0][0] > 1.0f && pupilBounds[0][1] > 1.0f) || 
-				(pupilBounds[1][0] < -1.0f && pupilBounds[1][1] < -1.0f))
+			int slotId = nextSlot;
+			nextSlot = (nextSlot + 1) % READBACK_RING_SIZE;
+
+			ReadbackSlot& slot = m_readbackRing[slotId];
+
+			// Process each ghost
+			for (size_t i = 0; i < chunk.size(); ++i)
 			{
-				pupilBounds[0] = pupilBounds[1] = glm::vec2(-1.0f);
-				sensorBounds[0] = sensorBounds[1] = glm::vec2(-1.0f);
+				// Set the ghost we are rendering
+				parameters.m_ghost = current[chunk[i]];
+
+				// Process each channel
+				for (int chId = 0; chId < numChannels; ++chId)
+				{
+					// Set the current wavelength
+					parameters.m_lambda = computeParams.m_lambdas[chId];
 
-				result[ghostId].setPupilBounds(pupilBounds);
-				result[ghostId].setSensorBounds(sensorBounds);
+					// Extract the corresponding byte offset and byte size
+					auto byteOffset = (i * ghostVertices + chId * channelVertices) * sizeof(PerVertexData);
+					auto byteSize = channelVertices * sizeof(PerVertexData);
+
+					// Bind the transform feedback buffer
+					glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 
+						slot.m_buffer, byteOffset, byteSize);
+
+					// Trace the rays of the ghost
+					traceGhostChannel(parameters);
+				}
 			}
 
-			// Store the computed bounds
-			else
+			// Mark the end of the commands writing the buffer, and make sure
+			// they start executing
+			slot.m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+
+			inFlight.emplace_back(slotId, std::move(chunk));
+			chunk.clear();
+		};
+
+		// Trace the active ghosts in chunks, processing the previous chunks
+		// while the GPU works on the next ones
+		std::vector<size_t> chunk;
+		for (size_t ghostId = 0; ghostId < current.size(); ++ghostId)
+		{
+			// Skip the ghosts that do not take part in this pass
+			if (!active[ghostId])
 			{
-				pupilBounds[1] = pupilBounds[1] - pupilBounds[0];
-				sensorBounds[1] = sensorBounds[1] - sensorBounds[0];
+				continue;
+			}
 
-				result[ghostId].setPupilBounds(pupilBounds);
-				result[ghostId].setSensorBounds(sensorBounds);
+			chunk.push_back(ghostId);
+			if (chunk.size() == (size_t) chunkSize)
+			{
+				submitChunk(chunk);
 			}
 		}
+		if (!chunk.empty())
+		{
+			submitChunk(chunk);
+		}
 
-		// Unmap the buffer
-		glUnmapBuffer(GL_ARRAY_BUFFER);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-	}
+		// Process the remaining chunks
+		while (!inFlight.empty())
+		{
+			retireChunk();
+		}
+	}, stats);
 
-	// Create the vectors that we will be using during the bounding process
-	std::vector<float> triangleAreas;   // Holds the area of each valid triangle
-	std::vector<float> areaDifferences; // Holds the difference between each
-	                                    // triangle area and the average area
-	std::vector<float> totalAreas;      // Holds the total areas for each channel
-	std::vector<float> avgAreas;        // Holds the average areas for each channel
-	std::vector<float> variances;       // Holds the per-channel variances
-
-	triangleAreas.reserve((maxRaysPresets - 1) * (maxRaysPresets - 1) * 2);
-	areaDifferences.reserve((maxRaysPresets - 1) * (maxRaysPresets - 1) * 2);
-	totalAreas.reserve(computeParams.m_lambdas.size());
-	avgAreas.reserve(computeParams.m_lambdas.size());
-	variances.reserve(computeParams.m_lambdas.size());
-
-	// Set the ray grid sizes to 0 for each ghost, to indicate that it needs
-	// to be processed
-	for (int ghostId = 0; ghostId < ghosts.size(); ++ghostId)
-	{
-		result[ghostId].setMinimumRays(0);
-		result[ghostId].setOptimalRays(0);
-	}
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
 
-	// Compute bounding geometry
-	for (int passId = 0; passId < computeParams.m_rayPresets.size(); ++passId)
-	{
-		// Extract the current grid size
-		int numRays = computeParams.m_rayPresets[passId];
-		int numVertices = (numRays - 1) * (numRays - 1) * 6;
+	// Re-enable rasterization
+	glDisable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(0);
 
+	// Return the refreshed ghost list
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+GhostList RayTraceGhostAlgorithm::computeGhostAttributesCompute(const GhostList& ghosts,
+	const GhostAttribComputeParams& computeParams, RenderParameters& parameters,
+	GhostAttribComputeStats* stats)
+{
+	// Compute the per-ghost vertex offsets into the vertex buffer
+	auto layout = GhostAttribHelpers::computeVertexLayout(
+		*m_opticalSystem, ghosts, computeParams);
+
+	// Number of channels per ghost
+	size_t numChannels = computeParams.m_lambdas.size();
+
+	// Create the vertex buffer, which is never read back
+	GLuint vertexBuffer;
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertexBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 
+		glm::max(layout.m_totalVertices, 1) * sizeof(PerVertexData), nullptr, GL_DYNAMIC_COPY);
+
+	// Create the buffer describing the reduced channels
+	GLuint itemBuffer;
+	glGenBuffers(1, &itemBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, itemBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 
+		glm::max(ghosts.size() * numChannels, size_t(1)) * sizeof(glm::ivec2), nullptr, GL_DYNAMIC_DRAW);
+
+	// Create the reduction result buffer
+	GLuint recordBuffer;
+	glGenBuffers(1, &recordBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, glm::max(ghosts.size() * numChannels, size_t(1)) * 
+		sizeof(GhostAttribHelpers::ChannelReduction), nullptr, GL_DYNAMIC_READ);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, itemBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, recordBuffer);
+
+	// The reduced channels of the current pass
+	std::vector<glm::ivec2> items;
+
+	// Run the attribute computations, reducing the traced rays on the GPU
+	auto result = GhostAttribHelpers::computeGhostAttributesReduced(
+		*m_opticalSystem, ghosts, computeParams,
+		[&](const GhostList& current, const std::vector<bool>& active, int numRays,
+			GhostAttribHelpers::ReductionType type, 
+			std::vector<GhostAttribHelpers::ChannelReduction>& reductions)
+	{
 		// Set it as the fixed ray grid size
 		parameters.m_fixedRayCount = numRays;
 
-		// Process each ghost
-		for (int ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+		// Number of work groups needed to trace a channel
+		int numVertices = GhostAttribHelpers::gridVertexCount(numRays);
+		GLuint traceGroups = (GLuint) ((numVertices + TRACE_GROUP_SIZE - 1) / TRACE_GROUP_SIZE);
+
+		// Trace the rays of each active ghost channel
+		glUseProgram(m_computeTraceShader);
+		items.clear();
+
+		for (size_t ghostId = 0; ghostId < current.size(); ++ghostId)
 		{
-			// Skip invalid, invisible, and already finished ghosts
-			if (!m_opticalSystem->isValidGhost(result[ghostId]) || 
-				result[ghostId].getPupilBounds()[1][0] < 0.0f ||
-				result[ghostId].getMinimumRays() != 0)
+			// Skip the ghosts that do not take part in this pass
+			if (!active[ghostId])
 			{
 				continue;
 			}
 
 			// Set the ghost we are rendering
-			parameters.m_ghost = result[ghostId];
+			parameters.m_ghost = current[ghostId];
 
 			// Process each channel
-			for (int chId = 0; chId < computeParams.m_lambdas.size(); ++chId)
+			for (size_t chId = 0; chId < numChannels; ++chId)
 			{
 				// Set the current wavelength
 				parameters.m_lambda = computeParams.m_lambdas[chId];
 
-				// Extract the corresponding byte offset and byte size
-				auto byteOffset = byteOffsets[ghostId][0];
-				auto byteSize = byteOffsets[ghostId][1];
-
-				// Bind the transform feedback buffer
-				glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 
-					readBackBuffer, byteOffset + chId * byteSize, byteSize);
+				// First vertex of the channel
+				GLint vertexOffset = layout.m_vertexOffsets[ghostId][0] + 
+					(GLint) chId * layout.m_vertexOffsets[ghostId][1];
 
-				// Start the transform feedback
-				glBeginTransformFeedback(GL_TRIANGLES);
+				// Trace the rays of the channel
+				uploadUniforms(parameters);
+				GLHelpers::uploadUniform(m_computeTraceUniforms, "iVertexOffset", vertexOffset);
+				glDispatchCompute(traceGroups, 1, 1);
 
-				// Render the ghost
-				renderGhostChannel(parameters);
-
-				// End the transform feedback
-				glEndTransformFeedback();
+				// Store the reduction item
+				items.push_back(glm::ivec2(vertexOffset, (GLint) (ghostId * numChannels + chId)));
 			}
 		}
-		
-		// Read back the values
-		glMemoryBarrier(GL_TRANSFORM_FEEDBACK_BARRIER_BIT);
-		glBindBuffer(GL_ARRAY_BUFFER, readBackBuffer);
-		PerVertexData* vertices = 
-			(PerVertexData*) glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
-
-		// Process the generated ray data to find the rest of the attributes
-		for (int ghostId = 0; ghostId < ghosts.size(); ++ghostId)
-		{
-			// Skip invalid, invisible, and already finished ghosts
-			if (!m_opticalSystem->isValidGhost(result[ghostId]) || 
-				result[ghostId].getPupilBounds()[1][0] < 0.0f ||
-				result[ghostId].getMinimumRays() != 0)
-			{
-				continue;
-			}
-
-            // Clear the variance vector
-            totalAreas.clear();
-            avgAreas.clear();
-            variances.clear();
-			float totalIntensity = 0.0f;
-			int validVertices = 0;
-
-			// Go through each channel
-			for (int channelId = 0; channelId < computeParams.m_lambdas.size(); ++channelId)
-			{
-				// Clear the temporary buffer holding triangle information
-				triangleAreas.clear();
-
-				// Process each vertex
-				for (int vertexId = 0; vertexId < numVertices; ++vertexId)
-				{
-					int actualVertexId = vertexOffsets[ghostId][0] + 
-						channelId * vertexOffsets[ghostId][1] + vertexId;
-					const auto& vertex = vertices[actualVertexId];
-
-					if (vertex.m_radius <= computeParams.m_radiusClip && 
-						vertex.m_intensity >= computeParams.m_intensityClip && 
-						vertex.m_irisDistance <= computeParams.m_distanceClip)
-					{
-						totalIntensity += vertex.m_intensity;
-						++validVertices;
-					}
-				}
-
-				// Process each triangle
-				for (int triangleId = 0; triangleId < numVertices / 3; ++triangleId)
-				{
-					// Index of the first vertex
-					int baseVertexId = vertexOffsets[ghostId][0] + 
-						channelId * vertexOffsets[ghostId][1] + triangleId * 3;
-
-					// Only keep those triangles that are fully valid (a.k.a.
-					// all of its vertices are valid) - this should minimize
-					// the effect of degenerate values on the output
-					bool keep = true;
-					for (int vertexId = 0; vertexId < 3; ++vertexId)
-					{
-						// Extract the current vertex
-						int actualVertexId = baseVertexId + vertexId;
-						const auto& vertex = vertices[actualVertexId];
-
-						keep = keep && (
-							vertex.m_radius <= computeParams.m_radiusClip && 
-							vertex.m_intensity >= computeParams.m_intensityClip && 
-							vertex.m_irisDistance <= computeParams.m_distanceClip);
-					}
-
-					// Skip a degenerate triangle
-					if (!keep)
-					{
-						continue;
-					}
-
-					// Extract the triangle vertices
-					glm::vec2 triVertices[] =
-					{
-						vertices[baseVertexId + 0].m_position,
-						vertices[baseVertexId + 1].m_position,
-						vertices[baseVertexId + 2].m_position,
-					};
-					
-					// Compute the area of the projected triangle
-					float triangleArea = 0.5f * glm::abs(
-						triVertices[0].x * (triVertices[1].y - triVertices[2].y) +
-						triVertices[1].x * (triVertices[2].y - triVertices[0].y) +
-						triVertices[2].x * (triVertices[0].y - triVertices[1].y));
-
-					// Store it
-					triangleAreas.push_back(triangleArea);
-				}
-				
-				// Skip the remaining computations if the channel is fully invisible
-				if (triangleAreas.empty())
-					continue;
-
-				// Compute the total area
-				float totalArea = std::accumulate(
-					triangleAreas.begin(), triangleAreas.end(), 0.0f);
-				totalAreas.push_back(totalArea);
-
-				// Compute the avg area
-				float avgArea = totalArea / triangleAreas.size();
-				avgAreas.push_back(avgArea);
-
-				// Compute the variance
-				areaDifferences.resize(triangleAreas.size());
-				std::transform(
-					triangleAreas.begin(), triangleAreas.end(), areaDifferences.begin(), 
-					[&] (float area) { return glm::pow(area - avgArea, 2.0f); });
-
-				float totalVariance = std::accumulate(
-					areaDifferences.begin(), areaDifferences.end(), 0.0f);
-				float variance = glm::sqrt(totalVariance / areaDifferences.size());
-				variances.push_back(variance);
-			}
-
-			// Compute the average variance
-			float avgVariance = std::accumulate(
-				variances.begin(), variances.end(), 0.0f) / variances.size();
-
-			// Area of an 'ideal' triangle - that is, if the ghost projection
-			// was equally distributed over the sensor bounds, then this would
-			// be the area of a single triangle cell
-			float cellArea = 0.5f * 
-				(result[ghostId].getSensorBounds()[1].x / (numRays - 1)) *
-				(result[ghostId].getSensorBounds()[1].y / (numRays - 1));
-
-			// Compute the average variance's ratio to the ideal cell area
-			float varianceToCellArea = avgVariance / cellArea;
 
-			// The current variance value to use for comparison.
-            //float currentVariance = varianceToCellArea;
-			float currentVariance = avgVariance;
-
-			// Store the grid size as the result if the variance is small enough
-			if (currentVariance <= computeParams.m_targetVariance ||
-				numRays == computeParams.m_rayPresets.back())
-			{
-				result[ghostId].setMinimumRays(numRays);
-				result[ghostId].setOptimalRays(numRays);
-				result[ghostId].setAverageIntensity(totalIntensity / validVertices);
-			}
+		// Nothing else to do if every ghost is inactive
+		if (items.empty())
+			return;
+
+		// Upload the reduced items and the initial reduction values
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, itemBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, items.size() * sizeof(glm::ivec2), items.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 
+			reductions.size() * sizeof(GhostAttribHelpers::ChannelReduction), reductions.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		// Reduce the traced rays; the area variance needs the average area,
+		// which is computed by a separate dispatch
+		glUseProgram(m_computeReduceShader);
+		GLHelpers::uploadUniform(m_computeReduceUniforms, "iRayCount", numRays);
+		GLHelpers::uploadUniform(m_computeReduceUniforms, "fRadiusClip", computeParams.m_radiusClip);
+		GLHelpers::uploadUniform(m_computeReduceUniforms, "fIrisClip", computeParams.m_distanceClip);
+		GLHelpers::uploadUniform(m_computeReduceUniforms, "fIntensityClip", computeParams.m_intensityClip);
+
+		std::vector<GLint> reductionTypes;
+		if (type == GhostAttribHelpers::ReductionType::BOUNDS)
+			reductionTypes = { REDUCTION_BOUNDS };
+		else
+			reductionTypes = { REDUCTION_AREAS, REDUCTION_VARIANCE };
+
+		for (GLint reductionType: reductionTypes)
+		{
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			GLHelpers::uploadUniform(m_computeReduceUniforms, "iReductionType", reductionType);
+			glDispatchCompute((GLuint) items.size(), 1, 1);
 		}
 
-		// Unmap the buffer
-		glUnmapBuffer(GL_ARRAY_BUFFER);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-	}
+		// Read back the reduced values
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 
+			reductions.size() * sizeof(GhostAttribHelpers::ChannelReduction), reductions.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}, stats);
 
-	// Re-enable rasterization
-	glDisable(GL_RASTERIZER_DISCARD);
-    glBindVertexArray(0);
+	// Unbind and release the buffers
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
 
-	// Release the vertex buffer
-	glDeleteBuffers(1, &readBackBuffer);
+	glDeleteBuffers(1, &vertexBuffer);
+	glDeleteBuffers(1, &itemBuffer);
+	glDeleteBuffers(1, &recordBuffer);
 
 	// Return the refreshed ghost list
 	return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void RayTraceGhostAlgorithm::renderGhostChannel(const RenderParameters& parameters)
+int RayTraceGhostAlgorithm::getRayCount(const RenderParameters& parameters)
+{
+	return parameters.m_fixedRayCount != 0 ? 
+		parameters.m_fixedRayCount :
+		parameters.m_ghost.getMinimumRays();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::computeGhostParams(const RenderParameters& parameters,
+	GhostParamsData& ghostParams) const
 {	
-	// Calculate the entrance plane's distance from the sensor plane 
-	float sensorDistance = m_opticalSystem->getSensorDistance();
-		
 	// Convert it to spherical angles
 	glm::vec3 toLight = -parameters.m_lightSource.getIncidenceDirection();
 	float rotation = glm::atan(toLight.y, toLight.x);
@@ -600,66 +1271,6 @@ void RayTraceGhostAlgorithm::renderGhostChannel(const RenderParameters& paramete
 
 	// Lambertian shading term
 	float lambert = glm::max(glm::dot(toLight, glm::vec3(0.0f, 0.0f, -1.0f)), 0.0f);
-	
-	// Compute the effective aperture length
-	float apertureHeight = m_opticalSystem->getEffectiveApertureHeight();
-
-    // Bind the aperture texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, parameters.m_mask);
-	GLHelpers::uploadUniform(parameters.m_shader, "sAperture", 0);
-
-	// Temporary vectors for the lens parameters
-	auto elementCount = m_opticalSystem->getElementCount() + 1;
-
-	static const int MAX_ELEMENTS = 64;
-
-	float heights[MAX_ELEMENTS] = { 0.0f };
-	float curvatures[MAX_ELEMENTS] = { 0.0f };
-	float apertures[MAX_ELEMENTS] = { 0.0f };
-	float thicknesses[MAX_ELEMENTS] = { 0.0f };
-	glm::vec3 centers[MAX_ELEMENTS] = { glm::vec3(0.0f) };
-	glm::vec3 refractions[MAX_ELEMENTS] = { glm::vec3(1.0f) };
-
-	// Fill the lens parameter arrays
-	float lensDistance = sensorDistance;
-	for (int lensId = 1; lensId < elementCount; ++lensId)
-	{
-		// Reference to the current lens
-		const auto& lens = (*m_opticalSystem)[lensId - 1];
-
-		// Set its attributes
-		curvatures[lensId] = lens.getRadiusOfCurvature();
-		heights[lensId] = lens.getHeight();
-		apertures[lensId] = 0.0f;
-		centers[lensId].x = 0.0f;
-		centers[lensId].y = 0.0f;
-		centers[lensId].z = lensDistance - lens.getRadiusOfCurvature();
-		refractions[lensId].x = refractions[lensId - 1].z;
-		refractions[lensId].y = lens.getCoatingLambda();
-		refractions[lensId].z = lens.computeIndexOfRefraction(parameters.m_lambda);
-		thicknesses[lensId] = lens.getCoatingLambda() / 4.0f / glm::max(
-			glm::sqrt(refractions[lensId][0] * refractions[lensId][2]), 
-			refractions[lensId][1]);
-
-		// Special treatment for the special elements
-		if (lens.getType() == OpticalSystemElement::ElementType::APERTURE_STOP)
-		{
-			curvatures[lensId] = 0.0f;
-			heights[lensId] = apertureHeight;
-			apertures[lensId] = apertureHeight;
-		}
-		else if (lens.getType() == OpticalSystemElement::ElementType::SENSOR)
-		{
-			curvatures[lensId] = 0.0f;
-			heights[lensId] = glm::min(m_opticalSystem->getFilmWidth(), 
-				m_opticalSystem->getFilmHeight());
-			apertures[lensId] = 0.0f;
-		}
-
-		// The next element is closer
-		lensDistance -= lens.getThickness();
-	}
 
 	// Compute the remaining attributes
 	glm::mat4 rotMat = glm::rotate(rotation, glm::vec3(0.0f, 0.0f, 1.0f));
@@ -667,106 +1278,296 @@ void RayTraceGhostAlgorithm::renderGhostChannel(const RenderParameters& paramete
 
 	// Ghost interface indices (increment by one because of the empty
 	// space before the front element)
-	GLint ghostIndices[16];
-	for (int i = 0; i < parameters.m_ghost.getLength(); ++i)
+	for (int i = 0; i < 16; ++i)
 	{
-		ghostIndices[i] = parameters.m_ghost[i] + 1;
+		ghostParams.m_ghostIndices[i / 4][i % 4] = i < (int) parameters.m_ghost.getLength() ?
+			parameters.m_ghost[i] + 1 : 0;
 	}
 
-	// Number of interfaces (including air before)
-	GLint numIndices = (GLint) parameters.m_ghost.getLength();
-	
-	// Number of interfaces (including air before)
-	GLint elementLength = (GLint) elementCount;
+	// Number of reflecting interfaces
+	ghostParams.m_numIndices = (GLint) parameters.m_ghost.getLength();
 	
 	// Ray grid dimensions
-	GLint rayCount = parameters.m_fixedRayCount != 0 ? 
-		parameters.m_fixedRayCount :
-		parameters.m_ghost.getMinimumRays();
+	ghostParams.m_rayCount = getRayCount(parameters);
 	
 	// Direction of the ray
-	glm::vec3 rayDir = glm::vec3(rotMat * glm::vec4(baseDir, 1.0f));
+	ghostParams.m_rayDir = glm::vec3(rotMat * glm::vec4(baseDir, 1.0f));
 	
 	// Center of the ray grid
-	glm::vec2 gridCenter = glm::mat2(rotMat) * (
+	ghostParams.m_gridCenter = glm::mat2(rotMat) * (
 		parameters.m_ghost.getPupilBounds()[0] + 
 		parameters.m_ghost.getPupilBounds()[1] / 2.0f);
 	
 	// Size of the ray grid
-	glm::vec2 gridSize = parameters.m_ghost.getPupilBounds()[1] / 2.0f;
+	ghostParams.m_gridSize = parameters.m_ghost.getPupilBounds()[1] / 2.0f;
 	
 	// Center of the ghost image
-	glm::vec2 imageCenter = glm::mat2(rotMat) * (
+	ghostParams.m_imageCenter = glm::mat2(rotMat) * (
 		parameters.m_ghost.getSensorBounds()[0] + 
 		parameters.m_ghost.getSensorBounds()[1] / 2.0f);
 	
 	// Size of the ghost image
-	glm::vec2 imageSize = parameters.m_ghost.getSensorBounds()[1] / 2.0f;
+	ghostParams.m_imageSize = parameters.m_ghost.getSensorBounds()[1] / 2.0f;
 	
-	// Distance of the ray from the sensor, along the optical axis
-	GLfloat rayDist = sensorDistance + 0.1f;
-	
-	// Size of the film
-	glm::vec2 filmSize = m_opticalSystem->getFilmSize();
+	// Height of the pupil lens
+	float pupilHeight = m_opticalSystem->getPupilHeight();
+
+	// Calculate the area of the ray grid on the pupil
+	float pupilArea = 
+		(ghostParams.m_gridSize.x * pupilHeight) * 
+		(ghostParams.m_gridSize.y * pupilHeight);
 
-	// Wavelength at which we render
-	float lambda = parameters.m_lambda;
+	// Compute the area of the whole pupil
+	float wholePupilArea = glm::pow(2.0f * pupilHeight, 2.0f);
 
-	// Lambertian coefficient
-	GLfloat intensity = lambert * parameters.m_intensityScale;
+	// Compute the area of the image on the sensor; it is unknown while the
+	// ghost attributes are being computed, but then nothing is drawn either
+	float sensorArea = ghostParams.m_imageSize.x * ghostParams.m_imageSize.y;
+
+	// Compute the scaled intensity of the channel
+	float intensity = sensorArea > 0.0f ? pupilArea / wholePupilArea / sensorArea : 0.0f;
 
 	// Light color
-	glm::vec4 color = glm::vec4(parameters.m_lightSource.getDiffuseColor() * 
+	glm::vec4 lightColor = glm::vec4(parameters.m_lightSource.getDiffuseColor() * 
 		parameters.m_lightSource.getDiffuseIntensity(),
 		1.0f);
 
-	// Ghost rendering mode (ghost, ray grid, etc.)
-	GLint renderMode = (GLint) parameters.m_renderMode;
-
-	// Ghost shading mode (shaded, unlit, UV, etc.)
-	GLint shadingMode = (GLint) parameters.m_shadingMode;
+	// Channel color, with the constant intensity factors applied once here
+	// instead of per vertex
+	ghostParams.m_color = glm::vec4(ColorSpaceHelpers::lambda2RGB(parameters.m_lambda, 1.0f) * 
+		intensity * lambert * parameters.m_intensityScale, 1.0f) * lightColor;
 
 	// Radius clipping
-	GLfloat radiusClip = parameters.m_radiusClip;
+	ghostParams.m_radiusClip = parameters.m_radiusClip;
 
 	// Iris clipping.
-	GLfloat irisClip = parameters.m_distanceClip;
-
-	// Upload all the uniforms
-	GLHelpers::uploadUniform(parameters.m_shader, "vLensCenter", centers);
-	GLHelpers::uploadUniform(parameters.m_shader, "vLensIor", refractions);
-	GLHelpers::uploadUniform(parameters.m_shader, "fLensRadius", curvatures);
-	GLHelpers::uploadUniform(parameters.m_shader, "fLensHeight", heights);
-	GLHelpers::uploadUniform(parameters.m_shader, "fLensAperture", apertures);
-	GLHelpers::uploadUniform(parameters.m_shader, "fLensCoating", thicknesses);
-
-	GLHelpers::uploadUniform(parameters.m_shader, "iGhostIndices", ghostIndices);
-	GLHelpers::uploadUniform(parameters.m_shader, "iNumIndices", numIndices);
-	GLHelpers::uploadUniform(parameters.m_shader, "iLength", elementLength);
-	GLHelpers::uploadUniform(parameters.m_shader, "iRayCount", rayCount);
-	GLHelpers::uploadUniform(parameters.m_shader, "vRayDir", rayDir);
-	GLHelpers::uploadUniform(parameters.m_shader, "vGridCenter", gridCenter);
-	GLHelpers::uploadUniform(parameters.m_shader, "vGridSize", gridSize);
-	GLHelpers::uploadUniform(parameters.m_shader, "vImageCenter", imageCenter);
-	GLHelpers::uploadUniform(parameters.m_shader, "vImageSize", imageSize);
-	GLHelpers::uploadUniform(parameters.m_shader, "fRayDistance", rayDist);
-	GLHelpers::uploadUniform(parameters.m_shader, "vFilmSize", filmSize);
-	GLHelpers::uploadUniform(parameters.m_shader, "fLambda", lambda);
-	GLHelpers::uploadUniform(parameters.m_shader, "fIntensityScale", intensity);
-	GLHelpers::uploadUniform(parameters.m_shader, "vColor", color);
-	GLHelpers::uploadUniform(parameters.m_shader, "iRenderMode", renderMode);
-	GLHelpers::uploadUniform(parameters.m_shader, "iShadingMode", shadingMode);
-	GLHelpers::uploadUniform(parameters.m_shader, "fRadiusClip", radiusClip);
-	GLHelpers::uploadUniform(parameters.m_shader, "fIrisClip", irisClip);
-
-	// Render the tessellated quad
-	int vertexCount = (rayCount - 1) * (rayCount - 1) * 6;
-	glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+	ghostParams.m_irisClip = parameters.m_distanceClip;
+
+	// Only used by the batched path
+	ghostParams.m_vertexOffset = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::uploadUniforms(const RenderParameters& parameters, GhostRenderStats* stats)
+{	
+	GhostParamsData ghostParams;
+	computeGhostParams(parameters, ghostParams);
+
+	// Pick the next slot of the ghost parameter buffer, orphaning the buffer
+	// once every slot has been used, so that earlier draws can still read
+	// their own parameters
+	if (m_ghostParamsSlot == GHOST_PARAMS_SLOTS)
+	{
+		countedCall(stats, glBindBuffer, GL_UNIFORM_BUFFER, m_ghostParamsBuffer);
+		countedCall(stats, glBufferData, GL_UNIFORM_BUFFER, GHOST_PARAMS_SLOTS * m_ghostParamsSlotSize, 
+			nullptr, GL_STREAM_DRAW);
+		m_ghostParamsSlot = 0;
+	}
+	GLintptr slotOffset = m_ghostParamsSlot++ * m_ghostParamsSlotSize;
+
+	// Upload the ghost parameters; binding the range also binds the generic
+	// uniform buffer binding point
+	countedCall(stats, glBindBufferRange, GL_UNIFORM_BUFFER, GHOST_PARAMS_BINDING, m_ghostParamsBuffer, 
+		slotOffset, (GLsizeiptr) sizeof(GhostParamsData));
+	countedCall(stats, glBufferSubData, GL_UNIFORM_BUFFER, slotOffset, 
+		(GLsizeiptr) sizeof(GhostParamsData), (const void*) &ghostParams);
+
+	// Bind the lens table of the current wavelength
+	countedCall(stats, glBindBufferBase, GL_UNIFORM_BUFFER, LENS_TABLE_BINDING, getLensTable(parameters.m_lambda));
+
+    // Bind the aperture texture
+    countedCall(stats, glActiveTexture, GL_TEXTURE0);
+    countedCall(stats, glBindTexture, GL_TEXTURE_2D, parameters.m_mask);
+
+	if (stats)
+	{
+		stats->m_uniformUpdates += 1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::traceGhostChannel(const RenderParameters& parameters, GhostRenderStats* stats)
+{
+	// Upload the tracing parameters
+	uploadUniforms(parameters, stats);
+
+	// Trace a single ray for each grid point
+	int rayCount = getRayCount(parameters);
+
+	countedCall(stats, glBeginTransformFeedback, GL_POINTS);
+	countedCall(stats, glDrawArrays, GL_POINTS, 0, GhostAttribHelpers::gridVertexCount(rayCount));
+	countedCall(stats, glEndTransformFeedback);
+
+	if (stats)
+	{
+		stats->m_drawCalls += 1;
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void RayTraceGhostAlgorithm::renderGhosts(const LightSource& light, const GhostList& ghosts)
+void RayTraceGhostAlgorithm::renderGhostChannel(const RenderParameters& parameters)
 {
+	int rayCount = getRayCount(parameters);
+
+	// Trace the rays into the vertex buffer
+	countedCall(&m_renderStats, glUseProgram, m_bakedTracing ? 
+		getBakedTraceShader(parameters.m_lambda, parameters.m_ghost) : 
+		m_traceShader);
+	countedCall(&m_renderStats, glBindVertexArray, m_vao);
+	countedCall(&m_renderStats, glEnable, GL_RASTERIZER_DISCARD);
+	countedCall(&m_renderStats, glBindBufferBase, GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_vertexBuffer);
+
+	traceGhostChannel(parameters, &m_renderStats);
+
+	countedCall(&m_renderStats, glBindBufferBase, GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	countedCall(&m_renderStats, glDisable, GL_RASTERIZER_DISCARD);
+
+	// Draw the indexed ray grid, sharing the traced vertices between the
+	// neighbouring triangles; the parameters uploaded for the tracing pass
+	// are still bound
+	countedCall(&m_renderStats, glUseProgram, 
+		getRenderShader(parameters.m_renderMode, parameters.m_shadingMode, false));
+	countedCall(&m_renderStats, glBindVertexArray, m_renderVao);
+	countedCall(&m_renderStats, glBindBuffer, GL_ELEMENT_ARRAY_BUFFER, getIndexBuffer(rayCount));
+	countedCall(&m_renderStats, glDrawElements, GL_TRIANGLES, GhostAttribHelpers::gridIndexCount(rayCount), 
+		GL_UNSIGNED_INT, (const void*) nullptr);
+
+	m_renderStats.m_channels += 1;
+	m_renderStats.m_rays += rayCount * rayCount;
+	m_renderStats.m_drawCalls += 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::renderGhostsBatched(RenderParameters& parameters, 
+	const std::vector<GhostScheduler::ScheduledGhost>& ghosts)
+{
+	// The traced vertices are read from storage buffers, but a vertex array
+	// must still be bound for drawing
+	countedCall(&m_renderStats, glBindVertexArray, m_vao);
+	countedCall(&m_renderStats, glActiveTexture, GL_TEXTURE0);
+	countedCall(&m_renderStats, glBindTexture, GL_TEXTURE_2D, parameters.m_mask);
+
+	// Per-draw parameters and draw commands of the current wavelength
+	std::vector<GhostParamsData> drawParams;
+	std::vector<DrawArraysIndirectCommand> drawCommands;
+
+	// Each wavelength uses its own lens table, so the ghost channels are
+	// batched per wavelength
+	for (int ch = 0; ch < (int) m_lambdas.size(); ++ch)
+	{
+		parameters.m_lambda = m_lambdas[ch];
+
+		// Lay out the ray grids of the ghosts that have this channel one
+		// after the other
+		drawParams.clear();
+		drawCommands.clear();
+		int numVertices = 0;
+		int maxRayCount = 0;
+		for (const auto& ghost: ghosts)
+		{
+			if (ch >= ghost.m_channels)
+				continue;
+
+			parameters.m_ghost = *ghost.m_ghost;
+			parameters.m_fixedRayCount = ghost.m_rayCount;
+			int rayCount = getRayCount(parameters);
+
+			GhostParamsData ghostParams;
+			computeGhostParams(parameters, ghostParams);
+			ghostParams.m_vertexOffset = numVertices;
+			drawParams.push_back(ghostParams);
+
+			DrawArraysIndirectCommand command;
+			command.m_count = (GLuint) GhostAttribHelpers::gridIndexCount(rayCount);
+			command.m_instanceCount = 1;
+			command.m_first = 0;
+			command.m_baseInstance = 0;
+			drawCommands.push_back(command);
+
+			numVertices += GhostAttribHelpers::gridVertexCount(rayCount);
+			maxRayCount = glm::max(maxRayCount, rayCount);
+		}
+
+		if (drawParams.empty())
+			continue;
+
+		int numDraws = (int) drawParams.size();
+		reserveVertexBuffer(numVertices);
+
+		// Upload the draw parameters, and bind the shared buffers
+		countedCall(&m_renderStats, glBindBuffer, GL_SHADER_STORAGE_BUFFER, m_batchParamsBuffer);
+		countedCall(&m_renderStats, glBufferData, GL_SHADER_STORAGE_BUFFER, 
+			(GLsizeiptr) (numDraws * sizeof(GhostParamsData)), (const void*) drawParams.data(), GL_STREAM_DRAW);
+		countedCall(&m_renderStats, glBindBufferBase, GL_SHADER_STORAGE_BUFFER, BATCH_PARAMS_BINDING, m_batchParamsBuffer);
+		countedCall(&m_renderStats, glBindBufferBase, GL_SHADER_STORAGE_BUFFER, BATCH_VERTEX_BINDING, m_vertexBuffer);
+		countedCall(&m_renderStats, glBindBufferBase, GL_UNIFORM_BUFFER, LENS_TABLE_BINDING, 
+			getLensTable(parameters.m_lambda));
+		m_renderStats.m_uniformUpdates += 1;
+
+		// Trace every ray grid, with a row of work groups for each draw
+		GLuint traceGroups = (GLuint) ((GhostAttribHelpers::gridVertexCount(maxRayCount) + 
+			TRACE_GROUP_SIZE - 1) / TRACE_GROUP_SIZE);
+
+		countedCall(&m_renderStats, glUseProgram, m_batchTraceShader);
+		for (int firstDraw = 0; firstDraw < numDraws; firstDraw += MAX_DISPATCH_DRAWS)
+		{
+			countedCall(&m_renderStats, [&]() { GLHelpers::uploadUniform(m_batchTraceUniforms, "iFirstDraw", firstDraw); });
+			countedCall(&m_renderStats, glDispatchCompute, traceGroups, 
+				(GLuint) glm::min(numDraws - firstDraw, MAX_DISPATCH_DRAWS), (GLuint) 1);
+			m_renderStats.m_drawCalls += 1;
+		}
+		countedCall(&m_renderStats, glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// Draw every ray grid with a single submission
+		countedCall(&m_renderStats, glUseProgram, 
+			getRenderShader(parameters.m_renderMode, parameters.m_shadingMode, true));
+		countedCall(&m_renderStats, glBindBuffer, GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+		countedCall(&m_renderStats, glBufferData, GL_DRAW_INDIRECT_BUFFER, 
+			(GLsizeiptr) (numDraws * sizeof(DrawArraysIndirectCommand)), (const void*) drawCommands.data(), GL_STREAM_DRAW);
+		countedCall(&m_renderStats, glMultiDrawArraysIndirect, GL_TRIANGLES, (const void*) nullptr, numDraws, 0);
+		countedCall(&m_renderStats, glBindBuffer, GL_DRAW_INDIRECT_BUFFER, 0);
+
+		m_renderStats.m_channels += numDraws;
+		m_renderStats.m_rays += numVertices;
+		m_renderStats.m_drawCalls += 1;
+	}
+
+	countedCall(&m_renderStats, glBindVertexArray, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::collectRenderTimings()
+{
+	for (auto& timer: m_renderTimers)
+	{
+		if (!timer.m_pending)
+			continue;
+
+		// Don't wait for the results that haven't arrived yet
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(timer.m_query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+			continue;
+
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(timer.m_query, GL_QUERY_RESULT, &elapsed);
+		timer.m_pending = false;
+
+		// Convert it to milliseconds, and refine the cost model with it
+		m_measuredRenderTime = double(elapsed) / 1e6;
+		m_scheduler.reportTiming(timer.m_rays, m_measuredRenderTime);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RayTraceGhostAlgorithm::renderGhosts(const LightSource& light, GhostListView ghosts)
+{
+    // Make sure the lens tables match the optical system
+    updateLensTables();
+
+    // Start a new set of statistics
+    m_renderStats = GhostRenderStats();
+
     // Find the aperture mask texture
     GLuint apertureTexture = 0;
     for (const auto& lens: m_opticalSystem->getElements())
@@ -783,33 +1584,115 @@ void RayTraceGhostAlgorithm::renderGhosts(const LightSource& light, const GhostL
 
 	parameters.m_lightSource = light;
 	parameters.m_mask = apertureTexture;
-	parameters.m_shader = m_renderShader;
 	parameters.m_fixedRayCount = 0;
 	parameters.m_intensityScale = m_intensityScale;
 	parameters.m_renderMode = m_renderMode;
 	parameters.m_shadingMode = m_shadingMode;
 	parameters.m_radiusClip = m_radiusClip;
 	parameters.m_distanceClip = m_distanceClip;
-	
-	// Bind the render shader
-	glUseProgram(m_renderShader);
 
-	// Render the selected ghosts
-    glBindVertexArray(m_vao);
+	// The ghost images are rotated by the light azimuth, the same way as in
+	// computeGhostParams
+	glm::vec3 toLight = -light.getIncidenceDirection();
+	glm::mat2 rotation = glm::mat2(glm::rotate(glm::atan(toLight.y, toLight.x), glm::vec3(0.0f, 0.0f, 1.0f)));
+
+	// The sensor bounds only describe the image in the projected ghost mode;
+	// the pupil grid mode draws the whole pupil, so nothing is culled there
+	bool cullGhosts = m_renderMode == RenderMode::PROJECTED_GHOST;
+
+	// Size of the viewport, for the sub-pixel culling
+	glm::vec2 viewportSize(0.0f);
+	if (cullGhosts && m_minPixelArea > 0.0f)
+	{
+		GLint viewport[4];
+		countedCall(&m_renderStats, glGetIntegerv, GL_VIEWPORT, viewport);
+		viewportSize = glm::vec2(viewport[2], viewport[3]);
+	}
+
+	// Collect the ghosts worth rendering, culling the ones that can't be seen,
+	// and let the scheduler choose which ones fit the budget, and at what
+	// quality
+	std::vector<const Ghost*> candidates;
 	for (const auto& ghost: ghosts)
 	{
-		if (m_opticalSystem->isValidGhost(ghost) && 
-			ghost.getAverageIntensity() >= m_intensityClip)
+		if (!m_opticalSystem->isValidGhost(ghost) || 
+			ghost.getAverageIntensity() < m_intensityClip)
+		{
+			continue;
+		}
+		++m_renderStats.m_ghosts;
+
+		// Reject the ghosts whose bounding box doesn't overlap the screen
+		glm::vec2 center, extents;
+		rotatedSensorBounds(ghost, rotation, center, extents);
+		if (cullGhosts && (glm::abs(center.x) - extents.x > 1.0f || glm::abs(center.y) - extents.y > 1.0f))
 		{
-			parameters.m_ghost = ghost;
-			for (int ch = 0; ch < ghost.getMinimumChannels(); ++ch)
+			++m_renderStats.m_culledOffscreen;
+			continue;
+		}
+
+		// Reject the ghosts covering less than the minimum pixel area; the
+		// rotation doesn't change the area, and the screen spans two units
+		// along both axes
+		glm::vec2 size = ghost.getSensorBounds()[1];
+		float pixelArea = size.x * size.y * viewportSize.x * viewportSize.y / 4.0f;
+		if (cullGhosts && m_minPixelArea > 0.0f && pixelArea < m_minPixelArea)
+		{
+			++m_renderStats.m_culledSubpixel;
+			continue;
+		}
+
+		candidates.push_back(&ghost);
+	}
+	std::vector<GhostScheduler::ScheduledGhost> scheduled = 
+		m_scheduler.schedule(candidates, (int) m_lambdas.size());
+
+	// Measure the render time while there is a budget to fit; a timer is
+	// only reused once its previous result has arrived
+	collectRenderTimings();
+	RenderTimer& timer = m_renderTimers[m_renderTimerSlot];
+	bool measure = m_scheduler.getBudget() > 0.0f && !timer.m_pending;
+	if (measure)
+	{
+		countedCall(&m_renderStats, glBeginQuery, GL_TIME_ELAPSED, timer.m_query);
+	}
+
+	// Render every ghost channel with a few batched submissions, if possible
+	if (m_batchedRendering && isBatchedRenderingSupported())
+	{
+		renderGhostsBatched(parameters, scheduled);
+	}
+	else
+	{
+		// Make sure the vertex buffer can hold the largest ray grid
+		int maxRayCount = 0;
+		for (const auto& ghost: scheduled)
+		{
+			maxRayCount = glm::max(maxRayCount, ghost.m_rayCount);
+		}
+		reserveVertexBuffer(GhostAttribHelpers::gridVertexCount(maxRayCount));
+
+		// Render the scheduled ghosts
+		for (const auto& ghost: scheduled)
+		{
+			parameters.m_ghost = *ghost.m_ghost;
+			parameters.m_fixedRayCount = ghost.m_rayCount;
+			for (int ch = 0; ch < ghost.m_channels; ++ch)
 			{
 				parameters.m_lambda = m_lambdas[ch];
 				renderGhostChannel(parameters);
 			}
 		}
+		countedCall(&m_renderStats, glBindVertexArray, 0);
+	}
+
+	if (measure)
+	{
+		countedCall(&m_renderStats, glEndQuery, GL_TIME_ELAPSED);
+		timer.m_rays = m_renderStats.m_rays;
+		timer.m_pending = true;
+		m_renderTimerSlot = (m_renderTimerSlot + 1) % RENDER_TIMER_COUNT;
 	}
-    glBindVertexArray(0);
 }
 
 }
\ No newline at end of file
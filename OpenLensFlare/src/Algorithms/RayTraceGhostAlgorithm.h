@@ -4,6 +4,9 @@
 #include "../Ghost.h"
 #include "../LightSource.h"
 #include "../GhostAlgorithm.h"
+#include "GLHelpers.h"
+#include "ProgramCache.h"
+#include "GhostScheduler.h"
 
 namespace OLEF
 {
@@ -48,9 +51,25 @@ public:
         RELATIVE_RADIUS
     };
 
+    /// Enumerates the possible ways the ghost attributes can be computed on
+    /// the GPU.
+    enum class PrecomputeBackend
+    {
+        /// Trace the rays through transform feedback, and process the full
+        /// ray data on the CPU.
+        TRANSFORM_FEEDBACK,
+
+        /// Trace the rays into a storage buffer with a compute shader, and
+        /// reduce them to a few values per ghost channel on the GPU. Requires
+        /// OpenGL 4.3; the transform feedback backend is used without it.
+        COMPUTE_SHADER,
+    };
+
     /// Construct a ray traced flare rendering object that can render ghosts
-    /// for the parameter optical system.
-    RayTraceGhostAlgorithm(OpticalSystem* system);
+    /// for the parameter optical system. If a program cache is provided, the
+    /// shader programs are taken from it, and shared with the other users of
+    /// the cache; the cache must outlive this object.
+    RayTraceGhostAlgorithm(OpticalSystem* system, ProgramCache* programCache = nullptr);
     
     /// Releases all the allocated GL objects.
     ~RayTraceGhostAlgorithm();
@@ -97,20 +116,132 @@ public:
         /// ideal cell triangle. The targeted variance is compared against this
         /// value to determine if a preset is suitable.
         float m_targetVariance = 0.01f;
+
+        /// Whether the pupil bounds of the input ghosts are used as seeds for
+        /// the bounding passes (e.g. the results for a neighbouring angle),
+        /// instead of the bounds being reset to the full pupil.
+        bool m_warmStart = false;
+
+        /// How much the seeded pupil bounds are extended in each direction.
+        float m_seedDilation = 0.1f;
+
+        /// The remaining bounding passes of a ghost are skipped once its pupil
+        /// bounds change less than this between two passes. Zero disables
+        /// the early stopping.
+        float m_boundsEpsilon = 0.0f;
+    };
+
+    /// Statistics gathered during the attribute computations.
+    struct GhostAttribComputeStats
+    {
+        /// Number of rays traced.
+        long long m_raysTraced = 0;
+
+        /// Number of rays the same computations would require if every
+        /// triangle vertex was traced separately, instead of sharing the rays
+        /// between the neighbouring triangles.
+        long long m_raysTracedWithoutReuse = 0;
+
+        /// Number of per-ghost bounding passes skipped, because the bounds of
+        /// the ghost already settled.
+        long long m_skippedBoundingPasses = 0;
+
+        /// Number of warm started ghosts that had to fall back to the full
+        /// pupil, because they reached the edge of their seed.
+        long long m_warmStartRestarts = 0;
+
+        /// Time spent waiting for the GPU to finish tracing, in seconds.
+        double m_gpuWaitTime = 0.0;
+
+        /// Time spent analysing the traced rays on the CPU, in seconds.
+        double m_cpuAnalysisTime = 0.0;
+
+        /// The part of the CPU analysis time during which the GPU was still
+        /// tracing further chunks of the same pass, in seconds. Divide it by
+        /// the analysis time to get the achieved GPU/CPU overlap. Passes
+        /// never overlap each other, since each pass depends on the results
+        /// of the previous one, so the GPU idles while the last chunk of
+        /// every pass is analysed.
+        double m_intraPassOverlapTime = 0.0;
+    };
+
+    /// Statistics of the GL work issued while rendering the ghost channels
+    /// of the last renderGhosts call.
+    struct GhostRenderStats
+    {
+        /// Number of valid ghosts above the intensity clip, before culling.
+        int m_ghosts = 0;
+
+        /// Number of ghosts culled, because their image lies entirely
+        /// outside the screen.
+        int m_culledOffscreen = 0;
+
+        /// Number of ghosts culled, because their image is smaller than the
+        /// minimum pixel area.
+        int m_culledSubpixel = 0;
+
+        /// Number of ghost channels rendered.
+        int m_channels = 0;
+
+        /// Number of rays traced.
+        int m_rays = 0;
+
+        /// Number of draw calls issued, including the ray tracing passes.
+        int m_drawCalls = 0;
+
+        /// Number of uniform and uniform buffer updates.
+        int m_uniformUpdates = 0;
+
+        /// Total number of GL calls issued, counted at the call sites. The
+        /// calls creating the shaders and buffers on first use are excluded.
+        int m_glCalls = 0;
+    };
+
+    /// Per-vertex data, written by the ray tracing pass and read back through
+    /// transform feedback (or generated by the CPU ghost tracer).
+    struct PerVertexData
+    {
+        /// Position of the ray on the pupil.
+        glm::vec2 m_parameter;
+
+        /// Position of the ray's projection on the sensor.
+        glm::vec2 m_position;
+
+        /// UV coordinates of the ray's hit on the iris.
+        glm::vec2 m_uv;
+
+        /// Distance of the trace hit from the optical axis.
+        GLfloat m_radius;
+
+        /// Transmitted light intensity of the ghost.
+        GLfloat m_intensity;
+
+        /// Distance of the ray to the center of the iris.
+        GLfloat m_irisDistance;
     };
 
     /// Computes the ghost rendering attributes corresponding to the provided
     /// parameters, and returns a new ghost list with the ghosts containing
-    /// the computed attributes.
-    GhostList computeGhostAttributes(
-        const GhostList& ghosts, const GhostAttribComputeParams& params = {});
+    /// the computed attributes. Tracing statistics are accumulated into the
+    /// optional stats object.
+    ///
+    /// With the transform feedback backend, the traced rays are read back
+    /// through a ring of buffers, so the CPU analyses a chunk of ghosts while
+    /// the GPU traces the next chunks of the same pass. The bounding and ray
+    /// grid passes still run one after the other: the next pass is only
+    /// issued once every ghost of the current one is analysed.
+    GhostList computeGhostAttributes(const GhostList& ghosts,
+        const GhostAttribComputeParams& params = {}, GhostAttribComputeStats* stats = nullptr);
 
     /// Renders the ghosts corresponding to the parameter light source.
-    void renderGhosts(const LightSource& light, const GhostList& ghosts);
+    void renderGhosts(const LightSource& light, GhostListView ghosts);
 
     /// Returns the optical system that generates the ghosts.
     OpticalSystem* getOpticalSystem() const { return m_opticalSystem; }
 
+    /// Returns the program cache the shaders are taken from, if any.
+    ProgramCache* getProgramCache() const { return m_programCache; }
+
     /// Returns the intensity scaling factor.
     float getIntensityScale() const { return m_intensityScale; }
 
@@ -129,9 +260,41 @@ public:
     /// Returns the intensity clipping value.
     float getIntensityClip() const { return m_intensityClip; }
 
+    /// Returns the minimum screen area of the rendered ghosts, in pixels.
+    float getMinPixelArea() const { return m_minPixelArea; }
+
     /// Returns the wavelengths at which to render the ghosts.
     const std::vector<float>& getLambdas() const { return m_lambdas; }
 
+    /// Returns the backend used for computing the ghost attributes.
+    PrecomputeBackend getPrecomputeBackend() const { return m_precomputeBackend; }
+
+    /// Returns whether the ghosts are rendered with the batched path.
+    bool getBatchedRendering() const { return m_batchedRendering; }
+
+    /// Returns whether the rays are traced with baked programs.
+    bool getBakedTracing() const { return m_bakedTracing; }
+
+    /// Returns whether the batched rendering path is available.
+    bool isBatchedRenderingSupported() const { return m_batchTraceShader != 0; }
+
+    /// Returns the statistics of the last renderGhosts call.
+    const GhostRenderStats& getRenderStats() const { return m_renderStats; }
+
+    /// Returns the scheduler that selects the rendered ghosts.
+    GhostScheduler& getScheduler() { return m_scheduler; }
+
+    /// Returns the scheduler that selects the rendered ghosts.
+    const GhostScheduler& getScheduler() const { return m_scheduler; }
+
+    /// Returns the last measured GPU time of a renderGhosts call, in
+    /// milliseconds. Render times are only measured while the scheduler has
+    /// a budget, and they arrive a few frames late.
+    double getMeasuredRenderTime() const { return m_measuredRenderTime; }
+
+    /// Returns whether the compute shader backend is available.
+    bool isComputeBackendSupported() const { return m_computeTraceShader != 0; }
+
     /// Sets the intensity scaling factor.
     void setIntensityScale(float value) { m_intensityScale = value; }
 
@@ -150,9 +313,45 @@ public:
     /// Sets the intensity clipping value.
     void setIntensityClip(float value) { m_intensityClip = value; }
 
+    /// Sets the minimum screen area of the rendered ghosts, in pixels of the
+    /// current viewport. Ghosts whose sensor bounds cover less are culled
+    /// before rendering. Zero disables the sub-pixel culling; ghosts lying
+    /// entirely off-screen are always culled. Only the projected ghost render
+    /// mode culls, since the pupil grid mode doesn't draw the sensor image.
+    void setMinPixelArea(float value) { m_minPixelArea = value; }
+
     /// Sets the wavelengths at which to render the ghosts.
     void setLambdas(const std::vector<float>& value) { m_lambdas = value; }
 
+    /// Sets the backend used for computing the ghost attributes.
+    void setPrecomputeBackend(PrecomputeBackend value) { m_precomputeBackend = value; }
+
+    /// Sets whether the ghosts are rendered with the batched path, which
+    /// traces every ghost channel of a wavelength with a single dispatch and
+    /// draws them with a single indirect multi-draw call. Requires OpenGL 4.3
+    /// and either OpenGL 4.6 or ARB_shader_draw_parameters; the regular path
+    /// is used without them.
+    void setBatchedRendering(bool value) { m_batchedRendering = value; }
+
+    /// Sets whether the rays are traced with programs baked for the optical
+    /// system. The lens tables of baked programs are constant arrays with the
+    /// exact element count, and the number of interfaces visited by the ghost
+    /// is a constant, so the walk has a fixed trip count. The reflecting
+    /// interfaces are still read from the ghost parameters, so the interface
+    /// visited at each step, and the lens table lookup, stay dynamic. Ghosts
+    /// with the same path length share a program, so there is one program per
+    /// path length and wavelength; the path length of a two-bounce ghost grows
+    /// with the distance between its reflecting interfaces, so that is a few
+    /// dozen programs for a typical system. Meant for optical systems that
+    /// don't change at runtime.
+    /// The programs are compiled on first use (see bakeGhosts), and are only
+    /// used by the per-channel path, not the batched one.
+    void setBakedTracing(bool value) { m_bakedTracing = value; }
+
+    /// Compiles the baked tracing programs of the parameter ghosts at every
+    /// wavelength up front, so that rendering doesn't stall on them.
+    void bakeGhosts(GhostListView ghosts);
+
 private:
     /// Parameters used for rendering the ghost.
     struct RenderParameters
@@ -163,13 +362,11 @@ private:
         /// The ghost to render.
         Ghost m_ghost;
 
-        /// The shader to render with.
-        GLuint m_shader;
-
         /// Mask texture.
         GLuint m_mask;
 
-        /// A fixed ray grid size to use, mainly for precomputation purposes.
+        /// A fixed ray grid size to use instead of the minimum ray count of
+        /// the ghost, set by the precomputations and the scheduler.
         int m_fixedRayCount;
 
         /// Wavelength to render at.
@@ -191,35 +388,126 @@ private:
         float m_distanceClip;
     };
 
-    /// Per-vertex data, read back through transform feedback.
-    struct PerVertexData
+    /// Computes the ghost attributes by tracing the rays through transform
+    /// feedback, reading the full ray data back to the CPU.
+    GhostList computeGhostAttributesTransformFeedback(const GhostList& ghosts,
+        const GhostAttribComputeParams& computeParams, RenderParameters& parameters,
+        GhostAttribComputeStats* stats);
+
+    /// Computes the ghost attributes with compute shaders, only reading back
+    /// the per-channel reductions.
+    GhostList computeGhostAttributesCompute(const GhostList& ghosts,
+        const GhostAttribComputeParams& computeParams, RenderParameters& parameters,
+        GhostAttribComputeStats* stats);
+
+    /// Returns the size of the ray grid to use for the parameter ghost.
+    static int getRayCount(const RenderParameters& parameters);
+
+    /// Per-draw ghost parameters, as stored in the GhostParams uniform block.
+    struct GhostParamsData;
+
+    /// Computes the ghost parameters corresponding to the render parameters.
+    void computeGhostParams(const RenderParameters& parameters, GhostParamsData& ghostParams) const;
+
+    /// Uploads the ghost parameters corresponding to the render parameters,
+    /// and binds them along with the lens table of the render wavelength and
+    /// the aperture texture. The bindings are shared by all the programs.
+    /// The issued GL calls are counted into the optional stats object.
+    void uploadUniforms(const RenderParameters& parameters, GhostRenderStats* stats = nullptr);
+
+    /// Releases the cached lens tables if the optical system changed since
+    /// they were built.
+    void updateLensTables();
+
+    /// Returns the uniform buffer holding the lens table at the parameter
+    /// wavelength, building it on first use.
+    GLuint getLensTable(float lambda);
+
+    /// Releases the cached lens tables, and the programs baked from them.
+    void releaseLensTables();
+
+    /// Returns the tracing program baked for the parameter wavelength and
+    /// the path length of the parameter ghost, compiling it on first use.
+    GLuint getBakedTraceShader(float lambda, const Ghost& ghost);
+
+    /// Traces the rays of a specific channel of a ghost, writing one vertex
+    /// per ray grid point to the bound transform feedback buffer. It uses a
+    /// parameter structure so that it can be reused for both rendering and
+    /// parameter computation. The issued GL calls are counted into the
+    /// optional stats object.
+    void traceGhostChannel(const RenderParameters& parameters, GhostRenderStats* stats = nullptr);
+
+    /// Renders a specific channel of a ghost, by tracing its rays and then
+    /// drawing the indexed ray grid.
+    void renderGhostChannel(const RenderParameters& parameters);
+
+    /// Renders every scheduled channel of the parameter ghosts with the
+    /// batched path.
+    void renderGhostsBatched(RenderParameters& parameters, 
+        const std::vector<GhostScheduler::ScheduledGhost>& ghosts);
+
+    /// Feeds the finished render time measurements back to the scheduler.
+    void collectRenderTimings();
+
+    /// Makes sure the traced vertex buffer can hold the parameter number of
+    /// vertices.
+    void reserveVertexBuffer(int numVertices);
+
+    /// Returns the index buffer triangulating a ray grid of the parameter size.
+    GLuint getIndexBuffer(int rayCount);
+
+    /// Returns the rendering shader specialized for the parameter render and
+    /// shading modes, compiling it on first use. The modes are baked into the
+    /// shaders as defines, so no per-fragment branching is left.
+    GLuint getRenderShader(RenderMode renderMode, ShadingMode shadingMode, bool batched);
+
+    /// Makes sure each buffer of the readback ring can hold the parameter
+    /// number of vertices.
+    void reserveReadbackRing(int numVertices);
+
+    /// Releases the buffers of the readback ring.
+    void releaseReadbackRing();
+
+    /// A buffer of the transform feedback readback ring.
+    struct ReadbackSlot
     {
-        /// Position of the ray on the pupil.
-        glm::vec2 m_parameter;
+        /// The buffer object.
+        GLuint m_buffer;
 
-        /// Position of the ray's projection on the sensor.
-        glm::vec2 m_position;
+        /// Persistently mapped contents of the buffer, or nullptr if
+        /// persistent mapping is not supported.
+        const PerVertexData* m_vertices;
 
-        /// UV coordinates of the ray's hit on the iris.
-        glm::vec2 m_uv;
+        /// Fence signalled once the GPU finished writing the buffer.
+        GLsync m_fence;
+    };
 
-        /// Distance of the trace hit from the optical axis.
-        GLfloat m_radius;
+    /// A timer query measuring the GPU time of a renderGhosts call.
+    struct RenderTimer
+    {
+        /// The query object.
+        GLuint m_query;
 
-        /// Transmitted light intensity of the ghost.
-        GLfloat m_intensity;
+        /// Number of rays traced in the measured call.
+        double m_rays;
 
-        /// Distance of the ray to the center of the iris.
-        GLfloat m_irisDistance;
+        /// Whether the query is still waiting for its result.
+        bool m_pending;
     };
 
-    /// Renders a specific channel of a ghost. It uses a parameter structure
-    /// so that it can be reused for both rendering and parameter computation.
-    void renderGhostChannel(const RenderParameters& parameters);
+    /// Number of buffers in the readback ring.
+    static const int READBACK_RING_SIZE = 3;
+
+    /// Number of timer queries in flight, which lets the results arrive a
+    /// few frames late without stalling on them.
+    static const int RENDER_TIMER_COUNT = 4;
 
     /// The optical system that generates the ghosts.
     OpticalSystem* m_opticalSystem;
 
+    /// The program cache the shaders are taken from, or nullptr.
+    ProgramCache* m_programCache;
+
     /// Intensity scaling.
     float m_intensityScale;
 
@@ -238,18 +526,123 @@ private:
     /// Intensity clip value, used to reject low intensity ghosts.
     float m_intensityClip;
 
+    /// Minimum screen area of the rendered ghosts, in pixels.
+    float m_minPixelArea;
+
     /// Wavelengths at which to render the ghosts.
     std::vector<float> m_lambdas;
 
-    /// A dummy vertex array to use, since OpenGL requires a valid object to be
-    /// bound, even if we don't actually use any vertex buffers.
+    /// Backend used for computing the ghost attributes.
+    PrecomputeBackend m_precomputeBackend;
+
+    /// A dummy vertex array to use while tracing, since OpenGL requires a
+    /// valid object to be bound, even if we don't actually use any vertex
+    /// buffers.
     GLuint m_vao;
 
-    /// Shader used for parameter computation.
-    GLuint m_precomputeShader;
+    /// Vertex array used for drawing the traced ray grids.
+    GLuint m_renderVao;
+
+    /// Buffer holding the traced vertices of the ghost being rendered.
+    GLuint m_vertexBuffer;
+
+    /// Number of vertices that fit into the traced vertex buffer.
+    int m_vertexBufferSize;
+
+    /// Ray grid index buffers, for each grid size.
+    std::map<int, GLuint> m_indexBuffers;
+
+    /// Uniform buffer holding the per-draw ghost parameters, used as a ring
+    /// of slots so that each draw can read its own parameters.
+    GLuint m_ghostParamsBuffer;
+
+    /// Size of a slot of the ghost parameter buffer.
+    GLsizeiptr m_ghostParamsSlotSize;
+
+    /// Next slot of the ghost parameter buffer to write.
+    int m_ghostParamsSlot;
+
+    /// Whether the ghosts are rendered with the batched path.
+    bool m_batchedRendering;
+
+    /// Whether the rays are traced with baked programs.
+    bool m_bakedTracing;
+
+    /// Storage buffer holding the per-draw parameters of the batched path.
+    GLuint m_batchParamsBuffer;
+
+    /// Buffer holding the indirect draw commands of the batched path.
+    GLuint m_indirectBuffer;
+
+    /// Uniform buffers holding the lens tables, for each wavelength.
+    std::map<float, GLuint> m_lensTables;
+
+    /// The optical system parameters the cached lens tables were built from.
+    std::vector<float> m_lensTableSource;
+
+    /// Ring of buffers that the traced rays are read back through, so that
+    /// the GPU can trace the next ghosts while the CPU processes the
+    /// previous ones.
+    std::array<ReadbackSlot, READBACK_RING_SIZE> m_readbackRing;
+
+    /// Number of vertices that fit into a buffer of the readback ring.
+    int m_readbackSlotSize;
+
+    /// Shader used for tracing the rays, both during rendering and parameter
+    /// computation.
+    GLuint m_traceShader;
+
+    /// Source of the tracing shader, which the baked programs extend.
+    GLHelpers::ShaderSource m_traceSource;
+
+    /// Baked tracing programs, keyed by the wavelength and the number of
+    /// interfaces visited by the ghosts.
+    std::map<std::pair<float, int>, GLuint> m_bakedTraceShaders;
     
-    /// Shader used for rendering.
-    GLuint m_renderShader;
+    /// Source of the rendering shader, without the mode defines.
+    GLHelpers::ShaderSource m_renderSource;
+
+    /// Source of the batched rendering shader, without the mode defines.
+    GLHelpers::ShaderSource m_batchRenderSource;
+
+    /// Rendering shader variants compiled so far, keyed by the render and
+    /// shading modes and whether they are batched (see getRenderShader).
+    std::map<int, GLuint> m_renderShaders;
+
+    /// Compute shader tracing the rays into a storage buffer (0 if compute
+    /// shaders are not supported).
+    GLuint m_computeTraceShader;
+
+    /// Compute shader reducing the traced rays of the ghost channels.
+    GLuint m_computeReduceShader;
+
+    /// Resolved uniforms of the compute tracing shader.
+    GLHelpers::ProgramReflection m_computeTraceUniforms;
+
+    /// Resolved uniforms of the reduction compute shader.
+    GLHelpers::ProgramReflection m_computeReduceUniforms;
+
+    /// Compute shader tracing the ray grids of a whole batch (0 if batched
+    /// rendering is not supported).
+    GLuint m_batchTraceShader;
+
+    /// Resolved uniforms of the batched tracing shader.
+    GLHelpers::ProgramReflection m_batchTraceUniforms;
+
+    /// Statistics of the last renderGhosts call.
+    GhostRenderStats m_renderStats;
+
+    /// Selects the rendered ghosts and their quality.
+    GhostScheduler m_scheduler;
+
+    /// Timer queries of the recent renderGhosts calls.
+    std::array<RenderTimer, RENDER_TIMER_COUNT> m_renderTimers;
+
+    /// Next timer query to use.
+    int m_renderTimerSlot;
+
+    /// The last measured render time, in milliseconds.
+    double m_measuredRenderTime;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,373 @@
+#include "SoftwareGhostAlgorithm.h"
+#include "GhostAttribHelpers.h"
+#include "ColorSpaceHelpers.h"
+
+namespace OLEF
+{
+
+/// Standard 3-color wavelengths
+static const std::vector<float> STANDARD_WAVELENGTHS = { 650.0f, 510.0f, 475.0f };
+
+/// Size of a framebuffer tile, in pixels.
+static const int TILE_SIZE = 32;
+
+/// Maximum number of vertices traced before the pending channels are
+/// rasterized, which limits the memory used by large ghost sets.
+static const int MAX_BATCH_VERTICES = 1 << 20;
+
+/// Quad corner offsets of the two triangles making up a grid cell; this
+/// matches the triangulation of the GL path.
+static const glm::ivec2 QUAD_IDS[6] =
+{
+    glm::ivec2(0, 0),
+    glm::ivec2(1, 0),
+    glm::ivec2(1, 1),
+
+    glm::ivec2(1, 1),
+    glm::ivec2(0, 1),
+    glm::ivec2(0, 0)
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Edge function of the parameter edge, which is positive on the left side.
+static float edgeFunction(glm::vec2 a, glm::vec2 b, glm::vec2 p)
+{
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+/// Whether the parameter edge of a counter-clockwise triangle is a top or a
+/// left edge, which own the pixels exactly on them.
+static bool isTopLeftEdge(glm::vec2 a, glm::vec2 b)
+{
+    return (a.y == b.y && b.x < a.x) || b.y < a.y;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+SoftwareGhostAlgorithm::SoftwareGhostAlgorithm(OpticalSystem* system, TaskPool* pool):
+    m_opticalSystem(system),
+    m_pool(pool),
+    m_tracer(system),
+    m_intensityScale(100.0f),
+    m_renderMode(RenderMode::PROJECTED_GHOST),
+    m_shadingMode(ShadingMode::SHADED),
+    m_radiusClip(1.0f),
+    m_distanceClip(0.95f),
+    m_intensityClip(1.0f),
+    m_lambdas(STANDARD_WAVELENGTHS)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareGhostAlgorithm::resize(int width, int height)
+{
+    m_framebuffer.m_width = glm::max(width, 0);
+    m_framebuffer.m_height = glm::max(height, 0);
+    m_framebuffer.m_pixels.assign(m_framebuffer.m_width * m_framebuffer.m_height, glm::vec4(0.0f));
+
+    int tilesX = (m_framebuffer.m_width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (m_framebuffer.m_height + TILE_SIZE - 1) / TILE_SIZE;
+    m_tileTriangles.assign(tilesX * tilesY, std::vector<int>());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareGhostAlgorithm::clear()
+{
+    std::fill(m_framebuffer.m_pixels.begin(), m_framebuffer.m_pixels.end(), glm::vec4(0.0f));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareGhostAlgorithm::renderGhosts(const LightSource& light, GhostListView ghosts)
+{
+    if (m_framebuffer.m_pixels.empty() || m_opticalSystem->getElementCount() == 0)
+        return;
+
+    // Lambertian shading term
+    glm::vec3 toLight = -light.getIncidenceDirection();
+    float lambert = glm::max(glm::dot(toLight, glm::vec3(0.0f, 0.0f, -1.0f)), 0.0f);
+
+    // Light color
+    glm::vec4 lightColor = glm::vec4(light.getDiffuseColor() * light.getDiffuseIntensity(), 1.0f);
+
+    // Height of the pupil lens, as seen by the tracer
+    float pupilHeight = m_opticalSystem->getPupilHeight();
+
+    // Collect the channels to render, rasterizing them in batches
+    std::vector<Channel> channels;
+    int numVertices = 0;
+    for (const auto& ghost: ghosts)
+    {
+        if (!m_opticalSystem->isValidGhost(ghost) ||
+            ghost.getAverageIntensity() < m_intensityClip)
+        {
+            continue;
+        }
+
+        int rayCount = ghost.getMinimumRays();
+        int numChannels = glm::min(ghost.getMinimumChannels(), (int) m_lambdas.size());
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            // Flush the pending channels once the batch is full
+            int channelVertices = GhostAttribHelpers::gridVertexCount(rayCount);
+            if (!channels.empty() && numVertices + channelVertices > MAX_BATCH_VERTICES)
+            {
+                renderChannels(light, channels);
+                channels.clear();
+                numVertices = 0;
+            }
+
+            // Scale the intensity by the ratio of the ray grid area on the
+            // pupil and the ghost image area on the sensor, like the GL
+            // path does
+            glm::vec2 gridSize = ghost.getPupilBounds()[1] / 2.0f;
+            glm::vec2 imageSize = ghost.getSensorBounds()[1] / 2.0f;
+            float pupilArea = (gridSize.x * pupilHeight) * (gridSize.y * pupilHeight);
+            float wholePupilArea = glm::pow(2.0f * pupilHeight, 2.0f);
+            float sensorArea = imageSize.x * imageSize.y;
+            float intensity = sensorArea > 0.0f ? pupilArea / wholePupilArea / sensorArea : 0.0f;
+
+            Channel channel;
+            channel.m_ghost = &ghost;
+            channel.m_lambda = m_lambdas[ch];
+            channel.m_rayCount = rayCount;
+            channel.m_vertexOffset = numVertices;
+            channel.m_color = glm::vec4(ColorSpaceHelpers::lambda2RGB(m_lambdas[ch], 1.0f) * intensity *
+                lambert * m_intensityScale, 1.0f) * lightColor;
+            channels.push_back(channel);
+
+            numVertices += channelVertices;
+        }
+    }
+
+    if (!channels.empty())
+    {
+        renderChannels(light, channels);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareGhostAlgorithm::renderChannels(const LightSource& light, std::vector<Channel>& channels)
+{
+    int width = m_framebuffer.m_width;
+    int height = m_framebuffer.m_height;
+
+    // Trace the ray grids of the channels
+    const Channel& lastChannel = channels.back();
+    m_vertices.resize(lastChannel.m_vertexOffset +
+        GhostAttribHelpers::gridVertexCount(lastChannel.m_rayCount));
+
+    parallelFor((int) channels.size(), [&](int channelId)
+    {
+        const Channel& channel = channels[channelId];
+        m_tracer.traceGhostChannel(light, *channel.m_ghost, channel.m_lambda,
+            channel.m_rayCount, m_vertices.data() + channel.m_vertexOffset);
+    });
+
+    // Set up the triangles of the ray grids, and bin them into the tiles
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    for (auto& tile: m_tileTriangles)
+    {
+        tile.clear();
+    }
+    m_triangles.clear();
+
+    for (int channelId = 0; channelId < (int) channels.size(); ++channelId)
+    {
+        const Channel& channel = channels[channelId];
+        int rayCount = channel.m_rayCount;
+
+        for (int row = 0; row < rayCount - 1; ++row)
+        for (int col = 0; col < rayCount - 1; ++col)
+        for (int half = 0; half < 2; ++half)
+        {
+            Triangle triangle;
+            triangle.m_channelId = channelId;
+
+            glm::vec2 screen[3];
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                glm::ivec2 gridPos = glm::ivec2(col, row) + QUAD_IDS[half * 3 + corner];
+                int vertexId = channel.m_vertexOffset + gridPos.y * rayCount + gridPos.x;
+                const auto& vertex = m_vertices[vertexId];
+
+                glm::vec2 ndc = m_renderMode == RenderMode::PUPIL_GRID ?
+                    vertex.m_parameter : vertex.m_position;
+
+                triangle.m_vertices[corner] = vertexId;
+                screen[corner] = (ndc * 0.5f + 0.5f) * glm::vec2(width, height);
+            }
+
+            // Skip the triangles of rays that failed to trace
+            if (!std::isfinite(screen[0].x) || !std::isfinite(screen[0].y) ||
+                !std::isfinite(screen[1].x) || !std::isfinite(screen[1].y) ||
+                !std::isfinite(screen[2].x) || !std::isfinite(screen[2].y))
+            {
+                continue;
+            }
+
+            // Skip degenerate triangles, and make the rest counter-clockwise
+            float area = edgeFunction(screen[0], screen[1], screen[2]);
+            if (area == 0.0f)
+                continue;
+
+            if (area < 0.0f)
+            {
+                std::swap(triangle.m_vertices[1], triangle.m_vertices[2]);
+                std::swap(screen[1], screen[2]);
+            }
+
+            // Pixels whose centers may be covered, clipped to the framebuffer
+            glm::vec2 size = glm::vec2(width, height);
+            glm::vec2 minPos = glm::clamp(glm::min(screen[0], glm::min(screen[1], screen[2])),
+                glm::vec2(-1.0f), size + 1.0f);
+            glm::vec2 maxPos = glm::clamp(glm::max(screen[0], glm::max(screen[1], screen[2])),
+                glm::vec2(-1.0f), size + 1.0f);
+            triangle.m_bounds = glm::ivec4(
+                glm::max((int) glm::ceil(minPos.x - 0.5f), 0),
+                glm::max((int) glm::ceil(minPos.y - 0.5f), 0),
+                glm::min((int) glm::floor(maxPos.x - 0.5f), width - 1),
+                glm::min((int) glm::floor(maxPos.y - 0.5f), height - 1));
+
+            if (triangle.m_bounds.x > triangle.m_bounds.z || triangle.m_bounds.y > triangle.m_bounds.w)
+                continue;
+
+            // Add it to every overlapped tile
+            int triangleId = (int) m_triangles.size();
+            m_triangles.push_back(triangle);
+
+            for (int tileY = triangle.m_bounds.y / TILE_SIZE; tileY <= triangle.m_bounds.w / TILE_SIZE; ++tileY)
+            for (int tileX = triangle.m_bounds.x / TILE_SIZE; tileX <= triangle.m_bounds.z / TILE_SIZE; ++tileX)
+            {
+                m_tileTriangles[tileY * tilesX + tileX].push_back(triangleId);
+            }
+        }
+    }
+
+    // Rasterize the tiles in parallel
+    parallelFor((int) m_tileTriangles.size(), [&](int tileId)
+    {
+        rasterizeTile(tileId, channels);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareGhostAlgorithm::rasterizeTile(int tileId, const std::vector<Channel>& channels)
+{
+    int width = m_framebuffer.m_width;
+    int height = m_framebuffer.m_height;
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+
+    // Pixel extents of the tile
+    glm::ivec2 tileMin = glm::ivec2(tileId % tilesX, tileId / tilesX) * TILE_SIZE;
+    glm::ivec2 tileMax = glm::min(tileMin + TILE_SIZE - 1, glm::ivec2(width - 1, height - 1));
+
+    // Tiles are disjoint, so each thread writes its own pixels
+    glm::vec4* pixels = m_framebuffer.m_pixels.data();
+
+    for (int triangleId: m_tileTriangles[tileId])
+    {
+        const Triangle& triangle = m_triangles[triangleId];
+        const Channel& channel = channels[triangle.m_channelId];
+
+        const auto& v0 = m_vertices[triangle.m_vertices[0]];
+        const auto& v1 = m_vertices[triangle.m_vertices[1]];
+        const auto& v2 = m_vertices[triangle.m_vertices[2]];
+
+        // Screen positions of the corners
+        glm::vec2 size = glm::vec2(width, height);
+        bool pupilGrid = m_renderMode == RenderMode::PUPIL_GRID;
+        glm::vec2 p0 = ((pupilGrid ? v0.m_parameter : v0.m_position) * 0.5f + 0.5f) * size;
+        glm::vec2 p1 = ((pupilGrid ? v1.m_parameter : v1.m_position) * 0.5f + 0.5f) * size;
+        glm::vec2 p2 = ((pupilGrid ? v2.m_parameter : v2.m_position) * 0.5f + 0.5f) * size;
+
+        float area = edgeFunction(p0, p1, p2);
+
+        // Pixels exactly on an edge belong to the triangle only for top and
+        // left edges, so that shared edges are not drawn twice
+        bool topLeft0 = isTopLeftEdge(p1, p2);
+        bool topLeft1 = isTopLeftEdge(p2, p0);
+        bool topLeft2 = isTopLeftEdge(p0, p1);
+
+        int minX = glm::max(triangle.m_bounds.x, tileMin.x);
+        int minY = glm::max(triangle.m_bounds.y, tileMin.y);
+        int maxX = glm::min(triangle.m_bounds.z, tileMax.x);
+        int maxY = glm::min(triangle.m_bounds.w, tileMax.y);
+
+        for (int y = minY; y <= maxY; ++y)
+        for (int x = minX; x <= maxX; ++x)
+        {
+            glm::vec2 p = glm::vec2(x + 0.5f, y + 0.5f);
+
+            float w0 = edgeFunction(p1, p2, p);
+            float w1 = edgeFunction(p2, p0, p);
+            float w2 = edgeFunction(p0, p1, p);
+
+            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f ||
+                (w0 == 0.0f && !topLeft0) ||
+                (w1 == 0.0f && !topLeft1) ||
+                (w2 == 0.0f && !topLeft2))
+            {
+                continue;
+            }
+
+            // Interpolate the traced values
+            float b0 = w0 / area;
+            float b1 = w1 / area;
+            float b2 = w2 / area;
+
+            float radius = v0.m_radius * b0 + v1.m_radius * b1 + v2.m_radius * b2;
+
+            // Apply clipping based on the relative radius
+            if (radius > m_radiusClip)
+                continue;
+
+            glm::vec2 param = v0.m_parameter * b0 + v1.m_parameter * b1 + v2.m_parameter * b2;
+            glm::vec2 uv = v0.m_uv * b0 + v1.m_uv * b1 + v2.m_uv * b2;
+            float intensity = v0.m_intensity * b0 + v1.m_intensity * b1 + v2.m_intensity * b2;
+
+            // Sample the aperture mask
+            uv = glm::clamp(uv, glm::vec2(-1.0f), glm::vec2(1.0f)) * 0.5f + 0.5f;
+            float mask = m_tracer.sampleApertureMask(uv) < m_distanceClip ? 1.0f : 0.0f;
+
+            // Shade the fragment, like the fragment shader does
+            glm::vec4 color;
+            switch (m_shadingMode)
+            {
+                case ShadingMode::SHADED:
+                    color = channel.m_color * intensity * mask;
+                    break;
+
+                case ShadingMode::UNCOLORED:
+                    color = glm::vec4(1.0f) * intensity * mask;
+                    break;
+
+                case ShadingMode::UNSHADED:
+                    color = glm::vec4(mask);
+                    break;
+
+                case ShadingMode::RAY_COORDINATES:
+                    color = glm::vec4(glm::abs(param), 0.0f, 1.0f) * mask;
+                    break;
+
+                case ShadingMode::UV_COORDINATES:
+                    color = glm::vec4(uv, 0.0f, 1.0f) * mask;
+                    break;
+
+                case ShadingMode::RELATIVE_RADIUS:
+                    color = glm::vec4(glm::vec3(radius), 1.0f) * mask;
+                    if (radius > 1.0f)
+                    {
+                        color.y = color.z = 0.0f;
+                    }
+                    break;
+
+                default:
+                    color = glm::vec4(1.0f, 0.0f, 1.0f, 1.0f);
+                    break;
+            }
+
+            // Additive blending
+            pixels[y * width + x] += color;
+        }
+    }
+}
+
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "../OpticalSystem.h"
+#include "../Ghost.h"
+#include "../LightSource.h"
+#include "../GhostAlgorithm.h"
+#include "../TaskPool.h"
+#include "RayTraceGhostAlgorithm.h"
+#include "CpuGhostTracer.h"
+
+namespace OLEF
+{
+
+/// A software rasterizer implementation of the ray traced ghost rendering,
+/// which renders the ghosts into a floating point framebuffer without
+/// requiring a GL context or a GPU.
+///
+/// The ghost channels are traced with the CPU ghost tracer, and their ray
+/// grids are rasterized with additive blending, mirroring the render shaders
+/// of the ray traced algorithm: the same triangulation, per-channel intensity
+/// factors, aperture masking, radius and iris clipping, and render and
+/// shading modes. The framebuffer is split into tiles, which are rasterized
+/// in parallel on the threads of the optional task pool.
+class SoftwareGhostAlgorithm: public GhostAlgorithm
+{
+public:
+    /// The render modes of the ray traced algorithm.
+    using RenderMode = RayTraceGhostAlgorithm::RenderMode;
+
+    /// The shading modes of the ray traced algorithm.
+    using ShadingMode = RayTraceGhostAlgorithm::ShadingMode;
+
+    /// A CPU-side copy of the aperture mask texture.
+    using ApertureMask = CpuGhostTracer::ApertureMask;
+
+    /// A floating point RGBA framebuffer. The rows are stored bottom to top,
+    /// the same way as GL returns them.
+    struct Framebuffer
+    {
+        /// Width of the framebuffer.
+        int m_width = 0;
+
+        /// Height of the framebuffer.
+        int m_height = 0;
+
+        /// Row-major pixel values.
+        std::vector<glm::vec4> m_pixels;
+    };
+
+    /// Constructs a software ghost renderer for the parameter optical system.
+    /// Rasterization is spread across the threads of the optional task pool.
+    SoftwareGhostAlgorithm(OpticalSystem* system, TaskPool* pool = nullptr);
+
+    /// Resizes the framebuffer, clearing its contents.
+    void resize(int width, int height);
+
+    /// Clears the framebuffer to zero.
+    void clear();
+
+    /// Renders the ghosts corresponding to the parameter light source, adding
+    /// them to the contents of the framebuffer.
+    void renderGhosts(const LightSource& light, GhostListView ghosts);
+
+    /// Returns the optical system that generates the ghosts.
+    OpticalSystem* getOpticalSystem() const { return m_opticalSystem; }
+
+    /// Returns the framebuffer holding the rendered ghosts.
+    const Framebuffer& getFramebuffer() const { return m_framebuffer; }
+
+    /// Returns the task pool used for rendering.
+    TaskPool* getTaskPool() const { return m_pool; }
+
+    /// Returns the intensity scaling factor.
+    float getIntensityScale() const { return m_intensityScale; }
+
+    /// Returns the render mode.
+    RenderMode getRenderMode() const { return m_renderMode; }
+
+    /// Returns the shading mode.
+    ShadingMode getShadingMode() const { return m_shadingMode; }
+
+    /// Returns the radius clipping value.
+    float getRadiusClip() const { return m_radiusClip; }
+
+    /// Returns the distance clipping value.
+    float getDistanceClip() const { return m_distanceClip; }
+
+    /// Returns the intensity clipping value.
+    float getIntensityClip() const { return m_intensityClip; }
+
+    /// Returns the wavelengths at which to render the ghosts.
+    const std::vector<float>& getLambdas() const { return m_lambdas; }
+
+    /// Returns the aperture mask.
+    const ApertureMask& getApertureMask() const { return m_tracer.getApertureMask(); }
+
+    /// Sets the task pool used for rendering.
+    void setTaskPool(TaskPool* value) { m_pool = value; }
+
+    /// Sets the intensity scaling factor.
+    void setIntensityScale(float value) { m_intensityScale = value; }
+
+    /// Sets the render mode.
+    void setRenderMode(RenderMode value) { m_renderMode = value; }
+
+    /// Sets the shading mode.
+    void setShadingMode(ShadingMode value) { m_shadingMode = value; }
+
+    /// Sets the radius clipping value.
+    void setRadiusClip(float value) { m_radiusClip = value; }
+
+    /// Sets the distance clipping value.
+    void setDistanceClip(float value) { m_distanceClip = value; }
+
+    /// Sets the intensity clipping value.
+    void setIntensityClip(float value) { m_intensityClip = value; }
+
+    /// Sets the wavelengths at which to render the ghosts.
+    void setLambdas(const std::vector<float>& value) { m_lambdas = value; }
+
+    /// Sets the aperture mask, used both for tracing and masking. Without a
+    /// mask, the ghosts are fully masked, like with an unbound texture.
+    void setApertureMask(const ApertureMask& value) { m_tracer.setApertureMask(value); }
+
+private:
+    /// A ghost channel to render.
+    struct Channel
+    {
+        /// The ghost of the channel.
+        const Ghost* m_ghost;
+
+        /// Wavelength of the channel.
+        float m_lambda;
+
+        /// Size of the ray grid.
+        int m_rayCount;
+
+        /// First traced vertex of the channel.
+        int m_vertexOffset;
+
+        /// Color of the channel, scaled by the per-channel intensity factors.
+        glm::vec4 m_color;
+    };
+
+    /// A triangle of a traced ray grid.
+    struct Triangle
+    {
+        /// Indices of the traced vertices, in counter-clockwise order.
+        int m_vertices[3];
+
+        /// Index of the channel.
+        int m_channelId;
+
+        /// Pixel space bounding box (min x, min y, max x, max y), inclusive.
+        glm::ivec4 m_bounds;
+    };
+
+    /// Traces the parameter channels, and rasterizes their triangles.
+    void renderChannels(const LightSource& light, std::vector<Channel>& channels);
+
+    /// Rasterizes the binned triangles of a single tile.
+    void rasterizeTile(int tileId, const std::vector<Channel>& channels);
+
+    /// Runs fn(i) for each i in [0, count), in parallel if a pool is set.
+    template<typename Fn>
+    void parallelFor(int count, Fn fn) const
+    {
+        if (m_pool)
+        {
+            m_pool->parallelFor(count, fn);
+        }
+        else
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                fn(i);
+            }
+        }
+    }
+
+    /// The optical system that generates the ghosts.
+    OpticalSystem* m_opticalSystem;
+
+    /// Task pool used for rendering, or nullptr.
+    TaskPool* m_pool;
+
+    /// The tracer generating the ray grids.
+    CpuGhostTracer m_tracer;
+
+    /// The framebuffer holding the rendered ghosts.
+    Framebuffer m_framebuffer;
+
+    /// Intensity scaling.
+    float m_intensityScale;
+
+    /// Render mode.
+    RenderMode m_renderMode;
+
+    /// Shading mode.
+    ShadingMode m_shadingMode;
+
+    /// Radius clipping.
+    float m_radiusClip;
+
+    /// Distance clipping.
+    float m_distanceClip;
+
+    /// Intensity clip value, used to reject low intensity ghosts.
+    float m_intensityClip;
+
+    /// Wavelengths at which to render the ghosts.
+    std::vector<float> m_lambdas;
+
+    /// Traced vertices of the channels being rendered.
+    std::vector<CpuGhostTracer::PerVertexData> m_vertices;
+
+    /// Triangles of the channels being rendered.
+    std::vector<Triangle> m_triangles;
+
+    /// Indices of the triangles overlapping each tile.
+    std::vector<std::vector<int>> m_tileTriangles;
+};
+
+}
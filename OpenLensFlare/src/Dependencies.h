@@ -3,13 +3,31 @@
 // Standard headers
 #include <utility>   // For std::move.
 #include <cassert>   // For parameter validations.
+#include <cstddef>   // For offsetof.
+#include <cstdint>   // For fixed size integers.
+#include <cstdio>    // For file removal.
+#include <cstring>   // For raw memory handling.
 #include <string>    // For string handling.
+#include <sstream>   // For string formatting.
+#include <iomanip>   // For string formatting.
+#include <locale>    // For locale independent formatting.
 #include <iostream>  // For serialization of certain objects
+#include <fstream>   // For file handling.
 #include <array>     // For statically sized arrays.
 #include <vector>    // For dynamic arrays.
 #include <map>       // For mapping data to certain ghosts.
+#include <set>       // For sorted unique collections.
 #include <numeric>   // For std algorithms.
+#include <limits>    // For numeric limits.
 #include <algorithm> // For std algorithms.
+#include <memory>    // For smart pointers.
+#include <functional>         // For storing tasks.
+#include <deque>              // For task queues.
+#include <atomic>             // For thread synchronization.
+#include <mutex>              // For thread synchronization.
+#include <condition_variable> // For thread synchronization.
+#include <thread>             // For worker threads.
+#include <chrono>             // For timing statistics.
 
 // GLEW
 #define GLEW_STATIC
@@ -18,5 +36,6 @@
 // GLM
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#include "glm/gtc/constants.hpp"
 #include "glm/gtx/transform.hpp"
 #include "glm/gtc/matrix_transform.hpp"
\ No newline at end of file
@@ -165,4 +165,59 @@ private:
 /// A ghost list is just a vector of ghosts.
 using GhostList = std::vector<Ghost>;
 
+/// A non-owning view of a contiguous range of ghosts, such as a ghost list or
+/// a row of a ghost attribute table. The viewed ghosts must outlive the view.
+class GhostListView
+{
+public:
+    /// Standard iterator to the underlying data.
+    using const_iterator = const Ghost*;
+
+    /// Constructs an empty view.
+    GhostListView():
+        m_ghosts(nullptr),
+        m_size(0)
+    {}
+
+    /// Constructs a view of the parameter range.
+    GhostListView(const Ghost* ghosts, size_t size):
+        m_ghosts(ghosts),
+        m_size(size)
+    {}
+
+    /// Constructs a view of the entire parameter ghost list.
+    GhostListView(const GhostList& ghosts):
+        GhostListView(ghosts.data(), ghosts.size())
+    {}
+
+    /// Returns the number of viewed ghosts.
+    size_t size() const { return m_size; }
+
+    /// Returns whether the view is empty or not.
+    bool empty() const { return m_size == 0; }
+
+    /// Accesses the ith ghost.
+    const Ghost& operator[](size_t i) const { return m_ghosts[i]; }
+
+    /// Returns a view of count ghosts, starting at the first one. The range
+    /// is clamped to the viewed ghosts.
+    GhostListView slice(size_t first, size_t count) const
+    {
+        first = std::min(first, m_size);
+        count = std::min(count, m_size - first);
+        return GhostListView(m_ghosts + first, count);
+    }
+
+    const_iterator begin() const { return m_ghosts; }
+
+    const_iterator end() const { return m_ghosts + m_size; }
+
+private:
+    /// The first viewed ghost.
+    const Ghost* m_ghosts;
+
+    /// Number of viewed ghosts.
+    size_t m_size;
+};
+
 }
\ No newline at end of file
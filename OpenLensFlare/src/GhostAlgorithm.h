@@ -16,7 +16,7 @@ public:
     virtual ~GhostAlgorithm() {}
 
     /// Renders the ghosts corresponding to the parameter light source.
-    virtual void renderGhosts(const LightSource& light, const GhostList& ghosts) = 0;
+    virtual void renderGhosts(const LightSource& light, GhostListView ghosts) = 0;
 };
 
 }
\ No newline at end of file
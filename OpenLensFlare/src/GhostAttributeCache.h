@@ -0,0 +1,363 @@
+#pragma once
+
+#include "Dependencies.h"
+#include "HashHelpers.h"
+#include "OpticalSystem.h"
+#include "Ghost.h"
+#include "GhostBoundsFile.h"
+#include "Algorithms/RayTraceGhostAlgorithm.h"
+
+namespace OLEF
+{
+
+/// A persistent, on-disk cache of precomputed ghost attributes.
+///
+/// Entries are keyed by a stable hash of everything that influences the
+/// computations (the optical system, the ghost list, the incoming angles and
+/// the computation parameters), so switching back and forth between optical
+/// systems can reuse the previous results instead of recomputing them.
+///
+/// Each entry is stored in a separate ghost bounds file (see GhostBoundsFile)
+/// inside the cache directory, next to
+/// an index file that records the size and the last use of every entry. Once
+/// the total size of the entries exceeds the size limit, the least recently
+/// used ones are evicted. The cache directory must already exist.
+class GhostAttributeCache
+{
+public:
+    /// Type of the cache keys.
+    using Key = std::uint64_t;
+
+    /// The cached values: ghost lists for a set of incoming angles.
+    using AngleGhostMap = std::map<float, GhostList>;
+
+    /// Parameters for the attribute computations.
+    using GhostAttribComputeParams = RayTraceGhostAlgorithm::GhostAttribComputeParams;
+
+    /// Starting value of the hash functions.
+    static const Key HASH_SEED = HashHelpers::HASH_SEED;
+
+    /// Version of the cached computations, hashed into every key. Increment
+    /// it whenever the attribute computations change, so that the entries
+    /// computed by older code aren't reused.
+    static const std::uint32_t VERSION = 1;
+
+    /// Default size limit of the cache, in bytes.
+    static const std::uint64_t DEFAULT_MAX_BYTES = 256ull * 1024ull * 1024ull;
+
+    /// Constructs a cache object that manages the parameter directory.
+    GhostAttributeCache(const std::string& directory, std::uint64_t maxBytes = DEFAULT_MAX_BYTES):
+        m_directory(directory),
+        m_maxBytes(maxBytes),
+        m_useCounter(0)
+    {
+        // Make sure the path ends with a separator
+        if (!m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\')
+        {
+            m_directory += '/';
+        }
+
+        loadIndex();
+    }
+
+    /// Hashes the parameter bytes, using the 64-bit FNV-1a hash function. The
+    /// seed can be used to chain multiple calls together.
+    static Key hashBytes(const void* data, size_t size, Key seed = HASH_SEED)
+    {
+        return HashHelpers::hashBytes(data, size, seed);
+    }
+
+    /// Hashes a single value.
+    template<typename T>
+    static Key hashValue(const T& value, Key seed = HASH_SEED)
+    {
+        return hashBytes(&value, sizeof(T), seed);
+    }
+
+    /// Hashes a single floating point value. Positive and negative zeros hash
+    /// to the same value.
+    static Key hashValue(float value, Key seed = HASH_SEED)
+    {
+        value = value == 0.0f ? 0.0f : value;
+        return hashBytes(&value, sizeof(float), seed);
+    }
+
+    /// Computes the cache key of the parameter computation inputs. The seed
+    /// can be used to hash in any additional data the caller depends on (e.g.
+    /// the contents of the aperture texture).
+    static Key computeKey(const OpticalSystem& system, const GhostList& ghosts,
+        const std::vector<float>& angles, const GhostAttribComputeParams& params,
+        Key seed = HASH_SEED)
+    {
+        Key result = seed;
+
+        // Hash the version of the computations
+        result = hashValue((std::uint32_t) VERSION, result);
+
+        // Hash the system attributes
+        result = hashValue(system.getFnumber(), result);
+        result = hashValue(system.getEffectiveFocalLength(), result);
+        result = hashValue(system.getFilmWidth(), result);
+        result = hashValue(system.getFilmHeight(), result);
+
+        // Hash the elements; textures are GL handles, and are left out
+        result = hashValue((std::uint64_t) system.getElementCount(), result);
+        for (const auto& element: system)
+        {
+            result = hashValue((std::int32_t) element.getType(), result);
+            result = hashValue(element.getHeight(), result);
+            result = hashValue(element.getThickness(), result);
+            result = hashValue(element.getRadiusOfCurvature(), result);
+            result = hashValue(element.getIndexOfRefraction(), result);
+            result = hashValue(element.getAbbeNumber(), result);
+            result = hashValue(element.getCoatingLambda(), result);
+            result = hashValue(element.getCoatingIor(), result);
+        }
+
+        // Hash the ghost interfaces
+        result = hashValue((std::uint64_t) ghosts.size(), result);
+        for (const auto& ghost: ghosts)
+        {
+            result = hashValue((std::uint64_t) ghost.getLength(), result);
+            for (int iface: ghost)
+            {
+                result = hashValue((std::int32_t) iface, result);
+            }
+        }
+
+        // Hash the incoming angles
+        result = hashValue((std::uint64_t) angles.size(), result);
+        for (float angle: angles)
+        {
+            result = hashValue(angle, result);
+        }
+
+        // Hash the computation parameters; the angle is overridden by the
+        // angle list
+        result = hashValue((std::uint64_t) params.m_lambdas.size(), result);
+        for (float lambda: params.m_lambdas)
+        {
+            result = hashValue(lambda, result);
+        }
+        result = hashValue((std::uint64_t) params.m_boundingRays.size(), result);
+        for (int rays: params.m_boundingRays)
+        {
+            result = hashValue((std::int32_t) rays, result);
+        }
+        result = hashValue((std::uint64_t) params.m_rayPresets.size(), result);
+        for (int rays: params.m_rayPresets)
+        {
+            result = hashValue((std::int32_t) rays, result);
+        }
+        result = hashValue(params.m_radiusClip, result);
+        result = hashValue(params.m_distanceClip, result);
+        result = hashValue(params.m_intensityClip, result);
+        result = hashValue(params.m_targetVariance, result);
+        result = hashValue((std::int32_t) params.m_warmStart, result);
+        result = hashValue(params.m_seedDilation, result);
+        result = hashValue(params.m_boundsEpsilon, result);
+
+        return result;
+    }
+
+    /// Looks up the parameter key, and loads the corresponding ghost lists
+    /// into the output parameter. Returns false if the key is not cached.
+    bool load(Key key, AngleGhostMap& ghosts)
+    {
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+        {
+            return false;
+        }
+
+        // Read the entry, and drop it if it is no longer valid
+        if (!readEntry(getEntryPath(key), ghosts))
+        {
+            m_entries.erase(it);
+            saveIndex();
+            return false;
+        }
+
+        // Mark it as recently used
+        it->second.m_lastUse = ++m_useCounter;
+        saveIndex();
+
+        return true;
+    }
+
+    /// Stores the parameter ghost lists with the parameter key, evicting the
+    /// least recently used entries if needed. Returns false if the entry
+    /// could not be written.
+    bool store(Key key, const AngleGhostMap& ghosts)
+    {
+        std::uint64_t bytes = 0;
+        if (!writeEntry(getEntryPath(key), ghosts, bytes))
+        {
+            return false;
+        }
+
+        Entry& entry = m_entries[key];
+        entry.m_bytes = bytes;
+        entry.m_lastUse = ++m_useCounter;
+
+        evict();
+        saveIndex();
+
+        return true;
+    }
+
+    /// Removes every entry from the cache.
+    void clear()
+    {
+        for (const auto& entry: m_entries)
+        {
+            std::remove(getEntryPath(entry.first).c_str());
+        }
+        m_entries.clear();
+        saveIndex();
+    }
+
+    /// Returns the directory of the cache.
+    const std::string& getDirectory() const { return m_directory; }
+
+    /// Returns the size limit of the cache, in bytes.
+    std::uint64_t getMaxBytes() const { return m_maxBytes; }
+
+    /// Returns the number of cached entries.
+    size_t getEntryCount() const { return m_entries.size(); }
+
+    /// Returns the total size of the cached entries, in bytes.
+    std::uint64_t getTotalBytes() const
+    {
+        std::uint64_t result = 0;
+        for (const auto& entry: m_entries)
+        {
+            result += entry.second.m_bytes;
+        }
+        return result;
+    }
+
+    /// Sets the size limit of the cache, evicting entries if needed.
+    void setMaxBytes(std::uint64_t value)
+    {
+        m_maxBytes = value;
+        evict();
+        saveIndex();
+    }
+
+private:
+    /// Bookkeeping information of a cache entry.
+    struct Entry
+    {
+        /// Size of the entry file, in bytes.
+        std::uint64_t m_bytes = 0;
+
+        /// Value of the use counter when the entry was last used.
+        std::uint64_t m_lastUse = 0;
+    };
+
+    /// Returns the path of the index file.
+    std::string getIndexPath() const
+    {
+        return m_directory + "index.txt";
+    }
+
+    /// Returns the path of the entry file belonging to the parameter key.
+    std::string getEntryPath(Key key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.olefgb", (unsigned long long) key);
+        return m_directory + name;
+    }
+
+    /// Loads the index file.
+    void loadIndex()
+    {
+        m_entries.clear();
+        m_useCounter = 0;
+
+        std::ifstream file(getIndexPath());
+        std::string line;
+        while (std::getline(file, line))
+        {
+            // Skip the malformed lines; their entries are simply recomputed
+            unsigned long long key, bytes, lastUse;
+            char extra;
+            if (std::sscanf(line.c_str(), "%llx %llu %llu %c", &key, &bytes, &lastUse, &extra) != 3)
+            {
+                continue;
+            }
+
+            Entry entry;
+            entry.m_bytes = bytes;
+            entry.m_lastUse = lastUse;
+            m_entries[(Key) key] = entry;
+            m_useCounter = std::max(m_useCounter, entry.m_lastUse);
+        }
+    }
+
+    /// Writes out the index file.
+    void saveIndex() const
+    {
+        std::ofstream file(getIndexPath(), std::ios::trunc);
+        for (const auto& entry: m_entries)
+        {
+            char keyString[32];
+            std::snprintf(keyString, sizeof(keyString), "%016llx", (unsigned long long) entry.first);
+            file << keyString << ' ' << entry.second.m_bytes << ' ' << entry.second.m_lastUse << '\n';
+        }
+    }
+
+    /// Removes the least recently used entries, until the total size fits
+    /// into the size limit.
+    void evict()
+    {
+        std::uint64_t totalBytes = getTotalBytes();
+        while (totalBytes > m_maxBytes && !m_entries.empty())
+        {
+            auto oldest = std::min_element(m_entries.begin(), m_entries.end(),
+                [](const auto& a, const auto& b)
+                {
+                    return a.second.m_lastUse < b.second.m_lastUse;
+                });
+
+            totalBytes -= oldest->second.m_bytes;
+            std::remove(getEntryPath(oldest->first).c_str());
+            m_entries.erase(oldest);
+        }
+    }
+
+    /// Writes an entry file, and returns its size in the last parameter.
+    static bool writeEntry(const std::string& path, const AngleGhostMap& ghosts, std::uint64_t& bytes)
+    {
+        bytes = GhostBoundsFile::write(path, ghosts);
+        return bytes != 0;
+    }
+
+    /// Reads an entry file.
+    static bool readEntry(const std::string& path, AngleGhostMap& ghosts)
+    {
+        GhostBoundsFile file;
+        if (!file.open(path))
+        {
+            return false;
+        }
+
+        ghosts = file.getGhostLists();
+        return true;
+    }
+
+    /// The cache directory, with a trailing separator.
+    std::string m_directory;
+
+    /// Size limit of the cache, in bytes.
+    std::uint64_t m_maxBytes;
+
+    /// Counter used for tracking the last use of the entries.
+    std::uint64_t m_useCounter;
+
+    /// The cached entries.
+    std::map<Key, Entry> m_entries;
+};
+
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include "Dependencies.h"
+#include "Ghost.h"
+
+namespace OLEF
+{
+
+/// A lookup table of precomputed ghost attributes, indexed by the incoming
+/// angle of the light.
+///
+/// The ghost lists computed for a set of angles are resampled into uniformly
+/// spaced angle bins, which are stored in a single contiguous array, so
+/// finding the ghosts for an angle is a direct index computation instead of a
+/// search. Lookups return non-owning views; with interpolation turned on, the
+/// pupil and sensor bounds and the intensity are linearly interpolated between
+/// the two closest bins, into a scratch list that is reused between lookups.
+class GhostAttributeTable
+{
+public:
+    /// The precomputed ghost lists, keyed by their incoming angles.
+    using AngleGhostMap = std::map<float, GhostList>;
+
+    /// Constructs an empty table.
+    GhostAttributeTable():
+        m_minAngle(0.0f),
+        m_binWidth(1.0f),
+        m_binCount(0),
+        m_ghostCount(0),
+        m_interpolation(true)
+    {}
+
+    /// Constructs a table out of the parameter angle samples.
+    GhostAttributeTable(const AngleGhostMap& samples, float binWidth = 0.0f):
+        GhostAttributeTable()
+    {
+        build(samples, binWidth);
+    }
+
+    /// Rebuilds the table out of the parameter angle samples, which must all
+    /// hold the same ghosts in the same order. The bins span the range of the
+    /// sampled angles; without an explicit bin width, the smallest distance
+    /// between two neighbouring samples is used. Returns false, and leaves
+    /// the table empty, if the samples are incompatible.
+    bool build(const AngleGhostMap& samples, float binWidth = 0.0f)
+    {
+        clear();
+
+        if (samples.empty())
+        {
+            return false;
+        }
+
+        // Make sure every sample holds the same number of ghosts
+        size_t ghostCount = samples.begin()->second.size();
+        for (const auto& sample: samples)
+        {
+            if (sample.second.size() != ghostCount)
+            {
+                return false;
+            }
+        }
+
+        // Determine the bin width
+        float minAngle = samples.begin()->first;
+        float maxAngle = samples.rbegin()->first;
+        if (binWidth <= 0.0f)
+        {
+            binWidth = maxAngle - minAngle;
+            for (auto it = std::next(samples.begin()); it != samples.end(); ++it)
+            {
+                binWidth = std::min(binWidth, it->first - std::prev(it)->first);
+            }
+        }
+
+        // Place the bins so that the first and last ones land exactly on the
+        // ends of the sampled range
+        size_t binCount = 1;
+        if (maxAngle > minAngle && binWidth > 0.0f)
+        {
+            binCount = (size_t) std::floor((maxAngle - minAngle) / binWidth + 0.5f) + 1;
+            binCount = std::max(binCount, size_t(2));
+            binWidth = (maxAngle - minAngle) / (binCount - 1);
+        }
+        else
+        {
+            binWidth = 1.0f;
+        }
+
+        m_minAngle = minAngle;
+        m_binWidth = binWidth;
+        m_binCount = binCount;
+        m_ghostCount = ghostCount;
+        m_ghosts.resize(binCount * ghostCount);
+        m_scratch.resize(ghostCount);
+
+        // Resample the angles into the bins
+        for (size_t bin = 0; bin < binCount; ++bin)
+        {
+            float angle = getBinAngle(bin);
+            Ghost* binGhosts = m_ghosts.data() + bin * ghostCount;
+
+            // Find the samples surrounding the bin
+            auto upper = samples.lower_bound(angle);
+            if (upper == samples.end())
+            {
+                upper = std::prev(samples.end());
+            }
+            auto lower = upper == samples.begin() ? upper : std::prev(upper);
+
+            // Snap to the closer sample if the bin is (almost) exactly on it
+            float t = lower == upper ? 0.0f : (angle - lower->first) / (upper->first - lower->first);
+            if (t < 1e-4f || t > 1.0f - 1e-4f)
+            {
+                const GhostList& ghosts = (t < 0.5f ? lower : upper)->second;
+                std::copy(ghosts.begin(), ghosts.end(), binGhosts);
+                continue;
+            }
+
+            for (size_t ghostId = 0; ghostId < ghostCount; ++ghostId)
+            {
+                binGhosts[ghostId] = interpolate(lower->second[ghostId], upper->second[ghostId], t);
+            }
+        }
+
+        return true;
+    }
+
+    /// Removes every bin from the table.
+    void clear()
+    {
+        m_ghosts.clear();
+        m_scratch.clear();
+        m_binCount = 0;
+        m_ghostCount = 0;
+    }
+
+    /// Returns whether the table is empty or not.
+    bool empty() const { return m_binCount == 0; }
+
+    /// Returns the number of angle bins.
+    size_t getBinCount() const { return m_binCount; }
+
+    /// Returns the number of ghosts in each bin.
+    size_t getGhostCount() const { return m_ghostCount; }
+
+    /// Returns the angle of the first bin.
+    float getMinAngle() const { return m_minAngle; }
+
+    /// Returns the angle of the last bin.
+    float getMaxAngle() const { return getBinAngle(m_binCount == 0 ? 0 : m_binCount - 1); }
+
+    /// Returns the distance between two neighbouring bins.
+    float getBinWidth() const { return m_binWidth; }
+
+    /// Returns the angle corresponding to the parameter bin.
+    float getBinAngle(size_t bin) const { return m_minAngle + bin * m_binWidth; }
+
+    /// Returns whether lookups interpolate between neighbouring bins.
+    bool getInterpolation() const { return m_interpolation; }
+
+    /// Sets whether lookups interpolate between neighbouring bins.
+    void setInterpolation(bool value) { m_interpolation = value; }
+
+    /// Returns the ghosts of the parameter bin.
+    GhostListView getBin(size_t bin) const
+    {
+        return GhostListView(m_ghosts.data() + bin * m_ghostCount, m_ghostCount);
+    }
+
+    /// Returns the bin closest to the parameter angle, or -1 if the angle is
+    /// more than one bin away from the range of the table.
+    int findBin(float angle) const
+    {
+        float x;
+        return findPosition(angle, x) ? (int) std::floor(x + 0.5f) : -1;
+    }
+
+    /// Returns the ghosts corresponding to the parameter angle, or an empty
+    /// view if the angle is more than one bin away from the range of the
+    /// table. Interpolated results are only valid until the next lookup.
+    GhostListView lookup(float angle)
+    {
+        float x;
+        if (!findPosition(angle, x))
+        {
+            return GhostListView();
+        }
+
+        // Use the closest bin, if no interpolation is needed
+        size_t bin = (size_t) std::floor(x);
+        float t = x - bin;
+        if (!m_interpolation || m_binCount == 1 || t == 0.0f)
+        {
+            return getBin((size_t) std::floor(x + 0.5f));
+        }
+
+        // Interpolate between the neighbouring bins
+        const Ghost* lower = m_ghosts.data() + bin * m_ghostCount;
+        const Ghost* upper = lower + m_ghostCount;
+        for (size_t ghostId = 0; ghostId < m_ghostCount; ++ghostId)
+        {
+            m_scratch[ghostId] = interpolate(lower[ghostId], upper[ghostId], t);
+        }
+
+        return GhostListView(m_scratch);
+    }
+
+    /// Returns whether the parameter ghost is visible; ghosts without any
+    /// valid rays carry negative sizes in their bounds instead.
+    static bool isVisible(const Ghost& ghost)
+    {
+        return ghost.getSensorBounds()[1].x >= 0.0f && ghost.getSensorBounds()[1].y >= 0.0f;
+    }
+
+    /// Linearly interpolates the bounds and the intensity of the parameter
+    /// ghosts, which must have the same interfaces. The channel and ray
+    /// counts are taken from the more demanding one of the two. If only one
+    /// of them is visible, the closer one is returned as is, since the
+    /// invisibility markers can't be interpolated.
+    static Ghost interpolate(const Ghost& a, const Ghost& b, float t)
+    {
+        if (!isVisible(a) || !isVisible(b))
+        {
+            return t < 0.5f ? a : b;
+        }
+
+        Ghost result = a;
+
+        Ghost::BoundingRect pupilA = a.getPupilBounds(), pupilB = b.getPupilBounds();
+        Ghost::BoundingRect sensorA = a.getSensorBounds(), sensorB = b.getSensorBounds();
+
+        result.setPupilBounds({ glm::mix(pupilA[0], pupilB[0], t), glm::mix(pupilA[1], pupilB[1], t) });
+        result.setSensorBounds({ glm::mix(sensorA[0], sensorB[0], t), glm::mix(sensorA[1], sensorB[1], t) });
+        result.setAverageIntensity(glm::mix(a.getAverageIntensity(), b.getAverageIntensity(), t));
+        result.setMinimumChannels(std::max(a.getMinimumChannels(), b.getMinimumChannels()));
+        result.setOptimalChannels(std::max(a.getOptimalChannels(), b.getOptimalChannels()));
+        result.setMinimumRays(std::max(a.getMinimumRays(), b.getMinimumRays()));
+        result.setOptimalRays(std::max(a.getOptimalRays(), b.getOptimalRays()));
+
+        return result;
+    }
+
+private:
+    /// Computes the fractional bin position of the parameter angle, clamped
+    /// to the range of the table. Returns false if the angle is more than
+    /// one bin away from the range of the table.
+    bool findPosition(float angle, float& x) const
+    {
+        if (m_binCount == 0)
+        {
+            return false;
+        }
+
+        x = (angle - m_minAngle) / m_binWidth;
+        if (x < -1.0f || x > (float) m_binCount)
+        {
+            return false;
+        }
+
+        x = glm::clamp(x, 0.0f, (float) (m_binCount - 1));
+        return true;
+    }
+
+    /// Angle of the first bin.
+    float m_minAngle;
+
+    /// Distance between two neighbouring bins.
+    float m_binWidth;
+
+    /// Number of angle bins.
+    size_t m_binCount;
+
+    /// Number of ghosts in each bin.
+    size_t m_ghostCount;
+
+    /// Whether lookups interpolate between neighbouring bins or not.
+    bool m_interpolation;
+
+    /// The binned ghosts, stored bin after bin.
+    GhostList m_ghosts;
+
+    /// Storage for the interpolated lookup results.
+    GhostList m_scratch;
+};
+
+}
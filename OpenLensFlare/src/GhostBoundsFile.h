@@ -0,0 +1,400 @@
+#pragma once
+
+#include "Dependencies.h"
+#include "Ghost.h"
+
+namespace OLEF
+{
+
+/// A compact, binary container of precomputed ghost attributes for a set of
+/// incoming angles.
+///
+/// The file starts with a fixed size header, followed by an index of the
+/// angles (sorted in increasing order), and the fixed-stride ghost records of
+/// every angle. Everything is stored in little-endian byte order with 4-byte
+/// alignment, so an opened file is simply memory mapped, and the records can
+/// be accessed in place, without any parsing or per-ghost allocations.
+class GhostBoundsFile
+{
+public:
+    /// Ghost lists for a set of incoming angles.
+    using AngleGhostMap = std::map<float, GhostList>;
+
+    /// Current version of the format. Files with a different version are
+    /// rejected.
+    static const std::uint32_t VERSION = 1;
+
+    /// The file header.
+    struct Header
+    {
+        /// Identifies the file format ("OLEFGHB" followed by a zero).
+        char m_magic[8];
+
+        /// Version of the format.
+        std::uint32_t m_version;
+
+        /// Size of the header, in bytes.
+        std::uint32_t m_headerSize;
+
+        /// Size of an angle index entry, in bytes.
+        std::uint32_t m_angleEntrySize;
+
+        /// Size of a ghost record, in bytes.
+        std::uint32_t m_ghostRecordSize;
+
+        /// Number of angles in the file.
+        std::uint32_t m_numAngles;
+
+        /// Total number of ghost records in the file.
+        std::uint32_t m_numGhosts;
+
+        /// Byte offset of the angle index.
+        std::uint64_t m_angleIndexOffset;
+
+        /// Byte offset of the ghost records.
+        std::uint64_t m_ghostRecordOffset;
+    };
+
+    /// An entry of the angle index.
+    struct AngleEntry
+    {
+        /// The incoming angle.
+        float m_angle;
+
+        /// Index of the first ghost record of the angle.
+        std::uint32_t m_firstGhost;
+
+        /// Number of ghost records of the angle.
+        std::uint32_t m_numGhosts;
+
+        /// Unused, keeps the entries 16 bytes long.
+        std::uint32_t m_reserved;
+    };
+
+    /// A ghost record, holding the attributes of a single ghost.
+    struct GhostRecord
+    {
+        /// Number of interfaces.
+        std::int32_t m_length;
+
+        /// The interfaces that the ghost is reflected by.
+        std::int32_t m_interfaces[Ghost::MAX_INTERFACES];
+
+        /// Pupil bounds, in corner-size format.
+        float m_pupilBounds[4];
+
+        /// Sensor bounds, in corner-size format.
+        float m_sensorBounds[4];
+
+        /// Average of the transported energy.
+        float m_avgIntensity;
+
+        /// Minimum number of channels to render.
+        std::int32_t m_minChannels;
+
+        /// Optimal number of channels to render.
+        std::int32_t m_optimalChannels;
+
+        /// Minimum number of rays to render with.
+        std::int32_t m_minRays;
+
+        /// Optimal number of rays to render with.
+        std::int32_t m_optimalRays;
+    };
+
+    static_assert(sizeof(Header) == 48, "Unexpected ghost bounds file header size.");
+    static_assert(sizeof(AngleEntry) == 16, "Unexpected ghost bounds file angle entry size.");
+    static_assert(sizeof(GhostRecord) == 120, "Unexpected ghost bounds file record size.");
+
+    /// Constructs an object with no file opened.
+    GhostBoundsFile():
+        m_data(nullptr),
+        m_size(0),
+        m_mapped(false),
+        m_file(nullptr),
+        m_mapping(nullptr)
+    {}
+
+    /// Closes the opened file.
+    ~GhostBoundsFile()
+    {
+        close();
+    }
+
+    /// These objects are not copyable.
+    GhostBoundsFile(const GhostBoundsFile& other) = delete;
+
+    /// These objects are not copyable.
+    GhostBoundsFile& operator=(const GhostBoundsFile& other) = delete;
+
+    /// Memory maps the parameter file. Returns false if the file could not be
+    /// opened, or it is not a valid ghost bounds file.
+    bool open(const std::string& path);
+
+    /// Uses the parameter memory block as the file contents. The memory must
+    /// be 8-byte aligned, and stay valid until the object is closed.
+    bool open(const void* data, size_t size)
+    {
+        close();
+
+        m_data = (const char*) data;
+        m_size = size;
+        m_mapped = false;
+
+        if (!validate())
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Closes the opened file.
+    void close();
+
+    /// Returns whether a file is opened.
+    bool isOpen() const { return m_data != nullptr; }
+
+    /// Returns the file header.
+    const Header& getHeader() const { return *(const Header*) m_data; }
+
+    /// Returns the number of angles in the file.
+    size_t getAngleCount() const { return getHeader().m_numAngles; }
+
+    /// Returns the angle index, sorted by the angles.
+    const AngleEntry* getAngles() const
+    {
+        return (const AngleEntry*) (m_data + getHeader().m_angleIndexOffset);
+    }
+
+    /// Returns the ghost records of the ith angle.
+    const GhostRecord* getGhostRecords(size_t angleId) const
+    {
+        return (const GhostRecord*) (m_data + getHeader().m_ghostRecordOffset) +
+            getAngles()[angleId].m_firstGhost;
+    }
+
+    /// Returns the index of the angle closest to the parameter one, or the
+    /// angle count (zero) if the file holds no angles.
+    size_t findAngle(float angle) const
+    {
+        if (getAngleCount() == 0)
+            return 0;
+
+        const AngleEntry* begin = getAngles();
+        const AngleEntry* end = begin + getAngleCount();
+
+        const AngleEntry* it = std::lower_bound(begin, end, angle,
+            [](const AngleEntry& entry, float value) { return entry.m_angle < value; });
+
+        if (it == end)
+            return getAngleCount() - 1;
+        if (it != begin && angle - (it - 1)->m_angle < it->m_angle - angle)
+            return (it - begin) - 1;
+        return it - begin;
+    }
+
+    /// Converts a ghost record to a ghost object.
+    static Ghost toGhost(const GhostRecord& record)
+    {
+        Ghost result(record.m_interfaces, record.m_interfaces + record.m_length);
+
+        result.setPupilBounds({
+            glm::vec2(record.m_pupilBounds[0], record.m_pupilBounds[1]),
+            glm::vec2(record.m_pupilBounds[2], record.m_pupilBounds[3]) });
+        result.setSensorBounds({
+            glm::vec2(record.m_sensorBounds[0], record.m_sensorBounds[1]),
+            glm::vec2(record.m_sensorBounds[2], record.m_sensorBounds[3]) });
+        result.setAverageIntensity(record.m_avgIntensity);
+        result.setMinimumChannels(record.m_minChannels);
+        result.setOptimalChannels(record.m_optimalChannels);
+        result.setMinimumRays(record.m_minRays);
+        result.setOptimalRays(record.m_optimalRays);
+
+        return result;
+    }
+
+    /// Converts a ghost object to a ghost record.
+    static GhostRecord toRecord(const Ghost& ghost)
+    {
+        GhostRecord result = {};
+
+        result.m_length = (std::int32_t) ghost.getLength();
+        std::copy(ghost.begin(), ghost.end(), result.m_interfaces);
+
+        auto pupilBounds = ghost.getPupilBounds();
+        auto sensorBounds = ghost.getSensorBounds();
+        for (int i = 0; i < 2; ++i)
+        {
+            result.m_pupilBounds[i * 2 + 0] = pupilBounds[i].x;
+            result.m_pupilBounds[i * 2 + 1] = pupilBounds[i].y;
+            result.m_sensorBounds[i * 2 + 0] = sensorBounds[i].x;
+            result.m_sensorBounds[i * 2 + 1] = sensorBounds[i].y;
+        }
+
+        result.m_avgIntensity = ghost.getAverageIntensity();
+        result.m_minChannels = ghost.getMinimumChannels();
+        result.m_optimalChannels = ghost.getOptimalChannels();
+        result.m_minRays = ghost.getMinimumRays();
+        result.m_optimalRays = ghost.getOptimalRays();
+
+        return result;
+    }
+
+    /// Returns the ghost list of the ith angle.
+    GhostList getGhostList(size_t angleId) const
+    {
+        const GhostRecord* records = getGhostRecords(angleId);
+
+        GhostList result;
+        result.reserve(getAngles()[angleId].m_numGhosts);
+        for (std::uint32_t i = 0; i < getAngles()[angleId].m_numGhosts; ++i)
+        {
+            result.push_back(toGhost(records[i]));
+        }
+
+        return result;
+    }
+
+    /// Returns the ghost lists of every angle.
+    AngleGhostMap getGhostLists() const
+    {
+        AngleGhostMap result;
+        for (size_t angleId = 0; angleId < getAngleCount(); ++angleId)
+        {
+            result[getAngles()[angleId].m_angle] = getGhostList(angleId);
+        }
+
+        return result;
+    }
+
+    /// Writes the parameter ghost lists to the parameter stream. Returns the
+    /// number of bytes written, or zero on failure.
+    static std::uint64_t write(std::ostream& stream, const AngleGhostMap& ghosts)
+    {
+        // Count the ghosts
+        std::uint32_t numGhosts = 0;
+        for (const auto& angle: ghosts)
+        {
+            numGhosts += (std::uint32_t) angle.second.size();
+        }
+
+        // Fill the header
+        Header header = {};
+        std::memcpy(header.m_magic, MAGIC, sizeof(header.m_magic));
+        header.m_version = VERSION;
+        header.m_headerSize = sizeof(Header);
+        header.m_angleEntrySize = sizeof(AngleEntry);
+        header.m_ghostRecordSize = sizeof(GhostRecord);
+        header.m_numAngles = (std::uint32_t) ghosts.size();
+        header.m_numGhosts = numGhosts;
+        header.m_angleIndexOffset = sizeof(Header);
+        header.m_ghostRecordOffset = sizeof(Header) + ghosts.size() * sizeof(AngleEntry);
+
+        stream.write((const char*) &header, sizeof(Header));
+
+        // Write the angle index
+        std::uint32_t firstGhost = 0;
+        for (const auto& angle: ghosts)
+        {
+            AngleEntry entry = {};
+            entry.m_angle = angle.first;
+            entry.m_firstGhost = firstGhost;
+            entry.m_numGhosts = (std::uint32_t) angle.second.size();
+
+            stream.write((const char*) &entry, sizeof(AngleEntry));
+            firstGhost += entry.m_numGhosts;
+        }
+
+        // Write the ghost records
+        for (const auto& angle: ghosts)
+        {
+            for (const auto& ghost: angle.second)
+            {
+                GhostRecord record = toRecord(ghost);
+                stream.write((const char*) &record, sizeof(GhostRecord));
+            }
+        }
+
+        if (!stream)
+            return 0;
+
+        return header.m_ghostRecordOffset + (std::uint64_t) numGhosts * sizeof(GhostRecord);
+    }
+
+    /// Writes the parameter ghost lists to the parameter file. Returns the
+    /// number of bytes written, or zero on failure.
+    static std::uint64_t write(const std::string& path, const AngleGhostMap& ghosts)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return 0;
+
+        return write(file, ghosts);
+    }
+
+private:
+    /// The identifier at the start of the files.
+    static constexpr const char* MAGIC = "OLEFGHB";
+
+    /// Makes sure the opened data is a valid ghost bounds file.
+    bool validate() const
+    {
+        if (m_size < sizeof(Header))
+            return false;
+
+        const Header& header = getHeader();
+        if (std::memcmp(header.m_magic, MAGIC, sizeof(header.m_magic)) != 0 ||
+            header.m_version != VERSION ||
+            header.m_headerSize != sizeof(Header) ||
+            header.m_angleEntrySize != sizeof(AngleEntry) ||
+            header.m_ghostRecordSize != sizeof(GhostRecord))
+        {
+            return false;
+        }
+
+        // Make sure the index and the records fit in the file
+        if (header.m_angleIndexOffset + (std::uint64_t) header.m_numAngles * sizeof(AngleEntry) > m_size ||
+            header.m_ghostRecordOffset + (std::uint64_t) header.m_numGhosts * sizeof(GhostRecord) > m_size ||
+            header.m_angleIndexOffset % 4 != 0 || header.m_ghostRecordOffset % 4 != 0)
+        {
+            return false;
+        }
+
+        // Make sure the angle entries refer to valid records
+        const AngleEntry* angles = getAngles();
+        for (std::uint32_t i = 0; i < header.m_numAngles; ++i)
+        {
+            if ((std::uint64_t) angles[i].m_firstGhost + angles[i].m_numGhosts > header.m_numGhosts)
+                return false;
+        }
+
+        // Make sure the ghost lengths are valid
+        const GhostRecord* records = (const GhostRecord*) (m_data + header.m_ghostRecordOffset);
+        for (std::uint32_t i = 0; i < header.m_numGhosts; ++i)
+        {
+            if (records[i].m_length < 0 || records[i].m_length > Ghost::MAX_INTERFACES)
+                return false;
+        }
+
+        return true;
+    }
+
+    /// The contents of the opened file.
+    const char* m_data;
+
+    /// Size of the opened file, in bytes.
+    size_t m_size;
+
+    /// Whether the data is mapped from a file, or provided by the user.
+    bool m_mapped;
+
+    /// Handle of the opened file, on Windows.
+    void* m_file;
+
+    /// Handle of the file mapping, on Windows.
+    void* m_mapping;
+};
+
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include "Dependencies.h"
+#include "OpticalSystem.h"
+#include "Ghost.h"
+
+namespace OLEF
+{
+
+/// Enumerates the ghosts of an optical system without building the full
+/// ghost list, in the same order as OpticalSystem::generateGhosts.
+///
+/// Every ghost has a rank: its index in the enumeration order. The number of
+/// ghosts is computed combinatorially, from a table holding the number of
+/// ways each partial ghost can be finished, which also allows constructing
+/// any ghost directly from its rank. Together with the lazy iterators, this
+/// lets the ghosts be split into rank ranges (e.g. between threads or
+/// processes), with each part enumerated independently.
+class GhostEnumerator
+{
+public:
+    /// A forward iterator over the ghosts, which produces them one at a time.
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Ghost;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Ghost*;
+        using reference = const Ghost&;
+
+        /// Constructs an invalid iterator.
+        iterator():
+            m_enumerator(nullptr),
+            m_rank(0),
+            m_regionId(0)
+        {}
+
+        /// Returns the rank of the current ghost.
+        size_t getRank() const { return m_rank; }
+
+        /// Accesses the current ghost.
+        reference operator*() const { return m_ghost; }
+
+        /// Accesses the current ghost.
+        pointer operator->() const { return &m_ghost; }
+
+        /// Steps to the next ghost.
+        iterator& operator++()
+        {
+            m_enumerator->advance(*this);
+            return *this;
+        }
+
+        /// Steps to the next ghost.
+        iterator operator++(int)
+        {
+            iterator result = *this;
+            ++(*this);
+            return result;
+        }
+
+        /// Iterators of the same enumerator are equal if they point to the
+        /// same rank.
+        bool operator==(const iterator& other) const { return m_rank == other.m_rank; }
+
+        /// Iterators of the same enumerator are equal if they point to the
+        /// same rank.
+        bool operator!=(const iterator& other) const { return m_rank != other.m_rank; }
+
+    private:
+        friend class GhostEnumerator;
+
+        /// The enumerator this iterator belongs to.
+        const GhostEnumerator* m_enumerator;
+
+        /// Rank of the current ghost.
+        size_t m_rank;
+
+        /// Region of the current ghost.
+        size_t m_regionId;
+
+        /// Positions of the reflecting interfaces inside the region.
+        std::vector<int> m_positions;
+
+        /// The current ghost.
+        Ghost m_ghost;
+    };
+
+    /// A range of ghosts, that can be used in range-based for loops.
+    struct Range
+    {
+        /// Iterator to the first ghost of the range.
+        iterator m_begin;
+
+        /// Iterator past the last ghost of the range.
+        iterator m_end;
+
+        iterator begin() const { return m_begin; }
+
+        iterator end() const { return m_end; }
+    };
+
+    /// Constructs an enumerator for the ghosts of the parameter system, with
+    /// the same filters as OpticalSystem::generateGhosts.
+    GhostEnumerator(const OpticalSystem& system, int maxBounces = 0, bool apertureCross = false):
+        m_numReflections(maxBounces),
+        m_regions(system.getGhostRegions(apertureCross)),
+        m_completions(m_regions.size()),
+        m_regionOffsets(m_regions.size() + 1, 0)
+    {
+        // The 'no reflections' case has a single, empty ghost
+        if (m_numReflections == 0)
+        {
+            m_regions.clear();
+            m_completions.clear();
+            m_regionOffsets = { 0, 1 };
+            return;
+        }
+
+        // Count the ghosts of each region
+        for (size_t regionId = 0; regionId < m_regions.size(); ++regionId)
+        {
+            int numInterfaces = (int) m_regions[regionId].size();
+            auto& completions = m_completions[regionId];
+            completions.assign(m_numReflections * numInterfaces, 0);
+
+            // The last reflection finishes the ghost
+            for (int position = 0; position < numInterfaces; ++position)
+            {
+                completions[(m_numReflections - 1) * numInterfaces + position] = 1;
+            }
+
+            // Work backwards, summing up the completions of the valid next
+            // positions with a running sum
+            for (int depth = m_numReflections - 2; depth >= 0; --depth)
+            {
+                const size_t* next = completions.data() + (depth + 1) * numInterfaces;
+                size_t* current = completions.data() + depth * numInterfaces;
+
+                // The next reflection is a forward one, behind the current
+                if ((depth + 1) % 2 == 0)
+                {
+                    size_t sum = 0;
+                    for (int position = numInterfaces - 1; position >= 0; --position)
+                    {
+                        current[position] = sum;
+                        sum += next[position];
+                    }
+                }
+
+                // The next reflection is a backward one, in front of the
+                // current
+                else
+                {
+                    size_t sum = 0;
+                    for (int position = 0; position < numInterfaces; ++position)
+                    {
+                        current[position] = sum;
+                        sum += next[position];
+                    }
+                }
+            }
+
+            // The first reflection can happen at any but the front interface
+            size_t numGhosts = 0;
+            for (int position = 1; position < numInterfaces; ++position)
+            {
+                numGhosts += completions[position];
+            }
+            m_regionOffsets[regionId + 1] = m_regionOffsets[regionId] + numGhosts;
+        }
+    }
+
+    /// Returns the number of reflections of the enumerated ghosts.
+    int getNumReflections() const { return m_numReflections; }
+
+    /// Returns the number of ghosts, without enumerating them.
+    size_t getGhostCount() const { return m_regionOffsets.back(); }
+
+    /// Returns the ghost with the parameter rank, which must be less than
+    /// the number of ghosts.
+    Ghost getGhost(size_t rank) const
+    {
+        return *at(rank);
+    }
+
+    /// Returns an iterator to the ghost with the parameter rank, or the end
+    /// iterator if the rank is out of range. Iteration can be resumed from
+    /// any rank this way.
+    iterator at(size_t rank) const
+    {
+        iterator result;
+        result.m_enumerator = this;
+        result.m_rank = std::min(rank, getGhostCount());
+
+        if (result.m_rank == getGhostCount() || m_numReflections == 0)
+        {
+            return result;
+        }
+
+        // Find the region of the ghost
+        result.m_regionId = std::upper_bound(m_regionOffsets.begin(), m_regionOffsets.end(),
+            result.m_rank) - m_regionOffsets.begin() - 1;
+        size_t remaining = result.m_rank - m_regionOffsets[result.m_regionId];
+
+        // Pick each reflection, by skipping over the ghosts of the earlier
+        // candidate positions
+        int numInterfaces = (int) m_regions[result.m_regionId].size();
+        const auto& completions = m_completions[result.m_regionId];
+        result.m_positions.resize(m_numReflections);
+        for (int depth = 0; depth < m_numReflections; ++depth)
+        {
+            int first, last;
+            getPositionRange(result.m_positions, depth, numInterfaces, first, last);
+
+            int position = first;
+            while (position < last && remaining >= completions[depth * numInterfaces + position])
+            {
+                remaining -= completions[depth * numInterfaces + position];
+                ++position;
+            }
+            result.m_positions[depth] = position;
+        }
+
+        updateGhost(result);
+        return result;
+    }
+
+    /// Returns an iterator to the first ghost.
+    iterator begin() const { return at(0); }
+
+    /// Returns the end iterator.
+    iterator end() const { return at(getGhostCount()); }
+
+    /// Returns the range of the parameter number of ghosts, starting with the
+    /// parameter rank. The range is clamped to the available ghosts.
+    Range range(size_t first, size_t count) const
+    {
+        first = std::min(first, getGhostCount());
+        return { at(first), at(first + std::min(count, getGhostCount() - first)) };
+    }
+
+    /// Generates the ghost list of the parameter rank range.
+    GhostList generateGhosts(size_t first, size_t count) const
+    {
+        Range ghosts = range(first, count);
+
+        GhostList result;
+        result.reserve(ghosts.m_end.getRank() - ghosts.m_begin.getRank());
+        for (const Ghost& ghost: ghosts)
+        {
+            result.push_back(ghost);
+        }
+
+        return result;
+    }
+
+private:
+    /// Computes the range of valid positions for the reflection at the
+    /// parameter depth, given the positions of the preceding ones. Forward
+    /// reflections happen behind the previous reflection (the first one at
+    /// any but the front interface), backward ones in front of it.
+    void getPositionRange(const std::vector<int>& positions, int depth, int numInterfaces,
+        int& first, int& last) const
+    {
+        int previous = depth == 0 ? 0 : positions[depth - 1];
+        first = depth % 2 == 0 ? previous + 1 : 0;
+        last = depth % 2 == 0 ? numInterfaces - 1 : previous - 1;
+    }
+
+    /// Rebuilds the ghost of the parameter iterator from its positions.
+    void updateGhost(iterator& it) const
+    {
+        const auto& region = m_regions[it.m_regionId];
+
+        it.m_ghost = Ghost();
+        it.m_ghost.setLength(m_numReflections);
+        for (int depth = 0; depth < m_numReflections; ++depth)
+        {
+            it.m_ghost[depth] = region[it.m_positions[depth]];
+        }
+    }
+
+    /// Steps the parameter iterator to the next ghost.
+    void advance(iterator& it) const
+    {
+        // Stop at the end
+        if (++it.m_rank >= getGhostCount())
+        {
+            it.m_rank = getGhostCount();
+            return;
+        }
+
+        // Move on to the next region once this one is finished, skipping
+        // the empty ones
+        if (it.m_rank == m_regionOffsets[it.m_regionId + 1])
+        {
+            it = at(it.m_rank);
+            return;
+        }
+
+        // Increment the deepest reflection that can still be moved, and
+        // restart the ones after it
+        int numInterfaces = (int) m_regions[it.m_regionId].size();
+        int depth = m_numReflections - 1;
+        for (; depth >= 0; --depth)
+        {
+            int first, last;
+            getPositionRange(it.m_positions, depth, numInterfaces, first, last);
+            if (it.m_positions[depth] < last)
+            {
+                ++it.m_positions[depth];
+                break;
+            }
+        }
+        for (++depth; depth < m_numReflections; ++depth)
+        {
+            int first, last;
+            getPositionRange(it.m_positions, depth, numInterfaces, first, last);
+            it.m_positions[depth] = first;
+        }
+
+        updateGhost(it);
+    }
+
+    /// Number of reflections of the ghosts.
+    int m_numReflections;
+
+    /// The interfaces of each region.
+    std::vector<std::vector<int>> m_regions;
+
+    /// The number of ways a partial ghost can be finished, for each region,
+    /// stored as a (reflection, position) table: the number of ghosts that
+    /// share the reflections up to and including the indexed one.
+    std::vector<std::vector<size_t>> m_completions;
+
+    /// Rank of the first ghost of each region, followed by the total count.
+    std::vector<size_t> m_regionOffsets;
+};
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Dependencies.h"
+
+namespace OLEF
+{
+namespace HashHelpers
+{
+    /// Type of the computed hashes.
+    using Hash = std::uint64_t;
+
+    /// Starting value of the hash functions.
+    static const Hash HASH_SEED = 14695981039346656037ull;
+
+    /// Hashes the parameter bytes, using the 64-bit FNV-1a hash function. The
+    /// seed can be used to chain multiple calls together.
+    inline Hash hashBytes(const void* data, size_t size, Hash seed = HASH_SEED)
+    {
+        const unsigned char* bytes = (const unsigned char*) data;
+
+        Hash result = seed;
+        for (size_t i = 0; i < size; ++i)
+        {
+            result ^= bytes[i];
+            result *= 1099511628211ull;
+        }
+
+        return result;
+    }
+}
+}
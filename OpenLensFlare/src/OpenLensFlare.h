@@ -3,12 +3,19 @@
 #include "Dependencies.h"
 #include "OpticalSystem.h"
 #include "Ghost.h"
+#include "GhostEnumerator.h"
 #include "LightSource.h"
 #include "StarburstAlgorithm.h"
 #include "GhostAlgorithm.h"
+#include "TaskPool.h"
+#include "GhostBoundsFile.h"
+#include "GhostAttributeCache.h"
+#include "GhostAttributeTable.h"
 
+#include "Algorithms/ProgramCache.h"
 #include "Algorithms/DiffractionStarburstAlgorithm.h"
+#include "Algorithms/GhostScheduler.h"
 #include "Algorithms/RayTraceGhostAlgorithm.h"
-
-// Not yet fully functional
-//#include "Algorithms/MatrixGhostAlgorithm.h"
\ No newline at end of file
+#include "Algorithms/CpuGhostTracer.h"
+#include "Algorithms/SoftwareGhostAlgorithm.h"
+#include "Algorithms/MatrixGhostAlgorithm.h"
\ No newline at end of file
@@ -59,6 +59,52 @@ public:
         return A + B / (lambdaMicro * lambdaMicro);
     }
     
+    /// Computes the reflectance of the element's surface, including its
+    /// single layer, quarter-wave anti-reflection coating, for light arriving
+    /// from a medium with an index of n0 at the parameter incident angle, and
+    /// entering a medium with an index of n2. Multiple reflections inside
+    /// the coating are accounted for.
+    ///
+    /// \param lambda Desired wavelength, in nanometers.
+    float computeReflectance(float lambda, float theta0, float n0, float n2) const
+    {
+        // Compute the optimal coating refractive index
+        float n1 = glm::max(glm::sqrt(n0 * n2), m_coatingIor);
+
+        // Compute the optimal coating thickness
+        float d = m_coatingLambda / 4.0f / n1;
+
+        // Apply Snell's law to get the other angles; everything is reflected
+        // past the critical angle
+        float sin1 = glm::sin(theta0) * n0 / n1;
+        float sin2 = glm::sin(theta0) * n0 / n2;
+        if (glm::abs(sin1) >= 1.0f || glm::abs(sin2) >= 1.0f)
+        {
+            return 1.0f;
+        }
+
+        float cos0 = glm::cos(theta0);
+        float cos1 = glm::sqrt(1.0f - sin1 * sin1);
+        float cos2 = glm::sqrt(1.0f - sin2 * sin2);
+
+        float beta = glm::two_pi<float>() / lambda * n1 * d * cos1;
+        float cos2beta = glm::cos(2.0f * beta);
+
+        // Compute the Fresnel terms for the first and second interfaces for
+        // both s and p polarized light
+        float r12p = (n1 * cos0 - n0 * cos1) / (n1 * cos0 + n0 * cos1);
+        float r23p = (n2 * cos1 - n1 * cos2) / (n2 * cos1 + n1 * cos2);
+        float r12s = (n0 * cos0 - n1 * cos1) / (n0 * cos0 + n1 * cos1);
+        float r23s = (n1 * cos1 - n2 * cos2) / (n1 * cos1 + n2 * cos2);
+
+        float rp = (r12p * r12p + r23p * r23p + 2.0f * r12p * r23p * cos2beta) /
+            (1.0f + r12p * r12p * r23p * r23p + 2.0f * r12p * r23p * cos2beta);
+        float rs = (r12s * r12s + r23s * r23s + 2.0f * r12s * r23s * cos2beta) /
+            (1.0f + r12s * r12s * r23s * r23s + 2.0f * r12s * r23s * cos2beta);
+
+        return (rs + rp) * 0.5f;
+    }
+
     /// Returns the type of the optical element.
     ElementType getType() const { return m_type;}
     
@@ -260,6 +306,27 @@ public:
         return (m_efl / m_fnumber) / 2.0f;
     }
 
+    /// Returns the height of the front element, as the ray tracers see it:
+    /// the effective aperture height for an aperture stop, and the smaller
+    /// film dimension for a sensor. The ray grids are scaled by this.
+    float getPupilHeight() const
+    {
+        if (m_elements.empty())
+            return 0.0f;
+
+        switch (m_elements.front().getType())
+        {
+            case OpticalSystemElement::ElementType::APERTURE_STOP:
+                return getEffectiveApertureHeight();
+
+            case OpticalSystemElement::ElementType::SENSOR:
+                return glm::min(m_filmSize.x, m_filmSize.y);
+
+            default:
+                return m_elements.front().getHeight();
+        }
+    }
+
     /// Returns the aspect ratio of the system.
     float getAspectRatio() const { return m_filmSize.x / m_filmSize.y; }
     
@@ -288,91 +355,142 @@ public:
         return true;
     }
 
-    /// Enumerates all the ghosts generated by the optical system that match
-    /// the parameter filter values.
-    GhostList generateGhosts(int maxBounces = 0, bool apertureCross = false)
+    /// Parameters of the reflectance based pruning of the ghost enumeration.
+    struct GhostPruningParams
     {
-        // Special treatment for the 'no reflections' case
-        if (maxBounces == 0)
+        /// Ghosts whose reflectance product is known to stay below this
+        /// value are not generated. Zero disables the pruning.
+        float m_minReflectance = 0.0f;
+
+        /// Wavelengths at which the interface reflectances are evaluated.
+        std::vector<float> m_lambdas = { 650.0f, 510.0f, 475.0f };
+
+        /// Largest incident angle, in radians, that the interface
+        /// reflectances are bounded for.
+        float m_maxIncidentAngle = glm::radians(30.0f);
+
+        /// Number of incident angles sampled between zero and the maximum.
+        int m_incidentAngleSamples = 8;
+    };
+
+    /// Computes an upper bound of the reflectance of the parameter element,
+    /// for light arriving from either side, over the wavelengths and the
+    /// sampled incident angles of the parameter pruning params.
+    float computeMaxReflectance(size_t elementId, const GhostPruningParams& params) const
+    {
+        const auto& element = m_elements[elementId];
+
+        float result = 0.0f;
+        for (float lambda: params.m_lambdas)
         {
-            return std::vector<Ghost>{ Ghost{} };
+            float nBefore = elementId == 0 ? 1.0f : m_elements[elementId - 1].computeIndexOfRefraction(lambda);
+            float nAfter = element.computeIndexOfRefraction(lambda);
+
+            for (int sampleId = 0; sampleId < params.m_incidentAngleSamples; ++sampleId)
+            {
+                float theta = params.m_maxIncidentAngle * sampleId /
+                    glm::max(params.m_incidentAngleSamples - 1, 1);
+
+                result = glm::max(result, element.computeReflectance(lambda, theta, nBefore, nAfter));
+                result = glm::max(result, element.computeReflectance(lambda, theta, nAfter, nBefore));
+            }
         }
 
-        // Enumerate the apertures
-        std::vector<int> interfaces;
-        int totalInterfaces = 0;
-        
-        int prevId = -1;
+        return result;
+    }
+
+    /// Returns the interfaces that ghosts can reflect off of, grouped into
+    /// the regions separated by the apertures and the sensor; every ghost
+    /// reflects off of interfaces of a single region. With aperture crossing
+    /// allowed, all the interfaces form a single region. Elements after the
+    /// last aperture or sensor are not used.
+    std::vector<std::vector<int>> getGhostRegions(bool apertureCross) const
+    {
+        std::vector<std::vector<int>> result(1);
         for (int i = 0; i < m_elements.size(); ++i)
         {
             auto type = m_elements[i].getType();
             if (type == OpticalSystemElement::ElementType::APERTURE_STOP ||
                 type == OpticalSystemElement::ElementType::SENSOR)
             {
-                int numInterfaces = i - prevId - 1;
-
-                interfaces.push_back(numInterfaces);
-                totalInterfaces += numInterfaces;
-                
-                prevId = i;
+                result.emplace_back();
+            }
+            else
+            {
+                result.back().push_back(i);
             }
         }
-        // Only use a single interface list if aperture crossing is allowed
-        if (apertureCross)
+        result.pop_back();
+
+        // Merge the regions if aperture crossing is allowed
+        if (apertureCross && !result.empty())
         {
-            interfaces = { totalInterfaces };
+            for (size_t regionId = 1; regionId < result.size(); ++regionId)
+            {
+                result[0].insert(result[0].end(), result[regionId].begin(), result[regionId].end());
+            }
+            result.resize(1);
         }
 
-        // The resulting ghost list
-        GhostList result;
+        return result;
+    }
+
+    /// Enumerates all the ghosts generated by the optical system that match
+    /// the parameter filter values.
+    GhostList generateGhosts(int maxBounces = 0, bool apertureCross = false)
+    {
+        return generateGhosts(maxBounces, apertureCross, GhostPruningParams());
+    }
 
-        // Perform a preliminary counting step to reserve space in advance
-        // for large reflection numbers
-        if (maxBounces > 4)
+    /// Enumerates the ghosts generated by the optical system that match the
+    /// parameter filter values, skipping the ones that are too dim.
+    ///
+    /// The reflecting interfaces are chosen by a depth-first search, which
+    /// carries an upper bound of the reflectance product of the ghost built
+    /// so far, using the per-interface reflectance maxima. Whole subtrees are
+    /// cut once even the most reflective interfaces of the region could not
+    /// lift the bound above the minimum reflectance, which keeps high bounce
+    /// counts tractable on systems with many elements.
+    GhostList generateGhosts(int maxBounces, bool apertureCross, const GhostPruningParams& pruning)
+    {
+        // Special treatment for the 'no reflections' case
+        if (maxBounces == 0)
         {
-            int numGhosts = 0;
-            generateGhosts(interfaces, maxBounces, [&](const auto& ghost)
-            {
-                ++numGhosts;
-            });
-            result.reserve(numGhosts);
+            return std::vector<Ghost>{ Ghost{} };
         }
 
-        // Enumerate the ghosts.
-        generateGhosts(interfaces, maxBounces, [&](const auto& ghost)
-        {
-            result.push_back(ghost);
-        });
+        // Collect the interfaces the ghosts can reflect off of
+        std::vector<std::vector<int>> regions = getGhostRegions(apertureCross);
 
-        // We need to remap the indices if interface crossing is allowed
-        if (apertureCross)
+        // Compute the reflectance bounds of the interfaces
+        std::vector<float> maxReflectances(m_elements.size(), 1.0f);
+        if (pruning.m_minReflectance > 0.0f)
         {
-            // Map between the generated and real indices
-            std::vector<int> indexRemap(totalInterfaces);
-            
-            // How much the index needs to be offset - it is the number of
-            // apertures found up to this element
-            int offset = 0;
-
-            for (int i = 0; i < totalInterfaces; ++i)
+            for (const auto& region: regions)
             {
-                auto type = m_elements[i + offset].getType();
-                while (type == OpticalSystemElement::ElementType::APERTURE_STOP)
+                for (int elementId: region)
                 {
-                    ++offset;
+                    maxReflectances[elementId] = computeMaxReflectance(elementId, pruning);
                 }
-
-                indexRemap[i] = i + offset;
             }
-        
-            // Remap each index of each ghost using the map generated above
-            for (auto& ghost: result)
+        }
+
+        // The resulting ghost list
+        GhostList result;
+
+        // Enumerate the ghosts of each region
+        Ghost ghost;
+        ghost.setLength(maxBounces);
+        for (const auto& region: regions)
+        {
+            float regionMax = 0.0f;
+            for (int elementId: region)
             {
-                for (int i = 0; i < ghost.getLength(); ++i)
-                {
-                    ghost[i] = indexRemap[ghost[i]];
-                }
+                regionMax = glm::max(regionMax, maxReflectances[elementId]);
             }
+
+            generateGhosts(region, maxReflectances, regionMax, pruning.m_minReflectance,
+                0, 0, 1.0f, ghost, result);
         }
 
         // Return the result
@@ -443,80 +561,49 @@ public:
     const_reverse_iterator crend() const { return m_elements.crend(); }
 
 private:
-    /// Generates all the ghosts that correspond to the parameter set of
-    /// interfaces and reflection numbers.
-    template<typename FnOut>
-    void generateGhosts(const std::vector<int>& interfaces, int numReflections, FnOut output)
+    /// Generates the ghosts of a single region, whose first depth
+    /// reflections are already stored in the parameter ghost. The previous
+    /// parameter is the position of the last of these in the region, and
+    /// bound is an upper bound of their reflectance product.
+    ///
+    /// Reflections alternate between the forward and backward passes: the
+    /// forward ones can happen at any interface behind the previous
+    /// reflection (the very first one at any but the front interface), while
+    /// the backward ones have to happen in front of it.
+    void generateGhosts(const std::vector<int>& region, const std::vector<float>& maxReflectances,
+        float regionMax, float minReflectance, int depth, int previous, float bound,
+        Ghost& ghost, GhostList& result) const
     {
-        // Holds the indices for the current interface for each interface
-        // that participates in the birth of the ghost
-        std::vector<int> indices(numReflections);
+        int numReflections = (int) ghost.getLength();
 
-        // Holds the current ghost interface indices
-        std::vector<int> ghost(numReflections);
+        // Store the finished ghosts
+        if (depth == numReflections)
+        {
+            result.push_back(ghost);
+            return;
+        }
 
-        // Interface offset, used to manage 'sub-regions' of the optical system
-        // as separated by the apertures
-        int offset = 0;
+        // Cut the subtree if not even the most reflective interfaces could
+        // keep the ghost above the threshold
+        if (bound * glm::pow(regionMax, float(numReflections - depth)) < minReflectance)
+        {
+            return;
+        }
 
-        // Process each region separately
-        for (auto numInterfaces: interfaces)
+        // Try each possible interface for the next reflection
+        int first = depth % 2 == 0 ? previous + 1 : 0;
+        int last = depth % 2 == 0 ? (int) region.size() - 1 : previous - 1;
+        for (int position = first; position <= last; ++position)
         {
-            // Init the indices for the current generation
-            for (int i = 0; i < numReflections; ++i)
+            float reflectance = bound * maxReflectances[region[position]];
+            if (reflectance < minReflectance)
             {
-                indices[i] = (i + 1) % 2;
+                continue;
             }
 
-            // Enumerate each ghost
-            while (indices[0] != numInterfaces)
-            {
-                // Generate the ghost indices
-                for (int i = 0; i < numReflections; ++i)
-                {
-                    ghost[i] = offset + indices[i];
-                }
-                
-                // Store the ghost
-                output(ghost);
-                
-                // Increment each interface from back to front, until we reach
-                // the first valid index, then note its position in the list
-                int startIndex = numReflections;
-                for (int i = numReflections - 1; i >= 0; --i, --startIndex)
-                {
-                    // Increment the index
-                    indices[i] = indices[i] + 1;
-                    
-                    // First interfaces - these can go until the last element
-                    if (i % 2 == 0 && (i == 0 || indices[i] < numInterfaces - 1))
-                        break;
-                    
-                    // Second interfaces - thes can only go until the preceding
-                    // interface index
-                    if (i % 2 == 1 && (i == 0 || indices[i] < indices[i - 1]))
-                        break;
-                }
-                
-                // Re-initialize the indices that became invalid
-                for (int i = startIndex; i < numReflections; ++i)
-                {
-                    // First interfaces - 
-                    if (i % 2 == 0)
-                    {
-                        indices[i] = indices[i - 1] + 1;
-                    }
-                    
-                    // Second interfaces - these start from the back
-                    if (i % 2 == 1)
-                    {
-                        indices[i] = 0;
-                    }
-                }
-            }
-            
-            // Increment the offset
-            offset = offset + numInterfaces + 1;
+            ghost[depth] = region[position];
+            generateGhosts(region, maxReflectances, regionMax, minReflectance,
+                depth + 1, position, reflectance, ghost, result);
         }
     }
 
@@ -0,0 +1,217 @@
+// Number of threads reducing a single channel
+#define REDUCE_GROUP_SIZE 256
+
+// Number of floats per traced vertex
+#define VERTEX_FLOATS 9
+
+// Number of floats per reduction record
+#define RECORD_FLOATS 16
+
+// Reduction types
+#define REDUCTION_BOUNDS   0
+#define REDUCTION_AREAS    1
+#define REDUCTION_VARIANCE 2
+
+layout(local_size_x = REDUCE_GROUP_SIZE) in;
+
+// The traced vertices
+layout(std430, binding = 0) readonly buffer VertexBuffer
+{
+    float vertices[];
+};
+
+// The reduced channels; each work group processes one of them, identified by
+// its first vertex and its output record
+layout(std430, binding = 1) readonly buffer ItemBuffer
+{
+    ivec2 items[];
+};
+
+// The reduction results, in the layout of GhostAttribHelpers::ChannelReduction
+layout(std430, binding = 2) buffer RecordBuffer
+{
+    float records[];
+};
+
+// Uniforms
+uniform int iRayCount;
+uniform int iReductionType;
+uniform float fRadiusClip;
+uniform float fIrisClip;
+uniform float fIntensityClip;
+
+// Shared reduction storage
+shared vec4 sharedMin[REDUCE_GROUP_SIZE];
+shared vec4 sharedMax[REDUCE_GROUP_SIZE];
+
+// Offsets of the triangle corners within a grid cell
+const ivec2 QUAD_IDS[6] = ivec2[6]
+(
+    ivec2(0, 0),
+    ivec2(1, 0),
+    ivec2(1, 1),
+
+    ivec2(1, 1),
+    ivec2(0, 1),
+    ivec2(0, 0)
+);
+
+// Returns the float offset of a triangle corner in the vertex buffer.
+int cornerOffset(int vertexOffset, int triangleId, int cornerId)
+{
+    int cell = triangleId / 2;
+    ivec2 corner = ivec2(cell % (iRayCount - 1), cell / (iRayCount - 1)) + 
+        QUAD_IDS[(triangleId % 2) * 3 + cornerId];
+    
+    return (vertexOffset + corner.y * iRayCount + corner.x) * VERTEX_FLOATS;
+}
+
+// Tests whether a traced vertex passes the clipping criteria.
+bool isValidVertex(int base)
+{
+    return 
+        vertices[base + 6] <= fRadiusClip &&
+        vertices[base + 7] >= fIntensityClip &&
+        vertices[base + 8] <= fIrisClip;
+}
+
+void main()
+{
+    // Extract the processed item
+    ivec2 item = items[gl_WorkGroupID.x];
+    int vertexOffset = item.x;
+    int record = item.y * RECORD_FLOATS;
+    
+    // Number of triangles in the grid
+    int numTriangles = (iRayCount - 1) * (iRayCount - 1) * 2;
+    
+    // Average triangle area, needed for the variance
+    float avgArea = 0.0;
+    if (iReductionType == REDUCTION_VARIANCE)
+        avgArea = records[record + 8] / records[record + 9];
+    
+    // Per-thread values; bounds are stored as (pupil, sensor), while the
+    // other reductions only use the first two vectors as accumulators
+    vec4 localMin = vec4(1.0);
+    vec4 localMax = vec4(-1.0);
+    if (iReductionType != REDUCTION_BOUNDS)
+        localMin = localMax = vec4(0.0);
+    
+    // Process the triangles assigned to this thread
+    for (int triangleId = int(gl_LocalInvocationID.x); triangleId < numTriangles; triangleId += REDUCE_GROUP_SIZE)
+    {
+        int corners[3] = int[3]
+        (
+            cornerOffset(vertexOffset, triangleId, 0),
+            cornerOffset(vertexOffset, triangleId, 1),
+            cornerOffset(vertexOffset, triangleId, 2)
+        );
+        
+        bvec3 valid = bvec3(isValidVertex(corners[0]), isValidVertex(corners[1]), isValidVertex(corners[2]));
+        
+        // Bounds of the triangles with at least one valid vertex
+        if (iReductionType == REDUCTION_BOUNDS)
+        {
+            if (!any(valid))
+                continue;
+            
+            for (int i = 0; i < 3; ++i)
+            {
+                vec4 v = vec4(
+                    vertices[corners[i] + 0], vertices[corners[i] + 1], 
+                    vertices[corners[i] + 2], vertices[corners[i] + 3]);
+                localMin = min(localMin, v);
+                localMax = max(localMax, v);
+            }
+            continue;
+        }
+        
+        // Intensity of the valid vertices
+        if (iReductionType == REDUCTION_AREAS)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                if (valid[i])
+                {
+                    localMax.x += vertices[corners[i] + 7];
+                    localMax.y += 1.0;
+                }
+            }
+        }
+        
+        // Area of the fully valid triangles
+        if (!all(valid))
+            continue;
+        
+        vec2 a = vec2(vertices[corners[0] + 2], vertices[corners[0] + 3]);
+        vec2 b = vec2(vertices[corners[1] + 2], vertices[corners[1] + 3]);
+        vec2 c = vec2(vertices[corners[2] + 2], vertices[corners[2] + 3]);
+        float area = 0.5 * abs(a.x * (b.y - c.y) + b.x * (c.y - a.y) + c.x * (a.y - b.y));
+        
+        if (iReductionType == REDUCTION_AREAS)
+        {
+            localMin.x += area;
+            localMin.y += 1.0;
+        }
+        else
+        {
+            localMin.x += (area - avgArea) * (area - avgArea);
+        }
+    }
+    
+    // Reduce the per-thread values
+    sharedMin[gl_LocalInvocationID.x] = localMin;
+    sharedMax[gl_LocalInvocationID.x] = localMax;
+    barrier();
+    
+    for (uint stride = REDUCE_GROUP_SIZE / 2; stride > 0; stride /= 2)
+    {
+        if (gl_LocalInvocationID.x < stride)
+        {
+            vec4 otherMin = sharedMin[gl_LocalInvocationID.x + stride];
+            vec4 otherMax = sharedMax[gl_LocalInvocationID.x + stride];
+            
+            if (iReductionType == REDUCTION_BOUNDS)
+            {
+                sharedMin[gl_LocalInvocationID.x] = min(sharedMin[gl_LocalInvocationID.x], otherMin);
+                sharedMax[gl_LocalInvocationID.x] = max(sharedMax[gl_LocalInvocationID.x], otherMax);
+            }
+            else
+            {
+                sharedMin[gl_LocalInvocationID.x] += otherMin;
+                sharedMax[gl_LocalInvocationID.x] += otherMax;
+            }
+        }
+        barrier();
+    }
+    
+    // Write out the results
+    if (gl_LocalInvocationID.x != 0)
+        return;
+    
+    vec4 resultMin = sharedMin[0];
+    vec4 resultMax = sharedMax[0];
+    
+    if (iReductionType == REDUCTION_BOUNDS)
+    {
+        records[record + 0] = resultMin.x;
+        records[record + 1] = resultMin.y;
+        records[record + 2] = resultMax.x;
+        records[record + 3] = resultMax.y;
+        records[record + 4] = resultMin.z;
+        records[record + 5] = resultMin.w;
+        records[record + 6] = resultMax.z;
+        records[record + 7] = resultMax.w;
+    }
+    else if (iReductionType == REDUCTION_AREAS)
+    {
+        records[record + 8] = resultMin.x;
+        records[record + 9] = resultMin.y;
+        records[record + 11] = resultMax.x;
+        records[record + 12] = resultMax.y;
+    }
+    else
+    {
+        records[record + 10] = resultMin.x;
+    }
+}
@@ -0,0 +1,57 @@
+// Number of floats per traced vertex
+#define VERTEX_FLOATS 9
+
+// Traced vertices of every draw of the batch
+layout(std430, binding = 0) readonly buffer VertexBuffer
+{
+    float vertices[];
+};
+
+// Corner offsets of the two triangles making up a grid cell
+const ivec2 QUAD_IDS[6] = ivec2[]
+(
+    ivec2(0, 0),
+    ivec2(1, 0),
+    ivec2(1, 1),
+
+    ivec2(1, 1),
+    ivec2(0, 1),
+    ivec2(0, 0)
+);
+
+// Outputs
+out vec2 vParam;        // Coordinates of the originating ray on the pupil element
+out vec2 vUv;           // UV coordinates of the ray passing the aperture
+out float fRadius;      // Relative radius
+out float fIntensity;   // Transmitted energy factor
+flat out int iDrawIdVS; // Index of the draw in the batch
+
+void main()
+{
+    // Select the parameters of the draw
+    iDrawId = DRAW_ID;
+    iDrawIdVS = iDrawId;
+
+    // Find the grid vertex of the triangle corner, using the same
+    // triangulation as the indexed path
+    int triangleId = gl_VertexID / 3;
+    int cell = triangleId / 2;
+    ivec2 corner = ivec2(cell % (iRayCount - 1), cell / (iRayCount - 1)) + 
+        QUAD_IDS[(triangleId % 2) * 3 + gl_VertexID % 3];
+    int base = (iDrawVertexOffset + corner.y * iRayCount + corner.x) * VERTEX_FLOATS;
+
+    // Pass through the traced values
+    vParam = vec2(vertices[base + 0], vertices[base + 1]);
+    vUv = vec2(vertices[base + 4], vertices[base + 5]);
+    fRadius = vertices[base + 6];
+    fIntensity = vertices[base + 7];
+    
+#if RENDER_MODE == RENDER_MODE_PROJECTED_GHOST
+    // Render mode: projected ghost
+    gl_Position = vec4(vertices[base + 2], vertices[base + 3], 0, 1);
+
+#elif RENDER_MODE == RENDER_MODE_PUPIL_GRID
+    // Render mode: pupil grid
+    gl_Position = vec4(vParam, 0, 1);
+#endif
+}
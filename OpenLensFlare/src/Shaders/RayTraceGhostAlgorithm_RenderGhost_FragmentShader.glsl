@@ -1,12 +1,11 @@
-// Input values, as explained in the geometry shader
-in vec2 vParamGS;
-in vec2 vUvGS;
-in float fRadiusGS;
-in float fIntensityGS;
-in vec3 vColorGS;
-#ifdef PRECOMPUTATION
-in vec2 vPositionGS;
-in float fIrisDistanceGS;
+// Input values, as explained in the vertex shader
+in vec2 vParam;
+in vec2 vUv;
+in float fRadius;
+in float fIntensity;
+
+#ifdef BATCHED
+flat in int iDrawIdVS;
 #endif
 
 // Framebuffer output value
@@ -14,59 +13,50 @@ out vec4 colorBuffer;
 
 void main()
 {
+#ifdef BATCHED
+    iDrawId = iDrawIdVS;
+#endif
+
     // Apply clipping based on the relative radius
-    if (fRadiusGS > fRadiusClip)
+    if (fRadius > fRadiusClip)
         discard;
     
     // Compute the UV coordinates
-    vec2 uv = clamp(vUvGS, vec2(-1.0), vec2(1.0)) * 0.5 + 0.5;
+    vec2 uv = clamp(vUv, vec2(-1.0), vec2(1.0)) * 0.5 + 0.5;
     
     // Sample the texture mask
     float mask = 1.0 - step(fIrisClip, texture(sAperture, uv).r);
     
-    // Shading mode: shaded
-    if (iShadingMode == SHADING_MODE_SHADED)
-    {
-        // Write out the final color
-        colorBuffer = vec4(vColorGS, 1) * vColor * fIntensityGS * mask;
-    }
-    
+#if SHADING_MODE == SHADING_MODE_SHADED
+    // Shading mode: shaded; the channel color already holds every constant
+    // intensity factor
+    colorBuffer = vColor * fIntensity * mask;
+
+#elif SHADING_MODE == SHADING_MODE_UNCOLORED
     // Shading mode: uncolored
-    else if (iShadingMode == SHADING_MODE_UNCOLORED)
-    {
-        colorBuffer = vec4(1) * fIntensityGS * mask;
-    }
-    
+    colorBuffer = vec4(1) * fIntensity * mask;
+
+#elif SHADING_MODE == SHADING_MODE_UNSHADED
     // Shading mode: unshaded
-    else if (iShadingMode == SHADING_MODE_UNSHADED)
-    {
-        // Write out only the mask
-        colorBuffer = vec4(mask);
-    }
-    
+    // Write out only the mask
+    colorBuffer = vec4(mask);
+
+#elif SHADING_MODE == SHADING_MODE_RAY_COORDINATES
     // Shading mode: ray coords
-    else if (iShadingMode == SHADING_MODE_RAY_COORDINATES)
-    {
-        colorBuffer = vec4(abs(vParamGS), 0, 1.0) * mask;
-    }
-    
+    colorBuffer = vec4(abs(vParam), 0, 1.0) * mask;
+
+#elif SHADING_MODE == SHADING_MODE_UV_COORDINATES
     // Shading mode: UV coords
-    else if (iShadingMode == SHADING_MODE_UV_COORDINATES)
-    {
-        colorBuffer = vec4(uv, 0, 1.0) * mask;
-    }
-    
+    colorBuffer = vec4(uv, 0, 1.0) * mask;
+
+#elif SHADING_MODE == SHADING_MODE_RELATIVE_RADIUS
     // Shading mode: relative radius
-    else if (iShadingMode == SHADING_MODE_RELATIVE_RADIUS)
-    {
-        colorBuffer = vec4(vec3(fRadiusGS), 1) * mask;
-        
-        if (fRadiusGS > 1.0)
-            colorBuffer.gb = vec2(0.0);
-    }
+    colorBuffer = vec4(vec3(fRadius), 1) * mask;
+    
+    if (fRadius > 1.0)
+        colorBuffer.gb = vec2(0.0);
 
-    else
-    {
-        colorBuffer = vec4(1, 0, 1, 1);
-    }
+#else
+    colorBuffer = vec4(1, 0, 1, 1);
+#endif
 }
\ No newline at end of file
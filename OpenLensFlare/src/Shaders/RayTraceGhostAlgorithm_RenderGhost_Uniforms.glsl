@@ -1,39 +1,94 @@
 // Lens uniforms
 #define MAX_ELEMENTS 64
 
-uniform vec3 vLensCenter[MAX_ELEMENTS];
-uniform vec3 vLensIor[MAX_ELEMENTS];
-uniform float fLensRadius[MAX_ELEMENTS];
-uniform float fLensHeight[MAX_ELEMENTS];
-uniform float fLensAperture[MAX_ELEMENTS];
-uniform float fLensCoating[MAX_ELEMENTS];
+// Per-wavelength lens table, built once per optical system and wavelength;
+// baked programs declare the same names as constants instead
+#ifndef BAKED_LENS_TABLE
+layout(std140) uniform LensTable
+{
+    vec4 vLensCenterRadius[MAX_ELEMENTS];   // center (xyz), radius (w)
+    vec4 vLensIorCoating[MAX_ELEMENTS];     // IORs (xyz), coating thickness (w)
+    vec4 vLensHeightAperture[MAX_ELEMENTS]; // height (x), aperture (y)
+    vec2 vFilmSize;
+    float fRayDistance;
+    int iLength;
+    float fLambda;
+};
+#endif
+
+#ifndef BATCHED
+
+// Per-draw ghost parameters
+layout(std140) uniform GhostParams
+{
+    ivec4 vGhostIndices[4]; // Reflecting interfaces, four per entry
+    vec4 vColor;            // Channel color, scaled by the intensity factors
+    vec3 vRayDir;
+    int iNumIndices;
+    vec2 vGridCenter;
+    vec2 vGridSize;
+    vec2 vImageCenter;
+    vec2 vImageSize;
+    int iRayCount;
+    float fRadiusClip;
+    float fIrisClip;
+};
+
+#else
+
+// Ghost parameters of a single draw of a batch; same layout as the
+// GhostParams block, with the first traced vertex of the draw appended
+struct GhostDrawParams
+{
+    ivec4 ghostIndices[4];
+    vec4 color;
+    vec3 rayDir;
+    int numIndices;
+    vec2 gridCenter;
+    vec2 gridSize;
+    vec2 imageCenter;
+    vec2 imageSize;
+    int rayCount;
+    float radiusClip;
+    float irisClip;
+    int vertexOffset;
+};
+
+// Parameters of every draw of the batch
+layout(std430, binding = 1) readonly buffer GhostParamsBuffer
+{
+    GhostDrawParams ghostParams[];
+};
+
+// Index of the current draw, set by the entry point of each stage
+int iDrawId;
+
+// Parameters of the current draw, under the names of the GhostParams block
+#define vGhostIndices ghostParams[iDrawId].ghostIndices
+#define vColor ghostParams[iDrawId].color
+#define vRayDir ghostParams[iDrawId].rayDir
+#define iNumIndices ghostParams[iDrawId].numIndices
+#define vGridCenter ghostParams[iDrawId].gridCenter
+#define vGridSize ghostParams[iDrawId].gridSize
+#define vImageCenter ghostParams[iDrawId].imageCenter
+#define vImageSize ghostParams[iDrawId].imageSize
+#define iRayCount ghostParams[iDrawId].rayCount
+#define fRadiusClip ghostParams[iDrawId].radiusClip
+#define fIrisClip ghostParams[iDrawId].irisClip
+#define iDrawVertexOffset ghostParams[iDrawId].vertexOffset
+
+#endif
 
 // Uniforms
-uniform int iGhostIndices[16];
-uniform int iNumIndices;
-uniform int iLength;
-uniform int iRayCount;
-uniform vec2 vGridCenter;
-uniform vec2 vGridSize;
-uniform vec2 vImageCenter;
-uniform vec2 vImageSize;
-uniform vec3 vRayDir;
-uniform float fRayDistance;
-uniform vec2 vFilmSize;
-uniform float fLambda;
-uniform float fIntensityScale;
-uniform vec4 vColor;
-uniform int iRenderMode;
-uniform int iShadingMode;
-uniform float fRadiusClip;
-uniform float fIrisClip;
 uniform sampler2D sAperture;
 
-// Render modes
+// Render modes; the render shaders are compiled separately for each mode,
+// with RENDER_MODE defined to one of these
 #define RENDER_MODE_PROJECTED_GHOST 0
 #define RENDER_MODE_PUPIL_GRID      1
 
-// Shading modes
+// Shading modes; the render shaders are compiled separately for each mode,
+// with SHADING_MODE defined to one of these
 #define SHADING_MODE_SHADED          0
 #define SHADING_MODE_UNCOLORED       1
 #define SHADING_MODE_UNSHADED        2
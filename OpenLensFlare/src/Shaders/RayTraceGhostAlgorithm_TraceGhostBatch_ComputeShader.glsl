@@ -0,0 +1,44 @@
+// Number of rays traced by a single work group
+#define TRACE_GROUP_SIZE 64
+
+// Number of floats per traced vertex
+#define VERTEX_FLOATS 9
+
+layout(local_size_x = TRACE_GROUP_SIZE) in;
+
+// Output vertex buffer, using the same layout as the transform feedback path
+layout(std430, binding = 0) writeonly buffer VertexBuffer
+{
+    float vertices[];
+};
+
+// Index of the first draw of the dispatch; each row of work groups traces
+// a single draw of the batch
+uniform int iFirstDraw;
+
+void main()
+{
+    // Select the draw of the work group
+    iDrawId = iFirstDraw + int(gl_WorkGroupID.y);
+
+    // Skip the padding invocations of smaller ray grids
+    int vertexId = int(gl_GlobalInvocationID.x);
+    if (vertexId >= iRayCount * iRayCount)
+        return;
+    
+    // Trace the ray of the grid point
+    GridVertex vertex = traceGridVertex(vertexId);
+    
+    // Write out the output values
+    int base = (iDrawVertexOffset + vertexId) * VERTEX_FLOATS;
+    
+    vertices[base + 0] = vertex.param.x;
+    vertices[base + 1] = vertex.param.y;
+    vertices[base + 2] = vertex.position.x;
+    vertices[base + 3] = vertex.position.y;
+    vertices[base + 4] = vertex.uv.x;
+    vertices[base + 5] = vertex.uv.y;
+    vertices[base + 6] = vertex.radius;
+    vertices[base + 7] = vertex.intensity;
+    vertices[base + 8] = vertex.irisDistance;
+}
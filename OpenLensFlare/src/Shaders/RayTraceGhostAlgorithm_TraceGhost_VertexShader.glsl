@@ -0,0 +1,21 @@
+// Outputs, captured through transform feedback
+out vec2 vParamOut;        // Coordinates of the originating ray on the pupil element
+out vec2 vPositionOut;     // Projected ray position on the sensor
+out vec2 vUvOut;           // UV coordinates of the ray passing the aperture
+out float fRadiusOut;      // Relative radius
+out float fIntensityOut;   // Transmitted energy factor
+out float fIrisDistanceOut; // Iris texture sampled by the UV
+
+void main()
+{
+    // Trace the ray of the grid point
+    GridVertex vertex = traceGridVertex(gl_VertexID);
+    
+    // Write out the output values
+    vParamOut = vertex.param;
+    vPositionOut = vertex.position;
+    vUvOut = vertex.uv;
+    fRadiusOut = vertex.radius;
+    fIntensityOut = vertex.intensity;
+    fIrisDistanceOut = vertex.irisDistance;
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "Dependencies.h"
+
+namespace OLEF
+{
+
+/// A simple work-stealing thread pool, used to spread CPU-side computations
+/// across multiple cores.
+///
+/// Each worker thread owns a task queue; new tasks are pushed to the queue of
+/// the thread submitting them (or to a shared queue, for outside threads).
+/// Workers take tasks from the back of their own queue, and steal from the
+/// front of the other queues once they run out of work. Threads waiting for a
+/// task group help out by executing queued tasks, so tasks are free to submit
+/// and wait for further tasks.
+class TaskPool
+{
+public:
+    /// A task to execute.
+    using Task = std::function<void()>;
+
+    /// A set of tasks that can be waited for together.
+    struct TaskGroup
+    {
+        /// Number of tasks that haven't finished yet.
+        std::atomic<int> m_pending{ 0 };
+    };
+
+    /// Creates a pool with the parameter number of worker threads. Using zero
+    /// creates one worker for each hardware thread, except the calling one.
+    explicit TaskPool(int numThreads = 0):
+        m_numQueued(0),
+        m_stop(false)
+    {
+        if (numThreads <= 0)
+        {
+            numThreads = glm::max((int) std::thread::hardware_concurrency() - 1, 1);
+        }
+
+        // One queue for each worker, plus a shared one for outside threads
+        for (int i = 0; i <= numThreads; ++i)
+        {
+            m_queues.emplace_back(new Queue);
+        }
+
+        // Start the workers
+        for (int i = 0; i < numThreads; ++i)
+        {
+            m_threads.emplace_back([this, i]() { workerMain(i); });
+        }
+    }
+
+    /// Stops and joins the worker threads. Tasks that are still queued are
+    /// not executed.
+    ~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+
+        for (auto& thread: m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    /// These objects are not copyable.
+    TaskPool(const TaskPool& other) = delete;
+
+    /// These objects are not copyable.
+    TaskPool& operator=(const TaskPool& other) = delete;
+
+    /// Returns the number of worker threads.
+    int getThreadCount() const { return (int) m_threads.size(); }
+
+    /// Queues a new task as part of the parameter group.
+    void run(TaskGroup& group, Task task)
+    {
+        group.m_pending.fetch_add(1);
+
+        // Push the task to the queue of the current thread
+        Queue& queue = *m_queues[currentQueueId()];
+        {
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            queue.m_tasks.push_back({ std::move(task), &group });
+        }
+
+        // Wake up a sleeping worker
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            ++m_numQueued;
+        }
+        m_wake.notify_one();
+    }
+
+    /// Waits for every task of the parameter group to finish, executing
+    /// queued tasks in the meantime.
+    void wait(TaskGroup& group)
+    {
+        int queueId = currentQueueId();
+        while (group.m_pending.load() > 0)
+        {
+            Entry entry;
+            if (popTask(queueId, entry))
+            {
+                execute(entry);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /// Executes fn(i) for each i in [0, count), and waits for all of them.
+    template<typename Fn>
+    void parallelFor(int count, Fn fn)
+    {
+        TaskGroup group;
+        for (int i = 0; i < count; ++i)
+        {
+            run(group, [&fn, i]() { fn(i); });
+        }
+        wait(group);
+    }
+
+private:
+    /// A queued task with its group.
+    struct Entry
+    {
+        /// The task to execute.
+        Task m_task;
+
+        /// The group the task belongs to.
+        TaskGroup* m_group;
+    };
+
+    /// A task queue, owned by a single thread.
+    struct Queue
+    {
+        /// Guards the task list.
+        std::mutex m_mutex;
+
+        /// The queued tasks.
+        std::deque<Entry> m_tasks;
+    };
+
+    /// Identifies the pool and queue of the current thread.
+    struct ThreadInfo
+    {
+        /// The pool that owns the thread.
+        const TaskPool* m_pool = nullptr;
+
+        /// Index of the thread's queue.
+        int m_queueId = 0;
+    };
+
+    /// Returns the thread information of the calling thread.
+    static ThreadInfo& threadInfo()
+    {
+        static thread_local ThreadInfo s_info;
+        return s_info;
+    }
+
+    /// Returns the queue owned by the calling thread, or the shared queue for
+    /// threads that do not belong to the pool.
+    int currentQueueId() const
+    {
+        const ThreadInfo& info = threadInfo();
+        return info.m_pool == this ? info.m_queueId : (int) m_threads.size();
+    }
+
+    /// Takes a task from the back of the parameter queue, or steals one from
+    /// the front of the other ones.
+    bool popTask(int queueId, Entry& out)
+    {
+        // Try our own queue first
+        {
+            Queue& queue = *m_queues[queueId];
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            if (!queue.m_tasks.empty())
+            {
+                out = std::move(queue.m_tasks.back());
+                queue.m_tasks.pop_back();
+                return true;
+            }
+        }
+
+        // Steal from the others
+        for (size_t offset = 1; offset < m_queues.size(); ++offset)
+        {
+            Queue& queue = *m_queues[(queueId + offset) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            if (!queue.m_tasks.empty())
+            {
+                out = std::move(queue.m_tasks.front());
+                queue.m_tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /// Executes a popped task.
+    void execute(Entry& entry)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            --m_numQueued;
+        }
+
+        entry.m_task();
+        entry.m_group->m_pending.fetch_sub(1);
+    }
+
+    /// Main function of the worker threads.
+    void workerMain(int queueId)
+    {
+        threadInfo().m_pool = this;
+        threadInfo().m_queueId = queueId;
+
+        for (;;)
+        {
+            // Sleep until there is something to do
+            {
+                std::unique_lock<std::mutex> lock(m_wakeMutex);
+                m_wake.wait(lock, [this]() { return m_stop || m_numQueued > 0; });
+                if (m_stop)
+                    return;
+            }
+
+            // Process tasks until we run out of them
+            Entry entry;
+            while (popTask(queueId, entry))
+            {
+                execute(entry);
+            }
+        }
+    }
+
+    /// The task queues (one per worker, plus the shared one at the end).
+    std::vector<std::unique_ptr<Queue>> m_queues;
+
+    /// The worker threads.
+    std::vector<std::thread> m_threads;
+
+    /// Guards the sleeping of the workers.
+    std::mutex m_wakeMutex;
+
+    /// Used to wake up the sleeping workers.
+    std::condition_variable m_wake;
+
+    /// Number of tasks queued but not yet started.
+    int m_numQueued;
+
+    /// Whether the workers should stop.
+    bool m_stop;
+};
+
+}
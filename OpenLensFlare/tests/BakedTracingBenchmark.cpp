@@ -0,0 +1,108 @@
+#include "HeadlessContext.h"
+
+using namespace OLEF;
+
+/// Size of the rendered framebuffer.
+static const int FRAMEBUFFER_SIZE = 512;
+
+/// Renders the ghosts repeatedly until enough time has passed, and returns
+/// the number of rays traced per second.
+static double measureRayRate(RayTraceGhostAlgorithm& algorithm, const LightSource& light,
+    const GhostList& ghosts, double minSeconds)
+{
+    // Warm up, so the first use of the programs isn't measured
+    algorithm.renderGhosts(light, ghosts);
+    glFinish();
+
+    long long rays = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0.0;
+    do
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        algorithm.renderGhosts(light, ghosts);
+        glFinish();
+        rays += algorithm.getRenderStats().m_rays;
+        seconds = TestHelpers::secondsSince(start);
+    } while (seconds < minSeconds);
+
+    return rays / seconds;
+}
+
+/// Measures the ray tracing throughput of the GL ghost algorithm, with the
+/// generic tracing program and with the programs baked for the optical
+/// system. Both use the per-channel path, since the batched path doesn't use
+/// the baked programs. Each frame is finished before the next one starts, so
+/// the rates include the whole frame, not just the tracing passes.
+///
+/// Usage: BakedTracingBenchmark [optical system] [max ghosts] [seconds]
+int main(int argc, char** argv)
+{
+    std::string systemPath = argc > 1 ? argv[1] : TestHelpers::examplePath("canon-zoom-long.xml");
+    size_t maxGhosts = argc > 2 ? std::atoi(argv[2]) : 0;
+    double minSeconds = argc > 3 ? std::atof(argv[3]) : 2.0;
+
+    TestHelpers::HeadlessContext context(4, 3);
+    if (!context.isValid())
+    {
+        std::cerr << "No OpenGL 4.3 context available." << std::endl;
+        return TestHelpers::SKIPPED;
+    }
+
+    OpticalSystem system;
+    if (!TestHelpers::loadOpticalSystem(systemPath, system))
+    {
+        std::cerr << "Unable to load " << systemPath << std::endl;
+        return 1;
+    }
+
+    GhostList ghosts = system.generateGhosts(2, false);
+    if (maxGhosts > 0 && ghosts.size() > maxGhosts)
+        ghosts.resize(maxGhosts);
+
+    LightSource light = TestHelpers::createLight(glm::radians(10.0f));
+
+    RayTraceGhostAlgorithm algorithm(&system);
+    RayTraceGhostAlgorithm::GhostAttribComputeParams params;
+    params.m_angle = glm::radians(10.0f);
+    ghosts = algorithm.computeGhostAttributes(ghosts, params);
+    algorithm.setBatchedRendering(false);
+
+    // Render target
+    GLuint colorTexture, framebuffer;
+    glGenTextures(1, &colorTexture);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    glViewport(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    std::cout << system.getName() << ": " << ghosts.size() << " ghosts, "
+        << algorithm.getLambdas().size() << " channels" << std::endl;
+
+    // Generic tracing program
+    algorithm.setBakedTracing(false);
+    double genericRate = measureRayRate(algorithm, light, ghosts, minSeconds);
+
+    // Baked programs, compiled up front
+    algorithm.setBakedTracing(true);
+    auto bakeStart = std::chrono::steady_clock::now();
+    algorithm.bakeGhosts(ghosts);
+    glFinish();
+    double bakeSeconds = TestHelpers::secondsSince(bakeStart);
+    double bakedRate = measureRayRate(algorithm, light, ghosts, minSeconds);
+
+    std::printf("generic  %8.3f Mrays/s\n", genericRate / 1e6);
+    std::printf("baked    %8.3f Mrays/s  %5.2fx generic  (baked in %.2f s)\n",
+        bakedRate / 1e6, bakedRate / genericRate, bakeSeconds);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &colorTexture);
+
+    return 0;
+}
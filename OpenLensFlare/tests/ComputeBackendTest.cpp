@@ -0,0 +1,81 @@
+#include "HeadlessContext.h"
+
+using namespace OLEF;
+
+/// Returns whether two values match within an absolute and relative tolerance.
+static bool nearlyEqual(float a, float b, float absTolerance, float relTolerance)
+{
+    return glm::abs(a - b) <= absTolerance + relTolerance * glm::max(glm::abs(a), glm::abs(b));
+}
+
+/// Returns whether two bounding rects match within the parameter tolerance.
+static bool nearlyEqual(const Ghost::BoundingRect& a, const Ghost::BoundingRect& b, float tolerance)
+{
+    return
+        nearlyEqual(a[0].x, b[0].x, tolerance, 0.0f) && nearlyEqual(a[0].y, b[0].y, tolerance, 0.0f) &&
+        nearlyEqual(a[1].x, b[1].x, tolerance, 0.0f) && nearlyEqual(a[1].y, b[1].y, tolerance, 0.0f);
+}
+
+/// Computes the ghost attributes of an optical system with the transform
+/// feedback and the compute shader backends, on the same ghost list, and
+/// checks that they produce the same bounds and intensities.
+///
+/// Usage: ComputeBackendTest [optical system] [max ghosts]
+int main(int argc, char** argv)
+{
+    std::string systemPath = argc > 1 ? argv[1] : TestHelpers::examplePath("canon-zoom-long.xml");
+    size_t maxGhosts = argc > 2 ? std::atoi(argv[2]) : 48;
+
+    TestHelpers::HeadlessContext context(4, 3);
+    if (!context.isValid())
+    {
+        std::cout << "No OpenGL 4.3 context available, skipping." << std::endl;
+        return TestHelpers::SKIPPED;
+    }
+
+    OpticalSystem system;
+    if (!TestHelpers::loadOpticalSystem(systemPath, system))
+    {
+        std::cerr << "Unable to load " << systemPath << std::endl;
+        return 1;
+    }
+
+    GhostList ghosts = system.generateGhosts(2, false);
+    if (ghosts.size() > maxGhosts)
+        ghosts.resize(maxGhosts);
+
+    RayTraceGhostAlgorithm algorithm(&system);
+    if (!algorithm.isComputeBackendSupported())
+    {
+        std::cout << "The compute backend is not supported, skipping." << std::endl;
+        return TestHelpers::SKIPPED;
+    }
+
+    RayTraceGhostAlgorithm::GhostAttribComputeParams params;
+    params.m_angle = glm::radians(10.0f);
+
+    algorithm.setPrecomputeBackend(RayTraceGhostAlgorithm::PrecomputeBackend::TRANSFORM_FEEDBACK);
+    GhostList expected = algorithm.computeGhostAttributes(ghosts, params);
+
+    algorithm.setPrecomputeBackend(RayTraceGhostAlgorithm::PrecomputeBackend::COMPUTE_SHADER);
+    GhostList computed = algorithm.computeGhostAttributes(ghosts, params);
+
+    // The bounds are extremes of the same traced rays, while the intensities
+    // are sums reduced in a different order
+    const float boundsTolerance = 1e-4f;
+    const float intensityTolerance = 1e-3f;
+
+    if (OLEF_CHECK(expected.size() == computed.size()))
+    {
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            OLEF_CHECK(nearlyEqual(expected[i].getPupilBounds(), computed[i].getPupilBounds(), boundsTolerance));
+            OLEF_CHECK(nearlyEqual(expected[i].getSensorBounds(), computed[i].getSensorBounds(), boundsTolerance));
+            OLEF_CHECK(nearlyEqual(expected[i].getAverageIntensity(), computed[i].getAverageIntensity(),
+                1e-6f, intensityTolerance));
+        }
+    }
+
+    std::cout << "Compared " << expected.size() << " ghosts of " << system.getName() << "." << std::endl;
+    return TestHelpers::exitCode();
+}
@@ -0,0 +1,119 @@
+#include "TestHelpers.h"
+
+using namespace OLEF;
+
+/// Measures the throughput of the CPU ghost tracer on a single core, with the
+/// scalar tracer and with 1, 4, 8 and 16 wide ray packets. The speedups are
+/// relative to the single-lane packets, which run the same code as the wider
+/// ones; the scalar tracer mirrors the GLSL one instead, and is the reference
+/// the packet results are validated against.
+///
+/// The packet width only changes how many rays are traced together; the
+/// vector width of the generated code is fixed by OLEF_CPU_INSTRUCTION_SET,
+/// so the library has to be configured once per instruction set to compare
+/// them (e.g. SSE2 for 4 lanes, AVX2 for 8, AVX512 for 16).
+///
+/// Usage: CpuGhostTracerBenchmark [optical system] [ray grid size] [seconds]
+int main(int argc, char** argv)
+{
+    std::string systemPath = argc > 1 ? argv[1] : TestHelpers::examplePath("canon-zoom-long.xml");
+    int rayCount = argc > 2 ? std::atoi(argv[2]) : 64;
+    double minSeconds = argc > 3 ? std::atof(argv[3]) : 2.0;
+
+    OpticalSystem system;
+    if (!TestHelpers::loadOpticalSystem(systemPath, system))
+    {
+        std::cerr << "Unable to load " << systemPath << std::endl;
+        return 1;
+    }
+
+    // Every two-bounce ghost, traced with its full pupil
+    GhostList ghosts = system.generateGhosts(2, false);
+    LightSource light = TestHelpers::createLight(glm::radians(10.0f));
+    const std::vector<float> lambdas = { 650.0f, 510.0f, 475.0f };
+
+    int numVertices = rayCount * rayCount;
+    std::vector<CpuGhostTracer::PerVertexData> vertices(numVertices);
+
+    std::cout << system.getName() << ": " << ghosts.size() << " ghosts, "
+        << rayCount << "x" << rayCount << " rays, " << lambdas.size() << " channels" << std::endl;
+    std::cout << "Native packet size: " << CpuGhostTracer::getNativePacketSize() << std::endl;
+
+    // Reference results of the scalar tracer, for validating the packets
+    CpuGhostTracer tracer(&system);
+    std::vector<CpuGhostTracer::PerVertexData> reference(ghosts.size() * lambdas.size() * numVertices);
+    tracer.setPacketSize(0);
+    for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+    {
+        for (size_t ch = 0; ch < lambdas.size(); ++ch)
+        {
+            tracer.traceGhostChannel(light, ghosts[ghostId], lambdas[ch], rayCount,
+                reference.data() + (ghostId * lambdas.size() + ch) * numVertices);
+        }
+    }
+
+    double singleLaneRate = 0.0;
+    for (int packetSize: { 0, 1, 4, 8, 16 })
+    {
+        tracer.setPacketSize(packetSize);
+
+        // Trace every ghost channel until enough time has passed
+        long long rays = 0;
+        auto start = std::chrono::steady_clock::now();
+        double seconds = 0.0;
+        do
+        {
+            for (const Ghost& ghost: ghosts)
+            {
+                for (float lambda: lambdas)
+                {
+                    tracer.traceGhostChannel(light, ghost, lambda, rayCount, vertices.data());
+                    rays += numVertices;
+                }
+            }
+            seconds = TestHelpers::secondsSince(start);
+        } while (seconds < minSeconds);
+
+        // Compare the last pass against the scalar tracer
+        float maxError = 0.0f;
+        for (size_t ghostId = 0; ghostId < ghosts.size(); ++ghostId)
+        {
+            for (size_t ch = 0; ch < lambdas.size(); ++ch)
+            {
+                tracer.traceGhostChannel(light, ghosts[ghostId], lambdas[ch], rayCount, vertices.data());
+                const auto* expected = reference.data() + (ghostId * lambdas.size() + ch) * numVertices;
+                for (int i = 0; i < numVertices; ++i)
+                {
+                    // Rays outside the radius clip miss the real lens, and
+                    // hit its extended sphere near grazing angles, so their
+                    // positions are too ill-conditioned to compare
+                    if (expected[i].m_intensity > 0.0f && expected[i].m_radius <= 1.0f &&
+                        std::isfinite(expected[i].m_position.x))
+                    {
+                        glm::vec2 diff = glm::abs(vertices[i].m_position - expected[i].m_position);
+                        maxError = glm::max(maxError, glm::max(diff.x, diff.y));
+                    }
+                }
+            }
+        }
+
+        double rate = rays / seconds;
+        if (packetSize == 1)
+        {
+            singleLaneRate = rate;
+        }
+
+        if (packetSize == 0)
+        {
+            std::printf("%-8s %8.3f Mrays/s per core\n", "scalar", rate / 1e6);
+        }
+        else
+        {
+            std::printf("%-8s %8.3f Mrays/s per core  %5.2fx 1 lane  max position error %g\n",
+                (std::to_string(packetSize) + (packetSize == 1 ? " lane" : " lanes")).c_str(),
+                rate / 1e6, rate / singleLaneRate, maxError);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "TestHelpers.h"
+
+using namespace OLEF;
+
+/// Creates a ghost visible with the parameter bounds and intensity.
+static Ghost createVisibleGhost(glm::vec2 sensorCorner, glm::vec2 sensorSize, float intensity)
+{
+    Ghost ghost({ 3, 1 });
+    ghost.setPupilBounds({ glm::vec2(-0.5f), glm::vec2(1.0f) });
+    ghost.setSensorBounds({ sensorCorner, sensorSize });
+    ghost.setAverageIntensity(intensity);
+    ghost.setMinimumChannels(1);
+    ghost.setOptimalChannels(3);
+    ghost.setMinimumRays(16);
+    ghost.setOptimalRays(64);
+    return ghost;
+}
+
+/// Creates a ghost without any valid rays, with the markers the tracers
+/// leave in its bounds.
+static Ghost createInvisibleGhost()
+{
+    Ghost ghost({ 3, 1 });
+    ghost.setPupilBounds({ glm::vec2(-1.0f), glm::vec2(-1.0f) });
+    ghost.setSensorBounds({ glm::vec2(-1.0f), glm::vec2(-1.0f) });
+    ghost.setAverageIntensity(0.0f);
+    return ghost;
+}
+
+/// Checks that a ghost is an exact copy of the expected sample.
+static void checkSnapped(const Ghost& expected, const Ghost& actual)
+{
+    OLEF_CHECK(expected.getPupilBounds() == actual.getPupilBounds());
+    OLEF_CHECK(expected.getSensorBounds() == actual.getSensorBounds());
+    OLEF_CHECK(expected.getAverageIntensity() == actual.getAverageIntensity());
+}
+
+/// Builds a table out of two samples, between which a ghost appears, and
+/// checks that the bins and the interpolated lookups between them snap to
+/// the closer sample instead of mixing in the invisibility markers.
+int main()
+{
+    Ghost invisible = createInvisibleGhost();
+    Ghost visible = createVisibleGhost(glm::vec2(0.2f, 0.1f), glm::vec2(0.4f, 0.3f), 0.5f);
+    Ghost other = createVisibleGhost(glm::vec2(-0.6f, -0.4f), glm::vec2(0.2f, 0.2f), 1.0f);
+    Ghost otherMoved = createVisibleGhost(glm::vec2(-0.2f, 0.0f), glm::vec2(0.6f, 0.4f), 2.0f);
+
+    GhostAttributeTable::AngleGhostMap samples;
+    samples[0.0f] = GhostList{ invisible, other };
+    samples[1.0f] = GhostList{ visible, otherMoved };
+
+    GhostAttributeTable table(samples, 0.25f);
+    if (!OLEF_CHECK(table.getBinCount() == 5 && table.getGhostCount() == 2))
+        return TestHelpers::exitCode();
+
+    // The resampled bins
+    checkSnapped(invisible, table.getBin(1)[0]);
+    checkSnapped(visible, table.getBin(3)[0]);
+    OLEF_CHECK(!GhostAttributeTable::isVisible(table.getBin(1)[0]));
+    OLEF_CHECK(GhostAttributeTable::isVisible(table.getBin(2)[0]));
+
+    // The interpolated lookups
+    table.setInterpolation(true);
+    checkSnapped(invisible, table.lookup(0.1f)[0]);
+    checkSnapped(visible, table.lookup(0.9f)[0]);
+
+    // Ghosts visible on both sides are still interpolated
+    GhostListView middle = table.lookup(0.5f);
+    glm::vec2 expectedCorner = glm::mix(other.getSensorBounds()[0], otherMoved.getSensorBounds()[0], 0.5f);
+    glm::vec2 cornerError = glm::abs(middle[1].getSensorBounds()[0] - expectedCorner);
+    OLEF_CHECK(cornerError.x < 1e-6f && cornerError.y < 1e-6f);
+    OLEF_CHECK(glm::abs(middle[1].getAverageIntensity() - 1.5f) < 1e-6f);
+
+    return TestHelpers::exitCode();
+}
@@ -0,0 +1,92 @@
+#include "TestHelpers.h"
+
+using namespace OLEF;
+
+/// Checks that two ghosts match exactly, field by field.
+static void checkGhost(const Ghost& expected, const Ghost& actual)
+{
+    if (OLEF_CHECK(expected.getLength() == actual.getLength()))
+    {
+        OLEF_CHECK(std::equal(expected.begin(), expected.end(), actual.begin()));
+    }
+    OLEF_CHECK(expected.getPupilBounds() == actual.getPupilBounds());
+    OLEF_CHECK(expected.getSensorBounds() == actual.getSensorBounds());
+    OLEF_CHECK(expected.getAverageIntensity() == actual.getAverageIntensity());
+    OLEF_CHECK(expected.getMinimumChannels() == actual.getMinimumChannels());
+    OLEF_CHECK(expected.getOptimalChannels() == actual.getOptimalChannels());
+    OLEF_CHECK(expected.getMinimumRays() == actual.getMinimumRays());
+    OLEF_CHECK(expected.getOptimalRays() == actual.getOptimalRays());
+}
+
+/// Converts a ghost bounds XML file to the binary format, reads it back, and
+/// checks that every ghost of every angle survives the round trip unchanged.
+static void testRoundTrip(const std::string& name)
+{
+    std::map<float, GhostList> expected;
+    if (!OLEF_CHECK(TestHelpers::loadGhostBounds(TestHelpers::examplePath(name), expected)))
+        return;
+    OLEF_CHECK(!expected.empty());
+
+    // Write the binary file next to the test
+    std::string path = name + ".olefgb";
+    OLEF_CHECK(GhostBoundsFile::write(path, expected) != 0);
+
+    GhostBoundsFile file;
+    if (OLEF_CHECK(file.open(path)))
+    {
+        std::map<float, GhostList> actual = file.getGhostLists();
+
+        if (OLEF_CHECK(expected.size() == actual.size()))
+        {
+            for (auto expectedIt = expected.begin(), actualIt = actual.begin();
+                expectedIt != expected.end(); ++expectedIt, ++actualIt)
+            {
+                OLEF_CHECK(expectedIt->first == actualIt->first);
+                if (!OLEF_CHECK(expectedIt->second.size() == actualIt->second.size()))
+                    continue;
+
+                for (size_t i = 0; i < expectedIt->second.size(); ++i)
+                {
+                    checkGhost(expectedIt->second[i], actualIt->second[i]);
+                }
+
+                // The per-angle lookup finds the same list
+                size_t angleId = file.findAngle(expectedIt->first);
+                OLEF_CHECK(angleId < file.getAngleCount() &&
+                    file.getAngles()[angleId].m_angle == expectedIt->first);
+            }
+        }
+        file.close();
+    }
+
+    std::remove(path.c_str());
+    std::cout << name << ": " << expected.size() << " angles" << std::endl;
+}
+
+/// Writes a file without any angles, and checks that it opens, and that the
+/// angle lookup stays in range.
+static void testEmpty()
+{
+    std::string path = "empty.olefgb";
+    OLEF_CHECK(GhostBoundsFile::write(path, GhostBoundsFile::AngleGhostMap()) != 0);
+
+    GhostBoundsFile file;
+    if (OLEF_CHECK(file.open(path)))
+    {
+        OLEF_CHECK(file.getAngleCount() == 0);
+        OLEF_CHECK(file.findAngle(0.0f) == file.getAngleCount());
+        OLEF_CHECK(file.getGhostLists().empty());
+        file.close();
+    }
+
+    std::remove(path.c_str());
+}
+
+int main()
+{
+    testRoundTrip("heliar-tronnier-bounds-full.xml");
+    testRoundTrip("heliar-tronnier-bounds-no-merge.xml");
+    testEmpty();
+
+    return TestHelpers::exitCode();
+}
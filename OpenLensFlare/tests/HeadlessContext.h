@@ -0,0 +1,100 @@
+#pragma once
+
+#include "TestHelpers.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace OLEF
+{
+namespace TestHelpers
+{
+    /// An OpenGL core profile context without a window, created through EGL
+    /// (e.g. Mesa's surfaceless platform), for running the GL algorithms in
+    /// headless tests.
+    class HeadlessContext
+    {
+    public:
+        /// Creates a context with at least the parameter GL version, makes it
+        /// current and initializes GLEW. Check isValid for the result.
+        HeadlessContext(int major = 4, int minor = 3)
+        {
+            // Prefer the surfaceless platform, which needs no display server
+            auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+                eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if (getPlatformDisplay)
+                m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            if (m_display == EGL_NO_DISPLAY)
+                m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr))
+                return;
+
+            const EGLint configAttribs[] =
+            {
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_NONE
+            };
+            EGLConfig config;
+            EGLint numConfigs = 0;
+            if (!eglChooseConfig(m_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+                return;
+
+            const EGLint contextAttribs[] =
+            {
+                EGL_CONTEXT_MAJOR_VERSION, major,
+                EGL_CONTEXT_MINOR_VERSION, minor,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+            };
+            if (!eglBindAPI(EGL_OPENGL_API))
+                return;
+            m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttribs);
+            if (m_context == EGL_NO_CONTEXT)
+                return;
+
+            // Render into framebuffer objects only
+            if (!eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context))
+                return;
+
+            // glewInit would look for a GLX display, which doesn't exist here
+            glewExperimental = GL_TRUE;
+            m_valid = glewContextInit() == GLEW_OK;
+        }
+
+        /// Releases the context.
+        ~HeadlessContext()
+        {
+            if (m_display == EGL_NO_DISPLAY)
+                return;
+
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (m_context != EGL_NO_CONTEXT)
+                eglDestroyContext(m_display, m_context);
+            eglTerminate(m_display);
+        }
+
+        /// These objects are not copyable.
+        HeadlessContext(const HeadlessContext& other) = delete;
+
+        /// These objects are not copyable.
+        HeadlessContext& operator=(const HeadlessContext& other) = delete;
+
+        /// Returns whether the context was created and is current.
+        bool isValid() const { return m_valid; }
+
+    private:
+        /// The EGL display.
+        EGLDisplay m_display = EGL_NO_DISPLAY;
+
+        /// The GL context.
+        EGLContext m_context = EGL_NO_CONTEXT;
+
+        /// Whether the context is usable.
+        bool m_valid = false;
+    };
+
+    /// Exit code of a test that was skipped, see SKIP_RETURN_CODE.
+    constexpr int SKIPPED = 77;
+}
+}
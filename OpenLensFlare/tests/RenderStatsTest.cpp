@@ -0,0 +1,102 @@
+#include "HeadlessContext.h"
+
+using namespace OLEF;
+
+/// Size of the rendered framebuffer.
+static const int FRAMEBUFFER_SIZE = 256;
+
+/// Renders a frame with the parameter settings, prints its statistics, and
+/// returns them.
+static RayTraceGhostAlgorithm::GhostRenderStats renderFrame(RayTraceGhostAlgorithm& algorithm,
+    const LightSource& light, const GhostList& ghosts, bool batched, bool baked)
+{
+    algorithm.setBatchedRendering(batched);
+    algorithm.setBakedTracing(baked);
+
+    // Render twice, so the programs created on first use are already there
+    algorithm.renderGhosts(light, ghosts);
+    glClear(GL_COLOR_BUFFER_BIT);
+    algorithm.renderGhosts(light, ghosts);
+    glFinish();
+
+    auto stats = algorithm.getRenderStats();
+    std::printf("batched %-3s baked %-3s  %6d GL calls  %5d draw calls  %5d uniform updates  %4d channels\n",
+        batched ? "on" : "off", baked ? "on" : "off",
+        stats.m_glCalls, stats.m_drawCalls, stats.m_uniformUpdates, stats.m_channels);
+    return stats;
+}
+
+/// Renders a frame of an optical system's ghosts with batched rendering and
+/// baked tracing turned on and off, and reports the number of GL calls issued
+/// per frame by each combination. Every combination has to render the same
+/// ghost channels, and the batched path has to issue fewer GL calls than the
+/// per-channel one.
+///
+/// Usage: RenderStatsTest [optical system] [max ghosts]
+int main(int argc, char** argv)
+{
+    std::string systemPath = argc > 1 ? argv[1] : TestHelpers::examplePath("heliar-tronnier.xml");
+    size_t maxGhosts = argc > 2 ? std::atoi(argv[2]) : 0;
+
+    TestHelpers::HeadlessContext context(4, 3);
+    if (!context.isValid())
+    {
+        std::cout << "No OpenGL 4.3 context available, skipping." << std::endl;
+        return TestHelpers::SKIPPED;
+    }
+
+    OpticalSystem system;
+    if (!TestHelpers::loadOpticalSystem(systemPath, system))
+    {
+        std::cerr << "Unable to load " << systemPath << std::endl;
+        return 1;
+    }
+
+    GhostList ghosts = system.generateGhosts(2, false);
+    if (maxGhosts > 0 && ghosts.size() > maxGhosts)
+        ghosts.resize(maxGhosts);
+
+    LightSource light = TestHelpers::createLight(glm::radians(5.0f));
+
+    RayTraceGhostAlgorithm algorithm(&system);
+    RayTraceGhostAlgorithm::GhostAttribComputeParams params;
+    params.m_angle = glm::radians(5.0f);
+    ghosts = algorithm.computeGhostAttributes(ghosts, params);
+
+    // Render target
+    GLuint colorTexture, framebuffer;
+    glGenTextures(1, &colorTexture);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    glViewport(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    std::cout << system.getName() << ": " << ghosts.size() << " ghosts" << std::endl;
+
+    auto perChannel = renderFrame(algorithm, light, ghosts, false, false);
+    auto baked = renderFrame(algorithm, light, ghosts, false, true);
+    OLEF_CHECK(perChannel.m_channels > 0 && perChannel.m_glCalls > 0);
+    OLEF_CHECK(baked.m_channels == perChannel.m_channels);
+
+    if (algorithm.isBatchedRenderingSupported())
+    {
+        auto batched = renderFrame(algorithm, light, ghosts, true, false);
+        OLEF_CHECK(batched.m_channels == perChannel.m_channels);
+        OLEF_CHECK(batched.m_glCalls < perChannel.m_glCalls);
+    }
+    else
+    {
+        std::cout << "Batched rendering is not supported." << std::endl;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &colorTexture);
+
+    return TestHelpers::exitCode();
+}
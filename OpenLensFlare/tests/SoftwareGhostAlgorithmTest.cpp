@@ -0,0 +1,166 @@
+#include "HeadlessContext.h"
+
+using namespace OLEF;
+
+/// Size of the rendered framebuffers.
+static const int FRAMEBUFFER_SIZE = 256;
+
+/// Size of the aperture mask.
+static const int MASK_SIZE = 64;
+
+/// Creates an aperture mask holding the distance from the center of the
+/// aperture, which the iris clip turns into a round iris.
+static CpuGhostTracer::ApertureMask createApertureMask()
+{
+    CpuGhostTracer::ApertureMask result;
+    result.m_width = MASK_SIZE;
+    result.m_height = MASK_SIZE;
+    result.m_values.resize(MASK_SIZE * MASK_SIZE);
+    for (int y = 0; y < MASK_SIZE; ++y)
+    for (int x = 0; x < MASK_SIZE; ++x)
+    {
+        glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / float(MASK_SIZE) * 2.0f - 1.0f;
+        result.m_values[y * MASK_SIZE + x] = glm::length(uv);
+    }
+    return result;
+}
+
+/// Uploads the parameter aperture mask into a texture, sampled the same way
+/// as the CPU tracer samples the mask.
+static GLuint createApertureTexture(const CpuGhostTracer::ApertureMask& mask)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, mask.m_width, mask.m_height, 0, GL_RED, GL_FLOAT, mask.m_values.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+/// Renders the ghosts of an optical system with the ray traced algorithm into
+/// a floating point framebuffer, and with the software rasterizer, and checks
+/// that the two images match within a tolerance. Pixels along the triangle
+/// edges may be covered by only one of the rasterizers, so a small fraction
+/// of the pixels is allowed to differ, as long as the total energy matches.
+///
+/// Usage: SoftwareGhostAlgorithmTest [optical system] [max ghosts]
+int main(int argc, char** argv)
+{
+    std::string systemPath = argc > 1 ? argv[1] : TestHelpers::examplePath("heliar-tronnier.xml");
+    size_t maxGhosts = argc > 2 ? std::atoi(argv[2]) : 16;
+
+    TestHelpers::HeadlessContext context(4, 3);
+    if (!context.isValid())
+    {
+        std::cout << "No OpenGL 4.3 context available, skipping." << std::endl;
+        return TestHelpers::SKIPPED;
+    }
+
+    OpticalSystem system;
+    if (!TestHelpers::loadOpticalSystem(systemPath, system))
+    {
+        std::cerr << "Unable to load " << systemPath << std::endl;
+        return 1;
+    }
+
+    // The same aperture mask for both renderers
+    CpuGhostTracer::ApertureMask mask = createApertureMask();
+    GLuint apertureTexture = createApertureTexture(mask);
+    for (size_t i = 0; i < system.getElementCount(); ++i)
+    {
+        if (system[i].getType() == OpticalSystemElement::ElementType::APERTURE_STOP)
+            system[i].setTexture(apertureTexture);
+    }
+
+    GhostList ghosts = system.generateGhosts(2, false);
+    if (ghosts.size() > maxGhosts)
+        ghosts.resize(maxGhosts);
+
+    LightSource light = TestHelpers::createLight(glm::radians(5.0f));
+
+    // Compute the ghost attributes, so both renderers trace the same pupil
+    // bounds with the same ray grids
+    RayTraceGhostAlgorithm glAlgorithm(&system);
+    RayTraceGhostAlgorithm::GhostAttribComputeParams params;
+    params.m_angle = glm::radians(5.0f);
+    ghosts = glAlgorithm.computeGhostAttributes(ghosts, params);
+
+    // Render with the GL path into a floating point framebuffer, with
+    // additive blending
+    GLuint colorTexture, framebuffer;
+    glGenTextures(1, &colorTexture);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    if (!OLEF_CHECK(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE))
+        return TestHelpers::exitCode();
+
+    glViewport(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    glAlgorithm.setMinPixelArea(0.0f);
+    glAlgorithm.renderGhosts(light, ghosts);
+
+    std::vector<glm::vec4> expected(FRAMEBUFFER_SIZE * FRAMEBUFFER_SIZE);
+    glReadPixels(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE, GL_RGBA, GL_FLOAT, expected.data());
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &colorTexture);
+    glDeleteTextures(1, &apertureTexture);
+
+    // Render with the software rasterizer, with the same settings
+    SoftwareGhostAlgorithm softwareAlgorithm(&system);
+    softwareAlgorithm.resize(FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+    softwareAlgorithm.setApertureMask(mask);
+    softwareAlgorithm.setIntensityScale(glAlgorithm.getIntensityScale());
+    softwareAlgorithm.setRenderMode(glAlgorithm.getRenderMode());
+    softwareAlgorithm.setShadingMode(glAlgorithm.getShadingMode());
+    softwareAlgorithm.setRadiusClip(glAlgorithm.getRadiusClip());
+    softwareAlgorithm.setDistanceClip(glAlgorithm.getDistanceClip());
+    softwareAlgorithm.setIntensityClip(glAlgorithm.getIntensityClip());
+    softwareAlgorithm.setLambdas(glAlgorithm.getLambdas());
+    softwareAlgorithm.clear();
+    softwareAlgorithm.renderGhosts(light, ghosts);
+    const auto& rendered = softwareAlgorithm.getFramebuffer().m_pixels;
+
+    // Compare the images, relative to the brightest pixel
+    float maxValue = 0.0f;
+    glm::dvec3 expectedSum(0.0), renderedSum(0.0);
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        maxValue = glm::max(maxValue, glm::max(expected[i].x, glm::max(expected[i].y, expected[i].z)));
+        expectedSum += glm::dvec3(expected[i].x, expected[i].y, expected[i].z);
+        renderedSum += glm::dvec3(rendered[i].x, rendered[i].y, rendered[i].z);
+    }
+
+    int covered = 0, mismatches = 0;
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        glm::vec3 diff = glm::abs(glm::vec3(expected[i]) - glm::vec3(rendered[i]));
+        covered += expected[i].x > 0.0f || expected[i].y > 0.0f || expected[i].z > 0.0f ? 1 : 0;
+        if (glm::max(diff.x, glm::max(diff.y, diff.z)) > 0.01f * maxValue)
+            ++mismatches;
+    }
+
+    OLEF_CHECK(maxValue > 0.0f && covered > 0);
+    OLEF_CHECK(mismatches <= covered / 50);
+    for (int c = 0; c < 3; ++c)
+    {
+        OLEF_CHECK(glm::abs(renderedSum[c] - expectedSum[c]) <= 0.02 * expectedSum[c]);
+    }
+
+    std::cout << "Compared " << ghosts.size() << " ghosts of " << system.getName() << ": "
+        << mismatches << " of " << covered << " covered pixels differ." << std::endl;
+    return TestHelpers::exitCode();
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "OpenLensFlare.h"
+
+#include <cmath>
+#include <cstdlib>
+
+namespace OLEF
+{
+namespace TestHelpers
+{
+    /// An element of a parsed XML document.
+    struct XmlElement
+    {
+        /// Name of the element.
+        std::string m_name;
+
+        /// Text content of the element, without the child elements.
+        std::string m_text;
+
+        /// Child elements, in document order.
+        std::vector<XmlElement> m_children;
+
+        /// Returns the first child with the parameter name, or nullptr.
+        const XmlElement* child(const char* name) const
+        {
+            for (const auto& element: m_children)
+            {
+                if (element.m_name == name)
+                {
+                    return &element;
+                }
+            }
+            return nullptr;
+        }
+
+        /// Returns the text of the first child with the parameter name, or an
+        /// empty string.
+        std::string childText(const char* name) const
+        {
+            const XmlElement* element = child(name);
+            return element ? element->m_text : std::string();
+        }
+    };
+
+    /// Returns the path of a bundled example file.
+    inline std::string examplePath(const std::string& name)
+    {
+        return std::string(OLEF_EXAMPLES_DIR) + "/" + name;
+    }
+
+    /// Returns the number of failed checks.
+    inline int& failureCount()
+    {
+        static int s_failures = 0;
+        return s_failures;
+    }
+
+    /// Reports a failed check, and counts it.
+    inline bool check(bool condition, const char* expression, const char* file, int line)
+    {
+        if (!condition)
+        {
+            std::cerr << file << "(" << line << "): check failed: " << expression << std::endl;
+            ++failureCount();
+        }
+        return condition;
+    }
+
+    /// Returns the exit code of a test: zero if every check passed.
+    inline int exitCode()
+    {
+        if (failureCount() != 0)
+        {
+            std::cerr << failureCount() << " check(s) failed." << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    /// Returns the seconds elapsed since the parameter time point.
+    inline double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// Parses the parameter element and its children, starting at the
+    /// position after its start tag. Only the subset of XML written by the
+    /// LensPlanner serializers is supported: nested elements with text, and
+    /// no attributes, comments or entities.
+    inline bool parseXmlElement(const std::string& xml, size_t& pos, XmlElement& element)
+    {
+        while (pos < xml.size())
+        {
+            size_t tag = xml.find('<', pos);
+            if (tag == std::string::npos)
+                return false;
+
+            element.m_text += xml.substr(pos, tag - pos);
+            size_t tagEnd = xml.find('>', tag);
+            if (tagEnd == std::string::npos)
+                return false;
+
+            // End of this element
+            if (xml[tag + 1] == '/')
+            {
+                pos = tagEnd + 1;
+                return xml.compare(tag + 2, tagEnd - tag - 2, element.m_name) == 0;
+            }
+
+            // A child element, possibly empty
+            XmlElement childElement;
+            bool empty = xml[tagEnd - 1] == '/';
+            childElement.m_name = xml.substr(tag + 1, tagEnd - tag - (empty ? 2 : 1));
+            pos = tagEnd + 1;
+            if (!empty && !parseXmlElement(xml, pos, childElement))
+                return false;
+
+            element.m_children.push_back(std::move(childElement));
+        }
+        return false;
+    }
+
+    /// Parses the parameter XML file into its root element.
+    inline bool parseXml(const std::string& path, XmlElement& root)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        std::string xml((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        // Skip the declaration
+        size_t pos = 0;
+        if (xml.compare(0, 5, "<?xml") == 0)
+        {
+            pos = xml.find("?>") + 2;
+        }
+
+        // Find the root element
+        size_t tag = xml.find('<', pos);
+        size_t tagEnd = xml.find('>', tag);
+        if (tag == std::string::npos || tagEnd == std::string::npos)
+            return false;
+
+        root = XmlElement();
+        root.m_name = xml.substr(tag + 1, tagEnd - tag - 1);
+        pos = tagEnd + 1;
+        return parseXmlElement(xml, pos, root);
+    }
+
+    /// Parses a float value.
+    inline float toFloat(const std::string& text)
+    {
+        return std::strtof(text.c_str(), nullptr);
+    }
+
+    /// Parses an integer value.
+    inline int toInt(const std::string& text)
+    {
+        return std::atoi(text.c_str());
+    }
+
+    /// Loads an optical system file, in the format written by LensPlanner's
+    /// OpticalSystemSerializer. The aperture masks are not loaded.
+    inline bool loadOpticalSystem(const std::string& path, OpticalSystem& system)
+    {
+        XmlElement root;
+        if (!parseXml(path, root) || root.m_name != "opticalSystem")
+            return false;
+
+        OpticalSystem result;
+        result.setName(root.childText("name"));
+        result.setFnumber(toFloat(root.childText("fnumber")));
+        result.setEffectiveFocalLength(toFloat(root.childText("effectiveFocalLength")));
+        result.setFieldOfView(toFloat(root.childText("fieldOfView")));
+        result.setFilmWidth(toFloat(root.childText("filmWidth")));
+        result.setFilmHeight(toFloat(root.childText("filmHeight")));
+
+        const XmlElement* elements = root.child("elements");
+        if (elements == nullptr)
+            return false;
+
+        OpticalSystem::ElementList elementList;
+        for (const auto& elementXml: elements->m_children)
+        {
+            OpticalSystemElement element;
+
+            std::string type = elementXml.childText("type");
+            if (type == "lensSpherical")
+                element.setType(OpticalSystemElement::ElementType::LENS_SPHERICAL);
+            else if (type == "lensAspherical")
+                element.setType(OpticalSystemElement::ElementType::LENS_ASPHERICAL);
+            else if (type == "apertureStop")
+                element.setType(OpticalSystemElement::ElementType::APERTURE_STOP);
+            else if (type == "sensor")
+                element.setType(OpticalSystemElement::ElementType::SENSOR);
+            else
+                return false;
+
+            element.setHeight(toFloat(elementXml.childText("height")));
+            element.setThickness(toFloat(elementXml.childText("thickness")));
+            element.setRadiusOfCurvature(toFloat(elementXml.childText("radius")));
+            element.setIndexOfRefraction(toFloat(elementXml.childText("refractiveIndex")));
+            element.setAbbeNumber(toFloat(elementXml.childText("abbeNumber")));
+            element.setCoatingLambda(toFloat(elementXml.childText("coatingLambda")));
+            element.setCoatingIor(toFloat(elementXml.childText("coatingIor")));
+            elementList.push_back(element);
+        }
+        result.setElements(elementList);
+
+        system = result;
+        return true;
+    }
+
+    /// Parses a bounding rect, in the format written by LensPlanner's
+    /// GhostSerializer.
+    inline Ghost::BoundingRect toBoundingRect(const XmlElement& element)
+    {
+        Ghost::BoundingRect result;
+        result[0].x = toFloat(element.childText("x"));
+        result[0].y = toFloat(element.childText("y"));
+        result[1].x = toFloat(element.childText("w"));
+        result[1].y = toFloat(element.childText("h"));
+        return result;
+    }
+
+    /// Loads a ghost bounds file, in the format written by LensPlanner's
+    /// GhostSerializer.
+    inline bool loadGhostBounds(const std::string& path, std::map<float, GhostList>& ghosts)
+    {
+        XmlElement root;
+        if (!parseXml(path, root) || root.m_name != "ghostList")
+            return false;
+
+        std::map<float, GhostList> result;
+        for (const auto& listXml: root.m_children)
+        {
+            const XmlElement* ghostsXml = listXml.child("ghosts");
+            if (listXml.m_name != "list" || ghostsXml == nullptr)
+                return false;
+
+            GhostList& list = result[toFloat(listXml.childText("angle"))];
+            for (const auto& ghostXml: ghostsXml->m_children)
+            {
+                std::vector<int> interfaces;
+                if (const XmlElement* interfacesXml = ghostXml.child("interfaces"))
+                {
+                    for (const auto& interfaceXml: interfacesXml->m_children)
+                    {
+                        interfaces.push_back(toInt(interfaceXml.m_text));
+                    }
+                }
+
+                const XmlElement* pupilBounds = ghostXml.child("pupilBounds");
+                const XmlElement* sensorBounds = ghostXml.child("sensorBounds");
+                if (interfaces.size() > Ghost::MAX_INTERFACES || !pupilBounds || !sensorBounds)
+                    return false;
+
+                Ghost ghost(interfaces);
+                ghost.setPupilBounds(toBoundingRect(*pupilBounds));
+                ghost.setSensorBounds(toBoundingRect(*sensorBounds));
+                ghost.setAverageIntensity(toFloat(ghostXml.childText("avgIntensity")));
+                ghost.setMinimumChannels(toInt(ghostXml.childText("minChannels")));
+                ghost.setOptimalChannels(toInt(ghostXml.childText("optimalChannels")));
+                ghost.setMinimumRays(toInt(ghostXml.childText("minRays")));
+                ghost.setOptimalRays(toInt(ghostXml.childText("optimalRays")));
+                list.push_back(ghost);
+            }
+        }
+
+        ghosts = std::move(result);
+        return true;
+    }
+
+    /// Creates a light source with the parameter incoming angle, in radians.
+    inline LightSource createLight(float angle)
+    {
+        LightSource light;
+        light.setIncidenceDirection(glm::vec3(-glm::sin(angle), 0.0f, glm::cos(angle)));
+        light.setDiffuseColor(glm::vec3(1.0f));
+        light.setDiffuseIntensity(1.0f);
+        return light;
+    }
+}
+}
+
+/// Checks the parameter condition, reporting and counting the failure.
+#define OLEF_CHECK(condition) OLEF::TestHelpers::check((condition), #condition, __FILE__, __LINE__)